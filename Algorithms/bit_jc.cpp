@@ -0,0 +1,114 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+#include <intrin.h>
+#endif
+
+#include "../ShapeOperations/GalWeight.h"
+#include "bit_jc.h"
+
+JoinCountBits::JoinCountBits(int n)
+: num_obs(n), words((n + 63) / 64, 0)
+{
+}
+
+int JoinCountBits::Popcount(uint64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(w);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+    return (int) __popcnt64(w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int) ((w * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+void JoinCountBits::Pack(const double* x, const std::vector<bool>& undefs)
+{
+    for (size_t k=0; k<words.size(); k++) words[k] = 0;
+    for (int i=0; i<num_obs; i++) {
+        if (!undefs[i] && (int) x[i] != 0) Set(i);
+    }
+}
+
+void JoinCountBits::AndWith(const JoinCountBits& b)
+{
+    for (size_t k=0; k<words.size(); k++) words[k] &= b.words[k];
+}
+
+int JoinCountBits::Count() const
+{
+    int c = 0;
+    for (size_t k=0; k<words.size(); k++) c += Popcount(words[k]);
+    return c;
+}
+
+int JoinCountBits::CountNbrs(const GalElement& w) const
+{
+    const std::vector<long>& nbrs = w.GetNbrs();
+    int c = 0;
+    for (size_t j=0; j<nbrs.size(); j++) {
+        long id = nbrs[j];
+        c += (int) ((words[id >> 6] >> (id & 63)) & 1);
+    }
+    return c;
+}
+
+void JoinCountBits::Unpack(int* zz) const
+{
+    for (int i=0; i<num_obs; i++) zz[i] = Test(i) ? 1 : 0;
+}
+
+void bit_localjoincount(int num_obs, const std::vector<const double*>& vars,
+                        const std::vector<bool>& undefs, const GalElement* W,
+                        int* zz, double* local_jc, JoinCountBits& zz_bits)
+{
+    int num_vars = vars.size();
+    zz_bits = JoinCountBits(num_obs);
+    zz_bits.Pack(vars[0], undefs);
+    for (int v=1; v<num_vars; v++) {
+        JoinCountBits b(num_obs);
+        b.Pack(vars[v], undefs);
+        zz_bits.AndWith(b);
+    }
+
+    // focal observations: x_i = 1, or x_i.z_i = 1 with co-location
+    JoinCountBits focal = zz_bits;
+
+    if (num_vars > 1 && zz_bits.Count() == 0) {
+        // bivariate no co-location: count the neighbors with z_j = 1
+        // around the observations with x_i = 1
+        zz_bits.Pack(vars[1], undefs);
+        focal = JoinCountBits(num_obs);
+        for (int i=0; i<num_obs; i++) {
+            if (vars[0][i] > 0) focal.Set(i);
+        }
+    }
+    zz_bits.Unpack(zz);
+
+    for (int i=0; i<num_obs; i++) {
+        if (focal.Test(i)) {
+            local_jc[i] = zz_bits.CountNbrs(W[i]);
+        }
+    }
+}
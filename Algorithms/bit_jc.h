@@ -0,0 +1,91 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_BIT_JC_H___
+#define __GEODA_CENTER_BIT_JC_H___
+
+#include <vector>
+#include <boost/cstdint.hpp>
+
+class GalElement;
+
+/**
+ Bit-packed binary variable for the local join count: one bit per
+ observation, 64 observations per word.
+
+ Co-location of several binary variables is the AND of their bitsets, and
+ the number of ones is a popcount over the words.  The join count of a set
+ of neighbors is the number of their bits that are set, read with a
+ branch-free shift and mask.  The packed zz of 100,000 observations takes
+ 12.5 KB, so the random reads of the permutation loop stay in L1.
+ */
+class JoinCountBits
+{
+public:
+    JoinCountBits() : num_obs(0) {}
+    explicit JoinCountBits(int n);
+
+    /** bit i is set if x[i] != 0 and i is not undefined */
+    void Pack(const double* x, const std::vector<bool>& undefs);
+    void AndWith(const JoinCountBits& b);
+
+    bool Test(int i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+    void Set(int i) { words[i >> 6] |= (uint64_t)1 << (i & 63); }
+
+    /** number of set bits */
+    int Count() const;
+
+    /** number of set bits among ids[0..k) */
+    int CountAt(const int* ids, int k) const
+    {
+        const uint64_t* w = &words[0];
+        int c = 0;
+        for (int j=0; j<k; j++) {
+            c += (int) ((w[ids[j] >> 6] >> (ids[j] & 63)) & 1);
+        }
+        return c;
+    }
+
+    /** number of set bits among the neighbors of w */
+    int CountNbrs(const GalElement& w) const;
+
+    /** bit i as 0/1 in zz[i] */
+    void Unpack(int* zz) const;
+
+    /** hardware popcount where the compiler offers it */
+    static int Popcount(uint64_t w);
+
+protected:
+    int num_obs;
+    std::vector<uint64_t> words;
+};
+
+/**
+ Local join count of one time period with bitsets, the counterpart of the
+ loops in JCCoordinator::CalcMultiLocalJoinCount().  vars holds the
+ binary variables of the period, undefs the undefined observations.  zz is
+ filled with the co-location indicator (or the second variable for
+ bivariate no co-location) and local_jc with the join counts; zz_bits
+ returns zz bit-packed for the permutation test.
+ */
+void bit_localjoincount(int num_obs, const std::vector<const double*>& vars,
+                        const std::vector<bool>& undefs, const GalElement* W,
+                        int* zz, double* local_jc, JoinCountBits& zz_bits);
+
+#endif
@@ -3284,6 +3284,39 @@ when microarrays are being clustered.
 
 /* ******************************************************************** */
 
+double rowdistance (int ncolumns, double** data, int** mask,
+  const double weight[], int index1, int index2, char dist)
+/*
+Purpose
+=======
+
+The rowdistance routine calculates the distance between the two rows index1
+and index2 of data, with the same distance measures as distancematrix. It lets
+callers that only need the distances of a few pairs (e.g. the neighbors in
+spatial weights) avoid the allocation of the full distance matrix.
+
+Arguments
+=========
+
+ncolumns   (input) int
+The number of columns in the data matrix.
+
+data, mask, weight, dist
+As in distancematrix; weight has ncolumns elements.
+
+index1, index2 (input) int
+The rows whose distance is calculated.
+
+========================================================================
+*/
+{ double (*metric)
+    (int, double**, double**, int**, int**, const double[], int, int, int) =
+       setmetric(dist);
+  return metric(ncolumns,data,data,mask,mask,weight,index1,index2,0);
+}
+
+/* ******************************************************************** */
+
 double* calculate_weights(int nrows, int ncolumns, double** data, int** mask,
   double weights[], int transpose, char dist, double cutoff, double exponent)
 
@@ -59,6 +59,8 @@ double clusterdistance (int nrows, int ncolumns, double** data, int** mask,
   char method, int transpose);
 double** distancematrix (int ngenes, int ndata, double** data,
   int** mask, double* weight, char dist, int transpose);
+double rowdistance (int ncolumns, double** data, int** mask,
+  const double weight[], int index1, int index2, char dist);
 
 /* Chapter 3 */
 int getclustercentroids(int nclusters, int nrows, int ncolumns,
@@ -0,0 +1,220 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <vector>
+#include <boost/bind.hpp>
+
+#include "../GenUtils.h"
+#include "../GdaThreadPool.h"
+#include "cpu_lisa.h"
+
+// permutations drawn before their lags are computed in one pass
+static const int perm_block_size = 64;
+
+struct PermKernelData
+{
+    int rows;
+    int permutations;
+    uint64_t seed;
+    const int* num_nbrs;
+    const char* undefs;
+    // lisa
+    const double* values;
+    const double* local_moran;
+    bool row_standardize;
+    // local join count
+    const int* zz;
+    const double* local_jc;
+    // gather sources: value (0 if undefined) and 1/0 valid flag
+    std::vector<double> gather_val;
+    std::vector<double> gather_valid;
+    double* p;
+};
+
+/** Draw num_perms permutations of k neighbors for observation i into
+ idx, num_perms rows of k, starting at permutation first_perm, with the
+ same random streams and candidate test as CalcPseudoP_range().  Each row is
+ stored last draw first, the order in which GeoDaSet::Pop() hands the
+ neighbors to the lag computation. */
+static void draw_block(const PermKernelData& d, bool lisa_candidates,
+                       int i, int k, uint64_t obs_key, int first_perm,
+                       int num_perms, std::vector<int>& stamp, int& mark,
+                       int* idx)
+{
+    int max_rand = d.rows - 1;
+    for (int b=0; b<num_perms; b++) {
+        int* row = idx + b * k;
+        mark++;
+        int rand = 0;
+        Gda::CounterRng rng(Gda::CounterRng::SubKey(obs_key, first_perm + b));
+        while (rand < k) {
+            double rng_val = rng.NextDouble() * max_rand;
+            int newRandom = (int)(rng_val<0.0?ceil(rng_val - 0.5):floor(rng_val + 0.5));
+            if (newRandom == i || stamp[newRandom] == mark) continue;
+            bool ok = lisa_candidates ? d.num_nbrs[newRandom] > 0
+                                      : d.undefs[newRandom] == 0;
+            if (ok) {
+                stamp[newRandom] = mark;
+                row[k - 1 - rand] = newRandom;
+                rand++;
+            }
+        }
+    }
+}
+
+static void lisa_range(const PermKernelData* d, int obs_start, int obs_end)
+{
+    uint64_t seed_key = Gda::CounterRng::SeedKey(d->seed);
+    std::vector<int> stamp(d->rows, 0);
+    int mark = 0;
+    std::vector<int> idx;
+    const double* val = &d->gather_val[0];
+    const double* valid = &d->gather_valid[0];
+
+    for (int i=obs_start; i<=obs_end; i++) {
+        int k = d->num_nbrs[i];
+        if (k == 0) continue;
+        uint64_t obs_key = Gda::CounterRng::SubKey(seed_key, i);
+        idx.resize(perm_block_size * k);
+        uint64_t countLarger = 0;
+        for (int perm=0; perm<d->permutations; perm+=perm_block_size) {
+            int num_perms = d->permutations - perm;
+            if (num_perms > perm_block_size) num_perms = perm_block_size;
+            draw_block(*d, true, i, k, obs_key, perm, num_perms, stamp, mark,
+                       &idx[0]);
+            for (int b=0; b<num_perms; b++) {
+                const int* row = &idx[b * k];
+                double permutedLag = 0;
+                double validNeighbors = 0;
+                for (int cp=0; cp<k; cp++) {
+                    permutedLag += val[row[cp]];
+                    validNeighbors += valid[row[cp]];
+                }
+                if (validNeighbors > 0 && d->row_standardize) {
+                    permutedLag /= validNeighbors;
+                }
+                if (permutedLag * d->values[i] >= d->local_moran[i]) {
+                    countLarger++;
+                }
+            }
+        }
+        // pick the smallest
+        if (d->permutations - countLarger <= countLarger) {
+            countLarger = d->permutations - countLarger;
+        }
+        d->p[i] = (countLarger + 1.0) / (d->permutations + 1);
+    }
+}
+
+static void localjc_range(const PermKernelData* d, int obs_start,
+                          int obs_end)
+{
+    uint64_t seed_key = Gda::CounterRng::SeedKey(d->seed);
+    std::vector<int> stamp(d->rows, 0);
+    int mark = 0;
+    std::vector<int> idx;
+    const double* val = &d->gather_val[0];
+
+    for (int i=obs_start; i<=obs_end; i++) {
+        if (d->undefs[i]) continue;
+        if (d->local_jc[i] == 0) {
+            d->p[i] = 0;
+            continue;
+        }
+        int k = d->num_nbrs[i];
+        if (k == 0) continue;
+        uint64_t obs_key = Gda::CounterRng::SubKey(seed_key, i);
+        idx.resize(perm_block_size * k);
+        int countLarger = 0;
+        for (int perm=0; perm<d->permutations; perm+=perm_block_size) {
+            int num_perms = d->permutations - perm;
+            if (num_perms > perm_block_size) num_perms = perm_block_size;
+            draw_block(*d, false, i, k, obs_key, perm, num_perms, stamp, mark,
+                       &idx[0]);
+            for (int b=0; b<num_perms; b++) {
+                const int* row = &idx[b * k];
+                double perm_jc = 0;
+                for (int cp=0; cp<k; cp++) {
+                    perm_jc += val[row[cp]];
+                }
+                if (perm_jc >= d->local_jc[i]) countLarger++;
+            }
+        }
+        // pick the smallest
+        if (d->permutations - countLarger < countLarger) {
+            countLarger = d->permutations - countLarger;
+        }
+        d->p[i] = (countLarger + 1.0) / (d->permutations + 1.0);
+    }
+}
+
+void cpu_lisa(int rows, int permutations, unsigned long long last_seed_used,
+              const double* values, const double* lag_values,
+              const double* local_moran, const int* num_nbrs,
+              const char* undefs, bool row_standardize, double* p)
+{
+    PermKernelData d;
+    d.rows = rows;
+    d.permutations = permutations;
+    d.seed = last_seed_used;
+    d.num_nbrs = num_nbrs;
+    d.undefs = undefs;
+    d.values = values;
+    d.local_moran = local_moran;
+    d.row_standardize = row_standardize;
+    d.zz = NULL;
+    d.local_jc = NULL;
+    d.p = p;
+    // adding 0 for an undefined neighbor leaves the sum bit-identical to
+    // skipping it, which keeps the inner loop free of branches
+    d.gather_val.resize(rows);
+    d.gather_valid.resize(rows);
+    for (int i=0; i<rows; i++) {
+        d.gather_val[i] = undefs[i] ? 0 : lag_values[i];
+        d.gather_valid[i] = undefs[i] ? 0 : 1;
+    }
+    GdaThreadPool::GetInstance().ParallelFor(rows,
+        boost::bind(&lisa_range, &d, _1, _2),
+        GdaThreadPool::permutation_chunk_size);
+}
+
+void cpu_localjoincount(int rows, int permutations,
+                        unsigned long long last_seed_used, const int* zz,
+                        const double* local_jc, const int* num_nbrs,
+                        const char* undefs, double* p)
+{
+    PermKernelData d;
+    d.rows = rows;
+    d.permutations = permutations;
+    d.seed = last_seed_used;
+    d.num_nbrs = num_nbrs;
+    d.undefs = undefs;
+    d.values = NULL;
+    d.local_moran = NULL;
+    d.row_standardize = false;
+    d.zz = zz;
+    d.local_jc = local_jc;
+    d.p = p;
+    d.gather_val.resize(rows);
+    for (int i=0; i<rows; i++) d.gather_val[i] = zz[i];
+    GdaThreadPool::GetInstance().ParallelFor(rows,
+        boost::bind(&localjc_range, &d, _1, _2),
+        GdaThreadPool::permutation_chunk_size);
+}
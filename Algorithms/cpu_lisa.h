@@ -0,0 +1,57 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_CPU_LISA_H___
+#define __GEODA_CENTER_CPU_LISA_H___
+
+/**
+ CPU counterparts of lisa_kernel.cl and localjc_kernel.cl for machines
+ without an OpenCL device.
+
+ The inputs use the flat layout of the OpenCL kernels: one value per
+ observation and the number of neighbors of every observation in num_nbrs.
+ Like the kernels, the permutation loop only needs the neighbor counts,
+ never the neighbor ids.  undefs flags observations with undefined values
+ (0 or 1 per observation).
+
+ Unlike the kernels, the random draws, the candidate test and the
+ summation order are those of CalcPseudoP_range() in AbstractCoordinator
+ and JCCoordinator: every permutation of an observation uses the
+ Gda::CounterRng stream keyed by (seed, observation, permutation), so both
+ paths give identical pseudo p-values for the same seed.  Each observation draws a block of permutations first and then
+ computes their lags in a branch-free gather loop the compiler can
+ vectorize.
+ */
+
+/** Pseudo p-values of the local Moran's I.  lag_values is the variable the
+ spatial lag is taken of (values itself for univariate LISA).  p is left
+ untouched for observations without neighbors. */
+void cpu_lisa(int rows, int permutations, unsigned long long last_seed_used,
+              const double* values, const double* lag_values,
+              const double* local_moran, const int* num_nbrs,
+              const char* undefs, bool row_standardize, double* p);
+
+/** Pseudo p-values of the local join count.  p is left untouched for
+ undefined observations and observations without neighbors. */
+void cpu_localjoincount(int rows, int permutations,
+                        unsigned long long last_seed_used, const int* zz,
+                        const double* local_jc, const int* num_nbrs,
+                        const char* undefs, double* p);
+
+#endif
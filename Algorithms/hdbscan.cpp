@@ -1,7 +1,10 @@
+#include <cmath>
 #include <deque>
 #include <algorithm>
 
 #include <boost/graph/prim_minimum_spanning_tree.hpp>
+#include <boost/bind.hpp>
+#include "../GdaThreadPool.h"
 #include "hdbscan.h"
 
 
@@ -12,12 +15,325 @@ bool EdgeLess1(SimpleEdge* a,  SimpleEdge* b)
     return a->length < b->length;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Minimum spanning tree of the mutual reachability distance
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// orders point indices by one coordinate, for splitting kd-tree nodes
+struct KdCoordLess
+{
+    const double* pts;
+    int n_dim;
+    int d;
+
+    KdCoordLess(const double* pts, int n_dim, int d)
+    : pts(pts), n_dim(n_dim), d(d) {}
+
+    bool operator()(int a, int b) const {
+        return pts[a*n_dim + d] < pts[b*n_dim + d];
+    }
+};
+
+MutualReachabilityMST::MutualReachabilityMST(double** data, int n_pts,
+                                             int n_dim, char dist,
+                                             const vector<double>& core_dist,
+                                             double alpha)
+: n_pts(n_pts), n_dim(n_dim), dist(dist), alpha(alpha)
+{
+    // build the tree on the points in row order, then store the points in
+    // the order of the tree so the points of a node are contiguous
+    pts.resize((size_t)n_pts * n_dim);
+    pts_index.resize(n_pts);
+    for (int i=0; i<n_pts; i++) {
+        pts_index[i] = i;
+        for (int j=0; j<n_dim; j++) {
+            pts[(size_t)i*n_dim + j] = data[i][j];
+        }
+    }
+    core = core_dist;
+    if (n_pts > 0) {
+        nodes.reserve(2 * (n_pts / leaf_size + 1));
+        Build(0, n_pts);
+    }
+
+    vector<double> row_pts;
+    row_pts.swap(pts);
+    pts.resize((size_t)n_pts * n_dim);
+    for (int i=0; i<n_pts; i++) {
+        int row = pts_index[i];
+        core[i] = core_dist[row];
+        for (int j=0; j<n_dim; j++) {
+            pts[(size_t)i*n_dim + j] = row_pts[(size_t)row*n_dim + j];
+        }
+    }
+
+    comp.resize(n_pts);
+    node_comp.resize(nodes.size());
+    nearest.resize(n_pts);
+    nearest_dist.resize(n_pts);
+}
+
+MutualReachabilityMST::~MutualReachabilityMST()
+{
+}
+
+int MutualReachabilityMST::Build(int start, int end)
+{
+    // called before the points are reordered: pts and core are in row
+    // order and pts_index[start..end-1] are the rows of the node
+    int node = nodes.size();
+    KdNode nd;
+    nd.start = start;
+    nd.end = end;
+    nd.left = -1;
+    nd.right = -1;
+    nd.min_core = DBL_MAX;
+    nodes.push_back(nd);
+
+    size_t box = box_lo.size();
+    box_lo.resize(box + n_dim, DBL_MAX);
+    box_hi.resize(box + n_dim, -DBL_MAX);
+    for (int i=start; i<end; i++) {
+        const double* x = &pts[(size_t)pts_index[i] * n_dim];
+        for (int j=0; j<n_dim; j++) {
+            if (x[j] < box_lo[box + j]) box_lo[box + j] = x[j];
+            if (x[j] > box_hi[box + j]) box_hi[box + j] = x[j];
+        }
+    }
+
+    if (end - start <= leaf_size) {
+        for (int i=start; i<end; i++) {
+            if (core[pts_index[i]] < nodes[node].min_core) {
+                nodes[node].min_core = core[pts_index[i]];
+            }
+        }
+        return node;
+    }
+
+    // split at the median of the widest side of the box
+    int split_dim = 0;
+    for (int j=1; j<n_dim; j++) {
+        if (box_hi[box + j] - box_lo[box + j] >
+            box_hi[box + split_dim] - box_lo[box + split_dim]) {
+            split_dim = j;
+        }
+    }
+    int mid = start + (end - start) / 2;
+    std::nth_element(pts_index.begin() + start, pts_index.begin() + mid,
+                     pts_index.begin() + end,
+                     KdCoordLess(&pts[0], n_dim, split_dim));
+
+    int left = Build(start, mid);
+    int right = Build(mid, end);
+    nodes[node].left = left;
+    nodes[node].right = right;
+    nodes[node].min_core = std::min(nodes[left].min_core,
+                                    nodes[right].min_core);
+    return node;
+}
+
+void MutualReachabilityMST::UpdateNodeComponents()
+{
+    // children come after their parent in nodes
+    for (int i=(int)nodes.size()-1; i>=0; i--) {
+        const KdNode& nd = nodes[i];
+        if (nd.left < 0) {
+            int c = comp[nd.start];
+            for (int j=nd.start+1; j<nd.end && c >= 0; j++) {
+                if (comp[j] != c) c = -1;
+            }
+            node_comp[i] = c;
+        } else {
+            int c = node_comp[nd.left];
+            node_comp[i] = (c == node_comp[nd.right]) ? c : -1;
+        }
+    }
+}
+
+double MutualReachabilityMST::Dist(const double* a, const double* b) const
+{
+    double d = 0;
+    if (dist == 'b') {
+        for (int j=0; j<n_dim; j++) d += fabs(a[j] - b[j]);
+        return d;
+    }
+    for (int j=0; j<n_dim; j++) d += (a[j] - b[j]) * (a[j] - b[j]);
+    return sqrt(d);
+}
+
+double MutualReachabilityMST::BoxDist(int node, const double* q) const
+{
+    const double* lo = &box_lo[(size_t)node * n_dim];
+    const double* hi = &box_hi[(size_t)node * n_dim];
+    double d = 0;
+    for (int j=0; j<n_dim; j++) {
+        double gap = 0;
+        if (q[j] < lo[j]) gap = lo[j] - q[j];
+        else if (q[j] > hi[j]) gap = q[j] - hi[j];
+        d += (dist == 'b') ? gap : gap * gap;
+    }
+    return (dist == 'b') ? d : sqrt(d);
+}
+
+void MutualReachabilityMST::FindNearest(int first, int last)
+{
+    // Only the shortest edge of each component is used, so a point can
+    // stop at the shortest edge found for its component by an earlier
+    // point of the chunk; points of a chunk are close in the kd-tree and
+    // mostly share their component.
+    boost::unordered_map<int, double> comp_best;
+    vector<NodeBound> stack;
+
+    for (int q=first; q<=last; q++) {
+        int c = comp[q];
+        const double* x = &pts[(size_t)q * n_dim];
+        double core_q = core[q];
+
+        double limit = DBL_MAX;
+        boost::unordered_map<int, double>::iterator it = comp_best.find(c);
+        if (it != comp_best.end()) limit = it->second;
+
+        // equal lengths go to the point earlier in kd-tree order
+        double best = DBL_MAX;
+        int best_p = -1;
+
+        stack.clear();
+        if (node_comp[0] != c) {
+            NodeBound root;
+            root.node = 0;
+            root.bound = std::max(core_q, nodes[0].min_core);
+            stack.push_back(root);
+        }
+        while (!stack.empty()) {
+            NodeBound nb = stack.back();
+            stack.pop_back();
+            const KdNode& nd = nodes[nb.node];
+            if (nb.bound > limit) continue;
+            if (nb.bound > best || (nb.bound == best && nd.start > best_p)) {
+                continue;
+            }
+            if (nd.left < 0) {
+                for (int p=nd.start; p<nd.end; p++) {
+                    if (comp[p] == c) continue;
+                    double d = std::max(core_q, core[p]);
+                    if (d > best || d > limit) continue;
+                    double d_qp = Dist(x, &pts[(size_t)p * n_dim]);
+                    if (alpha != 1.0) d_qp /= alpha;
+                    if (d_qp > d) d = d_qp;
+                    if (d < best || (d == best && p < best_p)) {
+                        best = d;
+                        best_p = p;
+                    }
+                }
+                continue;
+            }
+            // visit the closer child first
+            NodeBound child[2];
+            int n_child = 0;
+            int kids[2] = {nd.left, nd.right};
+            for (int k=0; k<2; k++) {
+                if (node_comp[kids[k]] == c) continue;
+                double b = BoxDist(kids[k], x);
+                if (alpha != 1.0) b /= alpha;
+                child[n_child].node = kids[k];
+                child[n_child].bound = std::max(std::max(core_q, b),
+                                                nodes[kids[k]].min_core);
+                n_child++;
+            }
+            if (n_child == 2 && child[0].bound <= child[1].bound) {
+                stack.push_back(child[1]);
+                stack.push_back(child[0]);
+            } else {
+                for (int k=0; k<n_child; k++) stack.push_back(child[k]);
+            }
+        }
+
+        nearest[q] = best_p;
+        nearest_dist[q] = best;
+        if (best_p >= 0 && best < limit) comp_best[c] = best;
+    }
+}
+
+void MutualReachabilityMST::Run(vector<SimpleEdge*>& mst_edges)
+{
+    if (n_pts < 2) return;
+
+    TreeUnionFind U(n_pts);
+    for (int i=0; i<n_pts; i++) comp[i] = i;
+    // point with the shortest edge of each component
+    vector<int> comp_edge(n_pts, -1);
+
+    int n_edges = 0;
+    while (n_edges < n_pts - 1) {
+        UpdateNodeComponents();
+        GdaThreadPool::GetInstance().ParallelFor(n_pts,
+            boost::bind(&MutualReachabilityMST::FindNearest, this, _1, _2),
+            GdaThreadPool::query_chunk_size);
+
+        // edges are ordered by length, then by their end points, so the
+        // components can't pick edges that close a cycle
+        for (int i=0; i<n_pts; i++) {
+            if (nearest[i] < 0) continue;
+            int e = comp_edge[comp[i]];
+            if (e >= 0) {
+                if (nearest_dist[i] > nearest_dist[e]) continue;
+                if (nearest_dist[i] == nearest_dist[e]) {
+                    int lo_i = std::min(i, nearest[i]);
+                    int lo_e = std::min(e, nearest[e]);
+                    if (lo_i > lo_e) continue;
+                    if (lo_i == lo_e &&
+                        std::max(i, nearest[i]) >= std::max(e, nearest[e])) {
+                        continue;
+                    }
+                }
+            }
+            comp_edge[comp[i]] = i;
+        }
+
+        int n_added = 0;
+        for (int c=0; c<n_pts; c++) {
+            int i = comp_edge[c];
+            if (i < 0) continue;
+            comp_edge[c] = -1;
+            int p = nearest[i];
+            // the same edge picked by both of its components
+            if (U.find(i) == U.find(p)) continue;
+            U.union_(i, p);
+            mst_edges.push_back(new SimpleEdge(pts_index[i], pts_index[p],
+                                               nearest_dist[i]));
+            n_added++;
+        }
+        if (n_added == 0) break;
+        n_edges += n_added;
+
+        for (int i=0; i<n_pts; i++) comp[i] = U.find(i);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // HDBSCAN
 //
 ////////////////////////////////////////////////////////////////////////////////
 
+// core distances of the points first..last
+static void CoreDistanceRows(ANNkd_tree* kd_tree, double** input_data,
+                             int min_samples, int dist_type,
+                             vector<double>* core_d, int first, int last)
+{
+    double eps = 0; // error bound
+    ANNidxArray nnIdx = new ANNidx[min_samples];
+    ANNdistArray dists = new ANNdist[min_samples];
+    for (int i=first; i<=last; i++) {
+        kd_tree->annkSearch(input_data[i], min_samples, nnIdx, dists, eps);
+        (*core_d)[i] = ANN_ROOT(dists[min_samples-1], dist_type);
+    }
+    delete[] nnIdx;
+    delete[] dists;
+}
+
 vector<double> HDBScan::ComputeCoreDistance(double** input_data, int n_pts,
                                             int n_dim, int min_samples,
                                             char dist)
@@ -25,23 +341,19 @@ vector<double> HDBScan::ComputeCoreDistance(double** input_data, int n_pts,
     vector<double> core_d;
     core_d.resize(n_pts);
 
-    double eps = 0; // error bound
-    if (dist == 'e') ANN_DIST_TYPE = 2; // euclidean
-    else if (dist == 'b') ANN_DIST_TYPE = 1; // manhattan
+    int dist_type = ANNuse_euclidean_dist;
+    if (dist == 'b') dist_type = ANNuse_manhattan_dist;
 
     // since KNN search will always return the query point itself, so add 1
     // to make sure returning min_samples number of results
     //min_samples = min_samples + 1;
 
     ANNkd_tree* kdTree = new ANNkd_tree(input_data, n_pts, n_dim);
-    ANNidxArray nnIdx = new ANNidx[min_samples];
-    ANNdistArray dists = new ANNdist[min_samples];
-    for (size_t i=0; i<n_pts; ++i) {
-        kdTree->annkSearch(input_data[i], min_samples, nnIdx, dists, eps);
-        core_d[i] = sqrt(dists[min_samples-1]);
-    }
-    delete[] nnIdx;
-    delete[] dists;
+    kdTree->setDistType(dist_type);
+    GdaThreadPool::GetInstance().ParallelFor(n_pts,
+        boost::bind(&CoreDistanceRows, kdTree, input_data, min_samples,
+                    dist_type, &core_d, _1, _2),
+        GdaThreadPool::query_chunk_size);
     delete kdTree;
 
     return core_d;
@@ -49,7 +361,7 @@ vector<double> HDBScan::ComputeCoreDistance(double** input_data, int n_pts,
 
 HDBScan::HDBScan(int min_cluster_size, int min_samples, double alpha,
                  int _cluster_selection_method, bool _allow_single_cluster,
-                 int rows, int cols, double** _distances,
+                 int rows, int cols, double** data, char dist,
                  vector<double> _core_dist,
                  const vector<bool>& _undefs)
 {
@@ -61,7 +373,8 @@ HDBScan::HDBScan(int min_cluster_size, int min_samples, double alpha,
     core_dist = _core_dist;
     
     // MST
-    mst_linkage_core_vector(cols, core_dist, _distances, alpha);
+    MutualReachabilityMST mst(data, rows, cols, dist, core_dist, alpha);
+    mst.Run(mst_edges);
     std::sort(mst_edges.begin(), mst_edges.end(), EdgeLess1);
     
     // Extract the HDBSCAN hierarchy as a dendrogram from mst
@@ -755,70 +1068,3 @@ vector<int> HDBScan::recurse_leaf_dfs(vector<CondensedTree*>& cluster_tree, int
     }
 }
 
-void HDBScan::mst_linkage_core_vector(int num_features,
-                                      vector<double>& core_distances,
-                                      double** dist_metric,
-                                      double alpha)
-{
-    int dim = core_distances.size();
-    
-    double current_node_core_distance;
-    vector<int> in_tree(dim,0);
-    int current_node = 0;
-    vector<double> current_distances(dim, DBL_MAX);
-    
-    for (int i=1; i<dim; i++) {
-        in_tree[current_node] = 1;
-        current_node_core_distance = core_distances[current_node];
-        
-        double new_distance = DBL_MAX;
-        int new_node = 0;
-        
-        for (int j=0; j<dim; j++) {
-            if (in_tree[j]) {
-                continue;
-            }
-            double right_value = current_distances[j];
-            double left_value = dist_metric[current_node][j];
-            
-            if (alpha!=1.0) {
-                left_value /= alpha;
-            }
-            
-            double core_value = core_distances[j];
-            if (current_node_core_distance > right_value || core_value > right_value ||  left_value > right_value) {
-                if (right_value < new_distance) {
-                    new_distance = right_value;
-                    new_node = j;
-                }
-                continue;
-            }
-            
-            if (core_value > current_node_core_distance) {
-                if (core_value > left_value) {
-                    left_value = core_value;
-                }
-            } else {
-                if (current_node_core_distance > left_value) {
-                    left_value = current_node_core_distance;
-                }
-            }
-            
-            if (left_value < right_value) {
-                current_distances[j] = left_value;
-                if (left_value < new_distance) {
-                    new_distance = left_value;
-                    new_node = j;
-                }
-            } else {
-                if (right_value < new_distance) {
-                    new_distance = right_value;
-                    new_node = j;
-                }
-            }
-        }
-        mst_edges.push_back(new SimpleEdge(current_node, new_node, new_distance));
-        
-        current_node = new_node;
-    }
-}
@@ -185,6 +185,81 @@ namespace Gda {
     };
     
     
+    /////////////////////////////////////////////////////////////////////////
+    //
+    // Minimum spanning tree of the mutual reachability distance
+    //
+    /////////////////////////////////////////////////////////////////////////
+    /**
+     The minimum spanning tree of the points under the mutual reachability
+     distance max(core[i], core[j], d(i,j) / alpha), without the n x n
+     distance matrix.
+
+     Boruvka rounds on a kd-tree of the points: in every round each point
+     looks up its nearest point of another component in parallel, the
+     shortest edge of every component is added and the components are
+     merged, so there are at most log2(n) rounds.  A kd-tree node is skipped
+     if all its points are in the component of the query, or if the lower
+     bound max(core[q], min core of the node, box distance / alpha) can't
+     beat the best edge found so far.
+
+     Edges of equal length are ordered by their end points, so the tree is
+     the same for any number of threads.  d is the euclidean or manhattan
+     ('b') distance of the rows of data, as in ComputeCoreDistance().
+     */
+    class MutualReachabilityMST
+    {
+    public:
+        MutualReachabilityMST(double** data, int n_pts, int n_dim, char dist,
+                              const vector<double>& core_dist, double alpha);
+        virtual ~MutualReachabilityMST();
+
+        /** append the n-1 edges of the tree, end points are row indices */
+        void Run(vector<SimpleEdge*>& mst_edges);
+
+    protected:
+        struct KdNode {
+            int start; // points start..end-1 in kd-tree order
+            int end;
+            int left;  // -1 for a leaf
+            int right;
+            double min_core;
+        };
+        struct NodeBound {
+            int node;
+            double bound;
+        };
+
+        int Build(int start, int end);
+        // component of each node, -1 if its points are in several
+        void UpdateNodeComponents();
+        // nearest point of another component for points first..last
+        void FindNearest(int first, int last);
+        double Dist(const double* a, const double* b) const;
+        double BoxDist(int node, const double* q) const;
+
+        int n_pts;
+        int n_dim;
+        char dist;
+        double alpha;
+
+        // coordinates and core distances in kd-tree order; pts_index is the
+        // row of each point
+        vector<double> pts;
+        vector<double> core;
+        vector<int> pts_index;
+        vector<KdNode> nodes;
+        vector<double> box_lo; // n_dim values per node
+        vector<double> box_hi;
+
+        vector<int> comp;      // component of each point
+        vector<int> node_comp;
+        vector<int> nearest;   // -1 if none was found
+        vector<double> nearest_dist;
+
+        static const int leaf_size = 16;
+    };
+
     /////////////////////////////////////////////////////////////////////////
     //
     // HDBSCAN
@@ -211,7 +286,8 @@ namespace Gda {
                 int cluster_selection_method,
                 bool allow_single_cluster,
                 int rows, int cols,
-                double** _distances,
+                double** data,
+                char dist,
                 vector<double> _core_dist,
                 const vector<bool>& undefs
                 //GalElement * w,
@@ -259,10 +335,6 @@ namespace Gda {
                           bool allow_single_cluster= false,
                           bool match_reference_implementation=false);
         
-        void mst_linkage_core_vector(int num_features,
-                                     vector<double>& core_distances,
-                                     double** dist_metric, double alpha);
-        
         vector<int> get_cluster_tree_leaves(vector<CondensedTree*>& cluster_tree);
         
         vector<int> recurse_leaf_dfs(vector<CondensedTree*>& cluster_tree,
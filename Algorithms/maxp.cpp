@@ -29,8 +29,10 @@
 #include <boost/unordered_map.hpp>
 #include <boost/thread.hpp>
 #include <boost/bind.hpp>
+#include <wx/log.h>
 
 #include "../ShapeOperations/GalWeight.h"
+#include "../GdaThreadPool.h"
 #include "../logger.h"
 #include "../GenUtils.h"
 #include "maxp.h"
@@ -38,9 +40,161 @@
 using namespace boost;
 using namespace std;
 
-Maxp::Maxp(const GalElement* _w,  const vector<vector<double> >& _z, double _floor, double* _floor_variable, int _initial, vector<wxInt64> _seeds, int _method, int _tabu_length, double _cool_rate,int _rnd_seed, char _dist,  bool _test )
-: w(_w), z(_z), floor(_floor), floor_variable(_floor_variable), initial(_initial),  LARGE(1000000), MAX_ATTEMPTS(100), rnd_seed(_rnd_seed), test(_test), initial_wss(_initial), regions_group(_initial), area2region_group(_initial), p_group(_initial), dist(_dist), best_ss(DBL_MAX), method(_method), tabu_length(_tabu_length), cooling_rate(_cool_rate)
+RegionStats::RegionStats(const GalElement* _w, const vector<vector<double> >& _z, double* _floor_variable)
+: w(_w), z(_z), floor_variable(_floor_variable)
 {
+    num_obs = z.size();
+    num_vars = num_obs > 0 ? z[0].size() : 0;
+    area2region.resize(num_obs, -1);
+    cut_type.resize(num_obs, 0);
+    disc.resize(num_obs, 0);
+    low.resize(num_obs, 0);
+}
+
+void RegionStats::Init(const vector<vector<int> >& regions)
+{
+    int nr = regions.size();
+    region_size.assign(nr, 0);
+    region_sum.assign(nr * num_vars, 0);
+    region_floor.assign(nr, 0);
+    cuts_valid.assign(nr, 0);
+    num_components.assign(nr, 0);
+    
+    for (int r=0; r<nr; r++) {
+        double* sum = &region_sum[r * num_vars];
+        for (size_t i=0; i<regions[r].size(); i++) {
+            int area = regions[r][i];
+            area2region[area] = r;
+            for (int m=0; m<num_vars; m++) sum[m] += z[area][m];
+            region_floor[r] += floor_variable[area];
+        }
+        region_size[r] = regions[r].size();
+    }
+}
+
+double RegionStats::MoveChange(int area, int to_region) const
+{
+    // adding x to a region of n areas with mean u raises its sum of squares
+    // by n/(n+1)*|x-u|^2, removing it from a region of n areas lowers it by
+    // n/(n-1)*|x-u|^2
+    const vector<double>& x = z[area];
+    int from_region = area2region[area];
+    
+    double add = 0;
+    int n = region_size[to_region];
+    if (n > 0) {
+        const double* sum = &region_sum[to_region * num_vars];
+        double ss = 0;
+        for (int m=0; m<num_vars; m++) {
+            double d = x[m] - sum[m] / n;
+            ss += d * d;
+        }
+        add = ss * n / (n + 1);
+    }
+    
+    double rem = 0;
+    n = region_size[from_region];
+    if (n > 1) {
+        const double* sum = &region_sum[from_region * num_vars];
+        double ss = 0;
+        for (int m=0; m<num_vars; m++) {
+            double d = x[m] - sum[m] / n;
+            ss += d * d;
+        }
+        rem = ss * n / (n - 1);
+    }
+    return add - rem;
+}
+
+bool RegionStats::CheckFloor(int area, double floor) const
+{
+    return region_floor[ area2region[area] ] - floor_variable[area] >= floor;
+}
+
+bool RegionStats::CheckContiguity(int area, const vector<int>& block)
+{
+    int r = area2region[area];
+    if (region_size[r] <= 1)
+        return true;
+    if (!cuts_valid[r])
+        UpdateCuts(r, block);
+    if (num_components[r] == 1)
+        return cut_type[area] != 1;
+    // a region in two pieces is only connected again if area is one of them
+    return num_components[r] == 2 && cut_type[area] == 2;
+}
+
+void RegionStats::Move(int area, int to_region)
+{
+    int from_region = area2region[area];
+    const vector<double>& x = z[area];
+    double* from_sum = &region_sum[from_region * num_vars];
+    double* to_sum = &region_sum[to_region * num_vars];
+    for (int m=0; m<num_vars; m++) {
+        from_sum[m] -= x[m];
+        to_sum[m] += x[m];
+    }
+    region_floor[from_region] -= floor_variable[area];
+    region_floor[to_region] += floor_variable[area];
+    region_size[from_region] -= 1;
+    region_size[to_region] += 1;
+    area2region[area] = to_region;
+    cuts_valid[from_region] = 0;
+    cuts_valid[to_region] = 0;
+}
+
+void RegionStats::UpdateCuts(int region, const vector<int>& block)
+{
+    for (size_t i=0; i<block.size(); i++) {
+        disc[ block[i] ] = 0;
+        cut_type[ block[i] ] = 0;
+    }
+    int counter = 0;
+    int components = 0;
+    for (size_t i=0; i<block.size(); i++) {
+        int root = block[i];
+        if (disc[root] > 0) continue;
+        components += 1;
+        int root_children = 0;
+        disc[root] = low[root] = ++counter;
+        dfs_stack.push_back(make_pair(root, 0));
+        while (!dfs_stack.empty()) {
+            int node = dfs_stack.back().first;
+            int& k = dfs_stack.back().second;
+            if (k < w[node].Size()) {
+                int nbr = w[node][k++];
+                if (area2region[nbr] != region) continue;
+                if (disc[nbr] == 0) {
+                    disc[nbr] = low[nbr] = ++counter;
+                    dfs_stack.push_back(make_pair(nbr, 0));
+                } else if (disc[nbr] < low[node]) {
+                    low[node] = disc[nbr];
+                }
+            } else {
+                dfs_stack.pop_back();
+                if (dfs_stack.empty()) break;
+                int parent = dfs_stack.back().first;
+                if (low[node] < low[parent]) low[parent] = low[node];
+                if (parent == root) root_children += 1;
+                else if (low[node] >= disc[parent]) cut_type[parent] = 1;
+            }
+        }
+        if (root_children > 1) cut_type[root] = 1;
+        else if (root_children == 0) cut_type[root] = 2;
+    }
+    num_components[region] = components;
+    cuts_valid[region] = 1;
+}
+
+const int Maxp::starts_per_batch = 32;
+
+Maxp::Maxp(const GalElement* _w,  const vector<vector<double> >& _z, double _floor, double* _floor_variable, int _initial, vector<wxInt64> _seeds, int _method, int _tabu_length, double _cool_rate,int _rnd_seed, char _dist,  bool _test, double _time_budget, const MaxpProgress& _progress, bool _prune_hopeless)
+: w(_w), z(_z), floor(_floor), floor_variable(_floor_variable), initial(_initial),  LARGE(1000000), MAX_ATTEMPTS(100), rnd_seed(_rnd_seed), test(_test), initial_wss(_initial), construct_wss(_initial), regions_group(_initial), area2region_group(_initial), p_group(_initial), dist(_dist), best_ss(DBL_MAX), method(_method), tabu_length(_tabu_length), cooling_rate(_cool_rate), batch_start(0), incumbent(-1), max_search_gain(0), pruned(_initial, 0), prune_hopeless(_prune_hopeless), time_budget(_time_budget), stop_search(false), progress(_progress)
+{
+    if (time_budget > 0) {
+        deadline = boost::posix_time::microsec_clock::universal_time() +
+            boost::posix_time::milliseconds((long)(time_budget * 1000));
+    }
     num_obs = z.size();
     num_vars = z[0].size();
 
@@ -49,15 +203,13 @@ Maxp::Maxp(const GalElement* _w,  const vector<vector<double> >& _z, double _flo
         floor = 5;
     }
 
-    // setup random number
+    // setup random number: every initial solution draws from its own
+    // counter stream keyed by (seed, solution), see init_solution()
     if (rnd_seed<0) {
-        unsigned int initseed = (unsigned int) time(0);
-        srand(initseed);
+        seed_start = (uint64_t) time(0);
     } else {
-        srand(rnd_seed);
+        seed_start = (uint64_t) rnd_seed;
     }
-    seed_start = rand();
-    seed_increment = MAX_ATTEMPTS * num_obs * 10000;
     
     // init solution
     if (_seeds.empty()) {
@@ -95,8 +247,7 @@ Maxp::Maxp(const GalElement* _w,  const vector<vector<double> >& _z, double _flo
 
         int attemps = 0;
         
-        // parallize following block, comparing the objective_function() return values
-        //for (int i=0; i<initial; i++)  init_solution(i);
+        // construct and improve all starts on the thread pool
         run_threaded();
         
         for (int i=0; i<initial; i++) {
@@ -148,33 +299,82 @@ wxString Maxp::print_regions(vector<vector<int> >& _regions)
 void Maxp::run(int a, int b)
 {
     for (int i=a; i<=b; i++) {
-        init_solution(i);
+        init_solution(batch_start + i);
+    }
+}
+
+void Maxp::run_batch(int num_starts)
+{
+    GdaThreadPool::GetInstance().ParallelFor(num_starts, boost::bind(&Maxp::run, this, _1, _2), 1);
+}
+
+bool Maxp::report_progress(int starts_done)
+{
+    if (incumbent < 0) {
+        return progress(vector<vector<int> >(), 0, starts_done, initial);
     }
+    return progress(regions_group[incumbent], initial_wss[incumbent], starts_done, initial);
 }
 
 void Maxp::run_threaded()
 {
-    int nCPUs = boost::thread::hardware_concurrency();;
-    int quotient = initial / nCPUs;
-    int remainder = initial % nCPUs;
-    int tot_threads = (quotient > 0) ? nCPUs : remainder;
-    
-    boost::thread_group threadPool;
-    for (int i=0; i<tot_threads; i++) {
-        int a=0;
-        int b=0;
-        if (i < remainder) {
-            a = i*(quotient+1);
-            b = a+quotient;
+    // Every start draws from its own random stream and only reads the
+    // incumbent of the batches before it, so the starts give the same
+    // solutions on any number of threads unless the time budget runs out.
+    int num_done = 0;
+    int num_pruned = 0;
+    for (batch_start = 0; batch_start < initial; batch_start += starts_per_batch) {
+        if (is_stopped()) break;
+        int batch_end = batch_start + starts_per_batch;
+        if (batch_end > initial) batch_end = initial;
+        
+        if (progress.empty()) {
+            run_batch(batch_end - batch_start);
         } else {
-            a = remainder*(quotient+1) + (i-remainder)*quotient;
-            b = a+quotient-1;
+            // the batch runs on its own thread so the progress callback,
+            // and with it the Cancel button, is served while it runs; the
+            // starts of the batch only write their own slots, so reading
+            // the incumbent of the batches before is safe
+            boost::thread batch(boost::bind(&Maxp::run_batch, this, batch_end - batch_start));
+            while (!batch.timed_join(boost::posix_time::milliseconds(200))) {
+                if (!report_progress(batch_start)) stop_search = true;
+            }
+        }
+        
+        for (int i=batch_start; i<batch_end; i++) {
+            if (p_group[i] == 0) continue;
+            num_done += 1;
+            num_pruned += pruned[i];
+            double gain = construct_wss[i] - initial_wss[i];
+            if (gain > max_search_gain) max_search_gain = gain;
+            if (incumbent < 0 || initial_wss[i] < initial_wss[incumbent]) {
+                incumbent = i;
+            }
+        }
+        if (incumbent >= 0 && !progress.empty()) {
+            if (!report_progress(batch_end)) stop_search = true;
         }
-        boost::thread* worker = new boost::thread(boost::bind(&Maxp::run,this,a,b));
-        threadPool.add_thread(worker);
     }
-    
-    threadPool.join_all();
+    wxLogMessage("Max-p: %d of %d starts done, %d stopped before local search%s", num_done, initial, num_pruned, stop_search ? ", search stopped early" : "");
+}
+
+bool Maxp::is_stopped()
+{
+    if (stop_search) return true;
+    if (time_budget > 0 &&
+        boost::posix_time::microsec_clock::universal_time() > deadline) {
+        stop_search = true;
+        return true;
+    }
+    return false;
+}
+
+bool Maxp::is_hopeless(double ss)
+{
+    if (!prune_hopeless || incumbent < 0) return false;
+    // twice the best gain: constructions of similar quality differ a lot
+    // in how much the local search can improve them
+    return ss - 2 * max_search_gain > initial_wss[incumbent];
 }
 
 vector<vector<int> >& Maxp::GetRegions()
@@ -184,7 +384,8 @@ vector<vector<int> >& Maxp::GetRegions()
 
 void Maxp::init_solution(int solution_idx)
 {
-    uint64_t seed_local = seed_start + (solution_idx+1) * seed_increment;
+    uint64_t seed_local = Gda::CounterRng::SubKey(
+                    Gda::CounterRng::SeedKey(seed_start), solution_idx+1);
     int p = 0;
     bool solving = true;
     int attempts = 0;
@@ -192,7 +393,7 @@ void Maxp::init_solution(int solution_idx)
     vector<vector<int> > _regions;
     unordered_map<int, int> _area2region;
     
-    while (solving && attempts <= MAX_ATTEMPTS) {
+    while (solving && attempts <= MAX_ATTEMPTS && (solution_idx < 0 || !is_stopped())) {
         vector<vector<int> > regn;
         list<int> enclaves;
         list<int> candidates;
@@ -361,8 +562,13 @@ void Maxp::init_solution(int solution_idx)
             p_group[solution_idx] = 0;
             initial_wss[solution_idx] = 0;
         } else {
-            // apply local search
-            if (method == 0) {
+            construct_wss[solution_idx] = objective_function(_regions);
+            // apply local search, unless pruning is on and even twice the
+            // best improvement seen so far would leave this start behind
+            // the incumbent
+            if (is_hopeless(construct_wss[solution_idx])) {
+                pruned[solution_idx] = 1;
+            } else if (method == 0) {
                 swap(_regions, _area2region, seed_local);
             } else if (method == 1) {
                 tabu_search(_regions, _area2region, tabu_length, seed_local);
@@ -407,10 +613,11 @@ void Maxp::shuffle(vector<int>& arry, uint64_t& seed)
 void Maxp::simulated_annealing(vector<vector<int> >& init_regions, unordered_map<int, int>& init_area2region, double alpha, double temperature, uint64_t seed_local)
 {
     vector<vector<int> > local_best_solution;
-    unordered_map<int, int> local_best_area2region;
     double local_best_ssd = 1;
     
     int nr = init_regions.size();
+    RegionStats stats(w, z, floor_variable);
+    stats.Init(init_regions);
     vector<int> changed_regions(nr, 1);
    
     bool use_sa = false;
@@ -418,7 +625,7 @@ void Maxp::simulated_annealing(vector<vector<int> >& init_regions, unordered_map
     // Openshaw's Simulated Annealing for AZP algorithm
     int maxit = 0;
     
-    while ( T > 0.1 || maxit < 3 ) {
+    while ( (T > 0.1 || maxit < 3) && !is_stopped() ) {
     //while ( maxit < 3 ) {
         int improved = 0;
        
@@ -459,9 +666,9 @@ void Maxp::simulated_annealing(vector<vector<int> >& init_regions, unordered_map
                 vector<int> candidates;
                 for (n_it=neighbors_dict.begin(); n_it!=neighbors_dict.end(); n_it++) {
                     int nbr = n_it->first;
-                    vector<int>& block = init_regions[ init_area2region[ nbr ] ];
-                    if (check_floor(block, nbr)) {
-                        if (check_contiguity(w, block, nbr)) {
+                    vector<int>& block = init_regions[ stats.GetRegion(nbr) ];
+                    if (stats.CheckFloor(nbr, floor)) {
+                        if (stats.CheckContiguity(nbr, block)) {
                             candidates.push_back(nbr);
                         }
                     }
@@ -474,9 +681,7 @@ void Maxp::simulated_annealing(vector<vector<int> >& init_regions, unordered_map
                     bool best_found = false;
                     for (int j=0; j<candidates.size() && best_found == false; j++) {
                         int area = candidates[j];
-                        vector<int>& current_internal = init_regions[seed];
-                        vector<int>& current_outter = init_regions[init_area2region[area]];
-                        double change = objective_function_change(area, current_internal, current_outter);
+                        double change = stats.MoveChange(area, seed);
                         change = -change / (local_best_ssd * T);
                         if (exp(change) > Gda::ThomasWangHashDouble(seed_local++)) {
                             best = area;
@@ -487,12 +692,12 @@ void Maxp::simulated_annealing(vector<vector<int> >& init_regions, unordered_map
                     if (best_found) {
                         // make the move
                         int area = best;
-                        int old_region = init_area2region[area];
+                        int old_region = stats.GetRegion(area);
                         vector<int>& rgn = init_regions[old_region];
                         rgn.erase(remove(rgn.begin(),rgn.end(), area), rgn.end());
                         
-                        init_area2region[area] = seed;
                         init_regions[seed].push_back(area);
+                        stats.Move(area, seed);
                       
                         moves_made += 1;
                         changed_regions[seed] = 1;
@@ -505,9 +710,7 @@ void Maxp::simulated_annealing(vector<vector<int> >& init_regions, unordered_map
                         bool best_found = false;
                         for (int j=0; j<candidates.size(); j++) {
                             int area = candidates[j];
-                            vector<int>& current_internal = init_regions[seed];
-                            vector<int>& current_outter = init_regions[init_area2region[area]];
-                            double change = objective_function_change(area, current_internal, current_outter);
+                            double change = stats.MoveChange(area, seed);
                             if (change <= cv) {
                                 best = area;
                                 cv = change;
@@ -518,12 +721,12 @@ void Maxp::simulated_annealing(vector<vector<int> >& init_regions, unordered_map
                         if (best_found) {
                             // make the move
                             int area = best;
-                            int old_region = init_area2region[area];
+                            int old_region = stats.GetRegion(area);
                             vector<int>& rgn = init_regions[old_region];
                             rgn.erase(remove(rgn.begin(),rgn.end(), area), rgn.end());
                             
-                            init_area2region[area] = seed;
                             init_regions[seed].push_back(area);
+                            stats.Move(area, seed);
                             
                             moves_made += 1;
                             changed_regions[seed] = 1;
@@ -535,9 +738,9 @@ void Maxp::simulated_annealing(vector<vector<int> >& init_regions, unordered_map
                             for (int k=0; k<w[area].Size(); k++) {
                                 int nbr = w[area][k];
                                 if (member_dict[nbr] || neighbors_dict[nbr]) continue;
-                                vector<int>& block = init_regions[ init_area2region[ nbr ] ];
-                                if (check_floor(block, nbr)) {
-                                    if (check_contiguity(w, block, nbr)) {
+                                vector<int>& block = init_regions[ stats.GetRegion(nbr) ];
+                                if (stats.CheckFloor(nbr, floor)) {
+                                    if (stats.CheckContiguity(nbr, block)) {
                                         candidates.push_back(nbr);
                                         neighbors_dict[nbr] = true;
                                     }
@@ -559,14 +762,12 @@ void Maxp::simulated_annealing(vector<vector<int> >& init_regions, unordered_map
         if (local_best_solution.empty()) {
             improved = 1;
             local_best_solution = init_regions;
-            local_best_area2region = init_area2region;
             local_best_ssd = objective_function(init_regions);
         } else {
             double current_ssd = objective_function(init_regions);
             if ( current_ssd < local_best_ssd) {
                 improved = 1;
                 local_best_solution = init_regions;
-                local_best_area2region = init_area2region;
                 local_best_ssd = current_ssd;
             }
         }
@@ -583,19 +784,20 @@ void Maxp::simulated_annealing(vector<vector<int> >& init_regions, unordered_map
     }
     // make sure tabu result is no worse than greedy research
     double search_best_ssd = objective_function(init_regions);
-    if (local_best_ssd < search_best_ssd) {
+    if (!local_best_solution.empty() && local_best_ssd < search_best_ssd) {
         init_regions = local_best_solution;
-        init_area2region = local_best_area2region;
     }
+    update_area2region(init_regions, init_area2region);
 }
 
 void Maxp::tabu_search(vector<vector<int> >& init_regions, unordered_map<int, int>& init_area2region, int tabuLength, uint64_t seed_local)
 {
     vector<vector<int> > local_best_solution;
-    unordered_map<int, int> local_best_area2region;
     double local_best_ssd;
     
     int nr = init_regions.size();
+    RegionStats stats(w, z, floor_variable);
+    stats.Init(init_regions);
     
     vector<int> changed_regions(nr, 1);
     // tabuLength: Number of times a reverse move is prohibited. Default value tabuLength = 85.
@@ -606,7 +808,7 @@ void Maxp::tabu_search(vector<vector<int> >& init_regions, unordered_map<int, in
     bool use_tabu = false;
     int c = 0;
     
-    while ( c<convTabu ) {
+    while ( c<convTabu && !is_stopped() ) {
         int num_move = 0;
         vector<int> regionIds;
         for (int r=0; r<nr; r++) {
@@ -638,9 +840,9 @@ void Maxp::tabu_search(vector<vector<int> >& init_regions, unordered_map<int, in
             vector<int> candidates;
             for (n_it=neighbors_dict.begin(); n_it!=neighbors_dict.end(); n_it++) {
                 int nbr = n_it->first;
-                vector<int>& block = init_regions[ init_area2region[ nbr ] ];
-                if (check_floor(block, nbr)) {
-                    if (check_contiguity(w, block, nbr)) {
+                vector<int>& block = init_regions[ stats.GetRegion(nbr) ];
+                if (stats.CheckFloor(nbr, floor)) {
+                    if (stats.CheckContiguity(nbr, block)) {
                         candidates.push_back(nbr);
                     }
                 }
@@ -652,14 +854,12 @@ void Maxp::tabu_search(vector<vector<int> >& init_regions, unordered_map<int, in
                 bool best_found = false;
                 for (int j=0; j<candidates.size(); j++) {
                     int area = candidates[j];
-                    vector<int>& current_internal = init_regions[seed];
-                    vector<int>& current_outter = init_regions[init_area2region[area]];
                     if (!tabuList.empty()) {
-                        TabuMove tabu(area, init_area2region[area], seed);
+                        TabuMove tabu(area, stats.GetRegion(area), seed);
                         if ( find(tabuList.begin(), tabuList.end(), tabu) != tabuList.end() )
                             continue;
                     }
-                    double change = objective_function_change(area, current_internal, current_outter);
+                    double change = stats.MoveChange(area, seed);
                     if (change <= cv) {
                         best = area;
                         cv = change;
@@ -669,14 +869,13 @@ void Maxp::tabu_search(vector<vector<int> >& init_regions, unordered_map<int, in
                 
                 if (best_found) {
                     int area = best;
-                    if (init_area2region.find(area) != init_area2region.end()) {
-                        int old_region = init_area2region[area];
-                        // make the move
-                        move(area, old_region, seed, init_regions, init_area2region, tabuList,tabuLength);
-                        num_move ++;
-                        changed_regions[seed] = 1;
-                        changed_regions[old_region] = 1;
-                    }
+                    int old_region = stats.GetRegion(area);
+                    // make the move
+                    move(area, old_region, seed, init_regions, tabuList,tabuLength);
+                    stats.Move(area, seed);
+                    num_move ++;
+                    changed_regions[seed] = 1;
+                    changed_regions[old_region] = 1;
                 }
             } else {
                 double cv = 0.0;
@@ -684,13 +883,11 @@ void Maxp::tabu_search(vector<vector<int> >& init_regions, unordered_map<int, in
                 bool best_found = false;
                 for (int j=0; j<candidates.size(); j++) {
                     int area = candidates[j];
-                    vector<int>& current_internal = init_regions[seed];
-                    vector<int>& current_outter = init_regions[init_area2region[area]];
                     // prohibit tabu
-                    TabuMove tabu(area, init_area2region[area], seed);
+                    TabuMove tabu(area, stats.GetRegion(area), seed);
                     if ( find(tabuList.begin(), tabuList.end(), tabu) != tabuList.end() )
                         continue;
-                    double change = objective_function_change(area, current_internal, current_outter);
+                    double change = stats.MoveChange(area, seed);
                     if (j ==0 || change <= cv) {
                         best = area;
                         cv = change;
@@ -700,14 +897,13 @@ void Maxp::tabu_search(vector<vector<int> >& init_regions, unordered_map<int, in
                 
                 if (best_found) {
                     int area = best;
-                    if (init_area2region.find(area) != init_area2region.end()) {
-                        int old_region = init_area2region[area];
-                        // make the move
-                        move(area, old_region, seed, init_regions, init_area2region, tabuList,tabuLength);
-                        num_move ++;
-                        changed_regions[seed] = 1;
-                        changed_regions[old_region] = 1;
-                    }
+                    int old_region = stats.GetRegion(area);
+                    // make the move
+                    move(area, old_region, seed, init_regions, tabuList,tabuLength);
+                    stats.Move(area, seed);
+                    num_move ++;
+                    changed_regions[seed] = 1;
+                    changed_regions[old_region] = 1;
                 }
                 c++;
             }
@@ -720,13 +916,11 @@ void Maxp::tabu_search(vector<vector<int> >& init_regions, unordered_map<int, in
            
             if (local_best_solution.empty()) {
                 local_best_solution = init_regions;
-                local_best_area2region = init_area2region;
                 local_best_ssd = objective_function(init_regions);
             } else {
                 double current_ssd = objective_function(init_regions);
                 if ( current_ssd < local_best_ssd ) {
                     local_best_solution = init_regions;
-                    local_best_area2region = init_area2region;
                     local_best_ssd = current_ssd;
                 }
             }
@@ -741,10 +935,10 @@ void Maxp::tabu_search(vector<vector<int> >& init_regions, unordered_map<int, in
     }
     // make sure tabu result is no worse than greedy research
     double search_best_ssd = objective_function(init_regions);
-    if (local_best_ssd < search_best_ssd) {
+    if (!local_best_solution.empty() && local_best_ssd < search_best_ssd) {
         init_regions = local_best_solution;
-        init_area2region = local_best_area2region;
     }
+    update_area2region(init_regions, init_area2region);
 }
 
 
@@ -757,12 +951,11 @@ void Maxp::move(int area, int from_region, int to_region, vector<vector<int> >&
     _regions[to_region].push_back(area);
 }
 
-void Maxp::move(int area, int from_region, int to_region, vector<vector<int> >& _regions, unordered_map<int, int>& _area2region, vector<TabuMove>& tabu_list, int max_labu_length)
+void Maxp::move(int area, int from_region, int to_region, vector<vector<int> >& _regions, vector<TabuMove>& tabu_list, int max_labu_length)
 {
     vector<int>& rgn = _regions[from_region];
     rgn.erase(remove(rgn.begin(),rgn.end(), area), rgn.end());
     
-    _area2region[area] = to_region;
     _regions[to_region].push_back(area);
     
     TabuMove tabu(area, from_region, to_region);
@@ -783,12 +976,14 @@ void Maxp::swap(vector<vector<int> >& init_regions, unordered_map<int, int>& ini
     int swap_iteration = 0;
     int total_move = 0;
     int nr = init_regions.size();
+    RegionStats stats(w, z, floor_variable);
+    stats.Init(init_regions);
     
     vector<int>::iterator iter;
     vector<int> changed_regions(nr, 1);
     
     // nr = range(k)
-    while (swapping && total_move<10000) {
+    while (swapping && total_move<10000 && !is_stopped()) {
         int moves_made = 0;
         
         //selects a neighbouring solution at random
@@ -835,9 +1030,9 @@ void Maxp::swap(vector<vector<int> >& init_regions, unordered_map<int, int>& ini
             vector<int> candidates;
             for (n_it=neighbors_dict.begin(); n_it!=neighbors_dict.end(); n_it++) {
                 int nbr = n_it->first;
-                vector<int>& block = init_regions[ init_area2region[ nbr ] ];
-                if (check_floor(block, nbr)) {
-                    if (check_contiguity(w, block, nbr)) {
+                vector<int>& block = init_regions[ stats.GetRegion(nbr) ];
+                if (stats.CheckFloor(nbr, floor)) {
+                    if (stats.CheckContiguity(nbr, block)) {
                         candidates.push_back(nbr);
                     }
                 }
@@ -849,9 +1044,7 @@ void Maxp::swap(vector<vector<int> >& init_regions, unordered_map<int, int>& ini
                 bool best_found = false;
                 for (int j=0; j<candidates.size(); j++) {
                     int area = candidates[j];
-                    vector<int>& current_internal = init_regions[seed];
-                    vector<int>& current_outter = init_regions[init_area2region[area]];
-                    double change = objective_function_change(area, current_internal, current_outter);
+                    double change = stats.MoveChange(area, seed);
                     if (change <= cv) {
                         best = area;
                         cv = change;
@@ -862,12 +1055,12 @@ void Maxp::swap(vector<vector<int> >& init_regions, unordered_map<int, int>& ini
                 if (best_found) {
                     // make the move
                     int area = best;
-                    int old_region = init_area2region[area];
+                    int old_region = stats.GetRegion(area);
                     vector<int>& rgn = init_regions[old_region];
                     rgn.erase(remove(rgn.begin(),rgn.end(), area), rgn.end());
                     
-                    init_area2region[area] = seed;
                     init_regions[seed].push_back(area);
+                    stats.Move(area, seed);
                     
                     moves_made += 1;
                     changed_regions[seed] = 1;
@@ -880,9 +1073,9 @@ void Maxp::swap(vector<vector<int> >& init_regions, unordered_map<int, int>& ini
                     for (int k=0; k<w[area].Size(); k++) {
                         int nbr = w[area][k];
                         if (member_dict[nbr] || neighbors_dict[nbr]) continue;
-                        vector<int>& block = init_regions[ init_area2region[ nbr ] ];
-                        if (check_floor(block, nbr)) {
-                            if (check_contiguity(w, block, nbr)) {
+                        vector<int>& block = init_regions[ stats.GetRegion(nbr) ];
+                        if (stats.CheckFloor(nbr, floor)) {
+                            if (stats.CheckContiguity(nbr, block)) {
                                 candidates.push_back(nbr);
                                 neighbors_dict[nbr] = true;
                             }
@@ -898,36 +1091,17 @@ void Maxp::swap(vector<vector<int> >& init_regions, unordered_map<int, int>& ini
             total_moves = total_move;
         }
     }
+    update_area2region(init_regions, init_area2region);
 }
 
-bool Maxp::check_floor(const vector<int>& region, int leaver)
+void Maxp::update_area2region(const vector<vector<int> >& _regions, unordered_map<int, int>& _area2region)
 {
-    // selectionIDs = [self.w.id_order.index(i) for i in region]
-    double cv = 0;
-    for (size_t i=0; i<region.size(); i++) {
-        int selectionID = region[i];
-        if (selectionID == leaver) continue;
-        cv += floor_variable[ selectionID ];
-    }
-    if (cv >= floor)
-        return true;
-    else
-        return false;
-}
-
-bool Maxp::check_floor(const vector<int>& region)
-{
-    // selectionIDs = [self.w.id_order.index(i) for i in region]
-    double cv = 0;
-    for (size_t i=0; i<region.size(); i++) {
-        int selectionID = region[i];
-        double f_v = floor_variable[ selectionID ];
-        cv += f_v;
+    // the local searches track regions in RegionStats only
+    for (int r=0; r<_regions.size(); r++) {
+        for (int j=0; j<_regions[r].size(); j++) {
+            _area2region[ _regions[r][j] ] = r;
+        }
     }
-    if (cv >= floor)
-        return true;
-    else
-        return false;
 }
 
 double Maxp::objective_function()
@@ -964,40 +1138,6 @@ double Maxp::objective_function(vector<int>& solution)
     return wss;
 }
 
-double Maxp::objective_function(vector<int>& region1, int leaver, vector<int>& region2, int comer )
-{
-    // solution is a list of region ids [1,7,2]
-    double wss = 0;
-    int j=0;
-    int n_size = region1.size();
-    // for every variable, calc the variance using selected neighbors
-    for (int m=0; m<num_vars; m++) {
-        vector<double> selected_z(n_size-1);
-        j = 0;
-        for (int i=0; i<n_size; i++ ) {
-            if (region1[i] == leaver) continue;
-            int selectionID = region1[i];
-            selected_z[j++] =  z[selectionID][m];
-        }
-        double ssd = GenUtils::SumOfSquares(selected_z);
-        wss += ssd;
-    }
-    
-    n_size = region2.size();
-    // for every variable, calc the variance using selected neighbors
-    for (int m=0; m<num_vars; m++) {
-        vector<double> selected_z(n_size+1);
-        for (int i=0; i<n_size; i++ ) {
-            int selectionID = region2[i];
-            selected_z[i] =  z[selectionID][m];
-        }
-        selected_z[n_size] = z[comer][m];
-        double ssd = GenUtils::SumOfSquares(selected_z);
-        wss += ssd;
-    }
-    return wss;
-}
-
 double Maxp::objective_function(vector<vector<int> >& solution)
 {
     // solution is a list of lists of region ids [[1,7,2],[0,4,3],...] such
@@ -1028,99 +1168,3 @@ double Maxp::objective_function(vector<vector<int> >& solution)
     return wss;
 }
 
-double Maxp::objective_function(vector<int>& current_internal, vector<int>& current_outter)
-{
-    vector<vector<int> > composed_region;
-    composed_region.push_back(current_internal);
-    composed_region.push_back(current_outter);
-    
-    return objective_function(composed_region);
-}
-
-
-double Maxp::objective_function_change(int area, vector<int>& current_internal, vector<int>& current_outter)
-{
-    double current = objective_function(current_internal) + objective_function(current_outter);
-    double new_val = objective_function(current_outter, area, current_internal, area);
-    double change = new_val - current;
-    return change;
-}
-
-bool Maxp::is_component(const GalElement *w, const vector<int> &ids)
-{
-    //Check if the set of ids form a single connected component
-    int components = 0;
-    unordered_map<int, int> marks;
-    for (int i=0; i<ids.size(); i++) marks[ids[i]] = 0;
-    
-    list<int> q;
-    list<int>::iterator iter;
-    for (int i=0; i<ids.size(); i++)
-    {
-        int node = ids[i];
-        if (marks[node] == 0) {
-            components += 1;
-            q.push_back(node);
-            if (components > 1)
-                return false;
-        }
-        while (!q.empty()) {
-            node = q.back();
-            q.pop_back();
-            marks[node] = components;
-            for (int n=0; n<w[node].Size(); n++) {
-                int nbr = w[node][n];
-                if (marks.find(nbr) != marks.end()) {
-                    if (marks[nbr] == 0 ) {
-                        iter = find(q.begin(), q.end(), nbr);
-                        if (iter == q.end()) {
-                            q.push_back(nbr);
-                        }
-                    }
-                }
-            }
-        }
-    }
-    return true;
-}
-
-bool Maxp::check_contiguity(const GalElement* w, vector<int>& ids, int leaver)
-{
-    //vector<int> ids = neighbors;
-    //ids.erase(remove(ids.begin(),ids.end(), leaver), ids.end());
-    //return is_component(w, ids);
-    list<int> q;
-    unordered_map<int, bool> marks;
-    for (int i=0; i<ids.size(); i++) {
-        if (ids[i]!=leaver) {
-            marks[ids[i]] = false;
-            if (q.empty()) {
-                q.push_back(ids[i]);
-                marks[ids[i]] = true;
-            }
-        }
-    }
-    
-    int nbr, node;
-    while (!q.empty()) {
-        node = q.front();
-        q.pop_front();
-        
-        marks[node] = true;
-        for (int n=0; n<w[node].Size(); n++) {
-            nbr = w[node][n];
-            if (marks.find(nbr) != marks.end()) {
-                if (marks[nbr] == false) {
-                    marks[nbr] = true;
-                    q.push_back(nbr);
-                }
-            }
-        }
-    }
-    unordered_map<int, bool>::iterator it;
-    for (it=marks.begin(); it!=marks.end(); it++) {
-        if (it->second == false)
-            return false;
-    }
-    return true;
-}
@@ -25,6 +25,9 @@
 #include <vector>
 #include <map>
 #include <boost/unordered_map.hpp>
+#include <boost/function.hpp>
+#include <boost/atomic/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "../ShapeOperations/GalWeight.h"
 
@@ -65,6 +68,72 @@ struct TabuMove
             t.to_region == to_region;
     }
 };
+/*! Running statistics of the regions of one max-p solution.
+
+ Keeps the size, the sum of every variable and the sum of the floor
+ variable of each region, so the change of the within sum of squares of a
+ move and the floor test are O(num_vars) and O(1) instead of a pass over
+ both regions.  The articulation points of a region are cached and only
+ rebuilt after a move changed the region, so testing whether a region stays
+ contiguous without one of its areas is a lookup.
+ */
+class RegionStats
+{
+public:
+    RegionStats(const GalElement* w, const vector<vector<double> >& z,
+                double* floor_variable);
+    
+    //! Rebuild all statistics from a solution where every area is assigned
+    void Init(const vector<vector<int> >& regions);
+    
+    //! Change of the within sum of squares if area moves to to_region
+    double MoveChange(int area, int to_region) const;
+    
+    //! True if the region of area still meets floor without area
+    bool CheckFloor(int area, double floor) const;
+    
+    //! True if block, the region of area, stays connected without area
+    bool CheckContiguity(int area, const vector<int>& block);
+    
+    //! Update the statistics after area moved to to_region
+    void Move(int area, int to_region);
+    
+    //! Region of area in the current solution
+    int GetRegion(int area) const { return area2region[area]; }
+    
+protected:
+    // Tarjan's articulation points of block, iterative
+    void UpdateCuts(int region, const vector<int>& block);
+    
+    const GalElement* w;
+    const vector<vector<double> >& z;
+    double* floor_variable;
+    int num_obs;
+    int num_vars;
+    
+    vector<int> area2region; // the only area to region map of a local search
+    vector<int> region_size;
+    // region_sum[r*num_vars + m]: sum of variable m over region r
+    vector<double> region_sum;
+    vector<double> region_floor;
+    
+    // cut cache: valid flag and number of components of every region, and
+    // per area 1 for an articulation point, 2 for an isolated area
+    vector<char> cuts_valid;
+    vector<int> num_components;
+    vector<char> cut_type;
+    vector<int> disc;
+    vector<int> low;
+    vector<pair<int, int> > dfs_stack;
+};
+
+/*! Called with the best solution found so far, its within sum of squares
+ and the number of starts done out of all starts.  Also called about every
+ 0.2 seconds while a batch of starts runs, with no regions before the first
+ batch is done.  Return false to stop the search, including the starts
+ already running, and keep the best solution so far. */
+typedef boost::function<bool (const vector<vector<int> >& regions, double wss, int starts_done, int starts_total)> MaxpProgress;
+
 /*! A Max-p class */
 
 class Maxp
@@ -78,8 +147,11 @@ public:
      \param floor_variable array n*1 vector of observations on variable for the floor
      \param initial int number of initial solutions to generate
      \param seed list ids of observations to form initial seeds. If len(ids) is less than the number of observations, the complementary ids are added to the end of seeds. Thus the specified seeds get priority in the solution
+     \param time_budget seconds after which no new start is begun and running local searches stop, 0 for no limit
+     \param progress called from the calling thread during and after every batch of starts, see MaxpProgress
+     \param prune_hopeless skip the local search of starts that look hopeless (see is_hopeless()); a heuristic that can drop the best start, off by default
      */
-    Maxp(const GalElement* w, const vector<vector<double> >& z, double floor, double* floor_variable, int initial, vector<wxInt64> seeds,int _method, int _tabu_lenght, double _cool_rate, int rnd_seed=-1, char dist='e',  bool test=false);
+    Maxp(const GalElement* w, const vector<vector<double> >& z, double floor, double* floor_variable, int initial, vector<wxInt64> seeds,int _method, int _tabu_lenght, double _cool_rate, int rnd_seed=-1, char dist='e',  bool test=false, double time_budget=0, const MaxpProgress& progress=MaxpProgress(), bool prune_hopeless=false);
     
     
     //! A Deconstructor
@@ -212,10 +284,40 @@ protected:
    
     uint64_t seed_start;
     
-    uint64_t seed_increment;
-    
     vector<double> initial_wss;
     
+    //! Within sum of squares of every start before its local search
+    vector<double> construct_wss;
+    
+    //! Number of starts run in parallel between two progress reports
+    /*!
+     Details. The starts of a batch see the incumbent of the batches before
+     them only, so the result does not depend on the number of threads.
+     */
+    static const int starts_per_batch;
+    
+    int batch_start;
+    
+    //! Best start of the finished batches, -1 if none yet
+    int incumbent;
+    
+    //! Largest improvement of the local search over any finished start
+    double max_search_gain;
+    
+    //! 1 for the starts that skipped the local search as hopeless
+    vector<char> pruned;
+    
+    //! Skip the local search of hopeless starts
+    bool prune_hopeless;
+    
+    double time_budget;
+    
+    boost::posix_time::ptime deadline;
+    
+    boost::atomic_bool stop_search;
+    
+    MaxpProgress progress;
+    
     //! A protected member function: init_solution(void).
     /*!
      Details.
@@ -226,11 +328,24 @@ protected:
     
     void run_threaded();
     
+    //! Run starts batch_start .. batch_start+num_starts-1 on the thread pool
+    void run_batch(int num_starts);
+    
+    //! Call progress with the incumbent, or no regions if there is none yet; false to stop
+    bool report_progress(int starts_done);
+    
+    //! True once the time budget is used up or the search was stopped
+    bool is_stopped();
+    
+    //! With prune_hopeless, true if a start with constructed objective ss would not beat the incumbent even with twice the best local search gain seen so far.  Not a bound: a start can gain more than any start before it.
+    bool is_hopeless(double ss);
+    
     //! A protected member function: init_solution(void).
     /*!
      Details.
      */
     void swap(vector<vector<int> >& init_regions, unordered_map<int, int>& area2region, uint64_t seed_local);
+
    
     //! xxx
     /* !
@@ -256,40 +371,19 @@ protected:
      */
     void move(int area, int from_region, int to_region, vector<vector<int> >& regions, unordered_map<int, int>& area2region);
     
-    void move(int area, int from_region, int to_region, vector<vector<int> >& regions, unordered_map<int, int>& area2region, vector<TabuMove>& tabu_list, int max_tabu_length);
+    void move(int area, int from_region, int to_region, vector<vector<int> >& regions, vector<TabuMove>& tabu_list, int max_tabu_length);
     
-    //! A protected member function: init_solution(void). return
-    /*!
-     \param region a const vector of unsigned int.
-     \return boolean true if meet floor else return false
-     */
-    bool check_floor(const vector<int>& region);
-    
-    bool check_floor(const vector<int>& region, int leaver);
+    //! Set area2region to the regions of every area in regions
+    void update_area2region(const vector<vector<int> >& regions, unordered_map<int, int>& area2region);
     
     double objective_function();
     
     double objective_function(vector<int>& solution);
     
-    double objective_function(vector<int>& region1, int leaver, vector<int>& region2, int comer);
-    
     double objective_function(vector<vector<int> >& solution);
-    
-    double objective_function(vector<int>& current_internal, vector<int>& current_outter);
-    
-    double objective_function_change(int area, vector<int>& current_internal, vector<int>& current_outter);
    
     wxString print_regions(vector<vector<int> >& _regions);
-    //! xxx
-    /* !
-     \param block
-     \param neighbor
-     \return boolean
-     */
-    bool check_contiguity(const GalElement* w, vector<int>& block, int neighbor);
     
-    bool is_component(const GalElement* w, const vector<int>& ids);
-   
     void shuffle(vector<int>& arry, uint64_t& seed);
     
     bool test;
@@ -36,6 +36,7 @@
 #include "../ShapeOperations/GalWeight.h"
 #include "../logger.h"
 #include "../GenUtils.h"
+#include "../GdaThreadPool.h"
 #include "cluster.h"
 #include "redcap.h"
 
@@ -66,23 +67,6 @@ bool EdgeLess(Edge* a, Edge* b)
 // SSDUtils
 //
 /////////////////////////////////////////////////////////////////////////
-void SSDUtils::MeasureSplit(double ssd, vector<int> &ids, int split_position,  Measure& result)
-{
-    int start1 = 0;
-    int end1 = split_position;
-    int start2 = split_position;
-    int end2 = ids.size();
-    
-    double ssd1 = ComputeSSD(ids, start1, end1);
-    double ssd2 = ComputeSSD(ids, start2, end2);
-
-    
-    result.measure_reduction = ssd - ssd1 - ssd2;
-    result.ssd = ssd;
-    result.ssd_part1 = ssd1;
-    result.ssd_part2 = ssd2;
-}
-
 double SSDUtils::ComputeSSD(vector<int> &visited_ids, int start, int end)
 {
     int size = end - start;
@@ -102,6 +86,55 @@ double SSDUtils::ComputeSSD(vector<int> &visited_ids, int start, int end)
     return sum_squared / col;
 }
 
+double SSDUtils::ComputeSSD(int size, const double* sum, const double* sqsum)
+{
+    double sum_squared = 0.0;
+    for (int i = 0; i < col; ++i) {
+        double mean = sum[i] / size;
+        sum_squared += sqsum[i] -  size * mean * mean;
+    }
+    return sum_squared / col;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// DissimUtils
+//
+/////////////////////////////////////////////////////////////////////////
+double DissimUtils::Get(int i, int j) const
+{
+    return rowdistance(col, raw_data, mask, weight, i, j, dist);
+}
+
+bool DissimUtils::IsSquaredEuclid(int rows) const
+{
+    if (dist != 'e') {
+        return false;
+    }
+    for (int i=0; i<rows; i++) {
+        for (int j=0; j<col; j++) {
+            if (mask[i][j] == 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+double DissimUtils::GetAverage(int n1, const double* sum1, const double* sqsum1,
+                               int n2, const double* sum2,
+                               const double* sqsum2) const
+{
+    // mean of sum_k w_k (x_k - y_k)^2 over all pairs x, y of the groups
+    double result = 0;
+    for (int k=0; k<col; k++) {
+        double term = sqsum1[k] / n1 + sqsum2[k] / n2 -
+            2 * (sum1[k] / n1) * (sum2[k] / n2);
+        result += weight[k] * term;
+    }
+    return result;
+}
+
 /////////////////////////////////////////////////////////////////////////
 //
 // Node
@@ -177,6 +210,8 @@ Edge::Edge(Node* a, Node* b, double _length)
 // Tree
 //
 /////////////////////////////////////////////////////////////////////////
+const int Tree::cut_chunk_size = 4096;
+
 Tree::Tree(vector<int> _ordered_ids, vector<Edge*> _edges, AbstractClusterFactory* _cluster)
 : ordered_ids(_ordered_ids), edges(_edges), cluster(_cluster)
 {
@@ -184,59 +219,17 @@ Tree::Tree(vector<int> _ordered_ids, vector<Edge*> _edges, AbstractClusterFactor
     ssd_utils = cluster->ssd_utils;
     controls = cluster->controls;
     control_thres = cluster->control_thres;
+    subtrees.first = NULL;
+    subtrees.second = NULL;
+    split_pos = -1;
     
     int size = ordered_ids.size();
-    int edge_size = edges.size();
     this->ssd = 0;
     this->ssd_reduce = 0;
     
-    if (ordered_ids.size() > 1) {
+    if (size > 1) {
         this->ssd = ssd_utils->ComputeSSD(ordered_ids, 0, size);
-        max_id = -1;
-        for (int i=0; i<size; i++) {
-            if (ordered_ids[i] > max_id) {
-                max_id = ordered_ids[i];
-            }
-        }
-        
-        // use edges and ordered_ids to create nbr_dict and od_array
-        boost::unordered_map<int, vector<int> > nbr_dict;
-        od_array.resize(edge_size);
-        
-        int o_id, d_id;
-        for (int i=0; i<edge_size; i++) {
-            o_id = edges[i]->orig->id;
-            d_id = edges[i]->dest->id;
-            
-            od_array[i].first = o_id;
-            od_array[i].second = d_id;
-            
-            nbr_dict[o_id].push_back(d_id);
-            nbr_dict[d_id].push_back(o_id);
-        }
-        
-        if (size < 1000) {
-            Partition(0, od_array.size()-1, ordered_ids, od_array, nbr_dict);
-        } else {
-            run_threads(ordered_ids, od_array, nbr_dict);
-        }
-        if (!split_cands.empty()) {
-            SplitSolution& ss = split_cands[0];
-            this->split_ids = ss.split_ids;
-            this->split_pos = ss.split_pos;
-            this->ssd = ss.ssd;
-            this->ssd_reduce = ss.ssd_reduce;
-            
-            for (int j=1; j<split_cands.size(); j++) {
-                SplitSolution& tmp_ss = split_cands[j];
-                if (tmp_ss.ssd_reduce > this->ssd_reduce) {
-                    this->split_ids = tmp_ss.split_ids;
-                    this->split_pos = tmp_ss.split_pos;
-                    this->ssd = tmp_ss.ssd;
-                    this->ssd_reduce = tmp_ss.ssd_reduce;
-                }
-            }
-        }
+        Partition();
     }
 }
 
@@ -244,138 +237,219 @@ Tree::~Tree()
 {
 }
 
-void Tree::run_threads(vector<int>& ids,
-                       vector<pair<int, int> >& od_array,
-                       boost::unordered_map<int, vector<int> >& nbr_dict)
+// The tree (a forest if the weights are not connected) is rooted once and
+// the values are summed over every subtree, bottom up.  Cutting an edge
+// leaves a subtree on one side, so the SSD of both parts of every cut comes
+// from the subtree sums and the totals in O(cols), instead of a traversal
+// of the whole tree per edge.
+void Tree::Partition()
 {
-    int n_jobs = od_array.size();
-    
-    int nCPUs = boost::thread::hardware_concurrency();;
-    int quotient = n_jobs / nCPUs;
-    int remainder = n_jobs % nCPUs;
-    int tot_threads = (quotient > 0) ? nCPUs : remainder;
-    
-    boost::thread_group threadPool;
-    for (int i=0; i<tot_threads; i++) {
-        int a=0;
-        int b=0;
-        if (i < remainder) {
-            a = i*(quotient+1);
-            b = a+quotient;
-        } else {
-            a = remainder*(quotient+1) + (i-remainder)*quotient;
-            b = a+quotient-1;
-        }
-        
-        //prunecost(tree, a, b, scores, candidates);
-        boost::thread* worker = new boost::thread(boost::bind(&Tree::Partition, this, a, b, boost::ref(ids), boost::ref(od_array), boost::ref(nbr_dict)));
-        threadPool.add_thread(worker);
-    }
-    
-    threadPool.join_all();
-}
-
-void Tree::Partition(int start, int end, vector<int>& ids,
-                           vector<pair<int, int> >& od_array,
-                           boost::unordered_map<int, vector<int> >& nbr_dict)
-{
-    int size = nbr_dict.size();
-    int id, orig_id, dest_id;
-    int i, e_idx, k = 1, cnt=0;
+    int size = ordered_ids.size();
+    int num_edges = edges.size();
+    int col = cluster->cols;
+    double** data = cluster->raw_data;
+    vector<int>& node_index = cluster->node_index;
     
-    int best_edge = -1;
-    int evaluated = 0;
-    int best_pos = -1;
-    double tmp_ssd_reduce = 0, tmp_ssd=0;
+    for (int i=0; i<size; i++) {
+        node_index[ ordered_ids[i] ] = i;
+    }
     
-    vector<int> visited_ids(size), best_ids(size);
+    SubtreeSums s;
+    s.orig.resize(num_edges);
+    s.dest.resize(num_edges);
+    vector<int> nbr_start(size+1, 0);
+    for (int i=0; i<num_edges; i++) {
+        s.orig[i] = node_index[ edges[i]->orig->id ];
+        s.dest[i] = node_index[ edges[i]->dest->id ];
+        nbr_start[ s.orig[i]+1 ]++;
+        nbr_start[ s.dest[i]+1 ]++;
+    }
+    for (int i=0; i<size; i++) {
+        nbr_start[i+1] += nbr_start[i];
+    }
+    vector<int> nbrs(nbr_start[size]);
+    vector<int> nbr_pos(nbr_start.begin(), nbr_start.end()-1);
+    for (int i=0; i<num_edges; i++) {
+        nbrs[ nbr_pos[s.orig[i]]++ ] = s.dest[i];
+        nbrs[ nbr_pos[s.dest[i]]++ ] = s.orig[i];
+    }
     
-    // cut edge one by one
-    for ( i=start; i<=end; i++) {
-        orig_id = od_array[i].first;
-        dest_id = od_array[i].second;
-        
-        int idx = 0;
-        vector<int> cand_ids(max_id+1, -1);
-        Split(orig_id, dest_id, nbr_dict, cand_ids);
-        
-        for (int j=0; j<ids.size(); j++) {
-            if (cand_ids[ ids[j] ] == 1) {
-                visited_ids[idx] = ids[j];
-                idx++;
-            }
+    // pre-order: the subtree of node k is at [pre[k], pre[k] + size[k])
+    s.parent.assign(size, -1);
+    s.root.assign(size, -1);
+    s.pre.resize(size);
+    vector<int> order(size);
+    vector<int> visit;
+    int n_visited = 0;
+    for (int r=0; r<size; r++) {
+        if (s.root[r] != -1) {
+            continue;
         }
-        
-        int tmp_split_pos = idx;
-        
-        if (checkControl(cand_ids, ids, 1)) {
-            evaluated++;
-            for (int j=0; j<ids.size(); j++) {
-                if (cand_ids[ ids[j] ] == -1) {
-                    visited_ids[idx] = ids[j];
-                    idx++;
-                }
-            }
-            if (checkControl(cand_ids, ids, -1)) {
-                Measure result;
-                ssd_utils->MeasureSplit(ssd, visited_ids, tmp_split_pos, result);
-                if (result.measure_reduction > tmp_ssd_reduce) {
-                    tmp_ssd_reduce = result.measure_reduction;
-                    tmp_ssd = result.ssd;
-                    best_pos = tmp_split_pos;
-                    best_ids = visited_ids;
+        s.root[r] = r;
+        visit.push_back(r);
+        while (!visit.empty()) {
+            int cur = visit.back();
+            visit.pop_back();
+            s.pre[cur] = n_visited;
+            order[n_visited++] = cur;
+            for (int j=nbr_start[cur]; j<nbr_start[cur+1]; j++) {
+                int nbr = nbrs[j];
+                if (s.root[nbr] == -1) {
+                    s.root[nbr] = r;
+                    s.parent[nbr] = cur;
+                    visit.push_back(nbr);
                 }
             }
         }
     }
     
-    if (split_pos != -1) {
-        SplitSolution ss;
-        ss.split_pos =  best_pos;
-        ss.split_ids = best_ids;
-        ss.ssd = tmp_ssd;
-        ss.ssd_reduce = tmp_ssd_reduce;
-        mutex.lock();
-        split_cands.push_back(ss);
-        mutex.unlock();
+    s.size.assign(size, 1);
+    s.sum.resize((size_t)size * col);
+    s.sqsum.resize((size_t)size * col);
+    s.ctrl.assign(size, 0);
+    for (int i=0; i<size; i++) {
+        double* row = data[ ordered_ids[i] ];
+        double* sum = &s.sum[(size_t)i * col];
+        double* sqsum = &s.sqsum[(size_t)i * col];
+        for (int c=0; c<col; c++) {
+            sum[c] = row[c];
+            sqsum[c] = row[c] * row[c];
+        }
+        if (controls) {
+            s.ctrl[i] = controls[ ordered_ids[i] ];
+        }
+    }
+    s.total_sum.assign(col, 0);
+    s.total_sqsum.assign(col, 0);
+    s.total_ctrl = 0;
+    for (int i=size-1; i>=0; i--) {
+        int cur = order[i];
+        int p = s.parent[cur];
+        double* sum = &s.sum[(size_t)cur * col];
+        double* sqsum = &s.sqsum[(size_t)cur * col];
+        double* p_sum = p < 0 ? &s.total_sum[0] : &s.sum[(size_t)p * col];
+        double* p_sqsum = p < 0 ? &s.total_sqsum[0] : &s.sqsum[(size_t)p * col];
+        for (int c=0; c<col; c++) {
+            p_sum[c] += sum[c];
+            p_sqsum[c] += sqsum[c];
+        }
+        if (p < 0) {
+            s.total_ctrl += s.ctrl[cur];
+        } else {
+            s.size[p] += s.size[cur];
+            s.ctrl[p] += s.ctrl[cur];
+        }
+    }
+    
+    // best cut per chunk of edges, reduced in edge order so ties go to the
+    // first edge on any number of threads
+    int num_chunks = (num_edges + cut_chunk_size - 1) / cut_chunk_size;
+    s.best_edge.assign(num_chunks, -1);
+    s.best_reduce.assign(num_chunks, 0);
+    if (num_chunks > 1) {
+        GdaThreadPool::GetInstance().ParallelFor(num_edges,
+            boost::bind(&Tree::EvaluateCuts, this, _1, _2, boost::ref(s)),
+            cut_chunk_size);
+    } else if (num_edges > 0) {
+        EvaluateCuts(0, num_edges-1, s);
+    }
+    
+    int best_edge = -1;
+    for (int i=0; i<num_chunks; i++) {
+        if (s.best_edge[i] >= 0 && s.best_reduce[i] > ssd_reduce) {
+            ssd_reduce = s.best_reduce[i];
+            best_edge = s.best_edge[i];
+        }
+    }
+    if (best_edge < 0) {
+        return;
+    }
+    
+    // the orig side first, then the dest side, both in the order of ids
+    split_ids.reserve(size);
+    for (int i=0; i<size; i++) {
+        if (IsOrigSide(s, best_edge, i)) {
+            split_ids.push_back(ordered_ids[i]);
+        }
+    }
+    split_pos = split_ids.size();
+    for (int i=0; i<size; i++) {
+        if (!IsOrigSide(s, best_edge, i)) {
+            split_ids.push_back(ordered_ids[i]);
+        }
     }
 }
 
-void Tree::Split(int orig, int dest, boost::unordered_map<int, vector<int> >& nbr_dict, vector<int>& cand_ids)
+bool Tree::IsOrigSide(const SubtreeSums& s, int e, int node) const
 {
-    stack<int> visited_ids;
-    int cur_id, i, nbr_size, nbr;
-    
-    visited_ids.push(orig);
-    while (!visited_ids.empty()) {
-        cur_id = visited_ids.top();
-        visited_ids.pop();
-        cand_ids[cur_id] = 1;
-        vector<int>& nbrs = nbr_dict[cur_id];
-        nbr_size = nbrs.size();
-        for (i=0; i<nbr_size; i++) {
-            nbr = nbrs[i];
-            if (nbr != dest && cand_ids[nbr] == -1) {
-                visited_ids.push(nbr);
-            }
-        }
+    int o = s.orig[e];
+    int d = s.dest[e];
+    int pos = s.pre[node];
+    if (s.parent[o] == d) {
+        return pos >= s.pre[o] && pos < s.pre[o] + s.size[o];
     }
+    return s.root[node] == s.root[o] &&
+        (pos < s.pre[d] || pos >= s.pre[d] + s.size[d]);
 }
 
-bool Tree::checkControl(vector<int>& cand_ids, vector<int>& ids, int flag)
+void Tree::EvaluateCuts(int first, int last, SubtreeSums& s)
 {
-    if (controls == NULL) {
-        return true;
-    }
+    int size = ordered_ids.size();
+    int col = cluster->cols;
+    vector<double> sum1(col), sqsum1(col), sum2(col), sqsum2(col);
     
-    double val = 0;
-    for (int j=0; j<ids.size(); j++) {
-        if (cand_ids[ ids[j] ] == flag) {
-            val += controls[ ids[j] ];
+    int best_edge = -1;
+    double best_reduce = 0;
+    for (int e=first; e<=last; e++) {
+        int o = s.orig[e];
+        int d = s.dest[e];
+        // the orig side is either the subtree of orig, or the component of
+        // orig without the subtree of dest
+        int n1;
+        double ctrl1;
+        if (s.parent[o] == d) {
+            n1 = s.size[o];
+            ctrl1 = s.ctrl[o];
+            const double* sum = &s.sum[(size_t)o * col];
+            const double* sqsum = &s.sqsum[(size_t)o * col];
+            for (int c=0; c<col; c++) {
+                sum1[c] = sum[c];
+                sqsum1[c] = sqsum[c];
+            }
+        } else {
+            int r = s.root[o];
+            n1 = s.size[r] - s.size[d];
+            ctrl1 = s.ctrl[r] - s.ctrl[d];
+            const double* r_sum = &s.sum[(size_t)r * col];
+            const double* r_sqsum = &s.sqsum[(size_t)r * col];
+            const double* d_sum = &s.sum[(size_t)d * col];
+            const double* d_sqsum = &s.sqsum[(size_t)d * col];
+            for (int c=0; c<col; c++) {
+                sum1[c] = r_sum[c] - d_sum[c];
+                sqsum1[c] = r_sqsum[c] - d_sqsum[c];
+            }
+        }
+        if (controls != NULL &&
+            (ctrl1 < control_thres || s.total_ctrl - ctrl1 < control_thres))
+        {
+            continue;
+        }
+        for (int c=0; c<col; c++) {
+            sum2[c] = s.total_sum[c] - sum1[c];
+            sqsum2[c] = s.total_sqsum[c] - sqsum1[c];
+        }
+        double ssd1 = ssd_utils->ComputeSSD(n1, &sum1[0], &sqsum1[0]);
+        double ssd2 = ssd_utils->ComputeSSD(size - n1, &sum2[0], &sqsum2[0]);
+        double reduce = ssd - ssd1 - ssd2;
+        if (reduce > best_reduce) {
+            best_reduce = reduce;
+            best_edge = e;
         }
     }
     
-    return val >= control_thres;
+    int chunk = first / cut_chunk_size;
+    s.best_edge[chunk] = best_edge;
+    s.best_reduce[chunk] = best_reduce;
 }
 
 pair<Tree*, Tree*> Tree::GetSubTrees()
@@ -383,26 +457,14 @@ pair<Tree*, Tree*> Tree::GetSubTrees()
     if (split_ids.empty()) {
         return this->subtrees;
     }
-    int size = this->split_ids.size();
-    vector<int> part1_ids(this->split_pos);
-    vector<int> part2_ids(size -this->split_pos);
+    vector<int> part1_ids(split_ids.begin(), split_ids.begin() + split_pos);
+    vector<int> part2_ids(split_ids.begin() + split_pos, split_ids.end());
     
-    int max_id = -1;
-    for (int i=0; i<size; i++) {
-        if (i <split_pos) {
-            part1_ids[i] = split_ids[i];
-        } else {
-            part2_ids[i-split_pos] = split_ids[i];
-        }
-        if (split_ids[i] > max_id) {
-            max_id = split_ids[i];
-        }
-    }
-    
-    vector<Edge*> part1_edges(part1_ids.size()-1);
-    vector<Edge*> part2_edges(part2_ids.size()-1);
+    vector<Edge*> part1_edges;
+    vector<Edge*> part2_edges;
     
-    vector<int> part_index(max_id+1, 0);
+    // node_index is free again once Partition() is done: the part of a node
+    vector<int>& part_index = cluster->node_index;
     for (int i=0; i< part1_ids.size(); i++) {
         part_index[ part1_ids[i] ] = -1;
     }
@@ -410,17 +472,14 @@ pair<Tree*, Tree*> Tree::GetSubTrees()
         part_index[ part2_ids[i] ] = 1;
     }
     int o_id, d_id;
-    int cnt1=0, cnt2=0, cnt=0;
     for (int i=0; i<this->edges.size(); i++) {
         o_id = this->edges[i]->orig->id;
         d_id = this->edges[i]->dest->id;
         
         if (part_index[o_id] == -1 && part_index[d_id] == -1) {
-            part1_edges[cnt1++] = this->edges[i];
+            part1_edges.push_back(this->edges[i]);
         } else if (part_index[o_id] == 1 && part_index[d_id] == 1) {
-            part2_edges[cnt2++] =  this->edges[i];
-        } else {
-            cnt++;
+            part2_edges.push_back(this->edges[i]);
         }
     }
 
@@ -437,9 +496,11 @@ pair<Tree*, Tree*> Tree::GetSubTrees()
 // AbstractClusterFactory
 //
 ////////////////////////////////////////////////////////////////////////////////
-AbstractClusterFactory::AbstractClusterFactory(int row, int col,  double** _distances, double** _data, const vector<bool>& _undefs, GalElement * _w)
-: rows(row), cols(col), dist_matrix(_distances), raw_data(_data), undefs(_undefs), w(_w)
+AbstractClusterFactory::AbstractClusterFactory(int row, int col, double** _data, int** _mask, double* _weight, char _dist, const vector<bool>& _undefs, GalElement * _w)
+: rows(row), cols(col), raw_data(_data), undefs(_undefs), w(_w)
 {
+    ssd_utils = NULL;
+    dissim_utils = new DissimUtils(_data, _mask, _weight, col, _dist);
 }
 
 AbstractClusterFactory::~AbstractClusterFactory()
@@ -447,6 +508,7 @@ AbstractClusterFactory::~AbstractClusterFactory()
     if (ssd_utils) {
         delete ssd_utils;
     }
+    delete dissim_utils;
 
     for (int i=0; i<edges.size(); i++) {
         delete edges[i];
@@ -467,12 +529,22 @@ void AbstractClusterFactory::init()
         nodes[i] = node;
     }
     
-    this->dist_dict.resize(rows);
+    node_index.resize(rows);
+    
+    // dissimilarities along the weights only, one per neighbor of a row
+    nbr_start.resize(rows+1);
+    nbr_start[0] = 0;
+    for (int i=0; i<rows; i++) {
+        nbr_start[i+1] = nbr_start[i] + w[i].Size();
+    }
+    nbr_dists.resize(nbr_start[rows]);
+    GdaThreadPool::GetInstance().ParallelFor(rows,
+        boost::bind(&AbstractClusterFactory::ComputeNbrDists, this, _1, _2),
+        GdaThreadPool::query_chunk_size);
     
     Node* orig;
     Node* dest;
     double length;
-    boost::unordered_map<pair<int, int>, bool> access_dict;
     
     for (int i=0; i<rows; i++) {
         orig = nodes[i];
@@ -480,21 +552,38 @@ void AbstractClusterFactory::init()
         for (int j=0; j<w[i].Size(); j++) {
             int nbr = nbrs[j];
             dest = nodes[nbr];
-            length = dist_matrix[orig->id][dest->id];
+            length = nbr_dists[nbr_start[i] + j];
             
-            if (access_dict.find(make_pair(i, nbr)) == access_dict.end()) {
+            // an edge is added once, by the first row that lists it
+            bool added = std::find(nbrs.begin(), nbrs.begin()+j, nbr) !=
+                nbrs.begin() + j;
+            if (!added && nbr < i) {
+                const vector<long>& nbr_nbrs = w[nbr].GetNbrs();
+                added = std::find(nbr_nbrs.begin(), nbr_nbrs.end(), i) !=
+                    nbr_nbrs.end();
+            }
+            if (!added) {
                 edges.push_back(new Edge(orig, dest, length));
-                access_dict[make_pair(i, nbr)] = true;
-                access_dict[make_pair(nbr, i)] = true;
             }
-            this->dist_dict[i][nbr] = length;
         }
     }
+    vector<double>().swap(nbr_dists);
+    vector<int>().swap(nbr_start);
     
     Clustering();
     
 }
 
+void AbstractClusterFactory::ComputeNbrDists(int first, int last)
+{
+    for (int i=first; i<=last; i++) {
+        const vector<long>& nbrs = w[i].GetNbrs();
+        for (int j=0; j<nbrs.size(); j++) {
+            nbr_dists[nbr_start[i] + j] = dissim_utils->Get(i, nbrs[j]);
+        }
+    }
+}
+
 vector<vector<int> >& AbstractClusterFactory::GetRegions()
 {
     return cluster_ids;
@@ -568,8 +657,8 @@ void AbstractClusterFactory::Partitioning(int k)
 // Skater
 //
 ////////////////////////////////////////////////////////////////////////////////
-Skater::Skater(int rows, int cols, double** _distances, double** _data, const vector<bool>& _undefs, GalElement* w, double* _controls, double _control_thres)
-: AbstractClusterFactory(rows, cols, _distances, _data, _undefs, w)
+Skater::Skater(int rows, int cols, double** _data, int** _mask, double* _weight, char _dist, const vector<bool>& _undefs, GalElement* w, double* _controls, double _control_thres)
+: AbstractClusterFactory(rows, cols, _data, _mask, _weight, _dist, _undefs, w)
 {
     controls = _controls;
     control_thres = _control_thres;
@@ -584,15 +673,9 @@ Skater::~Skater()
 void Skater::Clustering()
 {
     Graph g(rows);
-    boost::unordered_map<pair<int, int>, bool> access_dict;
-    for (int i=0; i<rows; i++) {
-        for (int j=0; j<w[i].Size(); j++) {
-            if (access_dict.find(make_pair(i, w[i][j])) == access_dict.end()) {
-                boost::add_edge(i, w[i][j], dist_matrix[i][ w[i][j] ], g);
-                access_dict[make_pair(i, w[i][j])] = true;
-                access_dict[make_pair(w[i][j], i)] = true;
-            }
-        }
+    for (int i=0; i<edges.size(); i++) {
+        Edge* e = edges[i];
+        boost::add_edge(e->orig->id, e->dest->id, e->length, g);
     }
     
     boost::unordered_map<int, bool> id_dict;
@@ -649,8 +732,8 @@ void Skater::Clustering()
 // 1 FirstOrderSLKRedCap
 //
 ////////////////////////////////////////////////////////////////////////////////
-FirstOrderSLKRedCap::FirstOrderSLKRedCap(int rows, int cols, double** _distances, double** _data, const vector<bool>& _undefs, GalElement* w, double* _controls, double _control_thres)
-: AbstractClusterFactory(rows, cols, _distances, _data, _undefs, w)
+FirstOrderSLKRedCap::FirstOrderSLKRedCap(int rows, int cols, double** _data, int** _mask, double* _weight, char _dist, const vector<bool>& _undefs, GalElement* w, double* _controls, double _control_thres)
+: AbstractClusterFactory(rows, cols, _data, _mask, _weight, _dist, _undefs, w)
 {
     controls = _controls;
     control_thres = _control_thres;
@@ -717,8 +800,8 @@ void FirstOrderSLKRedCap::Clustering()
 // The First-Order-ALK method also starts with the spatially contiguous graph G*. However, after each merge, the distance between the new cluster and every other cluster is recalculated. Therefore, edges that connect the new cluster and every other cluster are updated with new length values. Edges in G* are then re-sorted and re-evaluated from the beginning. The procedure stops when all objects are in one cluster. The algorithm is shown in figure 3. The complexity is O(n2log n) due to the sorting after each merge.
 //
 ////////////////////////////////////////////////////////////////////////////////
-FirstOrderALKRedCap::FirstOrderALKRedCap(int rows, int cols, double** _distances, double** _data, const vector<bool>& _undefs, GalElement * w, double* _controls, double _control_thres)
-: AbstractClusterFactory(rows, cols, _distances, _data, _undefs, w)
+FirstOrderALKRedCap::FirstOrderALKRedCap(int rows, int cols, double** _data, int** _mask, double* _weight, char _dist, const vector<bool>& _undefs, GalElement * w, double* _controls, double _control_thres)
+: AbstractClusterFactory(rows, cols, _data, _mask, _weight, _dist, _undefs, w)
 {
     controls = _controls;
     control_thres = _control_thres;
@@ -741,8 +824,8 @@ void FirstOrderALKRedCap::Clustering()
 // 3 FirstOrderCLKRedCap
 //
 ////////////////////////////////////////////////////////////////////////////////
-FirstOrderCLKRedCap::FirstOrderCLKRedCap(int rows, int cols, double** _distances, double** _data, const vector<bool>& _undefs, GalElement * w, double* _controls, double _control_thres)
-: AbstractClusterFactory(rows, cols, _distances, _data, _undefs, w)
+FirstOrderCLKRedCap::FirstOrderCLKRedCap(int rows, int cols, double** _data, int** _mask, double* _weight, char _dist, const vector<bool>& _undefs, GalElement * w, double* _controls, double _control_thres)
+: AbstractClusterFactory(rows, cols, _data, _mask, _weight, _dist, _undefs, w)
 {
     controls = _controls;
     control_thres = _control_thres;
@@ -764,8 +847,8 @@ void FirstOrderCLKRedCap::Clustering()
 // 4 FullOrderSLKRedCap
 //
 ////////////////////////////////////////////////////////////////////////////////
-FullOrderSLKRedCap::FullOrderSLKRedCap(int rows, int cols, double** _distances, double** _data, const vector<bool>& _undefs, GalElement * w, double* _controls, double _control_thres)
-: FullOrderALKRedCap(rows, cols, _distances, _data, _undefs, w, _controls, _control_thres, false)
+FullOrderSLKRedCap::FullOrderSLKRedCap(int rows, int cols, double** _data, int** _mask, double* _weight, char _dist, const vector<bool>& _undefs, GalElement * w, double* _controls, double _control_thres)
+: FullOrderALKRedCap(rows, cols, _data, _mask, _weight, _dist, _undefs, w, _controls, _control_thres, false)
 {
     init();
 }
@@ -775,34 +858,28 @@ FullOrderSLKRedCap::~FullOrderSLKRedCap()
     
 }
 
-double FullOrderSLKRedCap::UpdateClusterDist(int cur_id, int o_id, int d_id, bool conn_c_o, bool conn_c_d, vector<int>& clst_ids, vector<int>& clst_startpos, vector<int>& clst_nodenum)
+double FullOrderSLKRedCap::MergeLinkage(double d_c_o, double d_c_d, int n_o, int n_d)
 {
-    double new_dist;
-    if (conn_c_o && conn_c_d) {
-        double d_c_o = dist_dict[cur_id][o_id];
-        double d_c_d = dist_dict[cur_id][d_id];
-        if ((new_dist = d_c_o) > d_c_d) {
-            new_dist = d_c_d;
-        }
-        
-    } else if (conn_c_o || conn_c_d) {
-        if (conn_c_d) {
-            int tmp_id = o_id;
-            o_id = d_id;
-            d_id = tmp_id;
-        }
-        new_dist = dist_dict[cur_id][o_id];
-        int c_endpos = clst_startpos[cur_id] + clst_nodenum[cur_id];
-        int d_endpos = clst_startpos[d_id] + clst_nodenum[d_id];
-        for (int i=clst_startpos[cur_id]; i<c_endpos; i++) {
-            for (int j=clst_startpos[d_id]; j<d_endpos; j++) {
-                if (dist_dict[clst_ids[i]] [clst_ids[j]] < new_dist) {
-                    new_dist = dist_dict[clst_ids[i]] [clst_ids[j]];
-                }
+    return d_c_o < d_c_d ? d_c_o : d_c_d;
+}
+
+double FullOrderSLKRedCap::ComputeLinkage(int c1, int c2)
+{
+    double dist = DBL_MAX;
+    for (int i=c1; i!=-1; i=member_next[i]) {
+        for (int j=c2; j!=-1; j=member_next[j]) {
+            double d = dissim_utils->Get(i, j);
+            if (d < dist) {
+                dist = d;
             }
         }
     }
-    return new_dist;
+    return dist;
+}
+
+bool FullOrderSLKRedCap::UseClusterSums()
+{
+    return false;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -810,8 +887,8 @@ double FullOrderSLKRedCap::UpdateClusterDist(int cur_id, int o_id, int d_id, boo
 // 5 FullOrderALKRedCap
 //
 ////////////////////////////////////////////////////////////////////////////////
-FullOrderALKRedCap::FullOrderALKRedCap(int rows, int cols, double** _distances, double** _data, const vector<bool>& _undefs,  GalElement * w, double* _controls, double _control_thres, bool init_flag)
-: AbstractClusterFactory(rows, cols, _distances, _data, _undefs, w)
+FullOrderALKRedCap::FullOrderALKRedCap(int rows, int cols, double** _data, int** _mask, double* _weight, char _dist, const vector<bool>& _undefs,  GalElement * w, double* _controls, double _control_thres, bool init_flag)
+: AbstractClusterFactory(rows, cols, _data, _mask, _weight, _dist, _undefs, w)
 {
     controls = _controls;
     control_thres = _control_thres;
@@ -825,153 +902,83 @@ FullOrderALKRedCap::~FullOrderALKRedCap()
     
 }
 
+// Every cluster keeps the linkage to its neighbor clusters.  The shortest
+// link is taken from a heap of candidates, and after a merge the linkage of
+// the neighbors to the new cluster comes from the Lance-Williams recurrence
+// of the two old linkages.  Only a neighbor of one of the two clusters needs
+// the linkage to the other one, which is not a neighbor, from the members.
 void FullOrderALKRedCap::Clustering()
 {
     int num_nodes = nodes.size();
-    vector<Node*> ordered_nodes(num_nodes);
     
-    for (int i=0; i< this->edges.size(); i++) {
-        Edge* edge = this->edges[i];
-        Node* orig = edge->orig;
-        Node* dest = edge->dest;
-        ordered_nodes[ orig->id ] = orig;
-        ordered_nodes[ dest->id ] = dest;
+    cluster_links.assign(num_nodes, ClusterLinks());
+    cluster_size.assign(num_nodes, 1);
+    member_next.assign(num_nodes, -1);
+    member_last.resize(num_nodes);
+    for (int i=0; i<num_nodes; i++) {
+        member_last[i] = i;
     }
-
-    std::sort(edges.begin(), edges.end(), EdgeLess);
-    int num_edges = edges.size();
-    vector<Edge*> edges_copy(num_edges);
-    for (int i=0; i<num_edges; i++) {
-        edges_copy[i] = edges[i];
+    cluster_sum.clear();
+    cluster_sqsum.clear();
+    if (UseClusterSums()) {
+        cluster_sum.resize((size_t)num_nodes * cols);
+        cluster_sqsum.resize((size_t)num_nodes * cols);
+        for (int i=0; i<num_nodes; i++) {
+            for (int j=0; j<cols; j++) {
+                double val = raw_data[i][j];
+                cluster_sum[(size_t)i * cols + j] = val;
+                cluster_sqsum[(size_t)i * cols + j] = val * val;
+            }
+        }
     }
+    links.clear();
+    free_links.clear();
+    num_merges = 0;
     
-    //cout << "# edges:" << num_edges << endl;
-    
-    this->ordered_edges.resize(num_nodes-1);
-    
-    vector<int> ids(num_nodes);
-    // number of nodes in a cluster
-    // the start position of a cluster
-    // the cluster id of each nodes
-    vector<int> cluster_nodenum(num_nodes);
-    vector<int> cluster_ids(num_nodes);
-    vector<int> cluster_startpos(num_nodes);
-    for (int i=0; i<num_nodes; ++i) {
-        ids[i] = i;
-        cluster_ids[i] = i;
-        cluster_startpos[i] = i;
-        cluster_nodenum[i] = 1;
+    MergeHeap heap;
+    for (int i=0; i< this->edges.size(); i++) {
+        Edge* edge = this->edges[i];
+        int o_id = edge->orig->id;
+        int d_id = edge->dest->id;
+        if (o_id == d_id) {
+            continue;
+        }
+        int l = NewLink(o_id, d_id, edge->length, edge);
+        cluster_links[o_id][d_id] = l;
+        cluster_links[d_id][o_id] = l;
+        PushLink(l, heap);
     }
     
-    int index = 0;
-    int cnt = 0;
+    this->ordered_edges.clear();
+    this->ordered_edges.reserve(num_nodes-1);
     
-    vector<bool> access_flag(num_nodes, false);
-    vector<int> counts(num_nodes);
-    vector<Edge*> new_edges;
-    
-    Edge* cur_edge = edges_copy[0];
-    for (int k=0; k<num_edges; k++) {
-        ++cnt;
-        Node* orig = cur_edge->orig;
-        Node* dest = cur_edge->dest;
-        int orig_id = ids[orig->id];
-        int dest_id = ids[dest->id];
+    while (!heap.empty() && ordered_edges.size() < num_nodes-1) {
+        if (heap.size() > 2 * (links.size() - free_links.size()) + num_nodes) {
+            CompactHeap(heap);
+        }
+        MergeCandidate cand = heap.top();
+        heap.pop();
         
-        Node* root1 = djset.FindSet(orig);
-        Node* root2 = djset.FindSet(dest);
+        ClusterLink& link = links[cand.link];
+        if (link.version != cand.version || link.heap_dist != cand.dist) {
+            continue; // merged away, or pushed again with a lower key
+        }
+        if (link.dist != cand.dist) {
+            PushLink(cand.link, heap); // the linkage grew
+            continue;
+        }
+        this->ordered_edges.push_back(link.edge);
         
-        if (root1 != root2) {
-            // find the shortest e in edges
-            for (int i=0; i<this->edges.size(); i++) {
-                ++cnt;
-                Edge* tmp_edge = this->edges[i];
-                int tmp_o_id = ids[tmp_edge->orig->id];
-                int tmp_d_id = ids[tmp_edge->dest->id];
-                if ((tmp_o_id==orig_id && tmp_d_id == dest_id) ||
-                    (tmp_d_id==orig_id && tmp_o_id == dest_id))
-                {
-                    // add edge
-                    this->ordered_edges[index++] = tmp_edge;
-                    break;
-                }
-            }
-            // add e to cluster
-            djset.Union(orig, dest);
-            
-            if (index == num_nodes -1) {
-                break;
-            }
-            
-            // remove edges(c,l) and edges(c, m) from copy
-            int i=0;
-            while (i < num_edges) {
-                ++cnt;
-                int tmp_o_id = ids[edges_copy[i]->orig->id];
-                int tmp_d_id = ids[edges_copy[i]->dest->id];
-                if (tmp_o_id==orig_id || tmp_o_id==dest_id ||
-                    tmp_d_id==orig_id || tmp_d_id==dest_id)
-                {
-                    edges_copy[i] = edges_copy[--num_edges];
-                } else {
-                    ++i;
-                }
-            }
-            
-            for (i=0; i<num_nodes; i++) {
-                access_flag[i] = false;
-            }
-            
-            // update distance to (o,d) cluster
-            for (i=0; i<num_nodes; ++i) {
-                ++cnt;
-                int tmp_id = ids[i];
-                if (!access_flag[tmp_id] && tmp_id != dest_id && tmp_id != orig_id) {
-                    bool d_is_nbr = dist_dict[tmp_id].find(dest_id) != dist_dict[tmp_id].end();
-                    bool o_is_nbr = dist_dict[tmp_id].find(orig_id) != dist_dict[tmp_id].end();
-                    if (d_is_nbr || o_is_nbr) {
-                        double update_dist = UpdateClusterDist(tmp_id, orig_id, dest_id, o_is_nbr, d_is_nbr, cluster_ids, cluster_startpos, cluster_nodenum);
-                        
-                        Edge* new_e = new Edge(ordered_nodes[tmp_id], ordered_nodes[orig_id], update_dist);
-                        
-                        edges_copy[num_edges++] = new_e;
-                        new_edges.push_back(new_e);
-                        
-                        dist_dict[tmp_id].erase(dest_id);
-                        dist_dict[dest_id].erase(tmp_id);
-                        dist_dict[tmp_id][orig_id] = update_dist;
-                        dist_dict[orig_id][tmp_id] = update_dist;
-                    }
-                    access_flag[tmp_id] = true;
-                } else if (tmp_id == dest_id || tmp_id == orig_id) {
-                    ids[i] = orig_id;
-                 }
-            }
-            
-            cluster_nodenum[orig_id] += cluster_nodenum[dest_id];
-            cluster_nodenum[dest_id] = 0;
-            
-            cluster_startpos[0] = 0;
-            counts[0] = 0;
-            for (i=1; i<num_nodes; ++i) {
-                cluster_startpos[i] = cluster_startpos[i-1] + cluster_nodenum[i-1];
-                counts[i] = 0;
-             }
-            
-            for (i=0; i<num_nodes; i++) {
-                int j = ids[i];
-                cluster_ids[cluster_startpos[j] + counts[j]] = i;
-                ++counts[j];
-            }
-            
-            
-            cur_edge = GetShortestEdge(edges_copy, 0, num_edges);
-            k = -1;
+        // move the fewer links
+        int o_id = link.c1;
+        int d_id = link.c2;
+        if (cluster_links[o_id].size() < cluster_links[d_id].size()) {
+            o_id = link.c2;
+            d_id = link.c1;
         }
+        Merge(o_id, d_id, heap);
     }
     
-    //cout << "cnt: " << cnt << endl;
-    
     boost::unordered_map<int, bool> id_dict;
 
     for (int i=0; i<ordered_edges.size();i++) {
@@ -989,65 +996,174 @@ void FullOrderALKRedCap::Clustering()
         }
     }
     
-    for (int i=0; i<new_edges.size(); i++) {
-        delete new_edges[i];
+    vector<ClusterLinks>().swap(cluster_links);
+    vector<ClusterLink>().swap(links);
+    vector<int>().swap(free_links);
+    vector<double>().swap(cluster_sum);
+    vector<double>().swap(cluster_sqsum);
+}
+
+int FullOrderALKRedCap::NewLink(int c1, int c2, double dist, Edge* edge)
+{
+    int l;
+    if (free_links.empty()) {
+        l = links.size();
+        links.push_back(ClusterLink());
+        links[l].version = 0;
+    } else {
+        l = free_links.back();
+        free_links.pop_back();
     }
+    ClusterLink& link = links[l];
+    link.dist = dist;
+    link.heap_dist = dist;
+    link.edge = edge;
+    link.c1 = c1 < c2 ? c1 : c2;
+    link.c2 = c1 < c2 ? c2 : c1;
+    link.stamp = -1;
+    return l;
 }
 
-double FullOrderALKRedCap::UpdateClusterDist(int cur_id, int o_id, int d_id, bool conn_c_o, bool conn_c_d, vector<int>& clst_ids, vector<int>& clst_startpos, vector<int>& clst_nodenum)
+void FullOrderALKRedCap::FreeLink(int l)
 {
-    double new_dist;
-    if (conn_c_o && conn_c_d) {
-        double d_c_o = dist_dict[cur_id][o_id];
-        double d_c_d = dist_dict[cur_id][d_id];
-        
-        // (avg_d(c,o) * numEdges(c,o)  + avg_d(c,d)*numEdges(c,d)) /
-        // (numEdges(c, o) + numEdges(c, d))
-        new_dist = (d_c_o * clst_nodenum[o_id] * clst_nodenum[cur_id] + d_c_d * clst_nodenum[d_id] * clst_nodenum[cur_id]) / ((clst_nodenum[o_id] + clst_nodenum[d_id]) * clst_nodenum[cur_id]);
-        
-        
-    } else if (conn_c_o || conn_c_d) {
-        if (conn_c_d) {
-            int tmp_id = o_id;
-            o_id = d_id;
-            d_id = tmp_id;
+    links[l].c1 = -1;
+    links[l].version++;
+    free_links.push_back(l);
+}
+
+void FullOrderALKRedCap::PushLink(int l, MergeHeap& heap)
+{
+    ClusterLink& link = links[l];
+    link.heap_dist = link.dist;
+    
+    MergeCandidate cand;
+    cand.dist = link.dist;
+    cand.c1 = link.c1;
+    cand.c2 = link.c2;
+    cand.link = l;
+    cand.version = link.version;
+    heap.push(cand);
+}
+
+void FullOrderALKRedCap::UpdateLink(int l, MergeHeap& heap)
+{
+    if (links[l].dist < links[l].heap_dist) {
+        PushLink(l, heap);
+    }
+}
+
+void FullOrderALKRedCap::CompactHeap(MergeHeap& heap)
+{
+    heap = MergeHeap();
+    for (int l=0; l<links.size(); l++) {
+        if (links[l].c1 >= 0) {
+            PushLink(l, heap);
         }
-        double d_c_o = dist_dict[cur_id][o_id];
-        double sumval_c_d = 0;
-        int c_endpos = clst_startpos[cur_id] + clst_nodenum[cur_id];
-        int d_endpos = clst_startpos[d_id] + clst_nodenum[d_id];
+    }
+}
+
+void FullOrderALKRedCap::Merge(int o_id, int d_id, MergeHeap& heap)
+{
+    int stamp = num_merges++;
+    ClusterLinks& links_o = cluster_links[o_id];
+    ClusterLinks& links_d = cluster_links[d_id];
+    FreeLink(links_o[d_id]);
+    links_o.erase(d_id);
+    links_d.erase(o_id);
+    
+    int n_o = cluster_size[o_id];
+    int n_d = cluster_size[d_id];
+    
+    // neighbors of d, and maybe of o
+    ClusterLinks::iterator it;
+    for (it = links_d.begin(); it != links_d.end(); ++it) {
+        int c_id = it->first;
+        int l_c_d = it->second;
+        ClusterLinks& links_c = cluster_links[c_id];
+        links_c.erase(d_id);
         
-        for (int i=clst_startpos[cur_id]; i<c_endpos; i++) {
-            for (int j=clst_startpos[d_id]; j<d_endpos; j++) {
-                sumval_c_d += dist_matrix[clst_ids[i]] [clst_ids[j]];
+        int l;
+        ClusterLinks::iterator c_o = links_o.find(c_id);
+        if (c_o != links_o.end()) {
+            l = c_o->second;
+            ClusterLink& link = links[l];
+            ClusterLink& link_c_d = links[l_c_d];
+            link.dist = MergeLinkage(link.dist, link_c_d.dist, n_o, n_d);
+            if (!EdgeLess(link.edge, link_c_d.edge)) {
+                link.edge = link_c_d.edge;
             }
+            FreeLink(l_c_d);
+        } else {
+            l = l_c_d;
+            ClusterLink& link = links[l];
+            link.dist = MergeLinkage(ComputeLinkage(c_id, o_id), link.dist, n_o, n_d);
+            link.c1 = c_id < o_id ? c_id : o_id;
+            link.c2 = c_id < o_id ? o_id : c_id;
+            links_o[c_id] = l;
+            links_c[o_id] = l;
         }
-        
-        new_dist = (d_c_o * clst_nodenum[o_id] * clst_nodenum[cur_id] + sumval_c_d) / ((clst_nodenum[o_id] + clst_nodenum[d_id]) * clst_nodenum[cur_id]);
-        
+        links[l].stamp = stamp;
+        UpdateLink(l, heap);
+    }
+    
+    // neighbors of o only
+    for (it = links_o.begin(); it != links_o.end(); ++it) {
+        int l = it->second;
+        if (links[l].stamp == stamp) {
+            continue;
+        }
+        ClusterLink& link = links[l];
+        link.dist = MergeLinkage(link.dist, ComputeLinkage(it->first, d_id), n_o, n_d);
+        UpdateLink(l, heap);
     }
-    return new_dist;
+    
+    ClusterLinks().swap(links_d);
+    
+    member_next[ member_last[o_id] ] = d_id;
+    member_last[o_id] = member_last[d_id];
+    cluster_size[o_id] = n_o + n_d;
+    cluster_size[d_id] = 0;
+    if (!cluster_sum.empty()) {
+        for (int j=0; j<cols; j++) {
+            cluster_sum[(size_t)o_id * cols + j] += cluster_sum[(size_t)d_id * cols + j];
+            cluster_sqsum[(size_t)o_id * cols + j] += cluster_sqsum[(size_t)d_id * cols + j];
+        }
+    }
+}
+
+double FullOrderALKRedCap::MergeLinkage(double d_c_o, double d_c_d, int n_o, int n_d)
+{
+    // (avg_d(c,o) * numEdges(c,o)  + avg_d(c,d)*numEdges(c,d)) /
+    // (numEdges(c, o) + numEdges(c, d))
+    return (d_c_o * n_o + d_c_d * n_d) / (n_o + n_d);
 }
 
-Edge* FullOrderALKRedCap::GetShortestEdge(vector<Edge*>& _edges, int start, int end)
+double FullOrderALKRedCap::ComputeLinkage(int c1, int c2)
 {
-    double len = DBL_MAX;
-    Edge* short_e = NULL;
-    for (int i=start; i<end; i++) {
-        if (_edges[i]->length < len) {
-            len = _edges[i]->length;
-            short_e = _edges[i];
+    if (!cluster_sum.empty()) {
+        return dissim_utils->GetAverage(cluster_size[c1], &cluster_sum[(size_t)c1 * cols], &cluster_sqsum[(size_t)c1 * cols], cluster_size[c2], &cluster_sum[(size_t)c2 * cols], &cluster_sqsum[(size_t)c2 * cols]);
+    }
+    double sumval = 0;
+    for (int i=c1; i!=-1; i=member_next[i]) {
+        for (int j=c2; j!=-1; j=member_next[j]) {
+            sumval += dissim_utils->Get(i, j);
         }
     }
-    return short_e;
+    return sumval / ((double)cluster_size[c1] * cluster_size[c2]);
+}
+
+bool FullOrderALKRedCap::UseClusterSums()
+{
+    return dissim_utils->IsSquaredEuclid(rows);
 }
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // 6 FullOrderCLKRedCap
 //
 ////////////////////////////////////////////////////////////////////////////////
-FullOrderCLKRedCap::FullOrderCLKRedCap(int rows, int cols, double** _distances, double** _data, const vector<bool>& _undefs, GalElement * w, double* _controls, double _control_thres)
-: FullOrderALKRedCap(rows, cols, _distances, _data, _undefs, w, _controls, _control_thres, false)
+FullOrderCLKRedCap::FullOrderCLKRedCap(int rows, int cols, double** _data, int** _mask, double* _weight, char _dist, const vector<bool>& _undefs, GalElement * w, double* _controls, double _control_thres)
+: FullOrderALKRedCap(rows, cols, _data, _mask, _weight, _dist, _undefs, w, _controls, _control_thres, false)
 {
     init();
 }
@@ -1057,39 +1173,33 @@ FullOrderCLKRedCap::~FullOrderCLKRedCap()
     
 }
 
-double FullOrderCLKRedCap::UpdateClusterDist(int cur_id, int o_id, int d_id, bool conn_c_o, bool conn_c_d, vector<int>& clst_ids, vector<int>& clst_startpos, vector<int>& clst_nodenum)
+double FullOrderCLKRedCap::MergeLinkage(double d_c_o, double d_c_d, int n_o, int n_d)
 {
-    double new_dist;
-    if (conn_c_o && conn_c_d) {
-        double d_c_o = dist_dict[cur_id][o_id];
-        double d_c_d = dist_dict[cur_id][d_id];
-        if ((new_dist = d_c_o) < d_c_d) {
-            new_dist = d_c_d;
-        }
-        
-    } else if (conn_c_o || conn_c_d) {
-        if (conn_c_d) {
-            int tmp_id = o_id;
-            o_id = d_id;
-            d_id = tmp_id;
-        }
-        new_dist = dist_dict[cur_id][o_id];
-        int c_endpos = clst_startpos[cur_id] + clst_nodenum[cur_id];
-        int d_endpos = clst_startpos[d_id] + clst_nodenum[d_id];
-        for (int i=clst_startpos[cur_id]; i<c_endpos; i++) {
-            for (int j=clst_startpos[d_id]; j<d_endpos; j++) {
-                if (dist_dict[clst_ids[i]] [clst_ids[j]] > new_dist) {
-                    new_dist = dist_dict[clst_ids[i]] [clst_ids[j]];
-                }
+    return d_c_o > d_c_d ? d_c_o : d_c_d;
+}
+
+double FullOrderCLKRedCap::ComputeLinkage(int c1, int c2)
+{
+    double dist = -DBL_MAX;
+    for (int i=c1; i!=-1; i=member_next[i]) {
+        for (int j=c2; j!=-1; j=member_next[j]) {
+            double d = dissim_utils->Get(i, j);
+            if (d > dist) {
+                dist = d;
             }
         }
     }
-    return new_dist;
+    return dist;
+}
+
+bool FullOrderCLKRedCap::UseClusterSums()
+{
+    return false;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-FullOrderWardRedCap::FullOrderWardRedCap(int rows, int cols, double** _distances, double** _data, const vector<bool>& _undefs,  GalElement * w, double* _controls, double _control_thres)
-: AbstractClusterFactory(rows, cols, _distances, _data, _undefs, w)
+FullOrderWardRedCap::FullOrderWardRedCap(int rows, int cols, double** _data, int** _mask, double* _weight, char _dist, const vector<bool>& _undefs,  GalElement * w, double* _controls, double _control_thres)
+: AbstractClusterFactory(rows, cols, _data, _mask, _weight, _dist, _undefs, w)
 {
     controls = _controls;
     control_thres = _control_thres;
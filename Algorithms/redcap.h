@@ -24,8 +24,8 @@
 
 #include <vector>
 #include <set>
+#include <queue>
 #include <float.h>
-#include <boost/thread/mutex.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/heap/priority_queue.hpp>
 #include <boost/graph/adjacency_list.hpp>
@@ -48,14 +48,6 @@ namespace SpanningTreeClustering {
     // SSDUtils
     //
     /////////////////////////////////////////////////////////////////////////
-    struct Measure
-    {
-        double ssd;
-        double ssd_part1;
-        double ssd_part2;
-        double measure_reduction;
-    };
-    
     class SSDUtils
     {
         double** raw_data;
@@ -71,10 +63,51 @@ namespace SpanningTreeClustering {
         ~SSDUtils() {}
         
         double ComputeSSD(vector<int>& visited_ids, int start, int end);
-        void MeasureSplit(double ssd, vector<int>& visited_ids, int split_position, Measure& result);
+        // SSD of a group of size observations from its column sums and sums
+        // of squares
+        double ComputeSSD(int size, const double* sum, const double* sqsum);
         
     };
     
+    /////////////////////////////////////////////////////////////////////////
+    //
+    // DissimUtils
+    //
+    /////////////////////////////////////////////////////////////////////////
+    // Dissimilarity of two observations, computed when asked for, so only
+    // the pairs along the spatial weights are ever evaluated instead of a
+    // rows x rows distance matrix.
+    class DissimUtils
+    {
+        double** raw_data;
+        int** mask;
+        double* weight;
+        int col;
+        char dist;
+        
+    public:
+        DissimUtils(double** data, int** _mask, double* _weight, int _col,
+                    char _dist) {
+            raw_data = data;
+            mask = _mask;
+            weight = _weight;
+            col = _col;
+            dist = _dist;
+        }
+        ~DissimUtils() {}
+        
+        // safe to call from several threads
+        double Get(int i, int j) const;
+        
+        // true for the weighted squared Euclidean distance without missing
+        // values: the average of Get() over all pairs of two groups then
+        // follows from the column sums of the groups, see GetAverage()
+        bool IsSquaredEuclid(int rows) const;
+        double GetAverage(int n1, const double* sum1, const double* sqsum1,
+                          int n2, const double* sum2,
+                          const double* sqsum2) const;
+    };
+    
     /////////////////////////////////////////////////////////////////////////
     //
     // Node
@@ -159,12 +192,26 @@ namespace SpanningTreeClustering {
     // Tree
     //
     /////////////////////////////////////////////////////////////////////////
-    struct SplitSolution
+    // The tree rooted once, with the sums of every subtree, so the two
+    // parts left by cutting any edge are known without visiting them.
+    // Positions are local: node k of the tree is ordered_ids[k].
+    struct SubtreeSums
     {
-        int split_pos;
-        vector<int> split_ids;
-        double ssd;
-        double ssd_reduce;
+        vector<int> orig;      // local ends of the edges
+        vector<int> dest;
+        vector<int> parent;    // -1 for a root
+        vector<int> root;      // root of the component of a node
+        vector<int> pre;       // pre-order position of a node
+        vector<int> size;      // number of nodes in the subtree of a node
+        vector<double> sum;    // col values per node: sums of the subtree
+        vector<double> sqsum;
+        vector<double> ctrl;   // sum of the controls in the subtree
+        vector<double> total_sum; // sums of all nodes of the tree
+        vector<double> total_sqsum;
+        double total_ctrl;
+        // best cut of each chunk of edges: edge index (-1: none), reduction
+        vector<int> best_edge;
+        vector<double> best_reduce;
     };
     
     class Tree
@@ -176,22 +223,14 @@ namespace SpanningTreeClustering {
         
         ~Tree();
         
-        void Partition(int start, int end, vector<int>& ids,
-                       vector<pair<int, int> >& od_array,
-                       boost::unordered_map<int, vector<int> >& nbr_dict);
-        void Split(int orig, int dest,
-                   boost::unordered_map<int, vector<int> >& nbr_dict,
-                   vector<int>& cand_ids);
-        bool checkControl(vector<int>& cand_ids, vector<int>& ids, int flag);
+        void Partition();
         pair<Tree*, Tree*> GetSubTrees();
         
         double ssd_reduce;
         double ssd;
         
-        vector<pair<int, int> > od_array;
         AbstractClusterFactory* cluster;
         pair<Tree*, Tree*> subtrees;
-        int max_id;
         int split_pos;
         vector<int> split_ids;
         vector<Edge*> edges;
@@ -201,12 +240,15 @@ namespace SpanningTreeClustering {
         double* controls;
         double control_thres;
         
-        // threads
-        boost::mutex mutex;
-        void run_threads(vector<int>& ids,
-                       vector<pair<int, int> >& od_array,
-                       boost::unordered_map<int, vector<int> >& nbr_dict);
-        vector<SplitSolution> split_cands;
+    protected:
+        // edges the tree is cut at in parallel, chunks of this size
+        static const int cut_chunk_size;
+        
+        // the nodes on the orig side of cutting edge e: they keep their
+        // pre-order position in the subtree of orig, or in its component
+        // but outside of the subtree of dest
+        bool IsOrigSide(const SubtreeSums& s, int e, int node) const;
+        void EvaluateCuts(int first, int last, SubtreeSums& s);
     };
     
     ////////////////////////////////////////////////////////////////////////////////
@@ -231,13 +273,17 @@ namespace SpanningTreeClustering {
         int rows;
         int cols;
         GalElement* w;
-        double** dist_matrix;
+        DissimUtils* dissim_utils;
         double** raw_data;
         const vector<bool>& undefs; // undef = any one item is undef in all variables
         double* controls;
         double control_thres;
         SSDUtils* ssd_utils;
         
+        // scratch of rows entries, used by one Tree at a time to map ids to
+        // local positions
+        vector<int> node_index;
+        
         //Cluster* cluster;
         DisjoinSet djset;
         
@@ -247,26 +293,29 @@ namespace SpanningTreeClustering {
         vector<int> ordered_ids;
         vector<Edge*> ordered_edges;
         
-        vector<boost::unordered_map<int, double> > dist_dict;
-        
         vector<vector<int> > cluster_ids;
         
         AbstractClusterFactory(int row, int col,
-                       double** distances,
                        double** data,
+                       int** mask,
+                       double* weight,
+                       char dist,
                        const vector<bool>& undefs,
                        GalElement * w);
         virtual ~AbstractClusterFactory();
         
         virtual void Clustering()=0;
         
-        virtual double UpdateClusterDist(int cur_id, int orig_id, int dest_id, bool is_orig_nbr, bool is_dest_nbr, vector<int>& clst_ids, vector<int>& clst_startpos, vector<int>& clst_nodenum) { return 0;}
-        
-        Edge* GetShortestEdge(vector<Edge*>& edges, int start, int end){ return NULL;}
-        
         void init();
         void Partitioning(int k);
         vector<vector<int> >& GetRegions();
+        
+    protected:
+        // dissimilarity of row i and its j-th neighbor at
+        // nbr_dists[nbr_start[i] + j], only alive during init()
+        vector<int> nbr_start;
+        vector<double> nbr_dists;
+        void ComputeNbrDists(int first, int last);
     };
     
     ////////////////////////////////////////////////////////////////////////////////
@@ -286,8 +335,10 @@ namespace SpanningTreeClustering {
     {
     public:
         Skater(int rows, int cols,
-               double** _distances,
                double** data,
+               int** mask,
+               double* weight,
+               char dist,
                const vector<bool>& undefs,
                GalElement * w,
                double* controls,
@@ -305,8 +356,10 @@ namespace SpanningTreeClustering {
     {
     public:
         FirstOrderSLKRedCap(int rows, int cols,
-                            double** _distances,
                             double** data,
+                            int** mask,
+                            double* weight,
+                            char dist,
                             const vector<bool>& undefs,
                             GalElement * w,
                             double* controls,
@@ -326,8 +379,10 @@ namespace SpanningTreeClustering {
     {
     public:
         FirstOrderALKRedCap(int rows, int cols,
-                            double** _distances,
                             double** data,
+                            int** mask,
+                            double* weight,
+                            char dist,
                             const vector<bool>& undefs,
                             GalElement * w,
                             double* controls,
@@ -348,8 +403,10 @@ namespace SpanningTreeClustering {
     {
     public:
         FirstOrderCLKRedCap(int rows, int cols,
-                            double** _distances,
                             double** data,
+                            int** mask,
+                            double* weight,
+                            char dist,
                             const vector<bool>& undefs,
                             GalElement * w,
                             double* controls,
@@ -370,8 +427,10 @@ namespace SpanningTreeClustering {
     {
     public:
         FullOrderALKRedCap(int rows, int cols,
-                           double** _distances,
                            double** data,
+                           int** mask,
+                           double* weight,
+                           char dist,
                            const vector<bool>& undefs,
                            GalElement * w,
                            double* controls,
@@ -382,9 +441,74 @@ namespace SpanningTreeClustering {
         
         virtual void Clustering();
         
-        virtual double UpdateClusterDist(int cur_id, int orig_id, int dest_id, bool is_orig_nbr, bool is_dest_nbr, vector<int>& clst_ids, vector<int>& clst_startpos, vector<int>& clst_nodenum);
-        
-        Edge* GetShortestEdge(vector<Edge*>& edges, int start, int end);
+    protected:
+        // linkage of two neighbor clusters, and the shortest edge between
+        // them.  heap_dist is the key of its entry in the heap, never above
+        // dist: a linkage that grows keeps its entry, which is pushed again
+        // with the new key when it comes to the top.
+        struct ClusterLink
+        {
+            double dist;
+            double heap_dist;
+            Edge* edge;
+            int c1;       // -1 once the link is free
+            int c2;
+            int version;  // changes when the link is freed
+            int stamp;    // merge that last updated the link
+        };
+        // neighbor cluster to the index of the link in links
+        typedef boost::unordered_map<int, int> ClusterLinks;
+        
+        struct MergeCandidate
+        {
+            double dist;
+            int c1;
+            int c2;
+            int link;
+            int version;
+            
+            bool operator<(const MergeCandidate& o) const {
+                // reversed: std::priority_queue pops the shortest first
+                if (dist != o.dist) return dist > o.dist;
+                if (c1 != o.c1) return c1 > o.c1;
+                return c2 > o.c2;
+            }
+        };
+        typedef std::priority_queue<MergeCandidate> MergeHeap;
+        
+        int NewLink(int c1, int c2, double dist, Edge* edge);
+        void FreeLink(int l);
+        void PushLink(int l, MergeHeap& heap);
+        // push the link again if its linkage dropped below its key
+        void UpdateLink(int l, MergeHeap& heap);
+        // one entry per link, once most entries of the heap are stale
+        void CompactHeap(MergeHeap& heap);
+        
+        // merge cluster d into cluster o and update the linkage of all
+        // their neighbors
+        void Merge(int o, int d, MergeHeap& heap);
+        
+        // Lance-Williams update: linkage of c to the merge of o and d
+        virtual double MergeLinkage(double d_c_o, double d_c_d,
+                                    int n_o, int n_d);
+        // linkage of two clusters that are not neighbors, from their members
+        virtual double ComputeLinkage(int c1, int c2);
+        // the average linkage of any two clusters follows from their sums
+        virtual bool UseClusterSums();
+        
+        // clusters are known by one of their nodes; the links of a merged
+        // away cluster are empty
+        vector<ClusterLinks> cluster_links;
+        vector<ClusterLink> links;
+        vector<int> free_links;
+        int num_merges;
+        vector<int> cluster_size;
+        // members of a cluster: a list from the cluster id on, by member_next
+        vector<int> member_next;
+        vector<int> member_last;
+        // column sums of the clusters, if UseClusterSums()
+        vector<double> cluster_sum;
+        vector<double> cluster_sqsum;
     };
     
     ////////////////////////////////////////////////////////////////////////////////
@@ -396,16 +520,21 @@ namespace SpanningTreeClustering {
     {
     public:
         FullOrderSLKRedCap(int rows, int cols,
-                           double** _distances,
                            double** data,
+                           int** mask,
+                           double* weight,
+                           char dist,
                            const vector<bool>& undefs,
                            GalElement * w,
                            double* controls,
                            double control_thres);
         virtual ~FullOrderSLKRedCap();
         
-        virtual double UpdateClusterDist(int cur_id, int orig_id, int dest_id, bool is_orig_nbr, bool is_dest_nbr, vector<int>& clst_ids, vector<int>& clst_startpos, vector<int>& clst_nodenum);
-        
+    protected:
+        virtual double MergeLinkage(double d_c_o, double d_c_d,
+                                    int n_o, int n_d);
+        virtual double ComputeLinkage(int c1, int c2);
+        virtual bool UseClusterSums();
     };
     
     
@@ -418,8 +547,10 @@ namespace SpanningTreeClustering {
     {
     public:
         FullOrderCLKRedCap(int rows, int cols,
-                           double** _distances,
                            double** data,
+                           int** mask,
+                           double* weight,
+                           char dist,
                            const vector<bool>& undefs,
                            GalElement * w,
                            double* controls,
@@ -427,8 +558,11 @@ namespace SpanningTreeClustering {
         
         virtual ~FullOrderCLKRedCap();
         
-        virtual double UpdateClusterDist(int cur_id, int orig_id, int dest_id, bool is_orig_nbr, bool is_dest_nbr, vector<int>& clst_ids, vector<int>& clst_startpos, vector<int>& clst_nodenum);
-        
+    protected:
+        virtual double MergeLinkage(double d_c_o, double d_c_d,
+                                    int n_o, int n_d);
+        virtual double ComputeLinkage(int c1, int c2);
+        virtual bool UseClusterSums();
     };
 
     ////////////////////////////////////////////////////////////////////////////////
@@ -440,8 +574,10 @@ namespace SpanningTreeClustering {
     {
     public:
         FullOrderWardRedCap(int rows, int cols,
-                           double** _distances,
                            double** data,
+                           int** mask,
+                           double* weight,
+                           char dist,
                            const vector<bool>& undefs,
                            GalElement * w,
                            double* controls,
@@ -40,6 +40,7 @@
 #include <wx/checkbox.h>
 #include <wx/choice.h>
 
+#include "../ShapeOperations/CsrWeight.h"
 #include "../ShapeOperations/VoronoiUtils.h"
 #include "../ShapeOperations/PolysToContigWeights.h"
 #include "../Algorithms/texttable.h"
@@ -145,12 +146,12 @@ bool AbstractClusterDlg::GetDefaultContiguity()
         bool is_queen = true;
 
         if (project->IsPointTypeData()) {
-            std::vector<std::set<int> > nbr_map;
-            project->GetVoronoiQueenNeighborMap(nbr_map);
-            gal = Gda::VoronoiUtils::NeighborMapToGal(nbr_map);
+            CsrWeight* cw = project->GetVoronoiNeighborCsr(is_queen);
+            if (cw) gal = cw->ToGal();
+            delete cw;
         } else {
             // assume polygons (no lines)
-            gal = PolysToContigWeights(project->main_data, is_queen);
+            gal = CreateContigWeights(project->main_data, is_queen);
         }
     }
     return gal != NULL;
@@ -17,6 +17,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 #include <vector>
 #include <set>
@@ -29,8 +31,10 @@
 #include <wx/xrc/xmlres.h>
 #include <wx/grid.h>
 #include <wx/regex.h>
+#include <wx/stopwatch.h>
 #include "../FramesManager.h"
 #include "../ShapeOperations/PolysToContigWeights.h"
+#include "../ShapeOperations/CsrWeight.h"
 #include "../ShapeOperations/GalWeight.h"
 #include "../ShapeOperations/VoronoiUtils.h"
 #include "../ShapeOperations/WeightUtils.h"
@@ -41,6 +45,7 @@
 #include "../DataViewer/TableState.h"
 #include "../ShapeOperations/WeightsManState.h"
 #include "../ShapeOperations/WeightsManager.h"
+#include "../ShapeOperations/WeightsCache.h"
 //#include "../GeoDa.h"
 #include "../TemplateCanvas.h"
 #include "../GenUtils.h"
@@ -73,6 +78,42 @@ EVT_SPIN( XRCID("IDC_SPIN_POWER_KNN"), CreatingWeightDlg::OnCSpinPowerInverseKNN
 EVT_NOTEBOOK_PAGE_CHANGED( XRCID("IDC_WEIGHTS_DIST_VARS_LIST"), CreatingWeightDlg::OnDistanceWeightsInputUpdate )
 END_EVENT_TABLE()
 
+namespace {
+    /** replace the (asymmetric) KNN neighbors of Wp by W and W' merged */
+    void SymmetrizeGwt(GwtWeight* Wp, CsrWeight::SymmetrizeMode mode)
+    {
+        int n = Wp->num_obs;
+        std::vector<std::vector<int> > nbrs(n);
+        std::vector<std::vector<double> > vals(n);
+        for (int i=0; i<n; i++) {
+            const GwtElement& e = Wp->gwt[i];
+            for (long j=0; j<e.Size(); j++) {
+                nbrs[i].push_back(e.elt(j).nbx);
+                vals[i].push_back(e.elt(j).weight);
+            }
+        }
+        CsrWeight csr(nbrs, vals);
+        CsrWeight* sym = csr.Symmetrize(mode);
+        wxLogMessage("KNN weights symmetrized: %d to %d neighbor pairs",
+                     (int) csr.GetNumEdges(), (int) sym->GetNumEdges());
+        delete [] Wp->gwt;
+        Wp->gwt = new GwtElement[n];
+        for (int i=0; i<n; i++) {
+            int sz = sym->GetNumNbrs(i);
+            if (sz == 0) continue;
+            const int* nb = sym->GetNbrs(i);
+            const double* v = sym->GetValues(i);
+            Wp->gwt[i].alloc(sz);
+            for (int j=0; j<sz; j++) {
+                Wp->gwt[i].Push(GwtNeighbor(nb[j], v ? v[j] : 1.0));
+            }
+        }
+        delete sym;
+        Wp->is_symmetric = true;
+        Wp->symmetry_checked = true;
+    }
+}
+
 
 CreatingWeightDlg::CreatingWeightDlg(wxWindow* parent,
                                      Project* project_s,
@@ -90,6 +131,7 @@ m_thres_val_valid(false),
 m_threshold_val(0.01),
 project(project_s),
 dist_util(NULL),
+m_thres_grid(NULL),
 frames_manager(project_s->GetFramesManager()),
 table_int(project_s->GetTableInt()),
 table_state(project_s->GetTableState()),
@@ -116,6 +158,9 @@ CreatingWeightDlg::~CreatingWeightDlg()
 {
     if (dist_util) {
         delete dist_util;
+    }
+    if (m_thres_grid) {
+        delete m_thres_grid;
     }
 	frames_manager->removeObserver(this);
 	table_state->removeObserver(this);
@@ -148,6 +193,7 @@ bool CreatingWeightDlg::Create(wxWindow* parent, wxWindowID id, const wxString&
 	m_Y_time = 0;
 	m_threshold = 0;
 	m_sliderdistance = 0;
+	m_thres_nbr_stats = 0;
 	m_neighbors = 0;
 	m_spinneigh = 0;
     m_spinn_inverse = 0;
@@ -192,6 +238,7 @@ void CreatingWeightDlg::CreateControls()
     m_nb_distance_methods = XRCCTRL(*this, "IDC_NB_DISTANCE_WEIGHTS", wxNotebook);
 	m_threshold = XRCCTRL(*this, "IDC_THRESHOLD_EDIT", wxTextCtrl);
 	m_sliderdistance = XRCCTRL(*this, "IDC_THRESHOLD_SLIDER", wxSlider);
+    m_thres_nbr_stats = XRCCTRL(*this, "IDC_THRESHOLD_NBR_STATS", wxStaticText);
     m_neighbors = XRCCTRL(*this, "IDC_EDIT_KNN", wxTextCtrl);
 	m_spinneigh = XRCCTRL(*this, "IDC_SPIN_KNN", wxSpinButton);
     m_kernel_methods = XRCCTRL(*this, "IDC_KERNEL_METHODS", wxChoice);
@@ -210,6 +257,7 @@ void CreatingWeightDlg::CreateControls()
     m_use_inverse_knn = XRCCTRL(*this, "IDC_CHK_INVERSE_DISTANCE_KNN", wxCheckBox);
     m_power_knn = XRCCTRL(*this, "IDC_EDIT_POWER_KNN", wxTextCtrl);
     m_spinn_inverse_knn = XRCCTRL(*this, "IDC_SPIN_POWER_KNN", wxSpinButton);
+    m_knn_symmetric = XRCCTRL(*this, "IDC_CHOICE_KNN_SYMMETRIC", wxChoice);
     
     m_btn_ok = XRCCTRL(*this, "wxID_OK", wxButton);
 
@@ -362,6 +410,7 @@ void CreatingWeightDlg::OnDistanceWeightsInputUpdate( wxBookCtrlEvent& event )
             m_bandwidth_thres_val_multivars = (m_bandwidth_slider->GetValue() * thres_range/100.0) + m_thres_min_multivars;
             m_manu_bandwidth->ChangeValue( wxString::Format("%f", m_bandwidth_thres_val_multivars) );
         }
+        ShowThresholdNbrStats(-1);
     }
 }
 
@@ -535,9 +584,10 @@ void CreatingWeightDlg::UpdateThresholdValues()
         }
     }
 	
+	double mean_1nn = 0;
 	m_thres_min = SpatialIndAlgs::find_max_1nn_dist(m_XCOO, m_YCOO,
                                                     m_is_arc,
-                                                    !m_arc_in_km);
+                                                    !m_arc_in_km, &mean_1nn);
 	{
 		using namespace PointSetAlgs;
 		using namespace GenGeomAlgs;
@@ -558,6 +608,88 @@ void CreatingWeightDlg::UpdateThresholdValues()
     m_bandwidth_thres_val = (m_bandwidth_slider->GetValue() * (m_thres_max-m_thres_min)/100.0) + m_thres_min;
     m_bandwidth_thres_val_valid = true;
     m_manu_bandwidth->ChangeValue( wxString::Format("%f", m_bandwidth_thres_val) );
+
+    UpdateSliderNbrStats(mean_1nn);
+    ShowThresholdNbrStats(m_sliderdistance->GetValue());
+}
+
+double CreatingWeightDlg::ToGridDist(double t)
+{
+    // arc distances are searched as chords of the unit sphere
+    if (!m_is_arc) return t;
+    using namespace GenGeomAlgs;
+    return RadToUnitDist(m_arc_in_km ? EarthKmToRad(t) : EarthMiToRad(t));
+}
+
+// Count the neighbors of all 101 slider positions in one pass over a grid
+// of the points, so moving the slider only looks the counts up.  The search
+// radius stops where evenly spread points would have about 100 neighbors on
+// average (the mean 1nn distance of n points on an area A is about
+// sqrt(A/n)/2), so a wide threshold range doesn't turn into all pairs.
+void CreatingWeightDlg::UpdateSliderNbrStats(double mean_1nn)
+{
+    if (m_thres_grid) {
+        delete m_thres_grid;
+        m_thres_grid = NULL;
+    }
+    m_slider_nbr_stats.clear();
+    size_t n = m_XCOO.size();
+    if (n < 2 || m_YCOO.size() != n) return;
+
+    wxStopWatch sw;
+    double avg_budget = std::min(100.0, 5.0e7 / n);
+    double radius = 2.0 * mean_1nn * sqrt(avg_budget / GenGeomAlgs::pi);
+    radius = std::max(m_thres_min, std::min(radius, m_thres_max));
+    double grid_radius = ToGridDist(radius * m_thres_delta_factor);
+    if (m_is_arc) {
+        std::vector<double> ux(n), uy(n), uz(n);
+        for (size_t i=0; i<n; i++) {
+            GenGeomAlgs::LongLatDegToUnit(m_XCOO[i], m_YCOO[i],
+                                          ux[i], uy[i], uz[i]);
+        }
+        m_thres_grid = new Gda::GridNeighbors(ux, uy, uz, grid_radius);
+    } else {
+        m_thres_grid = new Gda::GridNeighbors(m_XCOO, m_YCOO, grid_radius);
+    }
+
+    // positions past the radius get the counts of the radius
+    std::vector<double> th(101);
+    for (int i=0; i<=100; i++) {
+        double t = (i * (m_thres_max-m_thres_min)/100.0) + m_thres_min;
+        th[i] = std::min(ToGridDist(t * m_thres_delta_factor), grid_radius);
+    }
+    m_thres_grid->CountNeighbors(th, m_slider_nbr_stats);
+    wxLogMessage("Threshold slider neighbor counts up to %f in %ld ms",
+                 radius, sw.Time());
+}
+
+// slider_pos < 0: the threshold was typed in, count it on the grid
+void CreatingWeightDlg::ShowThresholdNbrStats(int slider_pos)
+{
+    if (!m_thres_nbr_stats) return;
+    wxString lbl;
+    if (m_thres_grid && m_thres_val_valid &&
+        m_nb_distance_variables->GetSelection() == 0) {
+        double t = ToGridDist(m_threshold_val * m_thres_delta_factor);
+        bool is_counted = t <= m_thres_grid->GetRadius();
+        Gda::NbrCountStats s;
+        if (!is_counted) {
+            s = m_slider_nbr_stats.back();
+        } else if (slider_pos >= 0) {
+            s = m_slider_nbr_stats[slider_pos];
+        } else {
+            std::vector<double> th(1, t);
+            std::vector<Gda::NbrCountStats> stats;
+            m_thres_grid->CountNeighbors(th, stats);
+            s = stats[0];
+        }
+        if (is_counted) {
+            lbl = wxString::Format(_("Neighbors: avg %.2f, min %d, max %d, %d neighborless"), s.mean_nbrs, s.min_nbrs, s.max_nbrs, s.num_isolates);
+        } else {
+            lbl = wxString::Format(_("Neighbors: more than %.2f on average"), s.mean_nbrs);
+        }
+    }
+    m_thres_nbr_stats->SetLabel(lbl);
 }
 
 void CreatingWeightDlg::OnCThresholdTextEdit( wxCommandEvent& event )
@@ -586,6 +718,7 @@ void CreatingWeightDlg::OnCThresholdTextEdit( wxCommandEvent& event )
                 m_sliderdistance->SetValue((int) s);
             }
         }
+        ShowThresholdNbrStats(-1);
     } else {
         double t = m_threshold_val_multivars;
         m_thres_val_valid = val.ToDouble(&t);
@@ -661,6 +794,7 @@ void CreatingWeightDlg::OnCThresholdSliderUpdated( wxCommandEvent& event )
         if (m_threshold_val > 0)  {
             FindWindow(XRCID("wxID_OK"))->Enable(true);
         }
+        ShowThresholdNbrStats(m_sliderdistance->GetValue());
         wxString str_val;
         str_val << m_threshold_val;
         wxLogMessage(str_val);
@@ -933,6 +1067,7 @@ void CreatingWeightDlg::InitDlg()
     m_spinn_inverse->SetValue(1);
     m_power_knn->SetValue("1");
     m_spinn_inverse_knn->SetValue(1);
+    m_knn_symmetric->SetSelection(0);
 
     m_spinn_kernel->SetRange(1,20);
     int n_kernel_nbrs = ceil(pow(project->GetNumRecords(), 1.0/3.0));
@@ -1504,10 +1639,46 @@ void CreatingWeightDlg::CreateWeights()
         } else {
             wmi.SetToQueen(id, m_ooC, m_check1);
         }
-        if (user_xy) {
-            std::vector<std::set<int> > nbr_map;
-            Gda::VoronoiUtils::PointsToContiguity(m_XCOO, m_YCOO, false, nbr_map);
-            Wp->gal = Gda::VoronoiUtils::NeighborMapToGal(nbr_map);
+        double precision_threshold = 0.0;
+        if ( m_cbx_precision_threshold->IsChecked()) {
+            if (!m_txt_precision_threshold->IsEmpty()) {
+                wxString prec_thres = m_txt_precision_threshold->GetValue();
+                double value;
+                if ( prec_thres.ToDouble(&value) ) {
+                    precision_threshold = value;
+                }
+            } else {
+                precision_threshold = 0.0;
+            }
+        }
+        // the first order contiguity of the layer geometries is cached, the
+        // higher orders are derived from it below
+        WeightsMetaInfo first_wmi;
+        if (is_rook) {
+            first_wmi.SetToRook(wxEmptyString);
+        } else {
+            first_wmi.SetToQueen(wxEmptyString);
+        }
+        wxString cache_key;
+        bool from_cache = false;
+        if (!user_xy) {
+            cache_key = WeightsCache::GeomKey(project, first_wmi,
+                                              precision_threshold);
+            CsrWeight* cw = WeightsCache::GetInstance().Get(cache_key);
+            if (cw) {
+                Wp->gal = cw->ToGal();
+                delete cw;
+                from_cache = true;
+            }
+        }
+        if (from_cache) {
+            // first order contiguity from the weights cache
+        } else if (user_xy) {
+            int tiles = Gda::VoronoiUtils::SuggestTilesPerAxis(m_XCOO.size());
+            CsrWeight* cw = Gda::VoronoiUtils::PointsToContiguityCsr(m_XCOO,
+                                                    m_YCOO, false, tiles);
+            Wp->gal = cw ? cw->ToGal() : 0;
+            delete cw;
             if (!Wp->gal) {
                 wxString msg = _("There was a problem generating voronoi contiguity neighbors. Please report this.");
                 wxMessageDialog dlg(NULL, msg, _("Voronoi Contiguity Error"),
@@ -1520,13 +1691,9 @@ void CreatingWeightDlg::CreateWeights()
                 project->DisplayPointDupsWarning();
             }
             
-            std::vector<std::set<int> > nbr_map;
-            if (is_rook) {
-                project->GetVoronoiRookNeighborMap(nbr_map);
-            } else {
-                project->GetVoronoiQueenNeighborMap(nbr_map);
-            }
-            Wp->gal = Gda::VoronoiUtils::NeighborMapToGal(nbr_map);
+            CsrWeight* cw = project->GetVoronoiNeighborCsr(!is_rook);
+            Wp->gal = cw ? cw->ToGal() : 0;
+            delete cw;
             if (!Wp->gal) {
                 wxString msg = _("There was a problem generating voronoi contiguity neighbors. Please report this.");
                 wxMessageDialog dlg(NULL, msg, _("Voronoi Contiguity Error"),
@@ -1534,20 +1701,8 @@ void CreatingWeightDlg::CreateWeights()
                 dlg.ShowModal();
             }
         } else {
-            double precision_threshold = 0.0;
-            if ( m_cbx_precision_threshold->IsChecked()) {
-                if (!m_txt_precision_threshold->IsEmpty()) {
-                    wxString prec_thres = m_txt_precision_threshold->GetValue();
-                    double value;
-                    if ( prec_thres.ToDouble(&value) ) {
-                        precision_threshold = value;
-                    }
-                } else {
-                    precision_threshold = 0.0;
-                }
-            }
-            Wp->gal = PolysToContigWeights(project->main_data, !is_rook,
-                                           precision_threshold);
+            Wp->gal = CreateContigWeights(project->main_data, !is_rook,
+                                          precision_threshold);
         }
         
         bool empty_w = true;
@@ -1595,6 +1750,11 @@ void CreatingWeightDlg::CreateWeights()
                                 wxOK | wxICON_WARNING);
             dlg.ShowModal();
         }
+        if (!cache_key.IsEmpty() && !from_cache) {
+            CsrWeight first_order(Wp->gal, m_num_obs);
+            WeightsCache::GetInstance().Put(cache_key, first_order, wxEmptyString,
+                                            NULL, true);
+        }
         
         if (m_ooC > 1) {
             Gda::MakeHigherOrdContiguity(m_ooC, m_num_obs, Wp->gal, m_check1);
@@ -1670,6 +1830,11 @@ void CreatingWeightDlg::CreateWeights()
                                            is_mile, is_inverse, power);
             
             if (!Wp->gwt) return;
+            if (m_knn_symmetric->GetSelection() > 0) {
+                SymmetrizeGwt(Wp, m_knn_symmetric->GetSelection() == 1 ?
+                              CsrWeight::sym_union :
+                              CsrWeight::sym_intersection);
+            }
             Wp->id_field = id;
             WriteWeightFile(0, Wp, project->GetProjectTitle(), outputfile,
                             id, wmi);
@@ -1816,6 +1981,12 @@ bool CreatingWeightDlg::WriteWeightFile(GalWeight* Wp_gal, GwtWeight* Wp_gwt,
                 w->gal = tempGal;
                 w->id_field = idd;
                 
+                // known symmetry spares the check of the regressions
+                CsrWeight csr(tempGal, w->num_obs);
+                wmi.sym_type = (csr.CountAsymmetric() == 0 ?
+                                WeightsMetaInfo::SYM_symmetric :
+                                WeightsMetaInfo::SYM_asymmetric);
+                
                 WeightsMetaInfo e(wmi);
                 e.filename = ofn;
                 boost::uuids::uuid uid = w_man_int->RequestWeights(e);
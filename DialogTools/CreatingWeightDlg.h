@@ -35,6 +35,7 @@
 #include "../ShapeOperations/WeightsManStateObserver.h"
 #include "../VarCalc/WeightsMetaInfo.h"
 #include "../Weights/DistUtils.h"
+#include "../Weights/GridNeighbors.h"
 
 class wxSpinButton;
 class FramesManager;
@@ -141,6 +142,7 @@ protected:
     wxNotebook* m_nb_distance_methods;
 	wxTextCtrl* m_threshold;
 	wxSlider* m_sliderdistance;
+    wxStaticText* m_thres_nbr_stats;
     wxCheckBox* m_use_inverse;
     wxTextCtrl* m_power;
     wxSpinButton* m_spinn_inverse;
@@ -149,6 +151,7 @@ protected:
     wxCheckBox* m_use_inverse_knn;
     wxTextCtrl* m_power_knn;
     wxSpinButton* m_spinn_inverse_knn;
+    wxChoice* m_knn_symmetric;
     wxChoice* m_kernel_methods;
     wxTextCtrl* m_kernel_neighbors;
     wxSpinButton* m_spinn_kernel;
@@ -196,6 +199,10 @@ protected:
 	std::vector<double>	m_YCOO;
 	
     Gda::DistUtils* dist_util;
+    // grid of the points for the neighbor counts shown under the threshold
+    // slider, and the counts of the 101 slider positions
+    Gda::GridNeighbors* m_thres_grid;
+    std::vector<Gda::NbrCountStats> m_slider_nbr_stats;
     std::vector<wxString> col_names;
     
 	WeightsMetaInfo::DistanceMetricEnum dist_metric;
@@ -215,6 +222,9 @@ protected:
 	void UpdateCreateButtonState();
 	void UpdateTmSelEnableState();
 	void UpdateThresholdValues();
+    void UpdateSliderNbrStats(double mean_1nn);
+    void ShowThresholdNbrStats(int slider_pos);
+    double ToGridDist(double t);
 	void ResetThresXandYCombo();
 	void InitFields();
 	void InitDlg();
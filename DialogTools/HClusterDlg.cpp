@@ -612,12 +612,8 @@ void HClusterDlg::SpatialConstraintClustering()
             return;
         }
 
-        double** ragged_distances = distancematrix(rows, columns, input_data,  mask, weight, dist, transpose);
-        double** distances = DataUtils::fullRaggedMatrix(ragged_distances, rows, rows);
-        for (int i = 1; i < rows; i++) free(ragged_distances[i]);
-        free(ragged_distances);
         std::vector<bool> undefs(rows, false);
-        SpanningTreeClustering::AbstractClusterFactory* redcap = new SpanningTreeClustering::FirstOrderSLKRedCap(rows, columns, distances, input_data, undefs, gw->gal, NULL, 0);
+        SpanningTreeClustering::AbstractClusterFactory* redcap = new SpanningTreeClustering::FirstOrderSLKRedCap(rows, columns, input_data, mask, weight, dist, undefs, gw->gal, NULL, 0);
         for (int i=0; i<redcap->ordered_edges.size(); i++) {
             Z2[i]->node1 = redcap->ordered_edges[i]->orig->id;
             Z2[i]->node2 = redcap->ordered_edges[i]->dest->id;
@@ -476,28 +476,18 @@ bool HDBScanDlg::Run(vector<wxInt64>& clusters)
     core_dist = Gda::HDBScan::ComputeCoreDistance(
                                     data, rows, columns, m_min_samples, dist);
 
-    for (int i=0; i<rows; i++) delete[] data[i];
-    delete[] data;
-
-    double** dist_matrix = NULL;
-    if (dist == 'e') {
-        dist_matrix = DataUtils::ComputeFullDistMatrix(input_data, weight, rows,
-                                         columns, DataUtils::EuclideanDistance);
-    } else {
-        dist_matrix = DataUtils::ComputeFullDistMatrix(input_data, weight, rows,
-                                         columns,DataUtils::ManhattanDistance);
-    }
-    
+    // the spanning tree uses the same weighted data and distance as the
+    // core distances
     Gda::HDBScan hdb(m_min_pts, m_min_samples, m_alpha,
                                  m_cluster_selection_method,
                                  m_allow_single_cluster, rows, columns,
-                                 dist_matrix, core_dist, undefs);
+                                 data, dist, core_dist, undefs);
     cluster_ids = hdb.GetRegions();
     probabilities = hdb.probabilities;
     outliers = hdb.outliers;
 
-    for (int i=0; i<rows; i++) delete[] dist_matrix[i];
-    delete[] dist_matrix;
+    for (int i=0; i<rows; i++) delete[] data[i];
+    delete[] data;
 
     int ncluster = cluster_ids.size();
 
@@ -35,6 +35,8 @@
 #include <wx/panel.h>
 #include <wx/checkbox.h>
 #include <wx/choice.h>
+#include <wx/progdlg.h>
+#include <boost/bind.hpp>
 
 #include "../VarCalc/WeightsManInterface.h"
 #include "../ShapeOperations/OGRDataAdapter.h"
@@ -54,7 +56,7 @@ EVT_CLOSE( MaxpDlg::OnClose )
 END_EVENT_TABLE()
 
 MaxpDlg::MaxpDlg(wxFrame* parent_s, Project* project_s)
-: AbstractClusterDlg(parent_s, project_s, _("Max-p Settings"))
+: AbstractClusterDlg(parent_s, project_s, _("Max-p Settings")), progress_dlg(NULL)
 {
     wxLogMessage("Open Max-p dialog.");
     CreateControls();
@@ -79,7 +81,7 @@ void MaxpDlg::CreateControls()
     AddSimpleInputCtrls(panel, vbox);
     
     // Parameters
-    wxFlexGridSizer* gbox = new wxFlexGridSizer(9,2,5,0);
+    wxFlexGridSizer* gbox = new wxFlexGridSizer(11,2,5,0);
 
 	// Weights Control
     wxStaticText* st16 = new wxStaticText(panel, wxID_ANY, _("Weights:"));
@@ -115,6 +117,19 @@ void MaxpDlg::CreateControls()
     gbox->Add(st11, 0, wxALIGN_CENTER_VERTICAL | wxRIGHT | wxLEFT, 10);
     gbox->Add(m_iterations, 1, wxEXPAND);
     
+    wxStaticText* st12 = new wxStaticText(panel, wxID_ANY, _("Time Limit (sec):"));
+    m_timelimit = new wxTextCtrl(panel, wxID_ANY, "", wxDefaultPosition, wxSize(200,-1));
+    m_timelimit->SetValidator(wxTextValidator(wxFILTER_NUMERIC));
+    m_timelimit->SetToolTip(_("Stop the search after this many seconds and keep the best solution so far. Leave empty for no limit."));
+    gbox->Add(st12, 0, wxALIGN_CENTER_VERTICAL | wxRIGHT | wxLEFT, 10);
+    gbox->Add(m_timelimit, 1, wxEXPAND);
+    
+    wxStaticText* st20 = new wxStaticText(panel, wxID_ANY, _("Skip Hopeless Starts:"));
+    chk_prune = new wxCheckBox(panel, wxID_ANY, "");
+    chk_prune->SetToolTip(_("Skip the local search of initial solutions that are unlikely to beat the best one so far. Faster, but it can miss the best solution."));
+    gbox->Add(st20, 0, wxALIGN_CENTER_VERTICAL | wxRIGHT | wxLEFT, 10);
+    gbox->Add(chk_prune, 1, wxEXPAND);
+    
 	wxStaticText* st19 = new wxStaticText(panel, wxID_ANY, _("Local Search:"));
     wxString choices19[] = {"Greedy", "Tabu Search", "Simulated Annealing"};
     m_localsearch = new wxChoice(panel, wxID_ANY, wxDefaultPosition, wxSize(200,-1), 3, choices19);
@@ -239,6 +254,16 @@ void MaxpDlg::CreateControls()
 
 }
 
+bool MaxpDlg::OnMaxpProgress(const vector<vector<int> >& regions, double wss, int starts_done, int starts_total)
+{
+    if (progress_dlg == NULL) return true;
+    // no solution yet while the first batch runs, keep the message
+    if (regions.empty()) return progress_dlg->Update(starts_done);
+    wxString msg = wxString::Format(_("Best solution after %d of %d iterations:\n%d regions, within sum of squares %f"), starts_done, starts_total, (int)regions.size(), wss);
+    // abort keeps the best solution so far
+    return progress_dlg->Update(starts_done, msg);
+}
+
 void MaxpDlg::OnLocalSearch(wxCommandEvent& event)
 {
     wxLogMessage("On MaxpDlg::OnLocalSearch");
@@ -411,6 +436,14 @@ wxString MaxpDlg::_printConfiguration()
     }
     
     txt << _("# iterations:\t") << m_iterations->GetValue() << "\n";
+    
+    if (!m_timelimit->GetValue().IsEmpty()) {
+        txt << _("Time limit (sec):\t") << m_timelimit->GetValue() << "\n";
+    }
+    
+    if (chk_prune->GetValue()) {
+        txt << _("Skip hopeless starts:\t") << _("Yes") << "\n";
+    }
    
     int local_search_method = m_localsearch->GetSelection();
     if (local_search_method == 0) {
@@ -534,6 +567,17 @@ void MaxpDlg::OnOK(wxCommandEvent& event )
         initial = value_initial;
     }
     
+    double time_limit = 0;
+    wxString str_timelimit = m_timelimit->GetValue();
+    if (!str_timelimit.IsEmpty()) {
+        if (!str_timelimit.ToDouble(&time_limit) || time_limit <= 0) {
+            wxString err_msg = _("Time limit has to be a positive number of seconds, or empty for no limit.");
+            wxMessageDialog dlg(NULL, err_msg, _("Error"), wxOK | wxICON_ERROR);
+            dlg.ShowModal();
+            return;
+        }
+    }
+    
 	// Get initial seed e.g LISA clusters
     vector<wxInt64> seeds;
     bool use_lisa_seed = chk_lisa->GetValue();
@@ -600,7 +644,12 @@ void MaxpDlg::OnOK(wxCommandEvent& event )
 		}
 		z.push_back(vals);
 	}
-    Maxp maxp(gw->gal, z, min_bound, bound_vals, initial, seeds, local_search_method, tabu_length, cool_rate, rnd_seed, dist);
+    wxProgressDialog prog_dlg(_("Max-p"), _("Searching..."), initial, this,
+                              wxPD_APP_MODAL | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME);
+    progress_dlg = &prog_dlg;
+    Maxp maxp(gw->gal, z, min_bound, bound_vals, initial, seeds, local_search_method, tabu_length, cool_rate, rnd_seed, dist, false, time_limit, boost::bind(&MaxpDlg::OnMaxpProgress, this, _1, _2, _3, _4), chk_prune->GetValue());
+    progress_dlg = NULL;
+    prog_dlg.Hide();
     
 	delete[] bound_vals;
 
@@ -31,6 +31,7 @@
 #include "AbstractClusterDlg.h"
 
 class Project;
+class wxProgressDialog;
 class TableInterface;
 	
 class MaxpDlg : public AbstractClusterDlg
@@ -50,6 +51,9 @@ public:
     void OnLISACheck(wxCommandEvent& event);
     virtual void OnCheckMinBound(wxCommandEvent& event);
     
+    // progress of the max-p search, false if the user stopped it
+    bool OnMaxpProgress(const vector<vector<int> >& regions, double wss, int starts_done, int starts_total);
+    
     virtual void InitLISACombobox();
     
     virtual wxString _printConfiguration();
@@ -57,6 +61,7 @@ public:
 private:
     wxCheckBox* chk_seed;
     wxCheckBox* chk_lisa;
+    wxCheckBox* chk_prune;
     
     wxChoice* combo_weights;
     wxChoice* combo_lisa;
@@ -65,12 +70,14 @@ private:
     wxChoice* m_distance;
     wxTextCtrl* m_textbox;
     wxTextCtrl* m_iterations;
+    wxTextCtrl* m_timelimit;
     
     wxStaticText* st_minregions;
     wxTextCtrl* txt_minregions;
     wxTextCtrl* m_tabulength;
     wxTextCtrl* m_coolrate;
     wxButton* seedButton;
+    wxProgressDialog* progress_dlg;
     
     wxString select_floor;
     wxString select_lisa;
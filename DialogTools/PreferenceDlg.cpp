@@ -342,6 +342,41 @@ void PreferenceDlg::Init()
     grid_sizer1->Add(cbox_gpu, 0, wxALIGN_RIGHT);
     cbox_gpu->Bind(wxEVT_CHECKBOX, &PreferenceDlg::OnUseGPU, this);
     
+    wxString lbl21 = _("Reuse one permutation table for local statistics:");
+    wxStaticText* lbl_txt21 = new wxStaticText(vis_page, wxID_ANY, lbl21);
+    cbox_perm_table = new wxCheckBox(vis_page, XRCID("PREF_USE_PERM_TABLE"), "", pos);
+    grid_sizer1->Add(lbl_txt21, 1, wxEXPAND);
+    grid_sizer1->Add(cbox_perm_table, 0, wxALIGN_RIGHT);
+    cbox_perm_table->Bind(wxEVT_CHECKBOX, &PreferenceDlg::OnUsePermTable, this);
+    
+    wxString lbl114 = _("Stop permutations early for clearly non-significant observations:");
+    wxStaticText* lbl_txt114 = new wxStaticText(vis_page, wxID_ANY, lbl114);
+    cbox_perm_early_stop = new wxCheckBox(vis_page, XRCID("PREF_PERM_EARLY_STOP"), "", pos);
+    grid_sizer1->Add(lbl_txt114, 1, wxEXPAND);
+    grid_sizer1->Add(cbox_perm_early_stop, 0, wxALIGN_RIGHT);
+    cbox_perm_early_stop->Bind(wxEVT_CHECKBOX, &PreferenceDlg::OnPermEarlyStop, this);
+    
+    wxString lbl115 = _("Use batch CPU kernel for LISA and local join count:");
+    wxStaticText* lbl_txt115 = new wxStaticText(vis_page, wxID_ANY, lbl115);
+    cbox_cpu_kernel = new wxCheckBox(vis_page, XRCID("PREF_USE_CPU_KERNEL"), "", pos);
+    grid_sizer1->Add(lbl_txt115, 1, wxEXPAND);
+    grid_sizer1->Add(cbox_cpu_kernel, 0, wxALIGN_RIGHT);
+    cbox_cpu_kernel->Bind(wxEVT_CHECKBOX, &PreferenceDlg::OnUseCPUKernel, this);
+    
+    wxString lbl116 = _("Use bit-packed engine for local join count:");
+    wxStaticText* lbl_txt116 = new wxStaticText(vis_page, wxID_ANY, lbl116);
+    cbox_bitset_jc = new wxCheckBox(vis_page, XRCID("PREF_USE_BITSET_JC"), "", pos);
+    grid_sizer1->Add(lbl_txt116, 1, wxEXPAND);
+    grid_sizer1->Add(cbox_bitset_jc, 0, wxALIGN_RIGHT);
+    cbox_bitset_jc->Bind(wxEVT_CHECKBOX, &PreferenceDlg::OnUseBitsetJC, this);
+    
+    wxString lbl117 = _("Build contiguity weights from hashed vertices/edges:");
+    wxStaticText* lbl_txt117 = new wxStaticText(vis_page, wxID_ANY, lbl117);
+    cbox_hash_contig = new wxCheckBox(vis_page, XRCID("PREF_USE_HASH_CONTIG"), "", pos);
+    grid_sizer1->Add(lbl_txt117, 1, wxEXPAND);
+    grid_sizer1->Add(cbox_hash_contig, 0, wxALIGN_RIGHT);
+    cbox_hash_contig->Bind(wxEVT_CHECKBOX, &PreferenceDlg::OnUseHashContiguity, this);
+    
     //lbl_txt20->Hide();
     //cbox_gpu->Hide();
     
@@ -385,6 +420,14 @@ void PreferenceDlg::Init()
 	grid_sizer2->Add(lbl_txt23, 1, wxEXPAND);
 	grid_sizer2->Add(txt23, 0, wxALIGN_RIGHT);
 	txt23->Bind(wxEVT_TEXT, &PreferenceDlg::OnTimeoutInput, this);
+
+    wxString lbl28 = _("Size of the weights cache (MB, 0 to disable):");
+    wxStaticText* lbl_txt28 = new wxStaticText(gdal_page, wxID_ANY, lbl28);
+    txt_weights_cache = new wxTextCtrl(gdal_page, XRCID("ID_WEIGHTS_CACHE_MB"),
+                                       "", pos, txt_sz, txt_num_style);
+    grid_sizer2->Add(lbl_txt28, 1, wxEXPAND);
+    grid_sizer2->Add(txt_weights_cache, 0, wxALIGN_RIGHT);
+    txt_weights_cache->Bind(wxEVT_TEXT, &PreferenceDlg::OnWeightsCacheInput, this);
    
 	wxString lbl24 = _("Date/Time formats (using comma to separate formats):");
 	wxStaticText* lbl_txt24 = new wxStaticText(gdal_page, wxID_ANY, lbl24);
@@ -457,6 +500,11 @@ void PreferenceDlg::OnReset(wxCommandEvent& ev)
 {
     GdaConst::gda_create_csvt = false;
     GdaConst::gda_use_gpu = false;
+    GdaConst::gda_use_perm_table = false;
+    GdaConst::gda_perm_early_stop = false;
+    GdaConst::gda_use_cpu_kernel = false;
+    GdaConst::gda_use_bitset_jc = false;
+    GdaConst::gda_use_hash_contiguity = false;
     GdaConst::gda_ui_language = 0;
     GdaConst::gda_eigen_tol = 1.0E-8;
 	GdaConst::gda_set_cpu_cores = true;
@@ -477,6 +525,7 @@ void PreferenceDlg::OnReset(wxCommandEvent& ev)
 	GdaConst::show_csv_configure_in_merge = true;
 	GdaConst::enable_high_dpi_support = true;
     GdaConst::gdal_http_timeout = 5;
+    GdaConst::gda_weights_cache_mb = 512;
     GdaConst::use_gda_user_seed= true;
     GdaConst::gda_user_seed = 123456789;
     GdaConst::default_display_decimals = 6;
@@ -511,6 +560,7 @@ void PreferenceDlg::OnReset(wxCommandEvent& ev)
 	ogr_adapt.AddEntry("show_csv_configure_in_merge", "1");
 	ogr_adapt.AddEntry("enable_high_dpi_support", "1");
 	ogr_adapt.AddEntry("gdal_http_timeout", "5");
+	ogr_adapt.AddEntry("gda_weights_cache_mb", "512");
 	ogr_adapt.AddEntry("use_gda_user_seed", "1");
 	ogr_adapt.AddEntry("gda_user_seed", "123456789");
 	ogr_adapt.AddEntry("gda_datetime_formats_str", "%Y-%m-%d %H:%M:%S,%Y/%m/%d %H:%M:%S,%d.%m.%Y %H:%M:%S,%m/%d/%Y %H:%M:%S,%Y-%m-%d,%m/%d/%Y,%Y/%m/%d,%H:%M:%S,%H:%M,%Y/%m/%d %H:%M %p");
@@ -519,6 +569,11 @@ void PreferenceDlg::OnReset(wxCommandEvent& ev)
 	ogr_adapt.AddEntry("gda_eigen_tol", "1.0E-8");
     ogr_adapt.AddEntry("gda_ui_language", "0");
     ogr_adapt.AddEntry("gda_use_gpu", "0");
+    ogr_adapt.AddEntry("gda_use_perm_table", "0");
+    ogr_adapt.AddEntry("gda_perm_early_stop", "0");
+    ogr_adapt.AddEntry("gda_use_cpu_kernel", "0");
+    ogr_adapt.AddEntry("gda_use_bitset_jc", "0");
+    ogr_adapt.AddEntry("gda_use_hash_contiguity", "0");
     ogr_adapt.AddEntry("gda_displayed_decimals", "6");
     ogr_adapt.AddEntry("gda_enable_set_transparency_windows", "0");
     ogr_adapt.AddEntry("gda_create_csvt", "0");
@@ -553,6 +608,7 @@ void PreferenceDlg::SetupControls()
 	cbox10->SetValue(GdaConst::enable_high_dpi_support);
     
     txt23->SetValue(wxString::Format("%d", GdaConst::gdal_http_timeout));
+    txt_weights_cache->SetValue(wxString::Format("%d", GdaConst::gda_weights_cache_mb));
     txt24->SetValue(GdaConst::gda_datetime_formats_str);
     txt25->SetValue(wxString::Format("%d", GdaConst::default_display_decimals));
 
@@ -573,6 +629,11 @@ void PreferenceDlg::SetupControls()
     cmb113->SetSelection(GdaConst::gda_ui_language);
     
     cbox_gpu->SetValue(GdaConst::gda_use_gpu);
+    cbox_perm_table->SetValue(GdaConst::gda_use_perm_table);
+    cbox_perm_early_stop->SetValue(GdaConst::gda_perm_early_stop);
+    cbox_cpu_kernel->SetValue(GdaConst::gda_use_cpu_kernel);
+    cbox_bitset_jc->SetValue(GdaConst::gda_use_bitset_jc);
+    cbox_hash_contig->SetValue(GdaConst::gda_use_hash_contiguity);
     cbox26->SetValue(GdaConst::gda_enable_set_transparency_windows);
 
     cbox_csvt->SetValue(GdaConst::gda_create_csvt);
@@ -734,6 +795,14 @@ void PreferenceDlg::ReadFromCache()
             GdaConst::gdal_http_timeout = sel_l;
 		}
 	}
+    vector<wxString> gda_weights_cache_mb = ogr_adapt.GetHistory("gda_weights_cache_mb");
+    if (!gda_weights_cache_mb.empty()) {
+        long sel_l = 0;
+        wxString sel = gda_weights_cache_mb[0];
+        if (sel.ToLong(&sel_l) && sel_l >= 0) {
+            GdaConst::gda_weights_cache_mb = sel_l;
+        }
+    }
     
     vector<wxString> gda_datetime_formats_str = ogr_adapt.GetHistory("gda_datetime_formats_str");
     if (!gda_datetime_formats_str.empty()) {
@@ -818,6 +887,66 @@ void PreferenceDlg::ReadFromCache()
             GdaConst::gda_use_gpu = false;
         }
     }
+    
+    vector<wxString> gda_use_perm_table = ogr_adapt.GetHistory("gda_use_perm_table");
+    if (!gda_use_perm_table.empty()) {
+        long sel_l = 0;
+        wxString sel = gda_use_perm_table[0];
+        if (sel.ToLong(&sel_l)) {
+            if (sel_l == 1)
+                GdaConst::gda_use_perm_table = true;
+            else if (sel_l == 0)
+                GdaConst::gda_use_perm_table = false;
+        }
+    }
+    
+    vector<wxString> gda_perm_early_stop = ogr_adapt.GetHistory("gda_perm_early_stop");
+    if (!gda_perm_early_stop.empty()) {
+        long sel_l = 0;
+        wxString sel = gda_perm_early_stop[0];
+        if (sel.ToLong(&sel_l)) {
+            if (sel_l == 1)
+                GdaConst::gda_perm_early_stop = true;
+            else if (sel_l == 0)
+                GdaConst::gda_perm_early_stop = false;
+        }
+    }
+    
+    vector<wxString> gda_use_cpu_kernel = ogr_adapt.GetHistory("gda_use_cpu_kernel");
+    if (!gda_use_cpu_kernel.empty()) {
+        long sel_l = 0;
+        wxString sel = gda_use_cpu_kernel[0];
+        if (sel.ToLong(&sel_l)) {
+            if (sel_l == 1)
+                GdaConst::gda_use_cpu_kernel = true;
+            else if (sel_l == 0)
+                GdaConst::gda_use_cpu_kernel = false;
+        }
+    }
+    
+    vector<wxString> gda_use_bitset_jc = ogr_adapt.GetHistory("gda_use_bitset_jc");
+    if (!gda_use_bitset_jc.empty()) {
+        long sel_l = 0;
+        wxString sel = gda_use_bitset_jc[0];
+        if (sel.ToLong(&sel_l)) {
+            if (sel_l == 1)
+                GdaConst::gda_use_bitset_jc = true;
+            else if (sel_l == 0)
+                GdaConst::gda_use_bitset_jc = false;
+        }
+    }
+    
+    vector<wxString> gda_use_hash_contiguity = ogr_adapt.GetHistory("gda_use_hash_contiguity");
+    if (!gda_use_hash_contiguity.empty()) {
+        long sel_l = 0;
+        wxString sel = gda_use_hash_contiguity[0];
+        if (sel.ToLong(&sel_l)) {
+            if (sel_l == 1)
+                GdaConst::gda_use_hash_contiguity = true;
+            else if (sel_l == 0)
+                GdaConst::gda_use_hash_contiguity = false;
+        }
+    }
 
     vector<wxString> gda_create_csvt = ogr_adapt.GetHistory("gda_create_csvt");
     if (!gda_create_csvt.empty()) {
@@ -927,6 +1056,18 @@ void PreferenceDlg::OnTimeoutInput(wxCommandEvent& ev)
     }
 }
 
+void PreferenceDlg::OnWeightsCacheInput(wxCommandEvent& ev)
+{
+    wxString mb_str = txt_weights_cache->GetValue();
+    long mb;
+    if (mb_str.ToLong(&mb)) {
+        if (mb >= 0) {
+            GdaConst::gda_weights_cache_mb = mb;
+            OGRDataAdapter::GetInstance().AddEntry("gda_weights_cache_mb", mb_str);
+        }
+    }
+}
+
 void PreferenceDlg::OnSlider1(wxCommandEvent& ev)
 {
 	int val = slider1->GetValue();
@@ -1197,6 +1338,66 @@ void PreferenceDlg::OnUseGPU(wxCommandEvent& ev)
         OGRDataAdapter::GetInstance().AddEntry("gda_use_gpu", "1");
     }
 }
+void PreferenceDlg::OnUsePermTable(wxCommandEvent& ev)
+{
+    int sel = ev.GetSelection();
+    if (sel == 0) {
+        GdaConst::gda_use_perm_table = false;
+        OGRDataAdapter::GetInstance().AddEntry("gda_use_perm_table", "0");
+    }
+    else {
+        GdaConst::gda_use_perm_table = true;
+        OGRDataAdapter::GetInstance().AddEntry("gda_use_perm_table", "1");
+    }
+}
+void PreferenceDlg::OnPermEarlyStop(wxCommandEvent& ev)
+{
+    int sel = ev.GetSelection();
+    if (sel == 0) {
+        GdaConst::gda_perm_early_stop = false;
+        OGRDataAdapter::GetInstance().AddEntry("gda_perm_early_stop", "0");
+    }
+    else {
+        GdaConst::gda_perm_early_stop = true;
+        OGRDataAdapter::GetInstance().AddEntry("gda_perm_early_stop", "1");
+    }
+}
+void PreferenceDlg::OnUseCPUKernel(wxCommandEvent& ev)
+{
+    int sel = ev.GetSelection();
+    if (sel == 0) {
+        GdaConst::gda_use_cpu_kernel = false;
+        OGRDataAdapter::GetInstance().AddEntry("gda_use_cpu_kernel", "0");
+    }
+    else {
+        GdaConst::gda_use_cpu_kernel = true;
+        OGRDataAdapter::GetInstance().AddEntry("gda_use_cpu_kernel", "1");
+    }
+}
+void PreferenceDlg::OnUseBitsetJC(wxCommandEvent& ev)
+{
+    int sel = ev.GetSelection();
+    if (sel == 0) {
+        GdaConst::gda_use_bitset_jc = false;
+        OGRDataAdapter::GetInstance().AddEntry("gda_use_bitset_jc", "0");
+    }
+    else {
+        GdaConst::gda_use_bitset_jc = true;
+        OGRDataAdapter::GetInstance().AddEntry("gda_use_bitset_jc", "1");
+    }
+}
+void PreferenceDlg::OnUseHashContiguity(wxCommandEvent& ev)
+{
+    int sel = ev.GetSelection();
+    if (sel == 0) {
+        GdaConst::gda_use_hash_contiguity = false;
+        OGRDataAdapter::GetInstance().AddEntry("gda_use_hash_contiguity", "0");
+    }
+    else {
+        GdaConst::gda_use_hash_contiguity = true;
+        OGRDataAdapter::GetInstance().AddEntry("gda_use_hash_contiguity", "1");
+    }
+}
 void PreferenceDlg::OnCreateCSVT(wxCommandEvent& ev)
 {
     int sel = ev.GetSelection();
@@ -102,6 +102,8 @@ protected:
     wxTextCtrl* txt24;
     // displayed decimals
     wxTextCtrl* txt25;
+    // weights cache size
+    wxTextCtrl* txt_weights_cache;
     // cpu cores
     wxCheckBox* cbox18;
     wxTextCtrl* txt_cores;
@@ -111,6 +113,16 @@ protected:
     wxComboBox* cmb113;
     // gpu
     wxCheckBox* cbox_gpu;
+    // shared permutation table
+    wxCheckBox* cbox_perm_table;
+    // sequential early stopping of permutations
+    wxCheckBox* cbox_perm_early_stop;
+    // batch cpu kernel
+    wxCheckBox* cbox_cpu_kernel;
+    // bit-packed local join count
+    wxCheckBox* cbox_bitset_jc;
+    // hashed contiguity weights builder
+    wxCheckBox* cbox_hash_contig;
     // transp
     wxCheckBox* cbox26;
     // csvt
@@ -136,6 +148,7 @@ protected:
     void OnHideTablePostGIS(wxCommandEvent& ev);
     void OnHideTableSQLITE(wxCommandEvent& ev);
     void OnTimeoutInput(wxCommandEvent& ev);
+    void OnWeightsCacheInput(wxCommandEvent& ev);
     void OnDateTimeInput(wxCommandEvent& ev);
     void OnDisplayDecimal(wxCommandEvent& ev);
     void OnUseSpecifiedSeed(wxCommandEvent& ev);
@@ -146,6 +159,11 @@ protected:
    
     void OnPowerEpsEnter(wxCommandEvent& ev);
     void OnUseGPU(wxCommandEvent& ev);
+    void OnUsePermTable(wxCommandEvent& ev);
+    void OnPermEarlyStop(wxCommandEvent& ev);
+    void OnUseCPUKernel(wxCommandEvent& ev);
+    void OnUseBitsetJC(wxCommandEvent& ev);
+    void OnUseHashContiguity(wxCommandEvent& ev);
     void OnCreateCSVT(wxCommandEvent& ev);
     void OnEnableTransparencyWin(wxCommandEvent& ev);
     
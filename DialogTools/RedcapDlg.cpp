@@ -550,12 +550,6 @@ void RedcapDlg::OnOK(wxCommandEvent& event )
     int rnd_seed = -1;
     if (chk_seed->GetValue()) rnd_seed = GdaConst::gda_user_seed;
  
-    int transpose = 0; // row wise
-    double** ragged_distances = distancematrix(rows, columns, input_data,  mask, weight, dist, transpose);
-    double** distances = DataUtils::fullRaggedMatrix(ragged_distances, rows, rows);
-    for (int i = 1; i < rows; i++) free(ragged_distances[i]);
-    free(ragged_distances);
-    
     // run RedCap
     std::vector<bool> undefs(rows, false);
   
@@ -566,13 +560,13 @@ void RedcapDlg::OnOK(wxCommandEvent& event )
                                
     int method_idx = combo_method->GetSelection();
     if (method_idx == 0) {
-        redcap = new FirstOrderSLKRedCap(rows, columns, distances, input_data, undefs, gw->gal, bound_vals, min_bound);
+        redcap = new FirstOrderSLKRedCap(rows, columns, input_data, mask, weight, dist, undefs, gw->gal, bound_vals, min_bound);
     } else if (method_idx == 1) {
-        redcap = new FullOrderCLKRedCap(rows, columns, distances, input_data, undefs, gw->gal, bound_vals, min_bound);
+        redcap = new FullOrderCLKRedCap(rows, columns, input_data, mask, weight, dist, undefs, gw->gal, bound_vals, min_bound);
     } else if (method_idx == 2) {
-        redcap = new FullOrderALKRedCap(rows, columns, distances, input_data, undefs, gw->gal, bound_vals, min_bound);
+        redcap = new FullOrderALKRedCap(rows, columns, input_data, mask, weight, dist, undefs, gw->gal, bound_vals, min_bound);
     } else if (method_idx == 3) {
-        redcap = new FullOrderSLKRedCap(rows, columns, distances, input_data, undefs, gw->gal, bound_vals, min_bound);
+        redcap = new FullOrderSLKRedCap(rows, columns, input_data, mask, weight, dist, undefs, gw->gal, bound_vals, min_bound);
     }
 
    
@@ -645,9 +639,6 @@ void RedcapDlg::OnOK(wxCommandEvent& event )
     }
     
     // free memory
-    for (int i = 1; i < rows; i++) free(distances[i]);
-    free(distances);
-    
 	delete[] bound_vals;
 	bound_vals = NULL;
     
@@ -37,6 +37,7 @@
 #include "SaveToTableDlg.h"
 #include "../DataViewer/TableInterface.h"
 #include "../DataViewer/TableState.h"
+#include "../ShapeOperations/CsrWeight.h"
 #include "../ShapeOperations/WeightsManager.h"
 #include "../ShapeOperations/WeightsManState.h"
 #include "../ShapeOperations/GeodaWeight.h"
@@ -633,21 +634,8 @@ void RegressionDlg::OnRunClick( wxCommandEvent& event )
 		} else if (RegressModel == 2) {
             wxLogMessage("Spatial Lag model");
 			// Check for Symmetry first
-			WeightsMetaInfo::SymmetryEnum sym = w_man_int->IsSym(id);
-			if (sym == WeightsMetaInfo::SYM_unknown) {
-				ProgressDlg* p_dlg = new ProgressDlg(this, wxID_ANY,
-													 _("Weights Symmetry Check"));
-				p_dlg->Show();
-				p_dlg->StatusUpdate(0, _("Checking Symmetry..."));
-				sym = w_man_int->CheckSym(id, p_dlg);
-				p_dlg->StatusUpdate(1, _("Finished"));
-				p_dlg->Destroy();
-			}
-			if (sym != WeightsMetaInfo::SYM_symmetric) {
-                wxString s = _("Spatial lag and error regressions require symmetric weights (not KNN). You can still use KNN weights to obtain spatial diagnostics for classic regressions.");
-                wxMessageDialog dlg(NULL, s, _("Error"), wxOK | wxICON_ERROR);
-                dlg.ShowModal();
-                
+			boost::shared_array<GalElement> sym_gal;
+			if (!GetSymmetricWeights(id, valid_obs, gal_weight, sym_gal)) {
 				UpdateMessageBox("");
 				return;
 			}
@@ -672,8 +660,9 @@ void RegressionDlg::OnRunClick( wxCommandEvent& event )
 				UpdateMessageBox("");
 				return;
 			} else {
-				printAndShowLagResults(table_int->GetTableName(),
-									   w_man_int->GetLongDispName(id),
+				wxString w_name = w_man_int->GetLongDispName(id);
+				if (sym_gal) w_name << _(" (symmetrized)");
+				printAndShowLagResults(table_int->GetTableName(), w_name,
 									   &m_DR, n, nX);
 				m_yhat2 = m_DR.GetYHAT();
 				m_resid2= m_DR.GetResidual();
@@ -689,23 +678,11 @@ void RegressionDlg::OnRunClick( wxCommandEvent& event )
 		} else if (RegressModel == 3) {
             wxLogMessage("Spatial Error model");
 			// Check for Symmetry first
-			WeightsMetaInfo::SymmetryEnum sym = w_man_int->IsSym(id);
-			if (sym == WeightsMetaInfo::SYM_unknown) {
-				ProgressDlg* p_dlg = new ProgressDlg(this, wxID_ANY,
-													 _("Weights Symmetry Check"));
-				p_dlg->Show();
-				p_dlg->StatusUpdate(0, _("Checking Symmetry..."));
-				sym = w_man_int->CheckSym(id, p_dlg);
-				p_dlg->StatusUpdate(1, _("Finished"));
-				p_dlg->Destroy();
-			}
-			if (sym != WeightsMetaInfo::SYM_symmetric) {
-                wxString s = _("Spatial lag and error regressions require symmetric weights (not KNN). You can still use KNN weights to obtain spatial diagnostics for classic regressions.");
-                wxMessageDialog dlg(NULL, s, _("Error"), wxOK | wxICON_ERROR);
-                dlg.ShowModal();
+			boost::shared_array<GalElement> sym_gal;
+			if (!GetSymmetricWeights(id, valid_obs, gal_weight, sym_gal)) {
 				UpdateMessageBox("");
 				return;
-			}			
+			}
 			
 			// Error Model
 			DiagnosticReport m_DR(n, nX + 1, m_constant_term, true,
@@ -731,8 +708,9 @@ void RegressionDlg::OnRunClick( wxCommandEvent& event )
 				UpdateMessageBox("");
 				return;
 			} else {
-	  			printAndShowErrorResults(table_int->GetTableName(),
-										 w_man_int->GetLongDispName(id),
+				wxString w_name = w_man_int->GetLongDispName(id);
+				if (sym_gal) w_name << _(" (symmetrized)");
+	  			printAndShowErrorResults(table_int->GetTableName(), w_name,
 										 &m_DR, n, nX);
 				m_yhat3 = m_DR.GetYHAT();
 				m_resid3= m_DR.GetResidual();
@@ -1255,6 +1233,42 @@ boost::uuids::uuid RegressionDlg::GetWeightsId()
 	return w_ids[sel];
 }
 
+/** Spatial lag and error regressions require symmetric weights.  Weights
+ that are not symmetric, like KNN weights, can be symmetrized for this run
+ by the union of W and W'; the symmetrized GAL replaces gal_weight and is
+ owned by sym_gal.  Returns false if the regression can't be run. */
+bool RegressionDlg::GetSymmetricWeights(boost::uuids::uuid id, int num_obs,
+										GalElement*& gal_weight,
+										boost::shared_array<GalElement>& sym_gal)
+{
+	WeightsMetaInfo::SymmetryEnum sym = w_man_int->IsSym(id);
+	if (sym == WeightsMetaInfo::SYM_unknown) {
+		ProgressDlg* p_dlg = new ProgressDlg(this, wxID_ANY,
+											 _("Weights Symmetry Check"));
+		p_dlg->Show();
+		p_dlg->StatusUpdate(0, _("Checking Symmetry..."));
+		sym = w_man_int->CheckSym(id, p_dlg);
+		p_dlg->StatusUpdate(1, _("Finished"));
+		p_dlg->Destroy();
+	}
+	if (sym == WeightsMetaInfo::SYM_symmetric || gal_weight == NULL) {
+		return true;
+	}
+	wxString s = _("Spatial lag and error regressions require symmetric weights, and the selected weights (e.g. KNN) are not symmetric.\n\nRun the regression with the symmetrized weights, in which two observations are neighbors if either one is a neighbor of the other?");
+	wxMessageDialog dlg(NULL, s, _("Asymmetric Weights"),
+						wxYES_NO | wxICON_QUESTION);
+	if (dlg.ShowModal() != wxID_YES) return false;
+
+	CsrWeight csr(gal_weight, num_obs, true);
+	CsrWeight* sym_w = csr.Symmetrize(CsrWeight::sym_union);
+	wxLogMessage("Symmetrized weights: %d to %d neighbor pairs",
+				 (int) csr.GetNumEdges(), (int) sym_w->GetNumEdges());
+	sym_gal.reset(sym_w->ToGal());
+	delete sym_w;
+	gal_weight = sym_gal.get();
+	return true;
+}
+
 void RegressionDlg::OnCWeightCheckClick( wxCommandEvent& event )
 {
     wxLogMessage("Click RegressionDlg::OnCWeightCheckClick");
@@ -21,6 +21,7 @@
 #define __GEODA_CENTER_REGRESSION_DLG_H__
 
 #include <vector>
+#include <boost/shared_array.hpp>
 #include <wx/dialog.h>
 #include <wx/listbox.h>
 #include <wx/checkbox.h>
@@ -36,6 +37,7 @@
 class FramesManager;
 class TableState;
 class DiagnosticReport;
+class GalElement;
 class TableInterface;
 class Project;
 class WeightsManState;
@@ -152,6 +154,9 @@ public:
 	void EnablingItems();
 	void InitWeightsList();
 	boost::uuids::uuid GetWeightsId();
+	bool GetSymmetricWeights(boost::uuids::uuid id, int num_obs,
+							 GalElement*& gal_weight,
+							 boost::shared_array<GalElement>& sym_gal);
 
 	void UpdateMessageBox(wxString msg);
 
@@ -486,7 +486,6 @@ void SkaterDlg::OnOK(wxCommandEvent& event )
     }
     
 	// Get Distance Selection
-    int transpose = 0; // row wise
     char dist = 'e'; // euclidean
     int dist_sel = m_distance->GetSelection();
     char dist_choices[] = {'e','b'};
@@ -553,51 +552,13 @@ void SkaterDlg::OnOK(wxCommandEvent& event )
     int rnd_seed = -1;
     if (chk_seed->GetValue()) rnd_seed = GdaConst::gda_user_seed;
     
-    // Create distance matrix using weights
-    /*
-    double** ragged_distances = distancematrix(rows, columns, input_data,  mask, weight, dist, transpose);
-    double** distances = DataUtils::fullRaggedMatrix(ragged_distances, rows, rows);
-    for (int i = 1; i < rows; i++) free(ragged_distances[i]);
-    free(ragged_distances);
-    */
-    double** distances = new double*[rows];
-    for (int i=0; i<rows; i++) {
-        distances[i] = new double[rows];
-    }
-    boost::unordered_map<pair<int, int>, bool> access_dict;
-    for (int i=0; i<rows; i++) {
-        for (int j=0; j<gw->gal[i].Size(); j++) {
-            int nbr = gw->gal[i][j];
-            pair<int, int> i_nbr(i, nbr);
-            pair<int, int> nbr_i(nbr, i);
-            if (access_dict.find(i_nbr) != access_dict.end() ||
-                access_dict.find(nbr_i) != access_dict.end() )
-            {
-                continue;
-            }
-            {
-                double dis = 0;
-                for (int k=0; k<columns; k++) {
-                    double tmp = input_data[i][k] - input_data[nbr][k];
-                    dis += tmp * tmp;
-                }
-                dis = sqrt(dis);
-                distances[i][nbr] = dis;
-                distances[nbr][i] = dis;
-                access_dict[i_nbr] =  true;
-                access_dict[nbr_i] =  true;
-            }
-        }
-    }
-    
-    
     if (skater != NULL) {
         delete skater;
         skater = NULL;
     }
     
 	// Run Skater
-    skater = new SpanningTreeClustering::Skater(rows, columns, distances, input_data, undefs, gw->gal, bound_vals, min_bound);
+    skater = new SpanningTreeClustering::Skater(rows, columns, input_data, mask, weight, dist, undefs, gw->gal, bound_vals, min_bound);
     
     if (skater==NULL) {
         delete[] bound_vals;
@@ -462,6 +462,8 @@ void VarGroupingEditorDlg::OnSaveSpaceTimeTableClick( wxCommandEvent& event )
                     wx_fn.SetExt("gal");
                 } else if (w->weight_type == GeoDaWeight::gwt_type) {
                     wx_fn.SetExt("gwt");
+                } else if (w->weight_type == GeoDaWeight::csr_type) {
+                    wx_fn.SetExt("gwb");
                 }
                 wxString ofn(wx_fn.GetFullPath());
                 w->SaveSpaceTimeWeights(ofn, wmi, table_int);
@@ -34,6 +34,7 @@
 #include "../Explore/ConnectivityHistView.h"
 #include "../Explore/ConnectivityMapView.h"
 #include "../HighlightState.h"
+#include "../ShapeOperations/CsrWeight.h"
 #include "../ShapeOperations/GeodaWeight.h"
 #include "../ShapeOperations/GwtWeight.h"
 #include "../ShapeOperations/GalWeight.h"
@@ -45,6 +46,7 @@
 #include "../io/arcgis_swm.h"
 #include "../io/matlab_mat.h"
 #include "../io/weights_interface.h"
+#include "../io/weights_binary.h"
 #include "WeightsManDlg.h"
 
 BEGIN_EVENT_TABLE(WeightsManFrame, TemplateFrame)
@@ -93,6 +95,9 @@ create_btn(0), load_btn(0), remove_btn(0), w_list(0)
     union_btn = new wxButton(panel, XRCID("ID_UNION_BTN"),
                             _("Weights Union"), wxDefaultPosition,
                             wxDefaultSize, wxBU_EXACTFIT);
+    save_binary_btn = new wxButton(panel, XRCID("ID_SAVE_BINARY_BTN"),
+                            _("Save as Binary"), wxDefaultPosition,
+                            wxDefaultSize, wxBU_EXACTFIT);
 	Connect(XRCID("ID_CREATE_BTN"), wxEVT_BUTTON,
             wxCommandEventHandler(WeightsManFrame::OnCreateBtn));
 	Connect(XRCID("ID_LOAD_BTN"), wxEVT_BUTTON,
@@ -109,6 +114,8 @@ create_btn(0), load_btn(0), remove_btn(0), w_list(0)
             wxCommandEventHandler(WeightsManFrame::OnIntersectionBtn));
     Connect(XRCID("ID_UNION_BTN"), wxEVT_BUTTON,
             wxCommandEventHandler(WeightsManFrame::OnUnionBtn));
+    Connect(XRCID("ID_SAVE_BINARY_BTN"), wxEVT_BUTTON,
+            wxCommandEventHandler(WeightsManFrame::OnSaveBinaryBtn));
 	w_list = new wxListCtrl(panel, XRCID("ID_W_LIST"), wxDefaultPosition,
             wxSize(-1, 100), wxLC_REPORT);
 	// Note: search for "ungrouped_list" for examples of wxListCtrl usage.
@@ -148,6 +155,8 @@ create_btn(0), load_btn(0), remove_btn(0), w_list(0)
     btns_row3_h_szr->Add(intersection_btn, 0, wxALIGN_CENTER_VERTICAL);
     btns_row3_h_szr->AddSpacer(5);
     btns_row3_h_szr->Add(union_btn, 0, wxALIGN_CENTER_VERTICAL);
+    btns_row3_h_szr->AddSpacer(5);
+    btns_row3_h_szr->Add(save_binary_btn, 0, wxALIGN_CENTER_VERTICAL);
     btns_row3_h_szr->AddSpacer(5);
 
 	wxBoxSizer* wghts_list_h_szr = new wxBoxSizer(wxHORIZONTAL);
@@ -308,8 +317,10 @@ void WeightsManFrame::OnIntersectionBtn(wxCommandEvent& ev)
     std::vector<GeoDaWeight*> ws;
     if (WeightsManFrame::GetSelectWeights(ws)) {
         GalWeight* new_w = WeightUtils::WeightsIntersection(ws);
-        SaveGalWeightsFile(new_w);
-        delete new_w;
+        if (new_w) {
+            SaveGalWeightsFile(new_w);
+            delete new_w;
+        }
     } else {
         wxString msg = _("Selected weights are not valid for intersection, e.g. weights have different ID variable. Please select different weights.");
         wxMessageDialog dlg(NULL, msg, _("Warning"), wxOK | wxICON_INFORMATION);
@@ -323,8 +334,10 @@ void WeightsManFrame::OnUnionBtn(wxCommandEvent& ev)
     std::vector<GeoDaWeight*> ws;
     if (WeightsManFrame::GetSelectWeights(ws)) {
         GalWeight* new_w = WeightUtils::WeightsUnion(ws);
-        SaveGalWeightsFile(new_w);
-        delete new_w;
+        if (new_w) {
+            SaveGalWeightsFile(new_w);
+            delete new_w;
+        }
     } else {
         wxString msg = _("Selected weights are not valid for union, e.g. weights have different ID variable. Please select different weights.");
         wxMessageDialog dlg(NULL, msg, _("Warning"), wxOK | wxICON_INFORMATION);
@@ -332,6 +345,42 @@ void WeightsManFrame::OnUnionBtn(wxCommandEvent& ev)
     }
 }
 
+/** Write the selected weights as a GeoDa binary weights file, which
+ loads by mapping the file instead of parsing text */
+void WeightsManFrame::OnSaveBinaryBtn(wxCommandEvent& ev)
+{
+    wxLogMessage("WeightsManFrame::OnSaveBinaryBtn()");
+    boost::uuids::uuid id = GetHighlightId();
+    if (id.is_nil()) return;
+    
+    wxString wildcard = _("GeoDa binary weights files (*.gwb)|*.gwb");
+    wxFileName t_fn(w_man_int->GetMetaInfo(id).filename);
+    wxString defaultFile(t_fn.GetName());
+    if (defaultFile.IsEmpty()) defaultFile = project_p->GetProjectTitle();
+    defaultFile += ".gwb";
+    wxFileDialog dlg(this,
+                     _("Choose an output weights file name."),
+                     project_p->GetWorkingDir().GetPath(),
+                     defaultFile,
+                     wildcard,
+                     wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+    if (dlg.ShowModal() != wxID_OK)
+        return;
+    wxString outputfile = dlg.GetPath();
+    
+    if (!((WeightsNewManager*) w_man_int)->SaveBinary(id, outputfile)) {
+        wxString msg = _("Failed to create the weights file.");
+        wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
+        dlg.ShowModal();
+    } else {
+        wxFileName t_ofn(outputfile);
+        wxString file_name(t_ofn.GetFullName());
+        wxString msg = wxString::Format(_("Weights file \"%s\" created successfully."), file_name);
+        wxMessageDialog dlg(NULL, msg, _("Success"), wxOK | wxICON_INFORMATION);
+        dlg.ShowModal();
+    }
+}
+
 void WeightsManFrame::OnConnectGraphBtn(wxCommandEvent& ev)
 {
     wxLogMessage("WeightsManFrame::OnConnectGraphBtn()");
@@ -393,14 +442,14 @@ void WeightsManFrame::OnLoadBtn(wxCommandEvent& ev)
     wxFileName default_dir = project_p->GetWorkingDir();
     wxString default_path = default_dir.GetPath();
 	wxFileDialog dlg( this, _("Choose Weights File"), default_path, "",
-                     "Weights Files (*.gal, *.gwt, *.kwt, *.swm, *.mat)|*.gal;*.gwt;*.kwt;*.swm;*.mat");
+                     "Weights Files (*.gal, *.gwt, *.kwt, *.gwb, *.swm, *.mat)|*.gal;*.gwt;*.kwt;*.gwb;*.swm;*.mat");
 	
     if (dlg.ShowModal() != wxID_OK) return;
 	wxString path  = dlg.GetPath();
 	wxString ext = GenUtils::GetFileExt(path).Lower();
 	
-	if (ext != "gal" && ext != "gwt" && ext != "kwt" && ext != "mat" && ext != "swm") {
-		wxString msg = _("Only 'gal', 'gwt', 'kwt', 'mat' and 'swm' weights files supported.");
+	if (ext != "gal" && ext != "gwt" && ext != "kwt" && ext != "gwb" && ext != "mat" && ext != "swm") {
+		wxString msg = _("Only 'gal', 'gwt', 'kwt', 'gwb', 'mat' and 'swm' weights files supported.");
 		wxMessageDialog dlg(this, msg, _("Error"), wxOK|wxICON_ERROR);
 		dlg.ShowModal();
 		return;
@@ -439,6 +488,7 @@ void WeightsManFrame::OnLoadBtn(wxCommandEvent& ev)
 	}
 	
 	GalElement* tempGal = 0;
+	CsrWeight* tempCsr = 0;
     try {
         if (ext == "gal") {
             tempGal = WeightUtils::ReadGal(path, table_int);
@@ -446,6 +496,11 @@ void WeightsManFrame::OnLoadBtn(wxCommandEvent& ev)
             tempGal = ReadSwmAsGal(path, table_int);
         } else if (ext == "mat") {
             tempGal = ReadMatAsGal(path, table_int);
+        } else if (ext == "gwb") {
+            // kept as CSR on the mapped file, the GAL copy is only built
+            // if a view asks for it
+            tempCsr = GdaWeightsBinary::Read(path, table_int);
+            if (tempCsr->is_symmetric) wmi.SetSymmetric(true);
         } else {
             tempGal = WeightUtils::ReadGwtAsGal(path, table_int);
         }
@@ -472,6 +527,11 @@ void WeightsManFrame::OnLoadBtn(wxCommandEvent& ev)
         wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
         dlg.ShowModal();
         tempGal = 0;
+    } catch (WeightsIdsChangedException& e) {
+        wxString msg = _("The values of the id field in the currently loaded Table do not match the ids the weights file was created with.");
+        wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
+        dlg.ShowModal();
+        tempGal = 0;
     } catch (WeightsNotValidException& e) {
         wxString msg = _("Weights file/format is not valid.");
         wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
@@ -479,18 +539,22 @@ void WeightsManFrame::OnLoadBtn(wxCommandEvent& ev)
         tempGal = 0;
     }
     
-	if (tempGal == NULL) {
+	if (tempGal == NULL && tempCsr == NULL) {
 		// WeightsUtils read functions already reported any issues
 		// to user when NULL returned.
 		suspend_w_man_state_updates = false;
 		return;
 	}
    
-    GalWeight* gw = new GalWeight();
-    gw->num_obs = table_int->GetNumberRows();
-    gw->wflnm = wmi.filename;
-    gw->id_field = id_field;
-    gw->gal = tempGal;
+    GeoDaWeight* gw = tempCsr;
+    if (tempGal) {
+        GalWeight* w = new GalWeight();
+        w->num_obs = table_int->GetNumberRows();
+        w->wflnm = wmi.filename;
+        w->id_field = id_field;
+        w->gal = tempGal;
+        gw = w;
+    }
     
     gw->GetNbrStats();
     wmi.num_obs = gw->GetNumObs();
@@ -506,11 +570,14 @@ void WeightsManFrame::OnLoadBtn(wxCommandEvent& ev)
         wxString msg = _("There was a problem requesting the weights file.");
         wxMessageDialog dlg(this, msg, _("Error"), wxOK|wxICON_ERROR);
         dlg.ShowModal();
+        delete gw;
         suspend_w_man_state_updates = false;
         return;
     }
 	
-	if (!((WeightsNewManager*) w_man_int)->AssociateGal(id, gw)) {
+	WeightsNewManager* w_man = (WeightsNewManager*) w_man_int;
+	if (tempCsr ? !w_man->AssociateCsr(id, tempCsr) :
+		!w_man->AssociateGal(id, (GalWeight*) gw)) {
 		wxString msg = _("There was a problem associating the weights file.");
 		wxMessageDialog dlg(this, msg, _("Error"), wxOK|wxICON_ERROR);
 		dlg.ShowModal();
@@ -969,5 +1036,6 @@ void WeightsManFrame::UpdateButtons()
     int sel_w_cnt = w_list->GetSelectedItemCount();
     if (intersection_btn) intersection_btn->Enable(sel_w_cnt >= 2);
     if (union_btn) union_btn->Enable(sel_w_cnt >= 2);
+    if (save_binary_btn) save_binary_btn->Enable(any_sel);
 }
 
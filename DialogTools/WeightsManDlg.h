@@ -70,6 +70,7 @@ public:
     void OnConnectGraphBtn(wxCommandEvent& ev);
     void OnIntersectionBtn(wxCommandEvent& ev);
     void OnUnionBtn(wxCommandEvent& ev);
+    void OnSaveBinaryBtn(wxCommandEvent& ev);
 	
 	/** Implementation of WeightsManStateObserver interface */
 	virtual void update(WeightsManState* o);
@@ -112,6 +113,7 @@ protected:
 	wxListCtrl* w_list;	// ID_W_LIST
     wxButton* intersection_btn;
     wxButton* union_btn;
+    wxButton* save_binary_btn; // ID_SAVE_BINARY_BTN
 	static const long TITLE_COL = 0;
 	wxWebView* details_win;
     
@@ -30,55 +30,19 @@
 #include "../ShapeOperations/Randik.h"
 #include "../ShapeOperations/WeightsManState.h"
 #include "../ShapeOperations/WeightUtils.h"
+#include "../ShapeOperations/CsrWeight.h"
 #include "../VarCalc/WeightsManInterface.h"
 #include "../logger.h"
 #include "../Project.h"
+#include "../GdaThreadPool.h"
 #include "AbstractCoordinator.h"
 
-AbstractWorkerThread::AbstractWorkerThread(int obs_start_s,
-                                           int obs_end_s,
-                                           uint64_t	seed_start_s,
-                                           AbstractCoordinator* a_coord_s,
-                                           wxMutex* worker_list_mutex_s,
-                                           wxCondition* worker_list_empty_cond_s,
-                                           std::list<wxThread*> *worker_list_s,
-                                           int thread_id_s)
-: wxThread(),
-obs_start(obs_start_s),
-obs_end(obs_end_s),
-seed_start(seed_start_s),
-a_coord(a_coord_s),
-worker_list_mutex(worker_list_mutex_s),
-worker_list_empty_cond(worker_list_empty_cond_s),
-worker_list(worker_list_s),
-thread_id(thread_id_s)
-{
-}
-
-AbstractWorkerThread::~AbstractWorkerThread()
-{
-}
-
-wxThread::ExitCode AbstractWorkerThread::Entry()
-{
-	// call work for assigned range of observations
-	a_coord->CalcPseudoP_range(obs_start, obs_end, seed_start);
-	wxMutexLocker lock(*worker_list_mutex);
-	// remove ourself from the list
-	worker_list->remove(this);
-    // if empty, signal on empty condition since only main thread
-	// should be waiting on this condition
-	if (worker_list->empty()) {
-		worker_list_empty_cond->Signal();
-	}
-	return NULL;
-}
-
 ///////////////////////////////////////////////////////////////////////////////
 //
 //
 ///////////////////////////////////////////////////////////////////////////////
 AbstractCoordinator::AbstractCoordinator()
+: bo(0), fdr(0), user_sig_cutoff(0), weights(0), csr_weights(0)
 {
     
 }
@@ -102,7 +66,10 @@ undef_data(var_info_s.size()),
 last_seed_used(123456789),
 reuse_last_seed(true),
 row_standardize(row_standardize_s),
-user_sig_cutoff(0)
+csr_weights(0),
+user_sig_cutoff(0),
+bo(0),
+fdr(0)
 {
     wxLogMessage("Entering AbstractCoordinator::AbstractCoordinator().");
     reuse_last_seed = GdaConst::use_gda_user_seed;
@@ -136,6 +103,7 @@ AbstractCoordinator::~AbstractCoordinator()
         w_man_state->removeObserver(this);
     }
 	DeallocateVectors();
+    if (csr_weights) delete csr_weights;
 }
 
 std::vector<wxString> AbstractCoordinator::GetDefaultCategories()
@@ -187,6 +155,12 @@ void AbstractCoordinator::DeallocateVectors()
     Gal_vecs.clear();
     
     Gal_vecs_orig.clear();
+    
+    for (size_t i=0; i<Csr_vecs.size(); i++) {
+        if (Csr_vecs[i] != csr_weights) delete Csr_vecs[i];
+    }
+    Csr_vecs.clear();
+    num_nbrs_vecs.clear();
     wxLogMessage("Exiting AbstractCoordinator::DeallocateVectors()");
 }
 
@@ -205,6 +179,7 @@ void AbstractCoordinator::AllocateVectors()
 	has_undefined.resize(tms);
     Gal_vecs.resize(tms);
     Gal_vecs_orig.resize(tms);
+    if (csr_weights) Csr_vecs.resize(tms, NULL);
     
 	for (int i=0; i<tms; i++) {
 		if (calc_significances) {
@@ -340,6 +315,11 @@ int* AbstractCoordinator::GetSigCatIndicators(int t)
     return sig_cat_vecs[t];
 }
 
+const std::vector<int>& AbstractCoordinator::GetPermutationsUsed(int t)
+{
+    return perms_used[t];
+}
+
 boost::uuids::uuid AbstractCoordinator::GetWeightsID()
 {
     return w_id;
@@ -419,107 +399,80 @@ void AbstractCoordinator::CalcPseudoP()
 void AbstractCoordinator::CalcPseudoP_threaded()
 {
 	wxLogMessage("Entering AbstractCoordinator::CalcPseudoP_threaded()");
-    int nCPUs = GdaConst::gda_cpu_cores;
-    if (!GdaConst::gda_set_cpu_cores)
-        nCPUs = wxThread::GetCPUCount();
+	if (!reuse_last_seed) last_seed_used = time(0);
+    InitNumNbrs();
+    InitPermutationTable();
+    perms_used.assign(num_time_vals, std::vector<int>(num_obs, 0));
     
-	// mutext protects access to the worker_list
-    wxMutex worker_list_mutex;
-	// signals that worker_list is empty
-	wxCondition worker_list_empty_cond(worker_list_mutex);
-    // mutex should be initially locked
-	worker_list_mutex.Lock();
-	
-    // List of all the threads currently alive.  As soon as the thread
-	// terminates, it removes itself from the list.
-	std::list<wxThread*> worker_list;
+    // observations are handed out in small chunks to the shared worker
+    // pool; every permutation of every observation has its own random
+    // stream, so the chunking does not change the results
+    GdaThreadPoolStats stats;
+    GdaThreadPool::GetInstance().ParallelFor(num_obs,
+        boost::bind(&AbstractCoordinator::CalcPseudoP_range, this, _1, _2),
+        GdaThreadPool::permutation_chunk_size, &stats);
+    wxLogMessage("%s", stats.ToString());
+    wxLogMessage("%s", PermutationStopRule::Summarize(perms_used, permutations));
+    perm_cands.Reset();
+	wxLogMessage("Exiting AbstractCoordinator::CalcPseudoP_threaded()");
+}
 
-	// divide up work according to number of observations
-	// and number of CPUs
-	int work_chunk = num_obs / nCPUs;
-    
-    if (work_chunk == 0) {
-        work_chunk = 1;
+void AbstractCoordinator::InitPermutationTable()
+{
+    // same candidates the rejection sampling in CalcPseudoP_range accepts:
+    // observations with neighbors in the last time period
+    const std::vector<int>& w_nn = num_nbrs_vecs[num_time_vals-1];
+    std::vector<bool> is_candidate(num_obs);
+    int max_card = 0;
+    for (int i=0; i<num_obs; i++) {
+        is_candidate[i] = w_nn[i] > 0;
+        for (int t=0; t<num_time_vals; t++) {
+            int nn = num_nbrs_vecs[t][i];
+            if (nn > max_card) max_card = nn;
+        }
     }
-    
-	int obs_start = 0;
-	int obs_end = obs_start + work_chunk;
-	
-	bool is_thread_error = false;
-	int quotient = num_obs / nCPUs;
-	int remainder = num_obs % nCPUs;
-	int tot_threads = (quotient > 0) ? nCPUs : remainder;
-	
-    //boost::thread_group threadPool;
-    
-	if (!reuse_last_seed) last_seed_used = time(0);
-    
-	for (int i=0; i<tot_threads && !is_thread_error; i++) {
-		int a=0;
-		int b=0;
-		if (i < remainder) {
-			a = i*(quotient+1);
-			b = a+quotient;
-		} else {
-			a = remainder*(quotient+1) + (i-remainder)*quotient;
-			b = a+quotient-1;
-		}
-		uint64_t seed_start = last_seed_used+a;
-		uint64_t seed_end = seed_start + ((uint64_t) (b-a));
-        int thread_id = i+1;
-        //boost::thread* worker = new boost::thread(boost::bind(&AbstractCoordinator::CalcPseudoP_range,this, a, b, seed_start));
-        //threadPool.add_thread(worker);
-        AbstractWorkerThread* thread =
-        new AbstractWorkerThread(a, b, seed_start, this,
-                                 &worker_list_mutex,
-                                 &worker_list_empty_cond,
-                                 &worker_list, thread_id);
-        if ( thread->Create() != wxTHREAD_NO_ERROR ) {
-            delete thread;
-            is_thread_error = true;
+    perm_cands.Init(is_candidate, permutations, max_card, last_seed_used);
+}
+
+void AbstractCoordinator::InitNumNbrs()
+{
+    num_nbrs_vecs.resize(num_time_vals);
+    for (int t=0; t<num_time_vals; t++) {
+        std::vector<int>& nn = num_nbrs_vecs[t];
+        nn.resize(num_obs);
+        if (csr_weights) {
+            for (int i=0; i<num_obs; i++) nn[i] = Csr_vecs[t]->GetNumNbrs(i);
         } else {
-            worker_list.push_front(thread);
-        }
-	}
-    if (is_thread_error) {
-        // fall back to single thread calculation mode
-        CalcPseudoP_range(0, num_obs-1, last_seed_used);
-    } else {
-        std::list<wxThread*>::iterator it;
-        for (it = worker_list.begin(); it != worker_list.end(); it++) {
-            (*it)->Run();
-        }
-        while (!worker_list.empty()) {
-            // wait until thread_list might be empty
-            worker_list_empty_cond.Wait();
-            // We have been woken up. If this was not a false
-            // alarm (sprious signal), the loop will exit.
+            GalElement* w = Gal_vecs[t]->gal;
+            for (int i=0; i<num_obs; i++) nn[i] = w[i].Size();
         }
     }
-    //threadPool.join_all();
-	wxLogMessage("Exiting AbstractCoordinator::CalcPseudoP_threaded()");
 }
 
-void AbstractCoordinator::CalcPseudoP_range(int obs_start, int obs_end,
-                                            uint64_t seed_start)
+void AbstractCoordinator::CalcPseudoP_range(int obs_start, int obs_end)
 {
 	GeoDaSet workPermutation(num_obs);
     int max_rand = num_obs-1;
+    uint64_t seed_key = Gda::CounterRng::SeedKey(last_seed_used);
+    PermutationStopRule stop_rule(GdaConst::gda_perm_early_stop,
+        PermutationStopRule::GetMaxCutoff(significance_cutoff,
+                                          user_sig_cutoff));
     
 	for (int cnt=obs_start; cnt<=obs_end; cnt++) {
         std::vector<uint64_t> countLarger(num_time_vals, 0);
         
-        GalElement* w;
+        // neighbor counts of the last time period decide the candidates
+        const int* w_nn = NULL;
         
         // get full neighbors even if has undefined value
         int numNeighbors = 0;
         for (int t=0; t<num_time_vals; t++) {
-            w = Gal_vecs[t]->gal;
-            if (w[cnt].Size() > numNeighbors) {
-                numNeighbors = w[cnt].Size();
+            w_nn = &num_nbrs_vecs[t][0];
+            if (w_nn[cnt] > numNeighbors) {
+                numNeighbors = w_nn[cnt];
             }
             int* _sigCat = sig_cat_vecs[t];
-            if (w[cnt].Size() == 0) {
+            if (w_nn[cnt] == 0) {
                 _sigCat[cnt] = 5;
             }
         }
@@ -529,23 +482,40 @@ void AbstractCoordinator::CalcPseudoP_range(int obs_start, int obs_end,
             continue;
         }
         
+        uint64_t obs_key = Gda::CounterRng::SubKey(seed_key, cnt);
+        std::vector<int> permNeighbors(numNeighbors);
+        int perms_done = 0;
 		for (int perm=0; perm<permutations; perm++) {
+            if (stop_rule.IsEnabled() && perm > 0) {
+                // stop once every time period is clearly not significant
+                bool can_stop = true;
+                for (int t=0; t<num_time_vals && can_stop; t++) {
+                    uint64_t e = PermutationStopRule::Fold(countLarger[t], perm);
+                    can_stop = stop_rule.CanStop(e, perm);
+                }
+                if (can_stop) break;
+            }
+            perms_done++;
+            if (perm_cands.GetPermNeighbors(perm, cnt, permNeighbors)) {
+                ComputeLarger(cnt, permNeighbors, countLarger);
+                continue;
+            }
 			int rand=0;
             double rng_val;
             int newRandom;
+            Gda::CounterRng rng(Gda::CounterRng::SubKey(obs_key, perm));
 			while (rand < numNeighbors) {
 				// computing 'perfect' permutation of given size
-                rng_val = Gda::ThomasWangHashDouble(seed_start++) * max_rand;
+                rng_val = rng.NextDouble() * max_rand;
                 // round is needed to fix issue
                 // https://github.com/GeoDaCenter/geoda/issues/488
 				newRandom = (int)(rng_val<0.0?ceil(rng_val - 0.5):floor(rng_val + 0.5));
                 
-				if (newRandom != cnt && !workPermutation.Belongs(newRandom) && w[newRandom].Size()>0) {
+				if (newRandom != cnt && !workPermutation.Belongs(newRandom) && w_nn[newRandom]>0) {
 					workPermutation.Push(newRandom);
 					rand++;
 				}
 			}
-            std::vector<int> permNeighbors(numNeighbors);
             for (int cp=0; cp<numNeighbors; cp++) {
                 permNeighbors[cp] = workPermutation.Pop();
             }
@@ -556,13 +526,14 @@ void AbstractCoordinator::CalcPseudoP_range(int obs_start, int obs_end,
         for (int t=0; t<num_time_vals; t++) {
             double* _sigLocal = sig_local_vecs[t];
             int* _sigCat = sig_cat_vecs[t];
+            perms_used[t][cnt] = perms_done;
 
     		// pick the smallest
-    		if (permutations-countLarger[t] <= countLarger[t]) {
-    			countLarger[t] = permutations-countLarger[t];
+    		if (perms_done-countLarger[t] <= countLarger[t]) {
+    			countLarger[t] = perms_done-countLarger[t];
     		}
     		
-    		_sigLocal[cnt] = (countLarger[t]+1.0)/(permutations+1);
+    		_sigLocal[cnt] = (countLarger[t]+1.0)/(perms_done+1);
     		// 'significance' of local Moran
     		if (_sigLocal[cnt] <= 0.0001) _sigCat[cnt] = 4;
     		else if (_sigLocal[cnt] <= 0.001) _sigCat[cnt] = 3;
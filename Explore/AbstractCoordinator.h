@@ -23,6 +23,7 @@
 #include <list>
 #include <vector>
 #include <boost/multi_array.hpp>
+#include <boost/shared_ptr.hpp>
 #include <wx/string.h>
 #include <wx/thread.h>
 #include "../VarTools.h"
@@ -30,9 +31,12 @@
 #include "../ShapeOperations/GalWeight.h"
 #include "../ShapeOperations/WeightsManStateObserver.h"
 #include "../ShapeOperations/OGRDataAdapter.h"
+#include "PermutationTable.h"
+#include "PermutationStopRule.h"
 
 
 class Project;
+class CsrWeight;
 class WeightsManState;
 typedef boost::multi_array<double, 2> d_array_type;
 typedef boost::multi_array<bool, 2> b_array_type;
@@ -48,31 +52,6 @@ public:
 };
 
 
-class AbstractWorkerThread : public wxThread
-{
-public:
-	AbstractWorkerThread(int obs_start,
-                         int obs_end,
-                         uint64_t seed_start,
-                         AbstractCoordinator* a_coord,
-                         wxMutex* worker_list_mutex,
-                         wxCondition* worker_list_empty_cond,
-                         std::list<wxThread*> *worker_list,
-                         int thread_id);
-	virtual ~AbstractWorkerThread();
-	virtual void* Entry();  // thread execution starts here
-
-	int obs_start;
-	int obs_end;
-	uint64_t seed_start;
-	int thread_id;
-	
-	AbstractCoordinator* a_coord;
-	wxMutex* worker_list_mutex;
-	wxCondition* worker_list_empty_cond;
-	std::list<wxThread*> *worker_list;
-};
-
 class AbstractCoordinator : public WeightsManStateObserver
 {
 public:
@@ -142,8 +121,13 @@ public:
     
     virtual void CalcPseudoP();
     
-    virtual void CalcPseudoP_range(int obs_start, int obs_end,
-                                   uint64_t seed_start);
+    virtual void CalcPseudoP_range(int obs_start, int obs_end);
+    
+    /** Set up perm_cands when GdaConst::gda_use_perm_table is on */
+    virtual void InitPermutationTable();
+    
+    /** Fill num_nbrs_vecs from Csr_vecs or Gal_vecs */
+    void InitNumNbrs();
     
     virtual void ComputeLarger(int cnt, std::vector<int>& permNeighbors,
                                std::vector<uint64_t>& countLarger) = 0;
@@ -166,6 +150,9 @@ public:
     
     int* GetSigCatIndicators(int t);
     
+    /** number of permutations each observation used in time period t */
+    const std::vector<int>& GetPermutationsUsed(int t);
+    
     boost::uuids::uuid GetWeightsID();
     
     wxString GetWeightsName(); 
@@ -189,6 +176,12 @@ protected:
     
     GalWeight* weights;
     
+    // used instead of weights and Gal_vecs when set; owned
+    CsrWeight* csr_weights;
+    
+    // num_nbrs_vecs[time][obs]: neighbors left after dropping undefined
+    std::vector<std::vector<int> > num_nbrs_vecs;
+    
     std::vector<double*> sig_local_vecs;
     std::vector<int*> sig_cat_vecs;
     std::vector<int*> cluster_vecs;
@@ -196,9 +189,16 @@ protected:
     boost::uuids::uuid w_id;
     wxString weight_name;
     
+    // shared permutation table, empty when drawing per observation
+    PermutationCandidates perm_cands;
+    
+    // perms_used[time][obs]: less than permutations if stopped early
+    std::vector<std::vector<int> > perms_used;
+    
 public:
     std::vector<GalWeight*> Gal_vecs;
     std::vector<GalWeight*> Gal_vecs_orig;
+    std::vector<CsrWeight*> Csr_vecs;
 
 	int num_obs; // total # obs including neighborless obs
 	int num_time_vals; // number of valid time periods based on var_info
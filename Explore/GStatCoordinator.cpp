@@ -18,6 +18,7 @@
  */
 
 #include <time.h>
+#include <boost/bind.hpp>
 #include <boost/math/distributions/normal.hpp> // for normal_distribution
 #include <algorithm>
 #include <functional>
@@ -31,50 +32,10 @@
 #include "../VarCalc/WeightsManInterface.h"
 #include "../logger.h"
 #include "../Project.h"
+#include "../GdaThreadPool.h"
 #include "GetisOrdMapNewView.h"
 #include "GStatCoordinator.h"
 
-GStatWorkerThread::GStatWorkerThread(int obs_start_s, int obs_end_s,
-									 uint64_t seed_start_s,
-									 GStatCoordinator* gstat_coord_s,
-									 wxMutex* worker_list_mutex_s,
-									 wxCondition* worker_list_empty_cond_s,
-									 std::list<wxThread*> *worker_list_s,
-									 int thread_id_s)
-: wxThread(),
-obs_start(obs_start_s), obs_end(obs_end_s), seed_start(seed_start_s),
-gstat_coord(gstat_coord_s),
-worker_list_mutex(worker_list_mutex_s),
-worker_list_empty_cond(worker_list_empty_cond_s),
-worker_list(worker_list_s),
-thread_id(thread_id_s)
-{
-}
-
-GStatWorkerThread::~GStatWorkerThread()
-{
-}
-
-wxThread::ExitCode GStatWorkerThread::Entry()
-{
-	LOG_MSG(wxString::Format("GStatWorkerThread %d started", thread_id));
-	
-	// call work for assigned range of observations
-	gstat_coord->CalcPseudoP_range(obs_start, obs_end, seed_start);
-	
-	wxMutexLocker lock(*worker_list_mutex);
-	// remove ourself from the list
-	worker_list->remove(this);
-	// if empty, signal on empty condition since only main thread
-	// should be waiting on this condition
-	if (worker_list->empty()) {
-		worker_list_empty_cond->Signal();
-	}
-	
-	return NULL;
-}
-
-
 GStatCoordinator::
 GStatCoordinator(boost::uuids::uuid weights_id,
                  Project* project,
@@ -92,7 +53,8 @@ var_info(var_info_s),
 data(var_info_s.size()),
 data_undef(var_info_s.size()),
 last_seed_used(123456789), reuse_last_seed(true),
-is_local_joint_count(_is_local_joint_count)
+is_local_joint_count(_is_local_joint_count),
+bo(0), fdr(0), user_sig_cutoff(0)
 {
     wxLogMessage("Entering GStatCoordinator::GStatCoordinator().");
     reuse_last_seed = GdaConst::use_gda_user_seed;
@@ -569,84 +531,46 @@ void GStatCoordinator::CalcPseudoP()
 void GStatCoordinator::CalcPseudoP_threaded()
 {
 	LOG_MSG("Entering GStatCoordinator::CalcPseudoP_threaded");
-    int nCPUs = GdaConst::gda_cpu_cores;
-    if (!GdaConst::gda_set_cpu_cores)
-        nCPUs = wxThread::GetCPUCount();
-	
-	// mutext protects access to the worker_list
-    wxMutex worker_list_mutex;
-	// signals that worker_list is empty
-	wxCondition worker_list_empty_cond(worker_list_mutex);
-	worker_list_mutex.Lock(); // mutex should be initially locked
-	
-    // List of all the threads currently alive.  As soon as the thread
-	// terminates, it removes itself from the list.
-	std::list<wxThread*> worker_list;
-	
-	// divide up work according to number of observations
-	// and number of CPUs
-	int work_chunk = num_obs / nCPUs;
-	int obs_start = 0;
-	int obs_end = obs_start + work_chunk;
-	
-	bool is_thread_error = false;
-	int quotient = num_obs / nCPUs;
-	int remainder = num_obs % nCPUs;
-	int tot_threads = (quotient > 0) ? nCPUs : remainder;
-	
 	if (!reuse_last_seed) last_seed_used = time(0);
-	for (int i=0; i<tot_threads && !is_thread_error; i++) {
-		int a=0;
-		int b=0;
-		if (i < remainder) {
-			a = i*(quotient+1);
-			b = a+quotient;
-		} else {
-			a = remainder*(quotient+1) + (i-remainder)*quotient;
-			b = a+quotient-1;
-		}
-		uint64_t seed_start = last_seed_used+a;
-		uint64_t seed_end = seed_start + ((uint64_t) (b-a));
-		int thread_id = i+1;
-		
-		GStatWorkerThread* thread =
-			new GStatWorkerThread(a, b, seed_start, this,
-								  &worker_list_mutex,
-								  &worker_list_empty_cond,
-								  &worker_list, thread_id);
-		if ( thread->Create() != wxTHREAD_NO_ERROR ) {
-			delete thread;
-			is_thread_error = true;
-		} else {
-			worker_list.push_front(thread);
-		}
-	}
-	if (is_thread_error) {
-		// fall back to single thread calculation mode
-		CalcPseudoP_range(0, num_obs-1, last_seed_used);
-	} else {
-		std::list<wxThread*>::iterator it;
-		for (it = worker_list.begin(); it != worker_list.end(); it++) {
-			(*it)->Run();
-		}
-		
-		while (!worker_list.empty()) {
-			// wait until thread_list might be empty
-			worker_list_empty_cond.Wait();
-			// We have been woken up. If this was not a false
-			// alarm (spurious signal), the loop will exit.
+	InitPermutationTable();
+	perms_used.assign(num_time_vals, std::vector<int>(num_obs, 0));
+	GdaThreadPoolStats stats;
+	GdaThreadPool::GetInstance().ParallelFor(num_obs,
+		boost::bind(&GStatCoordinator::CalcPseudoP_range, this, _1, _2),
+		GdaThreadPool::permutation_chunk_size, &stats);
+	wxLogMessage("%s", stats.ToString());
+	wxLogMessage("%s", PermutationStopRule::Summarize(perms_used, permutations));
+	perm_cands.Reset();
+	LOG_MSG("Exiting GStatCoordinator::CalcPseudoP_threaded");
+}
+
+void GStatCoordinator::InitPermutationTable()
+{
+	// candidates match the rejection test in CalcPseudoP_range
+	GalElement* w = Gal_vecs[num_time_vals-1]->gal;
+	std::vector<bool> is_candidate(num_obs);
+	int max_card = 0;
+	for (int i=0; i<num_obs; i++) {
+		is_candidate[i] = w[i].Size() > 0;
+		for (int t=0; t<num_time_vals; t++) {
+			int nn = Gal_vecs[t]->gal[i].Size();
+			if (nn > max_card) max_card = nn;
 		}
 	}
-	LOG_MSG("Exiting GStatCoordinator::CalcPseudoP_threaded");
+	perm_cands.Init(is_candidate, permutations, max_card, last_seed_used);
 }
 
 /** In the code that computes Gi and Gi*, we specifically checked for 
  self-neighbors and handled the situation appropriately.  For the
  permutation code, we will disallow self-neighbors. */
-void GStatCoordinator::CalcPseudoP_range(int obs_start, int obs_end,uint64_t seed_start)
+void GStatCoordinator::CalcPseudoP_range(int obs_start, int obs_end)
 {
 	GeoDaSet workPermutation(num_obs);
 	int max_rand = num_obs-1;
+	uint64_t seed_key = Gda::CounterRng::SeedKey(last_seed_used);
+	PermutationStopRule stop_rule(GdaConst::gda_perm_early_stop,
+		PermutationStopRule::GetMaxCutoff(significance_cutoff,
+										  user_sig_cutoff));
     
 	for (long i=obs_start; i<=obs_end; i++) {
         std::vector<uint64_t> countGLarger(num_time_vals, 0);
@@ -674,22 +598,39 @@ void GStatCoordinator::CalcPseudoP_range(int obs_start, int obs_end,uint64_t see
             continue;
         }
         
+        uint64_t obs_key = Gda::CounterRng::SubKey(seed_key, i);
+        std::vector<int> permNeighbors(numNeighbors);
+        int perms_done = 0;
         for (int perm=0; perm < permutations; perm++) {
-            int rand = 0;
-            while (rand < numNeighbors) {
-                // computing 'perfect' permutation of given size
-                double rng_val = Gda::ThomasWangHashDouble(seed_start++) * max_rand;
-                // round is needed to fix issue
-                //https://github.com/GeoDaCenter/geoda/issues/488
-                int newRandom = (int) (rng_val < 0.0 ? ceil(rng_val - 0.5) : floor(rng_val + 0.5));
-                if (newRandom != i && !workPermutation.Belongs(newRandom) && w[newRandom].Size()>0) {
-                    workPermutation.Push(newRandom);
-                    rand++;
+            if (stop_rule.IsEnabled() && perm > 0) {
+                // both Gi and Gi* must be clear of the cutoffs
+                bool can_stop = true;
+                for (int t=0; t<num_time_vals && can_stop; t++) {
+                    can_stop = stop_rule.CanStop(
+                        PermutationStopRule::Fold(countGLarger[t], perm), perm) &&
+                    stop_rule.CanStop(
+                        PermutationStopRule::Fold(countGStarLarger[t], perm), perm);
                 }
+                if (can_stop) break;
             }
-            std::vector<int> permNeighbors(numNeighbors);
-            for (int cp=0; cp<numNeighbors; cp++) {
-                permNeighbors[cp] = workPermutation.Pop();
+            perms_done++;
+            if (!perm_cands.GetPermNeighbors(perm, i, permNeighbors)) {
+                int rand = 0;
+                Gda::CounterRng rng(Gda::CounterRng::SubKey(obs_key, perm));
+                while (rand < numNeighbors) {
+                    // computing 'perfect' permutation of given size
+                    double rng_val = rng.NextDouble() * max_rand;
+                    // round is needed to fix issue
+                    //https://github.com/GeoDaCenter/geoda/issues/488
+                    int newRandom = (int) (rng_val < 0.0 ? ceil(rng_val - 0.5) : floor(rng_val + 0.5));
+                    if (newRandom != i && !workPermutation.Belongs(newRandom) && w[newRandom].Size()>0) {
+                        workPermutation.Push(newRandom);
+                        rand++;
+                    }
+                }
+                for (int cp=0; cp<numNeighbors; cp++) {
+                    permNeighbors[cp] = workPermutation.Pop();
+                }
             }
             // for each time step, reuse permuation
             for (int t=0; t<num_time_vals; t++) {
@@ -733,16 +674,17 @@ void GStatCoordinator::CalcPseudoP_range(int obs_start, int obs_end,uint64_t see
         for (int t=0; t<num_time_vals; t++) {
             double* p_t = pseudo_p_vecs[t];
             double* ps_t = pseudo_p_star_vecs[t];
+            perms_used[t][i] = perms_done;
             // pick the smallest
-            if (permutations-countGLarger[t] < countGLarger[t]) {
-                countGLarger[t] = permutations-countGLarger[t];
+            if (perms_done-countGLarger[t] < countGLarger[t]) {
+                countGLarger[t] = perms_done-countGLarger[t];
             }
-            p_t[i] = (countGLarger[t] + 1.0)/(permutations+1.0);
+            p_t[i] = (countGLarger[t] + 1.0)/(perms_done+1.0);
             
-            if (permutations-countGStarLarger[t] < countGStarLarger[t]) {
-                countGStarLarger[t] = permutations-countGStarLarger[t];
+            if (perms_done-countGStarLarger[t] < countGStarLarger[t]) {
+                countGStarLarger[t] = perms_done-countGStarLarger[t];
             }
-            ps_t[i] = (countGStarLarger[t] + 1.0)/(permutations+1.0);
+            ps_t[i] = (countGStarLarger[t] + 1.0)/(perms_done+1.0);
         }
 	}
 }
@@ -34,12 +34,15 @@
 #include <list>
 #include <vector>
 #include <boost/multi_array.hpp>
+#include <boost/shared_ptr.hpp>
 #include <wx/string.h>
 #include <wx/thread.h>
 #include "../VarTools.h"
 #include "../ShapeOperations/GalWeight.h"
 #include "../ShapeOperations/WeightsManStateObserver.h"
 #include "../ShapeOperations/OGRDataAdapter.h"
+#include "PermutationTable.h"
+#include "PermutationStopRule.h"
 
 
 class GetisOrdMapFrame; // instead of GStatCoordinatorObserver
@@ -49,29 +52,6 @@ class WeightsManState;
 typedef boost::multi_array<double, 2> d_array_type;
 typedef boost::multi_array<bool, 2> b_array_type;
 
-class GStatWorkerThread : public wxThread
-{
-public:
-    GStatWorkerThread(int obs_start, int obs_end, uint64_t seed_start,
-                      GStatCoordinator* gstat_coord,
-                      wxMutex* worker_list_mutex,
-                      wxCondition* worker_list_empty_cond,
-                      std::list<wxThread*> *worker_list,
-                      int thread_id);
-	virtual ~GStatWorkerThread();
-	virtual void* Entry();  // thread execution starts here
-
-	int obs_start;
-	int obs_end;
-	uint64_t seed_start;
-	int thread_id;
-	
-	GStatCoordinator* gstat_coord;
-	wxMutex* worker_list_mutex;
-	wxCondition* worker_list_empty_cond;
-	std::list<wxThread*> *worker_list;
-};
-
 class GStatCoordinator : public WeightsManStateObserver
 {
 public:
@@ -186,6 +166,8 @@ public:
 	std::vector<double*> p_star_vecs;
 	std::vector<double*> pseudo_p_vecs; //threaded
 	std::vector<double*> pseudo_p_star_vecs; //threaded
+	// perms_used[time][obs]: less than permutations if stopped early
+	std::vector<std::vector<int> > perms_used; //threaded
 	std::vector<double*> x_vecs; //threaded
     std::vector<std::vector<bool> > x_undefs;
 
@@ -220,7 +202,7 @@ public:
 	std::vector<GetisOrdMapFrame*> maps;
 	
 	void CalcPseudoP();
-	void CalcPseudoP_range(int obs_start, int obs_end, uint64_t seed_start);
+	void CalcPseudoP_range(int obs_start, int obs_end);
 	
 	void InitFromVarInfo();
 	void VarInfoAttributeChange();
@@ -232,6 +214,7 @@ protected:
 	void AllocateVectors();
 	
 	void CalcPseudoP_threaded();
+	void InitPermutationTable();
 	void CalcGs();
 	std::vector<bool> has_undefined;
 	std::vector<bool> has_isolates;
@@ -239,6 +222,9 @@ protected:
 	uint64_t last_seed_used;
 	bool reuse_last_seed;
 	
+	// shared permutation table, empty when drawing per observation
+	PermutationCandidates perm_cands;
+	
 	WeightsManState* w_man_state;
 	WeightsManInterface* w_man_int;
 };
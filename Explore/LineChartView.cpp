@@ -1247,6 +1247,8 @@ void LineChartFrame::SaveDataAndResults(bool save_weights, bool save_did,
                         wx_fn.SetExt("gal");
                     } else if (w->weight_type == GeoDaWeight::gwt_type) {
                         wx_fn.SetExt("gwt");
+                    } else if (w->weight_type == GeoDaWeight::csr_type) {
+                        wx_fn.SetExt("gwb");
                     }
                     wxString ofn(wx_fn.GetFullPath());
                     w->SaveDIDWeights(project, n_obs, newids, id_stack, ofn);
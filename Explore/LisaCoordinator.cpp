@@ -32,12 +32,14 @@
 #include "../ShapeOperations/Randik.h"
 #include "../ShapeOperations/WeightsManState.h"
 #include "../ShapeOperations/WeightUtils.h"
+#include "../ShapeOperations/CsrWeight.h"
 #include "../VarCalc/WeightsManInterface.h"
 #include "../logger.h"
 #include "../Project.h"
 #include "LisaCoordinator.h"
 
 #include "../Algorithms/gpu_lisa.h"
+#include "../Algorithms/cpu_lisa.h"
 
 /** 
  Since the user has the ability to synchronise either variable over time,
@@ -156,7 +158,103 @@ LisaCoordinator(wxString weights_path,
         }
     }
     
-    // create weights
+    ReadWeightsFile(weights_path);
+    
+    SetSignificanceFilter(1);
+    InitFromVarInfo();
+    wxLogMessage("Exiting LisaCoordinator::LisaCoordinator()2.");
+}
+
+/** Univariate LISA of a batch of variables with the same weights.  The
+ variables are stored as the time periods of a single variable, so the
+ permutation loop in AbstractCoordinator draws every permutation once and
+ ComputeLarger() scores it for all of them. */
+LisaCoordinator::
+LisaCoordinator(wxString weights_path,
+                int n,
+                const std::vector<std::vector<double> >& vars,
+                int permutations_s,
+                bool calc_significances_s,
+                bool row_standardize_s)
+: AbstractCoordinator()
+{
+    wxLogMessage("Entering LisaCoordinator::LisaCoordinator()3.");
+    InitBatch(n, vars, permutations_s, calc_significances_s, row_standardize_s);
+    ReadWeightsFile(weights_path);
+    
+    SetSignificanceFilter(1);
+    InitFromVarInfo();
+    wxLogMessage("Exiting LisaCoordinator::LisaCoordinator()3.");
+}
+
+/** Same as the batch constructor above, with the lags and the permutation
+ test running on CSR weights.  The coordinator takes ownership of w. */
+LisaCoordinator::
+LisaCoordinator(CsrWeight* w,
+                const std::vector<std::vector<double> >& vars,
+                int permutations_s,
+                bool calc_significances_s,
+                bool row_standardize_s)
+: AbstractCoordinator()
+{
+    wxLogMessage("Entering LisaCoordinator::LisaCoordinator()4.");
+    InitBatch(w->GetNumObs(), vars, permutations_s, calc_significances_s,
+              row_standardize_s);
+    w_man_state = NULL;
+    w_man_int = NULL;
+    weights = NULL;
+    csr_weights = w;
+    
+    SetSignificanceFilter(1);
+    InitFromVarInfo();
+    wxLogMessage("Exiting LisaCoordinator::LisaCoordinator()4.");
+}
+
+void LisaCoordinator::InitBatch(int n,
+                                const std::vector<std::vector<double> >& vars,
+                                int permutations_s,
+                                bool calc_significances_s,
+                                bool row_standardize_s)
+{
+    num_obs = n;
+    num_time_vals = vars.size();
+    permutations = permutations_s;
+    calc_significances = calc_significances_s;
+    row_standardize = row_standardize_s;
+    // the batch runs right away, so only the user seed can make it
+    // reproducible
+    last_seed_used = 0;
+    reuse_last_seed = GdaConst::use_gda_user_seed;
+    if ( GdaConst::use_gda_user_seed) {
+        last_seed_used = GdaConst::gda_user_seed;
+    }
+    isBivariate = false;
+    lisa_type = univariate;
+    
+    undef_tms.resize(num_time_vals);
+    data.resize(1);
+    undef_data.resize(1);
+    var_info.resize(1);
+    
+    data[0].resize(boost::extents[num_time_vals][num_obs]);
+    undef_data[0].resize(boost::extents[num_time_vals][num_obs]);
+    var_info[0].is_moran = true;
+    var_info[0].is_time_variant = true;
+    var_info[0].fixed_scale = true;
+    var_info[0].sync_with_global_time = true;
+    var_info[0].time_min = 0;
+    var_info[0].time_max = num_time_vals - 1;
+    
+    for (int v=0; v<num_time_vals; v++) {
+        for (int i=0; i<num_obs; i++) {
+            data[0][v][i] = vars[v][i];
+            undef_data[0][v][i] = false;
+        }
+    }
+}
+
+void LisaCoordinator::ReadWeightsFile(const wxString& weights_path)
+{
     w_man_state = NULL;
     w_man_int = NULL;
     
@@ -173,10 +271,6 @@ LisaCoordinator(wxString weights_path,
     weights->wflnm = weights_path;
     weights->id_field = "ogc_fid";
     weights->gal = tempGal;
-    
-    SetSignificanceFilter(1);
-    InitFromVarInfo();
-    wxLogMessage("Exiting LisaCoordinator::LisaCoordinator()2.");
 }
 
 LisaCoordinator::~LisaCoordinator()
@@ -395,7 +489,11 @@ void LisaCoordinator::GetRawData(int time, double* data1, double* data2)
 void LisaCoordinator::StandardizeData()
 {
     wxLogMessage("Entering LisaCoordinator::StandardizeData()");
-    GalElement* w = weights->gal;
+    std::vector<int> num_nbrs(num_obs);
+    for (int i=0; i<num_obs; i++) {
+        num_nbrs[i] = csr_weights ? csr_weights->GetNumNbrs(i)
+                                  : weights->gal[i].Size();
+    }
     
 	for (int t=0; t<data1_vecs.size(); t++) {
         undef_tms[t].resize(num_obs);
@@ -413,7 +511,7 @@ void LisaCoordinator::StandardizeData()
         
         // the isolates should be excluded as undefined
         for (int i=0; i<num_obs; i++) {
-            if (w[i].Size() == 0) {
+            if (num_nbrs[i] == 0) {
                 undef_tms[t][i] = true;
             }
         }
@@ -465,13 +563,20 @@ void LisaCoordinator::Calc()
             if (is_undef && !has_undef) {
                 has_undef = true;
             }
-            if (weights->gal[i].Size() == 0) {
+            int nn = csr_weights ? csr_weights->GetNumNbrs(i)
+                                 : weights->gal[i].Size();
+            if (nn == 0) {
                 is_undef = true;
                 has_isolate = true;
             }
             undefs.push_back(is_undef);
         }
         has_undefined[t] = has_undef;
+        
+        if (csr_weights) {
+            CalcCsr(t, undefs, has_undef || has_isolate);
+            continue;
+        }
        
         // local weights copy
         GalWeight* gw = NULL;
@@ -518,14 +623,66 @@ void LisaCoordinator::Calc()
     wxLogMessage("Exiting LisaCoordinator::Calc()");
 }
 
+/** Calc() of time period t on csr_weights: the undefined observations are
+ dropped from a copy of the CSR arrays and the lags read them directly */
+void LisaCoordinator::CalcCsr(int t, const std::vector<bool>& undefs,
+                              bool copy_weights)
+{
+    double* data1 = data1_vecs[t];
+    double* data2 = data1;
+    if (isBivariate) {
+        data2 = data2_vecs[0];
+        if (var_info[1].is_time_variant && var_info[1].sync_with_global_time) {
+            data2 = data2_vecs[t];
+        }
+    }
+    double* lags = lags_vecs[t];
+    double* localMoran = local_moran_vecs[t];
+    int* cluster = cluster_vecs[t];
+    
+    CsrWeight* cw = csr_weights;
+    if (copy_weights) {
+        cw = new CsrWeight(*csr_weights);
+        cw->Update(undefs);
+    }
+    if (Csr_vecs[t] && Csr_vecs[t] != csr_weights) delete Csr_vecs[t];
+    Csr_vecs[t] = cw;
+    
+    for (int i=0; i<num_obs; i++) {
+        if (undefs[i] == true) {
+            lags[i] = 0;
+            localMoran[i] = 0;
+            cluster[i] = 6; // undefined value
+            if (cw->GetNumNbrs(i) == 0) {
+                has_isolates[t] = true;
+                cluster[i] = 5; // neighborless
+            }
+            continue;
+        }
+        double Wdata = cw->SpatialLag(i, data2);
+        lags[i] = Wdata;
+        localMoran[i] = data1[i] * Wdata;
+        
+        if (data1[i] > 0 && Wdata < 0) cluster[i] = 4;
+        else if (data1[i] < 0 && Wdata > 0) cluster[i] = 3;
+        else if (data1[i] < 0 && Wdata < 0) cluster[i] = 2;
+        else cluster[i] = 1; //data1[i] > 0 && Wdata > 0
+    }
+}
+
 void LisaCoordinator::CalcPseudoP()
 {
     wxStopWatch sw_vd;
     
-    if (GdaConst::gda_use_gpu == false) {
+    if (GdaConst::gda_use_gpu == false || csr_weights) {
+        // the OpenCL kernel reads GalElement neighbors
         if (!calc_significances)
             return;
-        CalcPseudoP_threaded();
+        if (GdaConst::gda_use_cpu_kernel && CanUseCPUKernel()) {
+            CalcPseudoP_CPUKernel();
+        } else {
+            CalcPseudoP_threaded();
+        }
         
     } else {
         double* values = data1_vecs[0];
@@ -562,8 +719,171 @@ void LisaCoordinator::CalcPseudoP()
     LOG_MSG(wxString::Format("GPU took %ld ms", sw_vd.Time()));
 }
 
+/** The batch kernel covers the plain permutation test of a single time
+ period; the shared permutation table and early stopping need the general
+ path in AbstractCoordinator. */
+bool LisaCoordinator::CanUseCPUKernel()
+{
+    return num_time_vals == 1 &&
+        !GdaConst::gda_use_perm_table &&
+        !GdaConst::gda_perm_early_stop;
+}
+
+void LisaCoordinator::CalcPseudoP_CPUKernel()
+{
+    wxLogMessage("Entering LisaCoordinator::CalcPseudoP_CPUKernel()");
+	if (!reuse_last_seed) last_seed_used = time(0);
+    
+    InitNumNbrs();
+    std::vector<bool>& undefs = undef_tms[0];
+    std::vector<int>& num_nbrs = num_nbrs_vecs[0];
+    std::vector<char> undef_flags(num_obs);
+    for (int i=0; i<num_obs; i++) {
+        undef_flags[i] = undefs[i] ? 1 : 0;
+    }
+    double* data1 = data1_vecs[0];
+    double* data2 = isBivariate ? data2_vecs[0] : data1;
+    double* _sigLocal = sig_local_vecs[0];
+    int* _sigCat = sig_cat_vecs[0];
+    
+    cpu_lisa(num_obs, permutations, last_seed_used, data1, data2,
+             local_moran_vecs[0], &num_nbrs[0], &undef_flags[0],
+             row_standardize, _sigLocal);
+    
+    perms_used.assign(1, std::vector<int>(num_obs, 0));
+    for (int cnt=0; cnt<num_obs; cnt++) {
+        if (num_nbrs[cnt] == 0) {
+            _sigCat[cnt] = 5;
+            continue;
+        }
+        perms_used[0][cnt] = permutations;
+        if (_sigLocal[cnt] <= 0.0001) _sigCat[cnt] = 4;
+        else if (_sigLocal[cnt] <= 0.001) _sigCat[cnt] = 3;
+        else if (_sigLocal[cnt] <= 0.01) _sigCat[cnt] = 2;
+        else if (_sigLocal[cnt] <= 0.05) _sigCat[cnt]= 1;
+        else _sigCat[cnt]= 0;
+    }
+    wxLogMessage("Exiting LisaCoordinator::CalcPseudoP_CPUKernel()");
+}
+
+/** Time the threaded, batch CPU kernel and OpenCL paths of the permutation
+ test with the same seed, and count the p-values of each path that differ
+ from the threaded path.  The threaded results are restored afterwards. */
+wxString LisaCoordinator::BenchmarkPseudoP(int repeats)
+{
+    bool reuse = reuse_last_seed;
+    reuse_last_seed = true;
+    double* _sigLocal = sig_local_vecs[0];
+    std::vector<double> p_ref;
+    wxString clPath = GenUtils::GetExeDir() + "lisa_kernel.cl";
+    const char* names[] = {"threaded", "cpu kernel", "opencl"};
+    
+    wxString report;
+    report << num_obs << " observations, " << permutations
+           << " permutations, best of " << repeats << " runs\n";
+    for (int path=0; path<3; path++) {
+        if ((path == 1 && !CanUseCPUKernel()) || (path == 2 && csr_weights)) {
+            report << names[path] << ": not applicable\n";
+            continue;
+        }
+        long best = -1;
+        bool ok = true;
+        for (int r=0; r<repeats && ok; r++) {
+            wxStopWatch sw;
+            if (path == 0) {
+                CalcPseudoP_threaded();
+            } else if (path == 1) {
+                CalcPseudoP_CPUKernel();
+            } else {
+                ok = gpu_lisa(clPath.mb_str(), num_obs, permutations,
+                              last_seed_used, data1_vecs[0],
+                              local_moran_vecs[0], Gal_vecs[0]->gal,
+                              _sigLocal);
+            }
+            long ms = sw.Time();
+            if (best < 0 || ms < best) best = ms;
+        }
+        if (!ok) {
+            report << names[path] << ": no OpenCL device\n";
+            continue;
+        }
+        if (path == 0) p_ref.assign(_sigLocal, _sigLocal + num_obs);
+        int num_diff = 0;
+        for (int i=0; i<num_obs; i++) {
+            if (_sigLocal[i] != p_ref[i]) num_diff++;
+        }
+        report << names[path] << ": " << best << " ms, " << num_diff
+               << " p-values differ from threaded\n";
+    }
+    CalcPseudoP_threaded();
+    reuse_last_seed = reuse;
+    return report;
+}
+
+/** With more than one univariate variable (or time period) the lags of a
+ permutation are computed for all of them at once from batch_vals and
+ batch_valid: [obs][var] blocks where the values of one neighbor are
+ contiguous, so the loop over the variables vectorizes. */
+void LisaCoordinator::CalcPseudoP_threaded()
+{
+    batch_vals.clear();
+    batch_valid.clear();
+    if (!isBivariate && num_time_vals > 1) {
+        int nv = num_time_vals;
+        batch_vals.resize((size_t)num_obs * nv);
+        batch_valid.resize((size_t)num_obs * nv);
+        for (int v=0; v<nv; v++) {
+            double* data1 = data1_vecs[v];
+            std::vector<bool>& undefs = undef_tms[v];
+            for (int i=0; i<num_obs; i++) {
+                // adding 0 for an undefined neighbor gives the same sum as
+                // skipping it
+                batch_vals[(size_t)i*nv + v] = undefs[i] ? 0 : data1[i];
+                batch_valid[(size_t)i*nv + v] = undefs[i] ? 0 : 1;
+            }
+        }
+    }
+    AbstractCoordinator::CalcPseudoP_threaded();
+    batch_vals.clear();
+    batch_valid.clear();
+}
+
+void LisaCoordinator::ComputeLargerBatch(int cnt,
+                                         std::vector<int>& permNeighbors,
+                                         std::vector<uint64_t>& countLarger)
+{
+    int nv = num_time_vals;
+    int numNeighbors = permNeighbors.size();
+    std::vector<double> lags_v(nv, 0);
+    std::vector<double> valid_v(nv, 0);
+    double* lag = &lags_v[0];
+    double* valid = &valid_v[0];
+    
+    for (int cp=0; cp<numNeighbors; cp++) {
+        size_t offset = (size_t)permNeighbors[cp] * nv;
+        const double* vals = &batch_vals[offset];
+        const double* flags = &batch_valid[offset];
+        for (int v=0; v<nv; v++) {
+            lag[v] += vals[v];
+            valid[v] += flags[v];
+        }
+    }
+    for (int v=0; v<nv; v++) {
+        if (valid[v] > 0 && row_standardize) {
+            lag[v] /= valid[v];
+        }
+        if (lag[v] * data1_vecs[v][cnt] >= local_moran_vecs[v][cnt]) {
+            countLarger[v]++;
+        }
+    }
+}
+
 void LisaCoordinator::ComputeLarger(int cnt, std::vector<int>& permNeighbors, std::vector<uint64_t>& countLarger)
 {
+    if (!batch_vals.empty()) {
+        ComputeLargerBatch(cnt, permNeighbors, countLarger);
+        return;
+    }
     // for each time step, reuse permuation
     for (int t=0; t<num_time_vals; t++) {
         double *data1;
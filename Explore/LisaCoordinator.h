@@ -53,6 +53,24 @@ public:
                     bool calc_significances_s = true,
                     bool row_standardize_s = true);
     
+    /** Univariate LISA of several variables with the same weights: each
+     permutation is drawn once and scored for every variable.  The results
+     of vars[v] are local_moran_vecs[v], GetLocalSignificanceValues(v),
+     GetSigCatIndicators(v) and GetClusterIndicators(v). */
+    LisaCoordinator(wxString weights_path,
+                    int n,
+                    const std::vector<std::vector<double> >& vars,
+                    int permutations_s = 599,
+                    bool calc_significances_s = true,
+                    bool row_standardize_s = true);
+    
+    /** Batch LISA on CSR weights; takes ownership of w */
+    LisaCoordinator(CsrWeight* w,
+                    const std::vector<std::vector<double> >& vars,
+                    int permutations_s = 599,
+                    bool calc_significances_s = true,
+                    bool row_standardize_s = true);
+    
 	virtual ~LisaCoordinator();
 	
 
@@ -62,6 +80,19 @@ protected:
 	double* lags;
 	double*	localMoran;		// The LISA
 	double* sigLocalMoran;	// The significances / pseudo p-vals
+    
+    // batch_vals[obs*num_time_vals + t]: standardized value, 0 if undefined
+    std::vector<double> batch_vals;
+    // batch_valid[obs*num_time_vals + t]: 1 if defined, 0 if undefined
+    std::vector<double> batch_valid;
+    
+    void ReadWeightsFile(const wxString& weights_path);
+    void InitBatch(int n, const std::vector<std::vector<double> >& vars,
+                   int permutations_s, bool calc_significances_s,
+                   bool row_standardize_s);
+    void CalcCsr(int t, const std::vector<bool>& undefs, bool copy_weights);
+    void ComputeLargerBatch(int cnt, std::vector<int>& permNeighbors,
+                            std::vector<uint64_t>& countLarger);
 
 public:
     std::vector<double*> smoothed_results; // LISA EB
@@ -80,6 +111,11 @@ public:
 	virtual void DeallocateVectors();
 	virtual void AllocateVectors();
     virtual void CalcPseudoP();
+    virtual void CalcPseudoP_threaded();
+    
+    bool CanUseCPUKernel();
+    void CalcPseudoP_CPUKernel();
+    wxString BenchmarkPseudoP(int repeats = 3);
     
     void GetRawData(int time, double* data1, double* data2);
 	void StandardizeData();
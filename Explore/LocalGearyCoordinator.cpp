@@ -19,6 +19,7 @@
 
 #include <time.h>
 #include <math.h>
+#include <boost/bind.hpp>
 #include <wx/log.h>
 #include <wx/filename.h>
 #include <wx/stopwatch.h>
@@ -31,53 +32,12 @@
 
 #include "../logger.h"
 #include "../Project.h"
+#include "../GdaThreadPool.h"
 #include "LocalGearyCoordinatorObserver.h"
 #include "LocalGearyCoordinator.h"
 
 using namespace std;
 
-LocalGearyWorkerThread::LocalGearyWorkerThread(int obs_start_s, int obs_end_s,
-                                               uint64_t	seed_start_s,
-                                               LocalGearyCoordinator* local_geary_coord_s,
-                                               wxMutex* worker_list_mutex_s,
-                                               wxCondition* worker_list_empty_cond_s,
-                                               std::list<wxThread*> *worker_list_s,
-                                               int thread_id_s)
-: wxThread(),
-obs_start(obs_start_s), obs_end(obs_end_s), seed_start(seed_start_s),
-local_geary_coord(local_geary_coord_s),
-worker_list_mutex(worker_list_mutex_s),
-worker_list_empty_cond(worker_list_empty_cond_s),
-worker_list(worker_list_s),
-thread_id(thread_id_s)
-{
-}
-
-LocalGearyWorkerThread::~LocalGearyWorkerThread()
-{
-}
-
-wxThread::ExitCode LocalGearyWorkerThread::Entry()
-{
-    LOG_MSG(wxString::Format("LocalGearyWorkerThread %d started", thread_id));
-    
-    // call work for assigned range of observations
-    local_geary_coord->CalcPseudoP_range(obs_start, obs_end, seed_start);
-    
-    wxMutexLocker lock(*worker_list_mutex);
-    
-    // remove ourself from the list
-    worker_list->remove(this);
-    
-    // if empty, signal on empty condition since only main thread
-    // should be waiting on this condition
-    if (worker_list->empty()) {
-        worker_list_empty_cond->Signal();
-    }
-    
-    return NULL;
-}
-
 LocalGearyCoordinator::LocalGearyCoordinator(boost::uuids::uuid weights_id,
                                 Project* project,
                                 const vector<GdaVarTools::VarInfo>& var_info_s,
@@ -98,7 +58,8 @@ data(var_info_s.size()),
 undef_data(var_info_s.size()),
 last_seed_used(123456789),
 reuse_last_seed(true),
-row_standardize(row_standardize_s)
+row_standardize(row_standardize_s),
+bo(0), fdr(0), user_sig_cutoff(0)
 {
     wxLogMessage("In LocalGearyCoordinator::LocalGearyCoordinator()");
     reuse_last_seed = GdaConst::use_gda_user_seed;
@@ -132,6 +93,9 @@ LocalGearyCoordinator::LocalGearyCoordinator(wxString weights_path, int n, vecto
     permutations = permutations_s;
     calc_significances = calc_significances_s;
     row_standardize = row_standardize_s;
+    bo = 0;
+    fdr = 0;
+    user_sig_cutoff = 0;
     last_seed_used = 0;
     reuse_last_seed = false;
     num_vars = vars.size();
@@ -756,87 +720,50 @@ void LocalGearyCoordinator::CalcPseudoP()
 void LocalGearyCoordinator::CalcPseudoP_threaded()
 {
     wxLogMessage("In LocalGearyCoordinator::CalcPseudoP_threaded()");
-    int nCPUs = GdaConst::gda_cpu_cores;
-    if (!GdaConst::gda_set_cpu_cores)
-        nCPUs = wxThread::GetCPUCount();
-	
-	// mutext protects access to the worker_list
-    wxMutex worker_list_mutex;
-	// signals that worker_list is empty
-	wxCondition worker_list_empty_cond(worker_list_mutex);
-	worker_list_mutex.Lock(); // mutex should be initially locked
-	
-    // List of all the threads currently alive.  As soon as the thread
-	// terminates, it removes itself from the list.
-	list<wxThread*> worker_list;
-	
-	// divide up work according to number of observations
-	// and number of CPUs
-	int work_chunk = num_obs / nCPUs;
-    if (work_chunk == 0) work_chunk = 1;
-    
-	int obs_start = 0;
-	int obs_end = obs_start + work_chunk;
-
-    bool is_thread_error = false;
-	int quotient = num_obs / nCPUs;
-	int remainder = num_obs % nCPUs;
-	int tot_threads = (quotient > 0) ? nCPUs : remainder;
 	if (!reuse_last_seed) last_seed_used = time(0);
-    
-	for (int i=0; i<tot_threads && !is_thread_error; i++) {
-		int a=0;
-		int b=0;
-		if (i < remainder) {
-			a = i*(quotient+1);
-			b = a+quotient;
-		} else {
-			a = remainder*(quotient+1) + (i-remainder)*quotient;
-			b = a+quotient-1;
-		}
-		uint64_t seed_start = last_seed_used + a;
-		uint64_t seed_end = seed_start + ((uint64_t) (b-a));
-        int thread_id = i+1;
-        LocalGearyWorkerThread* thread =
-        new LocalGearyWorkerThread(a, b, seed_start, this,
-                                   &worker_list_mutex,
-                                   &worker_list_empty_cond,
-                                   &worker_list, thread_id);
-        if ( thread->Create() != wxTHREAD_NO_ERROR ) {
-            delete thread;
-            is_thread_error = true;
-        } else {
-            worker_list.push_front(thread);
-        }
-	}
-    if (is_thread_error) {
-        // fall back to single thread calculation mode
-        CalcPseudoP_range(0, num_obs-1, last_seed_used);
-    } else {
-        std::list<wxThread*>::iterator it;
-        for (it = worker_list.begin(); it != worker_list.end(); it++) {
-            (*it)->Run();
-        }
-        
-        while (!worker_list.empty()) {
-            // wait until thread_list might be empty
-            worker_list_empty_cond.Wait();
-            // We have been woken up. If this was not a false
-            // alarm (sprious signal), the loop will exit.
+    InitPermutationTable();
+    perms_used.assign(num_time_vals, std::vector<int>(num_obs, 0));
+    GdaThreadPoolStats stats;
+    GdaThreadPool::GetInstance().ParallelFor(num_obs,
+        boost::bind(&LocalGearyCoordinator::CalcPseudoP_range, this, _1, _2),
+        GdaThreadPool::permutation_chunk_size, &stats);
+    wxLogMessage("%s", stats.ToString());
+    wxLogMessage("%s", PermutationStopRule::Summarize(perms_used, permutations));
+    perm_cands.Reset();
+    wxLogMessage("End LocalGearyCoordinator::CalcPseudoP_threaded()");
+}
+
+void LocalGearyCoordinator::InitPermutationTable()
+{
+    // candidates match the rejection test in CalcPseudoP_range
+    GalElement* w = Gal_vecs[num_time_vals-1]->gal;
+    std::vector<bool> is_candidate(num_obs);
+    int max_card = 0;
+    for (int i=0; i<num_obs; i++) {
+        is_candidate[i] = w[i].Size() > 0;
+        for (int t=0; t<num_time_vals; t++) {
+            int nn = Gal_vecs[t]->gal[i].Size();
+            if (nn > max_card) max_card = nn;
         }
     }
-    wxLogMessage("End LocalGearyCoordinator::CalcPseudoP_threaded()");
+    perm_cands.Init(is_candidate, permutations, max_card, last_seed_used);
 }
 
-void LocalGearyCoordinator::CalcPseudoP_range(int obs_start, int obs_end, uint64_t seed_start)
+void LocalGearyCoordinator::CalcPseudoP_range(int obs_start, int obs_end)
 {
 	GeoDaSet workPermutation(num_obs);
 	int max_rand = num_obs-1;
+    uint64_t seed_key = Gda::CounterRng::SeedKey(last_seed_used);
+    PermutationStopRule stop_rule(GdaConst::gda_perm_early_stop,
+        PermutationStopRule::GetMaxCutoff(significance_cutoff,
+                                          user_sig_cutoff));
     
 	for (int cnt=obs_start; cnt<=obs_end; cnt++) {
         std::vector<uint64_t> countLarger(num_time_vals, 0);
         std::vector<std::vector<double> > gci(num_time_vals);
         std::vector<double> gci_sum(num_time_vals, 0);
+        // running count of gci <= local geary, for the stopping rule
+        std::vector<uint64_t> countNotLarger(num_time_vals, 0);
         
         for (int t=0; t<num_time_vals; t++) gci[t].resize(permutations, 0);
        
@@ -854,22 +781,40 @@ void LocalGearyCoordinator::CalcPseudoP_range(int obs_start, int obs_end, uint64
             continue;
         }
        
+        uint64_t obs_key = Gda::CounterRng::SubKey(seed_key, cnt);
+        std::vector<int> permNeighbors(numNeighbors);
+        int perms_done = 0;
 		for (int perm=0; perm<permutations; perm++) {
-			int rand=0;
-			while (rand < numNeighbors) {
-				// computing 'perfect' permutation of given size
-                double rng_val = Gda::ThomasWangHashDouble(seed_start++) * max_rand;
-                // round is needed to fix issue
-                //https://github.com/GeoDaCenter/geoda/issues/488
-				int newRandom = (int) (rng_val < 0.0 ? ceil(rng_val - 0.5) : floor(rng_val + 0.5));
-				if (newRandom != cnt && !workPermutation.Belongs(newRandom) && w[newRandom].Size()>0) {
-					workPermutation.Push(newRandom);
-					rand++;
-				}
-			}
-            std::vector<int> permNeighbors(numNeighbors);
-            for (int cp=0; cp<numNeighbors; cp++) {
-                permNeighbors[cp] = workPermutation.Pop();
+            if (stop_rule.IsEnabled() && perm > 0) {
+                // the tail is picked by the mean of gci so far, as below
+                bool can_stop = true;
+                for (int t=0; t<num_time_vals && can_stop; t++) {
+                    uint64_t e = countNotLarger[t];
+                    if (local_geary_vecs[t][cnt] > gci_sum[t] / perm) {
+                        e = perm - e;
+                    }
+                    can_stop = stop_rule.CanStop(e, perm);
+                }
+                if (can_stop) break;
+            }
+            perms_done++;
+            if (!perm_cands.GetPermNeighbors(perm, cnt, permNeighbors)) {
+                int rand=0;
+                Gda::CounterRng rng(Gda::CounterRng::SubKey(obs_key, perm));
+                while (rand < numNeighbors) {
+                    // computing 'perfect' permutation of given size
+                    double rng_val = rng.NextDouble() * max_rand;
+                    // round is needed to fix issue
+                    //https://github.com/GeoDaCenter/geoda/issues/488
+                    int newRandom = (int) (rng_val < 0.0 ? ceil(rng_val - 0.5) : floor(rng_val + 0.5));
+                    if (newRandom != cnt && !workPermutation.Belongs(newRandom) && w[newRandom].Size()>0) {
+                        workPermutation.Push(newRandom);
+                        rand++;
+                    }
+                }
+                for (int cp=0; cp<numNeighbors; cp++) {
+                    permNeighbors[cp] = workPermutation.Pop();
+                }
             }
             // for each time step, reuse permuation
             for (int t=0; t<num_time_vals; t++) {
@@ -968,6 +913,9 @@ void LocalGearyCoordinator::CalcPseudoP_range(int obs_start, int obs_end, uint64
                     }
                 }
                 gci_sum[t] += gci[t][perm];
+                if (gci[t][perm] <= local_geary_vecs[t][cnt]) {
+                    countNotLarger[t]++;
+                }
             }
 		}
         // end permutation
@@ -977,11 +925,12 @@ void LocalGearyCoordinator::CalcPseudoP_range(int obs_start, int obs_end, uint64
             double* _siglocalGeary = sig_local_geary_vecs[t];
             int* _sigCat = sig_cat_vecs[t];
             int* _cluster = cluster_vecs[t];
+            perms_used[t][cnt] = perms_done;
             // calc mean of gci
-            double gci_mean = gci_sum[t] / permutations;
+            double gci_mean = gci_sum[t] / perms_done;
             if (_localGeary[cnt] <= gci_mean) {
                 // positive lisasign[cnt] = 1
-                for (int perm=0; perm<permutations; perm++) {
+                for (int perm=0; perm<perms_done; perm++) {
                     if (gci[t][perm] <= _localGeary[cnt]) {
                         countLarger[t] += 1;
                     }
@@ -1001,7 +950,7 @@ void LocalGearyCoordinator::CalcPseudoP_range(int obs_start, int obs_end, uint64
                 }
             } else {
                 // negative lisasign[cnt] = -1
-                for (int perm=0; perm<permutations; perm++) {
+                for (int perm=0; perm<perms_done; perm++) {
                     if (gci[t][perm] > _localGeary[cnt]) {
                         countLarger[t] += 1;
                     }
@@ -1016,7 +965,7 @@ void LocalGearyCoordinator::CalcPseudoP_range(int obs_start, int obs_end, uint64
                 }
             }
             int kp = local_geary_type == multivariate ? num_vars : 1;
-            _siglocalGeary[cnt] = (countLarger[t]+1.0)/(permutations+1);
+            _siglocalGeary[cnt] = (countLarger[t]+1.0)/(perms_done+1);
             
             // 'significance' of local Moran
             if (_siglocalGeary[cnt] <= 0.0001) _sigCat[cnt] = 4;
@@ -23,6 +23,7 @@
 #include <list>
 #include <vector>
 #include <boost/multi_array.hpp>
+#include <boost/shared_ptr.hpp>
 #include <wx/string.h>
 #include <wx/thread.h>
 #include "../VarTools.h"
@@ -30,6 +31,8 @@
 #include "../ShapeOperations/GalWeight.h"
 #include "../ShapeOperations/WeightsManStateObserver.h"
 #include "../ShapeOperations/OGRDataAdapter.h"
+#include "PermutationTable.h"
+#include "PermutationStopRule.h"
 
 using namespace std;
 
@@ -40,29 +43,6 @@ class WeightsManState;
 typedef boost::multi_array<double, 2> d_array_type;
 typedef boost::multi_array<bool, 2> b_array_type;
 
-class LocalGearyWorkerThread : public wxThread
-{
-public:
-    LocalGearyWorkerThread(int obs_start, int obs_end, uint64_t seed_start,
-                           LocalGearyCoordinator* local_geary_coord,
-                           wxMutex* worker_list_mutex,
-                           wxCondition* worker_list_empty_cond,
-                           std::list<wxThread*> *worker_list,
-                           int thread_id);
-    virtual ~LocalGearyWorkerThread();
-    virtual void* Entry();  // thread execution starts here
-    
-    int obs_start;
-    int obs_end;
-    uint64_t seed_start;
-    int thread_id;
-    
-    LocalGearyCoordinator* local_geary_coord;
-    wxMutex* worker_list_mutex;
-    wxCondition* worker_list_empty_cond;
-    std::list<wxThread*> *worker_list;
-};
-
 class LocalGearyCoordinator : public WeightsManStateObserver
 {
 public:
@@ -147,6 +127,8 @@ public:
 	vector<double*> lags_vecs;
 	vector<double*> local_geary_vecs;
 	vector<double*> sig_local_geary_vecs;
+	// perms_used[time][obs]: less than permutations if stopped early
+	vector<vector<int> > perms_used;
 	vector<int*> sig_cat_vecs;
 	vector<int*> cluster_vecs;
     
@@ -196,9 +178,7 @@ public:
 	list<LocalGearyCoordinatorObserver*> observers;
 	
 	void CalcPseudoP();
-	void CalcPseudoP_range(int obs_start,
-                           int obs_end,
-                           uint64_t seed_start);
+	void CalcPseudoP_range(int obs_start, int obs_end);
 
 	void InitFromVarInfo();
 	void VarInfoAttributeChange();
@@ -210,6 +190,7 @@ protected:
 	void AllocateVectors();
 	
 	void CalcPseudoP_threaded();
+	void InitPermutationTable();
 	void CalcLocalGeary();
 	void CalcMultiLocalGeary();
 	void StandardizeData();
@@ -220,6 +201,9 @@ protected:
 	uint64_t last_seed_used;
 	bool reuse_last_seed;
 	
+	// shared permutation table, empty when drawing per observation
+	PermutationCandidates perm_cands;
+	
 	WeightsManState* w_man_state;
 	WeightsManInterface* w_man_int;
     
@@ -18,6 +18,7 @@
  */
 
 #include <time.h>
+#include <boost/bind.hpp>
 #include <boost/math/distributions/normal.hpp> // for normal_distribution
 #include <algorithm>
 #include <functional>
@@ -27,55 +28,18 @@
 #include <wx/msgdlg.h>
 
 #include "../Algorithms/gpu_lisa.h"
+#include "../Algorithms/cpu_lisa.h"
+#include "../Algorithms/bit_jc.h"
 #include "../DataViewer/TableInterface.h"
 #include "../ShapeOperations/Randik.h"
 #include "../ShapeOperations/WeightsManState.h"
 #include "../VarCalc/WeightsManInterface.h"
 #include "../logger.h"
 #include "../Project.h"
+#include "../GdaThreadPool.h"
 #include "MLJCCoordinatorObserver.h"
 #include "MLJCCoordinator.h"
 
-///////////////////////////////////////////////////////////////////////////////
-//
-// JCWorkerThread
-//
-///////////////////////////////////////////////////////////////////////////////
-JCWorkerThread::JCWorkerThread(int t_, int obs_start_s, int obs_end_s, uint64_t seed_start_s, JCCoordinator* jc_coord_s, wxMutex* worker_list_mutex_s, wxCondition* worker_list_empty_cond_s, std::list<wxThread*> *worker_list_s,int thread_id_s)
-: wxThread(),
-t(t_),
-obs_start(obs_start_s), obs_end(obs_end_s), seed_start(seed_start_s),
-jc_coord(jc_coord_s),
-worker_list_mutex(worker_list_mutex_s),
-worker_list_empty_cond(worker_list_empty_cond_s),
-worker_list(worker_list_s),
-thread_id(thread_id_s)
-{
-}
-
-JCWorkerThread::~JCWorkerThread()
-{
-}
-
-wxThread::ExitCode JCWorkerThread::Entry()
-{
-	LOG_MSG(wxString::Format("JCWorkerThread %d started", thread_id));
-	// call work for assigned range of observations
-	jc_coord->CalcPseudoP_range(t, obs_start, obs_end, seed_start);
-	
-	wxMutexLocker lock(*worker_list_mutex);
-	// remove ourself from the list
-	worker_list->remove(this);
-	// if empty, signal on empty condition since only main thread
-	// should be waiting on this condition
-	if (worker_list->empty()) {
-		worker_list_empty_cond->Signal();
-	}
-	
-	return NULL;
-}
-
-
 ///////////////////////////////////////////////////////////////////////////////
 //
 // JCCoordinator
@@ -90,7 +54,8 @@ permutations(999),
 var_info(var_info_s),
 data(var_info_s.size()),
 undef_data(var_info_s.size()),
-last_seed_used(123456789), reuse_last_seed(true)
+last_seed_used(123456789), reuse_last_seed(true),
+bo(0), fdr(0), user_sig_cutoff(0)
 {
     reuse_last_seed = GdaConst::use_gda_user_seed;
     if ( GdaConst::use_gda_user_seed) {
@@ -313,6 +278,9 @@ void JCCoordinator::FillClusterCats(int canvas_time, std::vector<wxInt64>& c_val
 
 void JCCoordinator::CalcMultiLocalJoinCount()
 {
+    zz_bits.clear();
+    if (GdaConst::gda_use_bitset_jc) zz_bits.resize(num_time_vals);
+    
 	for (int t=0; t<num_time_vals; t++) {
         // get undefs of objects/values at this time step
         vector<bool> undefs;
@@ -364,6 +332,17 @@ void JCCoordinator::CalcMultiLocalJoinCount()
         }
        
         int* zz = zz_vecs[t];
+        if (GdaConst::gda_use_bitset_jc) {
+            // co-location as AND of bitsets, join counts by popcount
+            vector<const double*> vars;
+            for (int v=0; v<num_vars; v++) {
+                vars.push_back(data_vecs[v][local_t[v]]);
+            }
+            bit_localjoincount(num_obs, vars, undefs, W, zz, local_jc,
+                               zz_bits[t]);
+            continue;
+        }
+        
 		for (int i=0; i<num_obs; i++) {
             if (undefs[i] == true) {
                 zz[i] = 0;
@@ -438,11 +417,17 @@ void JCCoordinator::CalcPseudoP()
 {
 	LOG_MSG("Entering JCCoordinator::CalcPseudoP");
 	wxStopWatch sw_vd;
+    perms_used.assign(num_time_vals, vector<int>(num_obs, 0));
     
     if (GdaConst::gda_use_gpu == false) {
+        bool use_kernel = GdaConst::gda_use_cpu_kernel &&
+            !GdaConst::gda_use_perm_table && !GdaConst::gda_perm_early_stop;
         for (int t=0; t<num_time_vals; t++) {
-            CalcPseudoP_threaded(t);
+            if (use_kernel) CalcPseudoP_CPUKernel(t);
+            else CalcPseudoP_threaded(t);
         }
+        wxLogMessage("%s", PermutationStopRule::Summarize(perms_used,
+                                                          permutations));
     } else {
         for (int t=0; t<num_time_vals; t++) {
             vector<int> local_t;
@@ -487,91 +472,73 @@ void JCCoordinator::CalcPseudoP()
 void JCCoordinator::CalcPseudoP_threaded(int t)
 {
 	LOG_MSG("Entering JCCoordinator::CalcPseudoP_threaded");
-    int nCPUs = GdaConst::gda_cpu_cores;
-    if (!GdaConst::gda_set_cpu_cores)
-        nCPUs = wxThread::GetCPUCount();
-	
-	// mutext protects access to the worker_list
-    wxMutex worker_list_mutex;
-	// signals that worker_list is empty
-	wxCondition worker_list_empty_cond(worker_list_mutex);
-	worker_list_mutex.Lock(); // mutex should be initially locked
-	
-    // List of all the threads currently alive.  As soon as the thread
-	// terminates, it removes itself from the list.
-	std::list<wxThread*> worker_list;
-	
-	// divide up work according to number of observations
-	// and number of CPUs
-	int work_chunk = num_obs / nCPUs;
-	int obs_start = 0;
-	int obs_end = obs_start + work_chunk;
-	
-	bool is_thread_error = false;
-	int quotient = num_obs / nCPUs;
-	int remainder = num_obs % nCPUs;
-	int tot_threads = (quotient > 0) ? nCPUs : remainder;
-	
 	if (!reuse_last_seed) last_seed_used = time(0);
-	for (int i=0; i<tot_threads && !is_thread_error; i++) {
-		int a=0;
-		int b=0;
-		if (i < remainder) {
-			a = i*(quotient+1);
-			b = a+quotient;
-		} else {
-			a = remainder*(quotient+1) + (i-remainder)*quotient;
-			b = a+quotient-1;
-		}
-		uint64_t seed_start = last_seed_used+a;
-		uint64_t seed_end = seed_start + ((uint64_t) (b-a));
-		int thread_id = i+1;
-		
-		JCWorkerThread* thread =
-			new JCWorkerThread(t, a, b, seed_start, this,
-								  &worker_list_mutex,
-								  &worker_list_empty_cond,
-								  &worker_list, thread_id);
-		if ( thread->Create() != wxTHREAD_NO_ERROR ) {
-			delete thread;
-			is_thread_error = true;
-		} else {
-			worker_list.push_front(thread);
+	InitPermutationTable(t);
+	GdaThreadPoolStats stats;
+	GdaThreadPool::GetInstance().ParallelFor(num_obs,
+		boost::bind(&JCCoordinator::CalcPseudoP_range, this, t, _1, _2),
+		GdaThreadPool::permutation_chunk_size, &stats);
+	wxLogMessage("%s", stats.ToString());
+	perm_cands.Reset();
+	LOG_MSG("Exiting JCCoordinator::CalcPseudoP_threaded");
+}
+
+void JCCoordinator::CalcPseudoP_CPUKernel(int t)
+{
+	LOG_MSG("Entering JCCoordinator::CalcPseudoP_CPUKernel");
+	if (!reuse_last_seed) last_seed_used = time(0);
+	GalElement* W = Gal_vecs[t]->gal;
+	std::vector<bool>& undefs = undef_tms[t];
+	double* local_jc = local_jc_vecs[t];
+	std::vector<int> num_nbrs(num_obs);
+	std::vector<char> undef_flags(num_obs);
+	for (int i=0; i<num_obs; i++) {
+		num_nbrs[i] = W[i].Size();
+		undef_flags[i] = undefs[i] ? 1 : 0;
+		if (!undefs[i] && local_jc[i] != 0 && num_nbrs[i] > 0) {
+			perms_used[t][i] = permutations;
 		}
 	}
-	if (is_thread_error) {
-		// fall back to single thread calculation mode
-		CalcPseudoP_range(t, 0, num_obs-1, last_seed_used);
-	} else {
-		std::list<wxThread*>::iterator it;
-		for (it = worker_list.begin(); it != worker_list.end(); it++) {
-			(*it)->Run();
-		}
-		
-		while (!worker_list.empty()) {
-			// wait until thread_list might be empty
-			worker_list_empty_cond.Wait();
-			// We have been woken up. If this was not a false
-			// alarm (spurious signal), the loop will exit.
-		}
+	cpu_localjoincount(num_obs, permutations, last_seed_used, zz_vecs[t],
+					   local_jc, &num_nbrs[0], &undef_flags[0],
+					   sig_local_jc_vecs[t]);
+	LOG_MSG("Exiting JCCoordinator::CalcPseudoP_CPUKernel");
+}
+
+void JCCoordinator::InitPermutationTable(int t)
+{
+	// any observation with a defined value can be drawn in time period t
+	GalElement* W = Gal_vecs[t]->gal;
+	std::vector<bool>& undefs = undef_tms[t];
+	std::vector<bool> is_candidate(num_obs);
+	int max_card = 0;
+	for (int i=0; i<num_obs; i++) {
+		is_candidate[i] = !undefs[i];
+		if (undefs[i]) continue;
+		if (W[i].Size() > max_card) max_card = W[i].Size();
 	}
-	LOG_MSG("Exiting JCCoordinator::CalcPseudoP_threaded");
+	perm_cands.Init(is_candidate, permutations, max_card, last_seed_used);
 }
 
 /** In the code that computes Gi and Gi*, we specifically checked for 
  self-neighbors and handled the situation appropriately.  For the
  permutation code, we will disallow self-neighbors. */
-void JCCoordinator::CalcPseudoP_range(int t, int obs_start, int obs_end, uint64_t seed_start)
+void JCCoordinator::CalcPseudoP_range(int t, int obs_start, int obs_end)
 {
 	GeoDaSet workPermutation(num_obs);
     
 	int max_rand = num_obs-1;
+    uint64_t seed_key = Gda::CounterRng::SeedKey(last_seed_used);
+    PermutationStopRule stop_rule(GdaConst::gda_perm_early_stop,
+        PermutationStopRule::GetMaxCutoff(significance_cutoff,
+                                          user_sig_cutoff));
     
     GalElement* W = Gal_vecs[t]->gal;
     int* zz = zz_vecs[t];
     double* local_jc = local_jc_vecs[t];
     std::vector<bool>& undefs = undef_tms[t];
     double* pseudo_p = sig_local_jc_vecs[t];
+    const JoinCountBits* bits = (size_t) t < zz_bits.size() ? &zz_bits[t] : NULL;
     
     vector<int> local_t;
     int delta_t = t - var_info[0].time;
@@ -600,40 +567,58 @@ void JCCoordinator::CalcPseudoP_range(int t, int obs_start, int obs_end, uint64_
 			int countLarger = 0;
 			double permuted = 0;
             
+            uint64_t obs_key = Gda::CounterRng::SubKey(seed_key, i);
+            std::vector<int> permNeighbors(numNeighsI);
+            int perms_done = 0;
+            
 			for (int perm=0; perm < permutations; perm++) {
-				int rand = 0;
-				while (rand < numNeighsI) {
-					// computing 'perfect' permutation of given size
-                    double rng_val = Gda::ThomasWangHashDouble(seed_start++) * max_rand;
-                    // round is needed to fix issue
-                    //https://github.com/GeoDaCenter/geoda/issues/488
-                    int newRandom = (int) (rng_val < 0.0 ? ceil(rng_val - 0.5) : floor(rng_val + 0.5));
-                    
-					if (newRandom != i &&
-                        !workPermutation.Belongs(newRandom) &&
-                        undefs[newRandom] == false)
-					{
-						workPermutation.Push(newRandom);
-						rand++;
-					}
-				}
+                if (stop_rule.CanStop(PermutationStopRule::Fold(countLarger, perm), perm)) {
+                    break;
+                }
+                perms_done++;
+                if (!perm_cands.GetPermNeighbors(perm, i, permNeighbors)) {
+                    int rand = 0;
+                    Gda::CounterRng rng(Gda::CounterRng::SubKey(obs_key, perm));
+                    while (rand < numNeighsI) {
+                        // computing 'perfect' permutation of given size
+                        double rng_val = rng.NextDouble() * max_rand;
+                        // round is needed to fix issue
+                        //https://github.com/GeoDaCenter/geoda/issues/488
+                        int newRandom = (int) (rng_val < 0.0 ? ceil(rng_val - 0.5) : floor(rng_val + 0.5));
+                        
+                        if (newRandom != i &&
+                            !workPermutation.Belongs(newRandom) &&
+                            undefs[newRandom] == false)
+                        {
+                            workPermutation.Push(newRandom);
+                            rand++;
+                        }
+                    }
+                    for (int j=0; j<numNeighsI; j++) {
+                        permNeighbors[j] = workPermutation.Pop();
+                    }
+                }
 				
 				double perm_jc = 0;
 				// use permutation to compute the lags
-				for (int j=0; j<numNeighsI; j++) {
-                    int perm_idx = workPermutation.Pop();
-                    perm_jc += zz[perm_idx];
+				if (bits) {
+                    perm_jc = bits->CountAt(&permNeighbors[0], numNeighsI);
+				} else {
+                    for (int j=0; j<numNeighsI; j++) {
+                        perm_jc += zz[permNeighbors[j]];
+                    }
 				}
 		
                 // binary weights
                 permuted = perm_jc;
 				if (permuted >= local_jc[i]) countLarger++;
 			}
+			perms_used[t][i] = perms_done;
 			// pick the smallest
-			if (permutations-countLarger < countLarger) {
-				countLarger=permutations - countLarger;
+			if (perms_done-countLarger < countLarger) {
+				countLarger=perms_done - countLarger;
 			}
-			pseudo_p[i] = (countLarger + 1.0)/(permutations+1.0);
+			pseudo_p[i] = (countLarger + 1.0)/(perms_done+1.0);
 		}
 	}
 }
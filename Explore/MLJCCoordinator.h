@@ -34,12 +34,16 @@
 #include <list>
 #include <vector>
 #include <boost/multi_array.hpp>
+#include <boost/shared_ptr.hpp>
 #include <wx/string.h>
 #include <wx/thread.h>
 #include "../VarTools.h"
 #include "../ShapeOperations/GalWeight.h"
 #include "../ShapeOperations/WeightsManStateObserver.h"
 #include "../ShapeOperations/OGRDataAdapter.h"
+#include "PermutationTable.h"
+#include "PermutationStopRule.h"
+#include "../Algorithms/bit_jc.h"
 
 
 class JCCoordinatorObserver; 
@@ -49,32 +53,6 @@ class WeightsManState;
 typedef boost::multi_array<double, 2> d_array_type;
 typedef boost::multi_array<bool, 2> b_array_type;
 
-class JCWorkerThread : public wxThread
-{
-public:
-    JCWorkerThread(int t,
-                   int obs_start, int obs_end, uint64_t seed_start,
-                   JCCoordinator* jc_coord,
-                   wxMutex* worker_list_mutex,
-                   wxCondition* worker_list_empty_cond,
-                   std::list<wxThread*> *worker_list,
-                   int thread_id);
-    
-	virtual ~JCWorkerThread();
-	virtual void* Entry();  // thread execution starts here
-
-    int t;
-	int obs_start;
-	int obs_end;
-	uint64_t seed_start;
-	int thread_id;
-	
-	JCCoordinator* jc_coord;
-	wxMutex* worker_list_mutex;
-	wxCondition* worker_list_empty_cond;
-	std::list<wxThread*> *worker_list;
-};
-
 class JCCoordinator : public WeightsManStateObserver
 {
 public:
@@ -130,8 +108,12 @@ public:
     vector<vector<double*> > data_vecs;
     vector<vector<bool> > undef_tms;
     vector<int*> zz_vecs;
+    // zz_vecs bit-packed, empty unless GdaConst::gda_use_bitset_jc
+    vector<JoinCountBits> zz_bits;
     vector<double*> local_jc_vecs;
     vector<double*> sig_local_jc_vecs;
+    // perms_used[time][obs]: less than permutations if stopped early
+    vector<vector<int> > perms_used;
     std::vector<std::vector<wxInt64> > num_neighbors;
 
     std::vector<GalWeight*> Gal_vecs;
@@ -171,10 +153,7 @@ public:
     std::list<JCCoordinatorObserver*> observers;
 	
 	void CalcPseudoP();
-	void CalcPseudoP_range(int t,
-                           int obs_start,
-                           int obs_end,
-                           uint64_t seed_start);
+	void CalcPseudoP_range(int t, int obs_start, int obs_end);
 	
 	void InitFromVarInfo();
     
@@ -193,6 +172,9 @@ protected:
 	uint64_t last_seed_used;
 	bool reuse_last_seed;
 	
+	// shared permutation table, empty when drawing per observation
+	PermutationCandidates perm_cands;
+	
 	WeightsManState* w_man_state;
 	WeightsManInterface* w_man_int;
     
@@ -200,6 +182,8 @@ protected:
 	void AllocateVectors();
     
 	void CalcPseudoP_threaded(int t);
+	void InitPermutationTable(int t);
+	void CalcPseudoP_CPUKernel(int t);
     
 	void CalcMultiLocalJoinCount();
 };
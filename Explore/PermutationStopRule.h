@@ -0,0 +1,109 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_PERMUTATION_STOP_RULE_H__
+#define __GEODA_CENTER_PERMUTATION_STOP_RULE_H__
+
+#include <math.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+/**
+ Sequential (Besag-Clifford style) stopping rule for the conditional
+ permutation tests of the local statistics.
+
+ After n permutations with `extreme` statistics at least as extreme as the
+ observed one, the pseudo p-value is (extreme+1)/(n+1).  Permuting an
+ observation stops once at least min_extreme extremes were seen and the
+ lower bound (extreme - 3*sqrt(extreme))/n is above max_cutoff: the
+ observation can then no longer become significant at any cutoff in use,
+ and only clearly non-significant observations lose precision.
+
+ The rule is checked every check_interval permutations so that stopping
+ points, and therefore results, do not depend on the thread layout.
+ */
+class PermutationStopRule
+{
+public:
+    PermutationStopRule(bool enabled_s, double max_cutoff_s)
+    : enabled(enabled_s), max_cutoff(max_cutoff_s) {}
+
+    bool IsEnabled() const { return enabled; }
+
+    /** true if the observation can stop after n permutations */
+    bool CanStop(uint64_t extreme, int n) const
+    {
+        if (!enabled || n % check_interval != 0) return false;
+        if (extreme < min_extreme) return false;
+        double e = (double) extreme;
+        return (e - 3.0 * sqrt(e)) / n > max_cutoff;
+    }
+
+    /** largest cutoff an observation may be classified against: the
+     fixed categories go up to 0.05, and the user cutoff can be set
+     freely.  The FDR bound is only known after the permutations, but
+     neither it nor the Bonferroni bound alpha/n is ever larger than the
+     cutoff alpha they are derived from, so they need no term of their
+     own. */
+    static double GetMaxCutoff(double significance_cutoff,
+                               double user_cutoff)
+    {
+        double c = 0.05;
+        if (significance_cutoff > c) c = significance_cutoff;
+        if (user_cutoff > c) c = user_cutoff;
+        return c;
+    }
+
+    /** folded count used by the two-sided tests: min(larger, n-larger) */
+    static uint64_t Fold(uint64_t larger, int n)
+    {
+        return (uint64_t) n - larger < larger ? (uint64_t) n - larger : larger;
+    }
+
+    /** one line summary of perms_used[time][obs] for the log; isolates
+     (0 permutations) are not counted */
+    static std::string Summarize(const std::vector<std::vector<int> >& perms_used,
+                                 int permutations)
+    {
+        uint64_t total = 0, stopped = 0, n = 0;
+        for (size_t t=0; t<perms_used.size(); t++) {
+            for (size_t i=0; i<perms_used[t].size(); i++) {
+                if (perms_used[t][i] == 0) continue;
+                total += perms_used[t][i];
+                if (perms_used[t][i] < permutations) stopped++;
+                n++;
+            }
+        }
+        std::ostringstream ss;
+        ss << "Permutations used: " << (n > 0 ? (double) total / n : 0)
+           << " per observation on average, " << stopped << " of " << n
+           << " observations stopped early";
+        return ss.str();
+    }
+
+    enum { check_interval = 32, min_extreme = 10 };
+
+protected:
+    bool enabled;
+    double max_cutoff;
+};
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <list>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <wx/log.h>
+
+#include "../GdaConst.h"
+#include "../GenUtils.h"
+#include "../GdaThreadPool.h"
+#include "PermutationTable.h"
+
+const size_t PermutationTable::max_table_entries = 64*1024*1024;
+const size_t PermutationTable::max_cached_tables = 4;
+
+static boost::mutex table_cache_mutex;
+static std::list<boost::shared_ptr<const PermutationTable> > table_cache;
+
+PermutationTable::PermutationTable(int num_candidates_s, int permutations_s,
+                                   int max_cardinality_s, uint64_t seed_s)
+: num_candidates(num_candidates_s),
+permutations(permutations_s),
+max_cardinality(max_cardinality_s),
+seed(seed_s)
+{
+    table.resize((size_t)permutations * max_cardinality);
+    // rows are independent: each row draws from its own counter stream
+    GdaThreadPool::GetInstance().ParallelFor(permutations,
+        boost::bind(&PermutationTable::FillRows, this, _1, _2), 256);
+}
+
+void PermutationTable::FillRows(int first, int last)
+{
+    int max_rank = num_candidates - 1; // ranks are drawn from [0, max_rank)
+    uint64_t seed_key = Gda::CounterRng::SeedKey(seed);
+    // stamp[r] == perm marks rank r as already drawn for row perm
+    std::vector<int> stamp(max_rank, -1);
+    for (int perm=first; perm<=last; perm++) {
+        int* row = &table[(size_t)perm * max_cardinality];
+        Gda::CounterRng rng(Gda::CounterRng::SubKey(seed_key, perm));
+        int rand = 0;
+        while (rand < max_cardinality) {
+            int r = (int) (rng.NextDouble() * max_rank);
+            if (r >= max_rank) r = max_rank - 1;
+            if (stamp[r] != perm) {
+                stamp[r] = perm;
+                row[rand++] = r;
+            }
+        }
+    }
+}
+
+boost::shared_ptr<const PermutationTable>
+PermutationTable::Get(int num_candidates, int permutations,
+                      int max_cardinality, uint64_t seed)
+{
+    boost::shared_ptr<const PermutationTable> result;
+    if (max_cardinality < 1 || max_cardinality > num_candidates - 1) {
+        return result;
+    }
+    if ((size_t)permutations * max_cardinality > max_table_entries) {
+        wxLogMessage("Permutation table of %d x %d is too large, "
+                     "drawing permutations per observation",
+                     permutations, max_cardinality);
+        return result;
+    }
+
+    boost::mutex::scoped_lock lock(table_cache_mutex);
+    std::list<boost::shared_ptr<const PermutationTable> >::iterator it;
+    for (it = table_cache.begin(); it != table_cache.end(); it++) {
+        const PermutationTable* t = it->get();
+        if (t->num_candidates == num_candidates &&
+            t->permutations == permutations &&
+            t->seed == seed &&
+            t->max_cardinality >= max_cardinality) {
+            result = *it;
+            // move to front: most recently used
+            table_cache.erase(it);
+            table_cache.push_front(result);
+            return result;
+        }
+    }
+    result.reset(new PermutationTable(num_candidates, permutations,
+                                      max_cardinality, seed));
+    table_cache.push_front(result);
+    while (table_cache.size() > max_cached_tables) table_cache.pop_back();
+    return result;
+}
+
+void PermutationTable::ClearCache()
+{
+    boost::mutex::scoped_lock lock(table_cache_mutex);
+    table_cache.clear();
+}
+
+void PermutationCandidates::Init(const std::vector<bool>& is_candidate,
+                                 int permutations, int max_cardinality,
+                                 uint64_t seed)
+{
+    table.reset();
+    if (!GdaConst::gda_use_perm_table) return;
+
+    int num_obs = is_candidate.size();
+    candidates.clear();
+    cand_rank.resize(num_obs);
+    for (int i=0; i<num_obs; i++) {
+        cand_rank[i] = -1;
+        if (is_candidate[i]) {
+            cand_rank[i] = candidates.size();
+            candidates.push_back(i);
+        }
+    }
+    table = PermutationTable::Get(candidates.size(), permutations,
+                                  max_cardinality, seed);
+}
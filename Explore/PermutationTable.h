@@ -0,0 +1,129 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_PERMUTATION_TABLE_H__
+#define __GEODA_CENTER_PERMUTATION_TABLE_H__
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ A permutations x max_cardinality table of random ranks shared by all
+ observations of a conditional randomization run.
+
+ Row perm holds max_cardinality distinct ranks drawn from
+ [0, num_candidates-2].  An observation with k neighbors uses the first k
+ ranks of each row; ranks at or above the observation's own rank are
+ shifted up by one, so the observation never draws itself, and the shifted
+ rank is looked up in the list of candidate neighbors.
+
+ Tables are cached for the session and shared across variables, time
+ periods and coordinators that use the same seed and number of
+ candidates.  A cached table with more columns also serves a request
+ with fewer columns, since any prefix of a row is still a random sample.
+ */
+class PermutationTable
+{
+public:
+    PermutationTable(int num_candidates, int permutations,
+                     int max_cardinality, uint64_t seed);
+
+    int GetNumCandidates() const { return num_candidates; }
+    int GetPermutations() const { return permutations; }
+    int GetMaxCardinality() const { return max_cardinality; }
+    uint64_t GetSeed() const { return seed; }
+
+    /** Fill perm_nbrs with the first perm_nbrs.size() random neighbors of
+     permutation perm for the candidate with rank self_rank. */
+    inline void GetPermNeighbors(int perm, int self_rank,
+                                 const std::vector<int>& candidates,
+                                 std::vector<int>& perm_nbrs) const
+    {
+        const int* row = &table[(size_t)perm * max_cardinality];
+        for (size_t cp=0; cp<perm_nbrs.size(); cp++) {
+            int r = row[cp];
+            if (r >= self_rank) r++;
+            perm_nbrs[cp] = candidates[r];
+        }
+    }
+
+    /** Return a cached or newly built table.  Returns an empty pointer if
+     the table would not fit in max_table_entries or there are not enough
+     candidates to draw max_cardinality distinct neighbors. */
+    static boost::shared_ptr<const PermutationTable>
+    Get(int num_candidates, int permutations, int max_cardinality,
+        uint64_t seed);
+
+    /** Drop all cached tables */
+    static void ClearCache();
+
+    /** upper bound on permutations * max_cardinality of one table */
+    static const size_t max_table_entries;
+
+    /** number of tables kept in the session cache */
+    static const size_t max_cached_tables;
+
+protected:
+    void FillRows(int first, int last);
+
+    int num_candidates;
+    int permutations;
+    int max_cardinality;
+    uint64_t seed;
+    std::vector<int> table;
+};
+
+/**
+ The candidate neighbors of a conditional randomization run and their
+ shared PermutationTable, as used by the local statistics coordinators.
+
+ The table only serves observations that are candidates themselves: a row
+ skips the rank of the drawing observation, which for any other observation
+ would be a valid neighbor.  Other observations, such as those with
+ neighbors in earlier time periods only, draw by rejection sampling.
+ */
+class PermutationCandidates
+{
+public:
+    /** Candidates are the observations with is_candidate set.  The table
+     is only set up if GdaConst::gda_use_perm_table is on. */
+    void Init(const std::vector<bool>& is_candidate, int permutations,
+              int max_cardinality, uint64_t seed);
+
+    /** Drop the table once the run is done */
+    void Reset() { table.reset(); }
+
+    /** Fill perm_nbrs with the random neighbors of obs for permutation
+     perm and return true, or return false if obs has to draw them itself. */
+    inline bool GetPermNeighbors(int perm, int obs,
+                                 std::vector<int>& perm_nbrs) const
+    {
+        if (!table || cand_rank[obs] < 0) return false;
+        table->GetPermNeighbors(perm, cand_rank[obs], candidates, perm_nbrs);
+        return true;
+    }
+
+protected:
+    boost::shared_ptr<const PermutationTable> table;
+    std::vector<int> candidates;
+    std::vector<int> cand_rank; // rank in candidates, -1 if not a candidate
+};
+
+#endif
@@ -323,6 +323,11 @@ bool GdaConst::gda_create_csvt = false;
 bool GdaConst::gda_enable_set_transparency_windows = false;
 int GdaConst::default_display_decimals = 6; // move in preference
 bool GdaConst::gda_use_gpu = false;
+bool GdaConst::gda_use_perm_table = false;
+bool GdaConst::gda_perm_early_stop = false;
+bool GdaConst::gda_use_cpu_kernel = false;
+bool GdaConst::gda_use_bitset_jc = false;
+bool GdaConst::gda_use_hash_contiguity = false;
 int GdaConst::gda_ui_language = 0;
 double GdaConst::gda_eigen_tol = 0.00000001;
 bool GdaConst::gda_set_cpu_cores = true;
@@ -331,6 +336,7 @@ wxString GdaConst::gda_user_email = "";
 uint64_t GdaConst::gda_user_seed = 123456789;
 bool GdaConst::use_gda_user_seed = true;
 int GdaConst::gdal_http_timeout = 5;
+int GdaConst::gda_weights_cache_mb = 512;
 bool GdaConst::enable_high_dpi_support = false;
 bool GdaConst::show_csv_configure_in_merge = true;
 bool GdaConst::show_recent_sample_connect_ds_dialog = true;
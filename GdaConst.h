@@ -244,6 +244,11 @@ public:
     static bool gda_create_csvt;
     static wxString gda_basemap_sources;
     static bool gda_use_gpu;
+    static bool gda_use_perm_table;
+    static bool gda_perm_early_stop;
+    static bool gda_use_cpu_kernel;
+    static bool gda_use_bitset_jc;
+    static bool gda_use_hash_contiguity;
     static int gda_ui_language;
     static double gda_eigen_tol;
     static int gda_cpu_cores;
@@ -252,6 +257,7 @@ public:
     static uint64_t gda_user_seed;
     static bool use_gda_user_seed;
     static int gdal_http_timeout;
+    static int gda_weights_cache_mb;
     static bool enable_high_dpi_support;
     static bool show_csv_configure_in_merge;
     static bool show_recent_sample_connect_ds_dialog;
@@ -0,0 +1,342 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "GdaConst.h"
+#include "GdaThreadPool.h"
+
+namespace bt = boost::posix_time;
+
+const int GdaThreadPool::permutation_chunk_size = 32;
+const int GdaThreadPool::query_chunk_size = 1024;
+
+// set on the pool's own threads to detect nested ParallelFor calls
+static boost::thread_specific_ptr<bool> in_worker_thread;
+
+static double elapsed_ms(const bt::ptime& start)
+{
+    bt::time_duration d = bt::microsec_clock::universal_time() - start;
+    return d.total_microseconds() / 1000.0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// GdaThreadPoolStats
+//
+///////////////////////////////////////////////////////////////////////////////
+GdaThreadPoolStats::GdaThreadPoolStats()
+: num_workers(0), num_items(0), chunk_size(0), num_chunks(0), num_steals(0),
+wall_ms(0)
+{
+}
+
+double GdaThreadPoolStats::GetImbalance() const
+{
+    if (busy_ms.empty()) return 1.0;
+    double max_busy = 0, sum_busy = 0;
+    for (size_t i=0; i<busy_ms.size(); i++) {
+        sum_busy += busy_ms[i];
+        if (busy_ms[i] > max_busy) max_busy = busy_ms[i];
+    }
+    double mean_busy = sum_busy / busy_ms.size();
+    return mean_busy > 0 ? max_busy / mean_busy : 1.0;
+}
+
+double GdaThreadPoolStats::GetStaticMakespan(int num_blocks) const
+{
+    // same split as the former CalcPseudoP_threaded(): the first
+    // (num_items % num_blocks) blocks get one extra item
+    if (num_blocks < 1 || num_items < 1 || chunk_size < 1) return 0;
+    int quotient = num_items / num_blocks;
+    int remainder = num_items % num_blocks;
+    int tot_blocks = (quotient > 0) ? num_blocks : remainder;
+    double makespan = 0;
+    for (int i=0; i<tot_blocks; i++) {
+        int a = i < remainder ? i*(quotient+1) :
+            remainder*(quotient+1) + (i-remainder)*quotient;
+        int b = i < remainder ? a+quotient : a+quotient-1;
+        // chunk times are spread evenly over the items of a chunk
+        double block_ms = 0;
+        for (int c=a/chunk_size; c<=b/chunk_size && c<(int)chunk_ms.size(); c++) {
+            int c_first = std::max(a, c*chunk_size);
+            int c_last = std::min(b, std::min(num_items, (c+1)*chunk_size)-1);
+            int c_len = std::min(num_items, (c+1)*chunk_size) - c*chunk_size;
+            block_ms += chunk_ms[c] * (c_last - c_first + 1) / c_len;
+        }
+        if (block_ms > makespan) makespan = block_ms;
+    }
+    return makespan;
+}
+
+std::string GdaThreadPoolStats::ToString() const
+{
+    double sum_busy = 0;
+    for (size_t i=0; i<busy_ms.size(); i++) sum_busy += busy_ms[i];
+    std::ostringstream ss;
+    ss << num_items << " items in " << num_chunks << " chunks on "
+       << num_workers << " workers: " << wall_ms << " ms wall, "
+       << sum_busy << " ms busy, imbalance " << GetImbalance()
+       << ", " << num_steals << " steals, static split would take "
+       << GetStaticMakespan(num_workers) << " ms";
+    return ss.str();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// GdaThreadPool
+//
+///////////////////////////////////////////////////////////////////////////////
+GdaThreadPool::GdaThreadPool()
+: generation(0), busy_workers(0), stopping(false), job(NULL), job_items(0),
+job_chunk_size(1), job_chunks(0), job_stats(NULL)
+{
+}
+
+GdaThreadPool::~GdaThreadPool()
+{
+    Shutdown();
+}
+
+int GdaThreadPool::GetNumWorkers()
+{
+    int n = GdaConst::gda_cpu_cores;
+    if (!GdaConst::gda_set_cpu_cores) {
+        n = boost::thread::hardware_concurrency();
+    }
+    return n < 1 ? 1 : n;
+}
+
+bool GdaThreadPool::IsWorkerThread()
+{
+    return in_worker_thread.get() != NULL && *in_worker_thread;
+}
+
+void GdaThreadPool::Shutdown()
+{
+    {
+        boost::mutex::scoped_lock lock(state_mutex);
+        stopping = true;
+    }
+    job_cond.notify_all();
+    for (size_t i=0; i<workers.size(); i++) {
+        workers[i]->join();
+        delete workers[i];
+    }
+    workers.clear();
+    for (size_t i=0; i<queues.size(); i++) delete queues[i];
+    queues.clear();
+    stopping = false;
+}
+
+void GdaThreadPool::Resize(int num_workers)
+{
+    if ((int)workers.size() == num_workers) return;
+    Shutdown();
+    for (int i=0; i<num_workers; i++) {
+        ChunkQueue* q = new ChunkQueue;
+        q->head = 0;
+        q->tail = 0;
+        queues.push_back(q);
+    }
+    for (int i=0; i<num_workers; i++) {
+        try {
+            boost::thread* worker = new boost::thread(
+                    boost::bind(&GdaThreadPool::WorkerLoop, this, i,
+                                generation));
+            workers.push_back(worker);
+        } catch (boost::thread_resource_error&) {
+            break;
+        }
+    }
+    // fewer threads than asked for: drop the queues nobody will serve
+    while (queues.size() > workers.size()) {
+        delete queues.back();
+        queues.pop_back();
+    }
+}
+
+void GdaThreadPool::ParallelFor(int num_items, const RangeJob& range_job,
+                                int chunk_size, GdaThreadPoolStats* stats)
+{
+    if (num_items <= 0) return;
+    if (chunk_size < 1) chunk_size = 1;
+    int num_chunks = (num_items + chunk_size - 1) / chunk_size;
+    bt::ptime start = bt::microsec_clock::universal_time();
+
+    if (IsWorkerThread()) {
+        // nested call: the pool is busy with our caller
+        for (int c=0; c<num_chunks; c++) {
+            int last = std::min(num_items, (c+1)*chunk_size) - 1;
+            range_job(c*chunk_size, last);
+        }
+        if (stats) {
+            stats->num_workers = 1;
+            stats->num_items = num_items;
+            stats->chunk_size = chunk_size;
+            stats->num_chunks = num_chunks;
+            stats->wall_ms = elapsed_ms(start);
+        }
+        return;
+    }
+
+    boost::mutex::scoped_lock job_lock(job_mutex);
+    Resize(GetNumWorkers());
+    int num_workers = workers.size();
+
+    if (stats) {
+        stats->num_workers = num_workers == 0 ? 1 : num_workers;
+        stats->num_items = num_items;
+        stats->chunk_size = chunk_size;
+        stats->num_chunks = num_chunks;
+        stats->num_steals = 0;
+        stats->busy_ms.assign(stats->num_workers, 0);
+        stats->chunk_ms.assign(num_chunks, 0);
+    }
+
+    if (num_workers == 0) {
+        // no thread could be started: fall back to the calling thread
+        for (int c=0; c<num_chunks; c++) {
+            int last = std::min(num_items, (c+1)*chunk_size) - 1;
+            range_job(c*chunk_size, last);
+        }
+        if (stats) {
+            stats->wall_ms = elapsed_ms(start);
+            stats->busy_ms[0] = stats->wall_ms;
+        }
+        return;
+    }
+
+    // hand out contiguous shares of chunks, stealing evens out the rest
+    int quotient = num_chunks / num_workers;
+    int remainder = num_chunks % num_workers;
+    int head = 0;
+    for (int i=0; i<num_workers; i++) {
+        int share = i < remainder ? quotient + 1 : quotient;
+        boost::mutex::scoped_lock q_lock(queues[i]->mutex);
+        queues[i]->head = head;
+        queues[i]->tail = head + share;
+        head += share;
+    }
+
+    {
+        boost::mutex::scoped_lock lock(state_mutex);
+        job = &range_job;
+        job_items = num_items;
+        job_chunk_size = chunk_size;
+        job_chunks = num_chunks;
+        job_stats = stats;
+        busy_workers = num_workers;
+        generation++;
+    }
+    job_cond.notify_all();
+
+    {
+        boost::mutex::scoped_lock lock(state_mutex);
+        while (busy_workers > 0) done_cond.wait(lock);
+        job = NULL;
+        job_stats = NULL;
+    }
+
+    if (stats) stats->wall_ms = elapsed_ms(start);
+}
+
+bool GdaThreadPool::NextChunk(int worker_id, int& chunk, bool& stolen)
+{
+    stolen = false;
+    {
+        ChunkQueue* own = queues[worker_id];
+        boost::mutex::scoped_lock lock(own->mutex);
+        if (own->head < own->tail) {
+            chunk = own->head++;
+            return true;
+        }
+    }
+    int n = queues.size();
+    for (int k=1; k<n; k++) {
+        ChunkQueue* victim = queues[(worker_id + k) % n];
+        int first = 0, last = 0;
+        {
+            boost::mutex::scoped_lock lock(victim->mutex);
+            int left = victim->tail - victim->head;
+            if (left <= 0) continue;
+            // take the back half, the owner keeps working from the front
+            int take = left > 1 ? left / 2 : 1;
+            first = victim->tail - take;
+            last = victim->tail;
+            victim->tail = first;
+        }
+        chunk = first;
+        stolen = true;
+        if (last - first > 1) {
+            ChunkQueue* own = queues[worker_id];
+            boost::mutex::scoped_lock lock(own->mutex);
+            own->head = first + 1;
+            own->tail = last;
+        }
+        return true;
+    }
+    return false;
+}
+
+void GdaThreadPool::RunChunk(int worker_id, int chunk)
+{
+    int first = chunk * job_chunk_size;
+    int last = std::min(job_items, first + job_chunk_size) - 1;
+    if (job_stats == NULL) {
+        (*job)(first, last);
+        return;
+    }
+    bt::ptime start = bt::microsec_clock::universal_time();
+    (*job)(first, last);
+    double ms = elapsed_ms(start);
+    job_stats->chunk_ms[chunk] = ms;
+    job_stats->busy_ms[worker_id] += ms;
+}
+
+void GdaThreadPool::WorkerLoop(int worker_id, unsigned long seen_generation)
+{
+    in_worker_thread.reset(new bool(true));
+    while (true) {
+        {
+            boost::mutex::scoped_lock lock(state_mutex);
+            while (!stopping && generation == seen_generation) {
+                job_cond.wait(lock);
+            }
+            if (stopping) return;
+            seen_generation = generation;
+        }
+
+        int steals = 0;
+        int chunk = 0;
+        bool stolen = false;
+        while (NextChunk(worker_id, chunk, stolen)) {
+            if (stolen) steals++;
+            RunChunk(worker_id, chunk);
+        }
+
+        boost::mutex::scoped_lock lock(state_mutex);
+        if (job_stats) job_stats->num_steals += steals;
+        busy_workers--;
+        if (busy_workers == 0) done_cond.notify_all();
+    }
+}
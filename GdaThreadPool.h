@@ -0,0 +1,135 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_GDA_THREAD_POOL_H__
+#define __GEODA_CENTER_GDA_THREAD_POOL_H__
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+/** Timing of one GdaThreadPool::ParallelFor run.  chunk_ms is indexed by
+ chunk, busy_ms by worker.  GetStaticMakespan() replays the measured chunk
+ times over the old one-block-per-CPU split, so comparing it with wall_ms
+ tells how much load imbalance the work stealing removed. */
+struct GdaThreadPoolStats
+{
+    GdaThreadPoolStats();
+
+    int num_workers;
+    int num_items;
+    int chunk_size;
+    int num_chunks;
+    int num_steals;
+    double wall_ms;
+    std::vector<double> busy_ms;
+    std::vector<double> chunk_ms;
+
+    /** max / mean of per-worker busy time, 1.0 is perfectly balanced */
+    double GetImbalance() const;
+
+    /** makespan the measured chunks would have had if split statically
+     into num_blocks contiguous blocks */
+    double GetStaticMakespan(int num_blocks) const;
+
+    std::string ToString() const;
+};
+
+/**
+ A persistent, process-wide pool of worker threads.
+
+ ParallelFor() cuts [0, num_items) into chunks of chunk_size items.  Every
+ worker starts on its own contiguous share of the chunks and steals half of
+ the remaining chunks of another worker once its share is done.  The chunk
+ boundaries only depend on num_items and chunk_size, never on the number of
+ workers, so jobs that derive their random seeds from the chunk start give
+ the same results on any machine.
+
+ The pool is created lazily on first use and sized by the cpu cores
+ preference (GdaConst::gda_cpu_cores).  Only one ParallelFor runs at a time;
+ a nested call from inside a worker runs serially on that worker.
+ */
+class GdaThreadPool
+{
+public:
+    /** job(first, last) handles items first..last, both inclusive */
+    typedef boost::function<void (int, int)> RangeJob;
+
+    static GdaThreadPool& GetInstance() {
+        static GdaThreadPool instance;
+        return instance;
+    }
+
+    /** Number of worker threads the next ParallelFor will use */
+    int GetNumWorkers();
+
+    void ParallelFor(int num_items, const RangeJob& job, int chunk_size,
+                     GdaThreadPoolStats* stats = NULL);
+
+    /** default number of observations per chunk for permutation tests */
+    static const int permutation_chunk_size;
+
+    /** default number of points per chunk for nearest neighbor queries */
+    static const int query_chunk_size;
+
+private:
+    GdaThreadPool();
+    ~GdaThreadPool();
+    GdaThreadPool(const GdaThreadPool&);
+    GdaThreadPool& operator=(const GdaThreadPool&);
+
+    /** chunks [head, tail) still owned by one worker */
+    struct ChunkQueue {
+        boost::mutex mutex;
+        int head;
+        int tail;
+    };
+
+    void Resize(int num_workers);
+    void Shutdown();
+    void WorkerLoop(int worker_id, unsigned long seen_generation);
+    bool NextChunk(int worker_id, int& chunk, bool& stolen);
+    void RunChunk(int worker_id, int chunk);
+    bool IsWorkerThread();
+
+    std::vector<boost::thread*> workers;
+    std::vector<ChunkQueue*> queues;
+
+    // serializes ParallelFor callers
+    boost::mutex job_mutex;
+
+    // protects the fields below
+    boost::mutex state_mutex;
+    boost::condition_variable job_cond;
+    boost::condition_variable done_cond;
+    unsigned long generation;
+    int busy_workers;
+    bool stopping;
+
+    // current job, only valid while busy_workers > 0
+    const RangeJob* job;
+    int job_items;
+    int job_chunk_size;
+    int job_chunks;
+    GdaThreadPoolStats* job_stats;
+};
+
+#endif
@@ -130,6 +130,34 @@ namespace Gda {
     
 	double ThomasWangDouble(uint64_t& key);
 	
+	/** Counter-based random stream, a keyed variant of the ThomasWang
+	 hash.  The n-th number of a stream only depends on the stream key and
+	 n, and keys are derived from a seed and a path of stream ids, e.g.
+	 (seed, observation, permutation).  Results therefore do not depend on
+	 which thread draws a stream, or on how many numbers other streams used
+	 before it. */
+	class CounterRng {
+	public:
+		explicit CounterRng(uint64_t key_s) : key(key_s), counter(0) {}
+		
+		/** key of the root stream of a seed */
+		static uint64_t SeedKey(uint64_t seed) {
+			return ThomasWangHashUInt64(seed); }
+		/** key of sub-stream id of the stream with key k */
+		static uint64_t SubKey(uint64_t k, uint64_t id) {
+			return ThomasWangHashUInt64(k ^ id); }
+		
+		/** next uniform double on the unit interval */
+		double NextDouble() { return ThomasWangHashDouble(key + counter++); }
+		
+		uint64_t GetKey() const { return key; }
+		uint64_t GetCounter() const { return counter; }
+		
+	private:
+		uint64_t key;
+		uint64_t counter;
+	};
+	
 	inline bool IsNaN(double x) { return x != x; }
 	inline bool IsFinite(double x) { return x-x == 0; }
     
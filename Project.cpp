@@ -33,7 +33,9 @@
 #include <wx/progdlg.h>
 #include <wx/dir.h>
 #include <wx/textfile.h>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 
 #include "ogr_srs_api.h"
@@ -60,6 +62,7 @@
 #include "GenGeomAlgs.h"
 #include "SpatialIndAlgs.h"
 #include "PointSetAlgs.h"
+#include "ShapeOperations/CsrWeight.h"
 #include "ShapeOperations/GalWeight.h"
 #include "ShapeOperations/VoronoiUtils.h"
 #include "VarCalc/WeightsManInterface.h"
@@ -89,7 +92,8 @@ dist_metric(WeightsMetaInfo::DM_euclidean),
 dist_units(WeightsMetaInfo::DU_mile),
 min_1nn_dist_euc(-1), max_1nn_dist_euc(-1), max_dist_euc(-1),
 min_1nn_dist_arc(-1), max_1nn_dist_arc(-1), max_dist_arc(-1),
-sourceSR(NULL), rtree_bbox_ready(false), has_null_geometry(false)
+sourceSR(NULL), rtree_bbox_ready(false), spatial_index_thread(0),
+has_null_geometry(false)
 {
     
 	wxLogMessage("Entering Project::Project (existing project)");
@@ -139,7 +143,7 @@ dist_metric(WeightsMetaInfo::DM_euclidean),
 dist_units(WeightsMetaInfo::DU_mile),
 min_1nn_dist_euc(-1), max_1nn_dist_euc(-1), max_dist_euc(-1),
 min_1nn_dist_arc(-1), max_1nn_dist_arc(-1), max_dist_arc(-1),
-sourceSR(NULL), rtree_bbox_ready(false)
+sourceSR(NULL), rtree_bbox_ready(false), spatial_index_thread(0)
 {
 	wxLogMessage("Entering Project::Project (new project)");
 	
@@ -186,6 +190,11 @@ Project::~Project()
 {
 	wxLogMessage("Entering Project::~Project");
 	
+    if (spatial_index_thread) {
+        spatial_index_thread->join();
+        delete spatial_index_thread;
+        spatial_index_thread = 0;
+    }
     if (project_conf) delete project_conf; project_conf=0;
     // datasource* has been deleted in project_conf* layer*
     datasource = 0;
@@ -387,32 +396,65 @@ Shapefile::ShapeType Project::GetGdaGeometries(vector<GdaShape*>& geometries)
 
 rtree_box_2d_t& Project::GetBBoxRtree()
 {
-	wxLogMessage("Project::CalcEucPlaneRtreeStats()");
+	wxLogMessage("Project::GetBBoxRtree()");
     if ( rtree_bbox_ready ) {
         return rtree_bbox;
     }
     if (main_data.header.shape_type == Shapefile::POLYGON) {
         Shapefile::PolygonContents* pc;
         int num_geometries = main_data.records.size();
+        std::vector<box_2d> boxes(num_geometries);
         for (int i=0; i<num_geometries; i++) {
             pc = (Shapefile::PolygonContents*)main_data.records[i].contents_p;
-            pc->box[0];
-            // create a box, tl, br
-            box_2d b(pt_2d(pc->box[0], pc->box[2]), pt_2d(pc->box[1], pc->box[3]));
-            // insert new value
-            rtree_bbox.insert(std::make_pair(b, i));
+            // box is xmin, ymin, xmax, ymax
+            boxes[i] = box_2d(pt_2d(pc->box[0], pc->box[1]),
+                              pt_2d(pc->box[2], pc->box[3]));
         }
+        SpatialIndAlgs::fill_box_rtree(rtree_bbox, boxes);
         rtree_bbox_ready = true;
     }
     return rtree_bbox;
 }
 
+void Project::StartSpatialIndexBuild()
+{
+    if (isTableOnly || num_records == 0 || spatial_index_thread) return;
+    spatial_index_sw.Start();
+    // OGR computes the centroids with GEOS, which must stay on the main
+    // thread; the thread only builds the indices from them
+    InitCentroids();
+    spatial_index_thread =
+        new boost::thread(boost::bind(&Project::BuildSpatialIndex, this));
+}
+
+void Project::BuildSpatialIndex()
+{
+    try {
+        CalcEucPlaneRtreeStats();
+        wxLogMessage("Project: spatial indices built in %ld ms",
+                     spatial_index_sw.Time());
+    } catch (std::exception& e) {
+        wxLogMessage("Project::BuildSpatialIndex(): %s", e.what());
+    }
+}
+
+void Project::WaitSpatialIndex()
+{
+    if (spatial_index_thread == 0) return;
+    wxStopWatch wait_sw;
+    spatial_index_thread->join();
+    delete spatial_index_thread;
+    spatial_index_thread = 0;
+    wxLogMessage("Project: time to first spatial query %ld ms after open, "
+                 "waited %ld ms", spatial_index_sw.Time(), wait_sw.Time());
+}
+
 void Project::CalcEucPlaneRtreeStats()
 {
     wxLogMessage("Project::CalcEucPlaneRtreeStats()");
     using namespace std;
     
-    GetCentroids();
+    InitCentroids();
     size_t num_obs = centroids.size();
     std::vector<pt_2d> pts(num_obs);
     std::vector<double> x(num_obs);
@@ -853,25 +895,15 @@ void Project::DisplayPointDupsWarning()
 	point_dups_warn_prev_displayed = true;
 }
 
-void Project::GetVoronoiRookNeighborMap(std::vector<std::set<int> >& nbr_map)
+CsrWeight* Project::GetVoronoiNeighborCsr(bool queen)
 {
-	wxLogMessage("Project::GetVoronoiRookNeighborMap()");
+	wxLogMessage("Project::GetVoronoiNeighborCsr()");
 
-	IsPointDuplicates();
 	std::vector<double> x;
 	std::vector<double> y;
 	GetCentroids(x, y);
-	Gda::VoronoiUtils::PointsToContiguity(x, y, false, nbr_map);
-}
-
-void Project::GetVoronoiQueenNeighborMap(std::vector<std::set<int> >& nbr_map)
-{
-	wxLogMessage("Project::GetVoronoiQueenNeighborMap()");
-
-	std::vector<double> x;
-	std::vector<double> y;
-	GetCentroids(x, y);
-	Gda::VoronoiUtils::PointsToContiguity(x, y, true, nbr_map);
+	int tiles = Gda::VoronoiUtils::SuggestTilesPerAxis(x.size());
+	return Gda::VoronoiUtils::PointsToContiguityCsr(x, y, queen, tiles);
 }
 
 GalElement* Project::GetVoronoiRookNeighborGal()
@@ -879,9 +911,9 @@ GalElement* Project::GetVoronoiRookNeighborGal()
 	wxLogMessage("Project::GetVoronoiRookNeighborGal()");
 
 	if (!voronoi_rook_nbr_gal) {
-		std::vector<std::set<int> > nbr_map;
-		GetVoronoiRookNeighborMap(nbr_map);
-		voronoi_rook_nbr_gal = Gda::VoronoiUtils::NeighborMapToGal(nbr_map);
+		CsrWeight* w = GetVoronoiNeighborCsr(false);
+		if (w) voronoi_rook_nbr_gal = w->ToGal();
+		delete w;
 	}
 	return voronoi_rook_nbr_gal;
 }
@@ -1133,7 +1165,13 @@ void Project::GetMeanCenters(std::vector<double>& x, std::vector<double>& y)
 const std::vector<GdaPoint*>& Project::GetCentroids()
 {
 	wxLogMessage("Project::GetCentroids()");
-   
+    WaitSpatialIndex();
+    InitCentroids();
+	return centroids;
+}
+
+void Project::InitCentroids()
+{
     if (layer_proxy->IsTableOnly()) {
         if (centroids.size() == 0 && num_records > 0) {
             centroids.resize(num_records);
@@ -1147,8 +1185,6 @@ const std::vector<GdaPoint*>& Project::GetCentroids()
     } else {
         layer_proxy->GetCentroids(centroids);
     }
-
-	return centroids;	
 }
 
 GdaPolygon* Project::GetMapBoundary()
@@ -1227,6 +1263,7 @@ const std::vector<GdaShape*>& Project::GetVoronoiPolygons()
 
 double Project::GetMin1nnDistEuc()
 {
+	WaitSpatialIndex();
 	if (min_1nn_dist_euc >= 0) return min_1nn_dist_euc;
 	CalcEucPlaneRtreeStats();
 	return min_1nn_dist_euc;
@@ -1234,6 +1271,7 @@ double Project::GetMin1nnDistEuc()
 
 double Project::GetMax1nnDistEuc()
 {
+	WaitSpatialIndex();
 	if (max_1nn_dist_euc >= 0) return max_1nn_dist_euc;
 	CalcEucPlaneRtreeStats();
 	return max_1nn_dist_euc;
@@ -1241,6 +1279,7 @@ double Project::GetMax1nnDistEuc()
 
 double Project::GetMaxDistEuc()
 {
+	WaitSpatialIndex();
 	if (max_dist_euc >= 0) return max_dist_euc;
 	CalcEucPlaneRtreeStats();
 	return max_dist_euc;
@@ -1269,11 +1308,14 @@ double Project::GetMaxDistArc()
 
 rtree_pt_2d_t& Project::GetEucPlaneRtree()
 {
+	WaitSpatialIndex();
+	if (min_1nn_dist_euc < 0) CalcEucPlaneRtreeStats();
 	return rtree_2d;
 }
 
 rtree_pt_3d_t& Project::GetUnitSphereRtree()
 {
+	if (min_1nn_dist_arc < 0) CalcUnitSphereRtreeStats();
 	return rtree_3d;
 }
 
@@ -1523,6 +1565,10 @@ bool Project::CommonProjectInit()
 	save_manager->SetMetaDataSaveNeeded(false);
 	save_manager->SetDbSaveNeeded(false);
 	
+	// the weights dialog and the correlogram query these; build them while
+	// the user looks at the map
+	StartSpatialIndexBuild();
+	
 	return true;
 }
 
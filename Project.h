@@ -32,6 +32,7 @@
 #include <boost/property_tree/ptree_fwd.hpp>
 #include <boost/shared_ptr.hpp>
 #include <wx/filename.h>
+#include <wx/stopwatch.h>
 
 #include "DataViewer/DataSource.h"
 #include "DataViewer/PtreeInterface.h"
@@ -46,6 +47,8 @@
 
 typedef boost::multi_array<int, 2> i_array_type;
 
+namespace boost { class thread; }
+
 //using namespace boost::geometry;
 class OGRTable;
 class TableInterface;
@@ -58,6 +61,7 @@ class WeightsManager;
 class WeightsManInterface;
 class WeightsManState;
 class SaveButtonManager;
+class CsrWeight;
 class GalElement;
 class TimeChooserDlg;
 class GdaPoint;
@@ -157,9 +161,11 @@ public:
 	void SaveVoronoiDupsToTable();
 	bool IsPointDuplicates();
 	void DisplayPointDupsWarning();
-	void GetVoronoiRookNeighborMap(std::vector<std::set<int> >& nbr_map);
-	void GetVoronoiQueenNeighborMap(std::vector<std::set<int> >& nbr_map);
 	GalElement* GetVoronoiRookNeighborGal();
+	/** Voronoi contiguity of the centroids as binary CSR weights, built
+	 without neighbor sets and in parallel tiles for large layers.  The
+	 caller owns the result. */
+	CsrWeight* GetVoronoiNeighborCsr(bool queen);
 	void AddMeanCenters();
 	void AddCentroids();
     void GetSelectedRows(vector<int>& rowids);
@@ -181,9 +187,14 @@ public:
 	double GetMax1nnDistArc(); // returned as radians
 	double GetMaxDistArc(); // returned as radians
 	
+    /** bulk loaded on first use */
     rtree_box_2d_t& GetBBoxRtree();
+    /** The spatial index getters below wait for the indices that are
+     built in the background after the project is opened. */
 	rtree_pt_2d_t& GetEucPlaneRtree();
 	rtree_pt_3d_t& GetUnitSphereRtree();
+    /** join the background build; a no-op once it was joined */
+    void WaitSpatialIndex();
 	
     // for multi-layer
     map<wxString, BackgroundMapLayer*> bg_maps;
@@ -270,6 +281,13 @@ protected:
 	void UpdateProjectConf();
 	void CalcEucPlaneRtreeStats();
 	void CalcUnitSphereRtreeStats();
+    // body of GetCentroids() without the wait; main thread only, see
+    // StartSpatialIndexBuild()
+    void InitCentroids();
+    // centroids, then the Euclidean rtree and the nearest neighbor stats
+    // on spatial_index_thread
+    void StartSpatialIndexBuild();
+    void BuildSpatialIndex();
     
   // XXX for multi-layer support, ProjectConfiguration is a container for
   // multi LayerConfiguration (layers), and each LayerConfiguration is defined
@@ -323,6 +341,10 @@ protected:
 	rtree_pt_3d_t rtree_3d; // lon/lat points projected to unit sphere
     rtree_box_2d_t rtree_bbox;
     bool rtree_bbox_ready;
+    // running BuildSpatialIndex(), NULL once joined
+    boost::thread* spatial_index_thread;
+    // started when the project is opened, for the time to first query
+    wxStopWatch spatial_index_sw;
     
 	/** The following array is not thread safe since it is shared by
 	 every TemplateCanvas instance in a given project. */
@@ -28,6 +28,7 @@ The IDE project should also include SLStream.cpp
 #ifndef WX_PRECOMP
     #include <wx/wx.h>
 #endif
+#include "../ShapeOperations/CsrWeight.h"
 #include "../ShapeOperations/GwtWeight.h"
 #include "mix.h"
 #include "Lite2.h"
@@ -244,27 +245,19 @@ void MakeSym(Iterator<WVector> it)
 	}
 }
 
-// determines if a gwt structure is symmetric
+// determines if a gwt structure is symmetric, weights included
 bool isSym(const GwtElement* g, int obs)
 {
-	int cnt = 0, cp = 0, ct = 0;
-	bool flag = false;
-	for (cnt = 0; cnt < obs; cnt++) {
-		for (cp = 0; cp < g[cnt].Size(); cp++) {
-			flag = false;
-			for (ct = 0; ct < g[g[cnt].elt(cp).nbx].Size(); ct++) {
-				if (g[g[cnt].elt(cp).nbx].elt(ct).nbx == cnt) {
-					if (g[g[cnt].elt(cp).nbx].elt(ct).weight
-						== g[cnt].elt(cp).weight) {
-						flag = true;
-						break;
-					}
-				}
-			}
-			if (!flag) return false;
+	std::vector<std::vector<int> > nbrs(obs);
+	std::vector<std::vector<double> > vals(obs);
+	for (int cnt = 0; cnt < obs; cnt++) {
+		for (int cp = 0; cp < g[cnt].Size(); cp++) {
+			nbrs[cnt].push_back(g[cnt].elt(cp).nbx);
+			vals[cnt].push_back(g[cnt].elt(cp).weight);
 		}
 	}
-	return true;
+	CsrWeight w(nbrs, vals);
+	return w.CountAsymmetric(true) == 0;
 }
 
 /*   Estimate
@@ -24,6 +24,7 @@
 #endif
 
 #include "../ShapeOperations/GalWeight.h"
+#include "../ShapeOperations/CsrWeight.h"
 
 #include "mix.h"
 #include "SparseMatrix.h"
@@ -55,6 +56,21 @@ SparseMatrix::SparseMatrix(const GalElement *my_gal, int obs)
 	createGAL(my_gal, obs);
 }
 
+SparseMatrix::SparseMatrix(const CsrWeight& w)
+{
+    int dim = w.GetNumObs();
+    this->init( dim );
+    for (int cnt = 0; cnt < dim; ++cnt) {
+        int nbs = w.GetNumNbrs(cnt);
+        const int* nbrs = w.GetNbrs(cnt);
+        const double* vals = w.GetValues(cnt);
+        this->row[cnt].alloc( nbs );
+        for (int nb = 0; nb < nbs; nb++) {
+            this->row[cnt].setNb( nb, nbrs[nb], vals ? vals[nb] : 1.0 );
+        }
+    }
+}
+
 void SparseMatrix::createGAL(const GalElement* my_gal, int obs)  
 {	// get the weights from GAL file
     int dim = obs;
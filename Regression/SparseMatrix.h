@@ -29,6 +29,7 @@
 #include "SparseRow.h"
 
 class GalElement;
+class CsrWeight;
 
 /*  ---  SparseMatrix  ---  */
 class SparseMatrix  {
@@ -36,6 +37,8 @@ class SparseMatrix  {
 public :
     SparseMatrix(const int sz)  { init(sz); }
 	SparseMatrix(const GalElement *my_gal, int obs); 
+    // rows copied straight from the CSR arrays, no id remapping needed
+    SparseMatrix(const CsrWeight& w);
 	virtual ~SparseMatrix();
 
     int dim()  const  {  return size;  }
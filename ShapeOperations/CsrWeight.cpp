@@ -0,0 +1,518 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <utility>
+#include <boost/bind.hpp>
+
+#include "../DataViewer/TableInterface.h"
+#include "../GdaThreadPool.h"
+#include "../GenUtils.h"
+#include "../Project.h"
+#include "GalWeight.h"
+#include "StackedWeights.h"
+#include "CsrWeight.h"
+
+CsrWeight::CsrWeight()
+: offsets(1, 0)
+{
+    weight_type = csr_type;
+    SetPointers();
+}
+
+CsrWeight::CsrWeight(const CsrWeight& w)
+: GeoDaWeight(w)
+{
+    CsrWeight::operator=(w);
+}
+
+const CsrWeight& CsrWeight::operator=(const CsrWeight& w)
+{
+    GeoDaWeight::operator=(w);
+    offsets = w.offsets;
+    nbrs = w.nbrs;
+    values = w.values;
+    mapping = w.mapping;
+    if (mapping) {
+        // share the read-only mapped arrays
+        off_ptr = w.off_ptr;
+        nbr_ptr = w.nbr_ptr;
+        val_ptr = w.val_ptr;
+    } else {
+        SetPointers();
+    }
+    return *this;
+}
+
+void CsrWeight::AttachMapped(int n, const boost::uint64_t* off_p,
+                             const int* nbr_p, const double* val_p,
+                             boost::shared_ptr<void> mapping_)
+{
+    num_obs = n;
+    offsets.clear();
+    nbrs.clear();
+    values.clear();
+    mapping = mapping_;
+    off_ptr = off_p;
+    nbr_ptr = off_p[n] > 0 ? nbr_p : NULL;
+    val_ptr = off_p[n] > 0 ? val_p : NULL;
+}
+
+void CsrWeight::SetPointers()
+{
+    mapping.reset();
+    off_ptr = &offsets[0];
+    nbr_ptr = nbrs.empty() ? NULL : &nbrs[0];
+    val_ptr = values.empty() ? NULL : &values[0];
+}
+
+void CsrWeight::Detach()
+{
+    if (!mapping) return;
+    size_t n_edges = off_ptr[num_obs];
+    offsets.assign(off_ptr, off_ptr + num_obs + 1);
+    if (nbr_ptr) nbrs.assign(nbr_ptr, nbr_ptr + n_edges);
+    if (val_ptr) values.assign(val_ptr, val_ptr + n_edges);
+    SetPointers();
+}
+
+CsrWeight::CsrWeight(const GalElement* gal, int n, bool keep_values)
+: offsets(n + 1, 0)
+{
+    weight_type = csr_type;
+    num_obs = n;
+
+    bool binary = true;
+    for (int i=0; i<n; i++) {
+        offsets[i+1] = offsets[i] + gal[i].Size();
+        if (keep_values && binary) {
+            const std::vector<double>& w = gal[i].GetNbrWeights();
+            for (size_t j=0; j<w.size() && binary; j++) {
+                if (w[j] != 1.0) binary = false;
+            }
+        }
+    }
+    nbrs.resize(offsets[n]);
+    if (!binary) values.resize(offsets[n]);
+    for (int i=0; i<n; i++) {
+        const std::vector<long>& nb = gal[i].GetNbrs();
+        size_t pos = offsets[i];
+        for (size_t j=0; j<nb.size(); j++) nbrs[pos + j] = (int) nb[j];
+        if (!binary) {
+            const std::vector<double>& w = gal[i].GetNbrWeights();
+            for (size_t j=0; j<nb.size(); j++) values[pos + j] = w[j];
+        }
+    }
+    SortRows();
+    SetPointers();
+}
+
+CsrWeight::CsrWeight(const std::vector<std::vector<int> >& nbr_lists,
+                     const std::vector<std::vector<double> >& value_lists)
+: offsets(nbr_lists.size() + 1, 0)
+{
+    weight_type = csr_type;
+    num_obs = nbr_lists.size();
+    for (int i=0; i<num_obs; i++) {
+        offsets[i+1] = offsets[i] + nbr_lists[i].size();
+    }
+    nbrs.resize(offsets[num_obs]);
+    if (!value_lists.empty()) values.resize(offsets[num_obs]);
+    for (int i=0; i<num_obs; i++) {
+        std::copy(nbr_lists[i].begin(), nbr_lists[i].end(),
+                  nbrs.begin() + offsets[i]);
+        if (!values.empty()) {
+            std::copy(value_lists[i].begin(), value_lists[i].end(),
+                      values.begin() + offsets[i]);
+        }
+    }
+    SortRows();
+    SetPointers();
+}
+
+CsrWeight::CsrWeight(std::vector<boost::uint64_t>& offsets_,
+                     std::vector<int>& nbrs_, std::vector<double>& values_)
+{
+    weight_type = csr_type;
+    offsets.swap(offsets_);
+    nbrs.swap(nbrs_);
+    values.swap(values_);
+    if (offsets.empty()) offsets.push_back(0);
+    num_obs = offsets.size() - 1;
+    SetPointers();
+}
+
+CsrWeight* CsrWeight::FromRowBlocks(const std::vector<boost::uint64_t>& counts,
+                                    std::vector<std::vector<int> >& rows,
+                                    int block_size)
+{
+    int n = counts.size();
+    std::vector<boost::uint64_t> offsets(n + 1, 0);
+    for (int i=0; i<n; i++) offsets[i+1] = offsets[i] + counts[i];
+    std::vector<int> nbrs(offsets[n]);
+    for (size_t c=0; c<rows.size(); c++) {
+        std::copy(rows[c].begin(), rows[c].end(),
+                  nbrs.begin() + offsets[c * block_size]);
+        std::vector<int>().swap(rows[c]);
+    }
+    std::vector<double> values;
+    return new CsrWeight(offsets, nbrs, values);
+}
+
+/** sort every row by neighbor id, keeping the weights with their ids */
+void CsrWeight::SortRows()
+{
+    if (nbrs.empty()) return;
+    std::vector<std::pair<int, double> > row;
+    for (int i=0; i<num_obs; i++) {
+        int* first = &nbrs[0] + offsets[i];
+        int* last = &nbrs[0] + offsets[i+1];
+        if (values.empty()) {
+            std::sort(first, last);
+            continue;
+        }
+        double* w = &values[0] + offsets[i];
+        row.clear();
+        for (int* p=first; p<last; p++) {
+            row.push_back(std::make_pair(*p, w[p - first]));
+        }
+        std::sort(row.begin(), row.end());
+        for (size_t j=0; j<row.size(); j++) {
+            first[j] = row[j].first;
+            w[j] = row[j].second;
+        }
+    }
+}
+
+double CsrWeight::GetRowSum(int obs_idx) const
+{
+    if (val_ptr == NULL) return GetNumNbrs(obs_idx);
+    double s = 0;
+    for (size_t j=off_ptr[obs_idx]; j<off_ptr[obs_idx+1]; j++) s += val_ptr[j];
+    return s;
+}
+
+double CsrWeight::GetWeight(int obs_idx, int nbr_idx,
+                            bool row_standardize) const
+{
+    const int* first = GetNbrs(obs_idx);
+    const int* last = first + GetNumNbrs(obs_idx);
+    const int* it = std::lower_bound(first, last, nbr_idx);
+    if (it == last || *it != nbr_idx) return 0;
+    double w = val_ptr ? val_ptr[off_ptr[obs_idx] + (it - first)] : 1.0;
+    if (row_standardize) {
+        double s = GetRowSum(obs_idx);
+        if (s != 0) w /= s;
+    }
+    return w;
+}
+
+void CsrWeight::SpatialLag(const double* x, double* lag,
+                           bool row_standardize) const
+{
+    for (int i=0; i<num_obs; i++) {
+        lag[i] = SpatialLag(i, x, row_standardize);
+    }
+}
+
+bool CsrWeight::CheckNeighbor(int obs_idx, int nbr_idx)
+{
+    const int* first = GetNbrs(obs_idx);
+    const int* last = first + GetNumNbrs(obs_idx);
+    return std::binary_search(first, last, nbr_idx);
+}
+
+const std::vector<long> CsrWeight::GetNeighbors(int obs_idx)
+{
+    const int* first = GetNbrs(obs_idx);
+    return std::vector<long>(first, first + GetNumNbrs(obs_idx));
+}
+
+void CsrWeight::Update(const std::vector<bool>& undefs)
+{
+    Detach();
+    // compact the arrays in place: pos never passes j
+    size_t pos = 0;
+    size_t first = offsets[0];
+    for (int i=0; i<num_obs; i++) {
+        size_t last = offsets[i+1];
+        for (size_t j=first; j<last; j++) {
+            if (undefs[nbrs[j]]) continue;
+            nbrs[pos] = nbrs[j];
+            if (!values.empty()) values[pos] = values[j];
+            pos++;
+        }
+        first = last;
+        offsets[i+1] = pos;
+    }
+    nbrs.resize(pos);
+    if (!values.empty()) values.resize(pos);
+    SetPointers();
+}
+
+bool CsrWeight::HasIsolates()
+{
+    for (int i=0; i<num_obs; i++) {
+        if (off_ptr[i+1] == off_ptr[i]) return true;
+    }
+    return false;
+}
+
+void CsrWeight::GetNbrStats()
+{
+    double empties = 0;
+    int sum_nnbrs = 0;
+    std::vector<int> nnbrs_array(num_obs);
+    for (int i=0; i<num_obs; i++) {
+        int n_nbrs = 0;
+        const int* nb = GetNbrs(i);
+        for (int j=0, sz=GetNumNbrs(i); j<sz; j++) {
+            if (nb[j] != i) n_nbrs++;
+        }
+        if (GetNumNbrs(i) == 0) empties += 1;
+        sum_nnbrs += n_nbrs;
+        if (i==0 || n_nbrs < min_nbrs) min_nbrs = n_nbrs;
+        if (i==0 || n_nbrs > max_nbrs) max_nbrs = n_nbrs;
+        nnbrs_array[i] = n_nbrs;
+    }
+    if (num_obs == 0) return;
+    sparsity = empties / (double)num_obs;
+    density = 100.0 * sum_nnbrs / ((double)num_obs * num_obs);
+    mean_nbrs = sum_nnbrs / (double)num_obs;
+    std::sort(nnbrs_array.begin(), nnbrs_array.end());
+    if (num_obs % 2 ==0) {
+        median_nbrs = (nnbrs_array[num_obs/2-1] + nnbrs_array[num_obs/2]) / 2.0;
+    } else {
+        median_nbrs = nnbrs_array[num_obs/2];
+    }
+}
+
+GalElement* CsrWeight::ToGal() const
+{
+    GalElement* gal = new GalElement[num_obs];
+    for (int i=0; i<num_obs; i++) {
+        int sz = GetNumNbrs(i);
+        const int* nb = GetNbrs(i);
+        const double* w = GetValues(i);
+        gal[i].SetSizeNbrs(sz);
+        for (int j=0; j<sz; j++) {
+            if (w) gal[i].SetNbr(j, nb[j], w[j]);
+            else gal[i].SetNbr(j, nb[j]);
+        }
+    }
+    return gal;
+}
+
+bool CsrWeight::SaveDIDWeights(Project* project, int n,
+                               std::vector<wxInt64>& newids,
+                               std::vector<wxInt64>& stack_ids,
+                               const wxString& ofname)
+{
+    if (!project || !project->GetWManInt() || ofname.empty()) return false;
+    if (n != num_obs) return false;
+    StackedWeights st(this);
+    st.SetDID(newids, stack_ids);
+    return st.Write(ofname, GenUtils::GetFileNameNoExt(ofname));
+}
+
+bool CsrWeight::SaveSpaceTimeWeights(const wxString& ofname,
+                                     WeightsManInterface* wmi,
+                                     TableInterface* table_int)
+{
+    if (ofname.empty() || !wmi || !table_int) return false;
+    std::vector<wxString> time_ids;
+    table_int->GetTimeStrings(time_ids);
+    StackedWeights st(this);
+    st.SetSpaceTime(time_ids.size());
+    return st.Write(ofname, GenUtils::GetFileNameNoExt(ofname));
+}
+
+CsrWeight* CsrWeight::Transpose() const
+{
+    // count the entries of every column, then scatter the rows in order, so
+    // the rows of W' come out sorted without a sort
+    size_t n_edges = off_ptr[num_obs];
+    std::vector<boost::uint64_t> t_off(num_obs + 1, 0);
+    for (size_t k=0; k<n_edges; k++) t_off[nbr_ptr[k] + 1]++;
+    for (int i=0; i<num_obs; i++) t_off[i+1] += t_off[i];
+
+    std::vector<int> t_nbrs(n_edges);
+    std::vector<double> t_vals(val_ptr ? n_edges : 0);
+    std::vector<boost::uint64_t> pos(t_off.begin(), t_off.end() - 1);
+    for (int i=0; i<num_obs; i++) {
+        for (size_t k=off_ptr[i]; k<off_ptr[i+1]; k++) {
+            boost::uint64_t p = pos[nbr_ptr[k]]++;
+            t_nbrs[p] = i;
+            if (val_ptr) t_vals[p] = val_ptr[k];
+        }
+    }
+    CsrWeight* t = new CsrWeight(t_off, t_nbrs, t_vals);
+    t->id_field = id_field;
+    return t;
+}
+
+/*
+ Symmetry kernels
+
+ Row i of W' lists the observations that have i as a neighbor, so W is
+ symmetric iff every row of W equals the same row of W'.  Both rows are
+ sorted, so the comparison and the symmetrization are linear merges of
+ two rows, done for blocks of rows on GdaThreadPool.  Symmetrize() counts
+ the merged rows in a first pass and writes them straight into the final
+ arrays in a second one.
+ */
+namespace {
+    const int csr_sym_chunk_size = 4096;
+
+    struct CsrSymmetry
+    {
+        const CsrWeight* w;
+        const CsrWeight* t;
+        bool compare_values;
+        CsrWeight::SymmetrizeMode mode;
+        // CountRows: mismatches per chunk
+        std::vector<size_t> mismatches;
+        // MergeRows: number of neighbors of each row, then the result
+        std::vector<boost::uint64_t> offsets;
+        std::vector<int> nbrs;
+        std::vector<double> values;
+
+        void CompareRows(int first, int last);
+        void MergeRows(int first, int last, bool fill);
+        void CountRows(int first, int last) { MergeRows(first, last, false); }
+        void FillRows(int first, int last) { MergeRows(first, last, true); }
+    };
+
+    void CsrSymmetry::CompareRows(int first, int last)
+    {
+        size_t cnt = 0;
+        for (int i=first; i<=last; i++) {
+            const int* a = w->GetNbrs(i);
+            const int* b = t->GetNbrs(i);
+            const double* va = w->GetValues(i);
+            const double* vb = t->GetValues(i);
+            int na = w->GetNumNbrs(i), nb = t->GetNumNbrs(i);
+            int ia = 0, ib = 0;
+            while (ia < na) {
+                if (ib == nb || a[ia] < b[ib]) {
+                    cnt++; // (i, a[ia]) has no reverse
+                    ia++;
+                } else if (b[ib] < a[ia]) {
+                    ib++;
+                } else {
+                    if (compare_values && va && va[ia] != vb[ib]) cnt++;
+                    ia++;
+                    ib++;
+                }
+            }
+        }
+        mismatches[first / csr_sym_chunk_size] = cnt;
+    }
+
+    void CsrSymmetry::MergeRows(int first, int last, bool fill)
+    {
+        bool keep_all = mode == CsrWeight::sym_union;
+        for (int i=first; i<=last; i++) {
+            const int* a = w->GetNbrs(i);
+            const int* b = t->GetNbrs(i);
+            const double* va = w->GetValues(i);
+            const double* vb = t->GetValues(i);
+            int na = w->GetNumNbrs(i), nb = t->GetNumNbrs(i);
+            int ia = 0, ib = 0;
+            boost::uint64_t p = fill ? offsets[i] : 0;
+            while (ia < na || ib < nb) {
+                int j;
+                double v = 1;
+                bool keep;
+                if (ib == nb || (ia < na && a[ia] < b[ib])) {
+                    j = a[ia];
+                    if (va) v = va[ia];
+                    keep = keep_all;
+                    ia++;
+                } else if (ia == na || b[ib] < a[ia]) {
+                    j = b[ib];
+                    if (vb) v = vb[ib];
+                    keep = keep_all;
+                    ib++;
+                } else {
+                    j = a[ia];
+                    if (va) v = va[ia];
+                    keep = true;
+                    ia++;
+                    ib++;
+                }
+                if (!keep) continue;
+                if (fill) {
+                    nbrs[p] = j;
+                    if (va) values[p] = v;
+                }
+                p++;
+            }
+            // the counting pass leaves the row size in offsets[i+1]
+            if (!fill) offsets[i+1] = p;
+        }
+    }
+}
+
+size_t CsrWeight::CountAsymmetric(bool compare_values) const
+{
+    if (num_obs == 0) return 0;
+    CsrWeight* t = Transpose();
+    CsrSymmetry job;
+    job.w = this;
+    job.t = t;
+    job.compare_values = compare_values;
+    job.mismatches.resize((num_obs + csr_sym_chunk_size - 1) /
+                          csr_sym_chunk_size, 0);
+    GdaThreadPool::GetInstance().ParallelFor(num_obs,
+        boost::bind(&CsrSymmetry::CompareRows, &job, _1, _2),
+        csr_sym_chunk_size);
+    delete t;
+
+    size_t cnt = 0;
+    for (size_t c=0; c<job.mismatches.size(); c++) cnt += job.mismatches[c];
+    return cnt;
+}
+
+CsrWeight* CsrWeight::Symmetrize(SymmetrizeMode mode) const
+{
+    CsrWeight* t = Transpose();
+    CsrSymmetry job;
+    job.w = this;
+    job.t = t;
+    job.mode = mode;
+    job.offsets.resize(num_obs + 1, 0);
+    GdaThreadPool& pool = GdaThreadPool::GetInstance();
+    pool.ParallelFor(num_obs, boost::bind(&CsrSymmetry::CountRows, &job,
+                                          _1, _2), csr_sym_chunk_size);
+    for (int i=0; i<num_obs; i++) job.offsets[i+1] += job.offsets[i];
+    job.nbrs.resize(job.offsets[num_obs]);
+    if (val_ptr) job.values.resize(job.offsets[num_obs]);
+    pool.ParallelFor(num_obs, boost::bind(&CsrSymmetry::FillRows, &job,
+                                          _1, _2), csr_sym_chunk_size);
+    delete t;
+
+    CsrWeight* s = new CsrWeight(job.offsets, job.nbrs, job.values);
+    s->id_field = id_field;
+    if (val_ptr == NULL) {
+        s->is_symmetric = true;
+        s->symmetry_checked = true;
+    }
+    return s;
+}
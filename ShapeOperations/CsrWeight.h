@@ -0,0 +1,190 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_CSR_WEIGHT_H__
+#define __GEODA_CENTER_CSR_WEIGHT_H__
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include "GeodaWeight.h"
+
+class GalElement;
+
+/**
+ Weights in compressed sparse row form: the neighbors of observation i are
+ nbrs[offsets[i]] .. nbrs[offsets[i+1]-1], sorted ascending, and their
+ weights are at the same positions in values.  values is empty for binary
+ weights.
+
+ The arrays are either owned vectors or, for a binary weights file opened
+ with AttachMapped(), read-only views into the mapped file.  Methods that
+ change the arrays copy a mapped file into vectors first.
+
+ Three flat arrays replace the per-observation vectors and maps of
+ GalElement, so a KNN-8 weights matrix of 2M observations takes about
+ 80 MB instead of several hundred, and a spatial lag reads the neighbors
+ of consecutive observations from consecutive memory.  Row
+ standardization is applied on the fly by dividing by the row sum; the
+ stored values are never rewritten.
+ */
+class CsrWeight : public GeoDaWeight
+{
+public:
+    CsrWeight();
+    /** from a GAL array; the weights are kept only if keep_values is set
+     and some weight differs from 1 */
+    CsrWeight(const GalElement* gal, int num_obs, bool keep_values = false);
+    /** from neighbor lists, nbrs[i] in any order; values may be empty */
+    CsrWeight(const std::vector<std::vector<int> >& nbr_lists,
+              const std::vector<std::vector<double> >& value_lists);
+    /** take over arrays built elsewhere by swapping them in: offsets holds
+     n+1 entries, the rows of nbrs must be sorted, values may be empty */
+    CsrWeight(std::vector<boost::uint64_t>& offsets,
+              std::vector<int>& nbrs, std::vector<double>& values);
+    /** binary weights from the rows a ParallelFor with chunk size
+     block_size wrote: rows[c] holds the sorted rows of observations
+     c*block_size .. (c+1)*block_size-1 back to back, counts[i] the size
+     of row i.  The blocks are released as they are copied. */
+    static CsrWeight* FromRowBlocks(const std::vector<boost::uint64_t>& counts,
+                                    std::vector<std::vector<int> >& rows,
+                                    int block_size);
+    CsrWeight(const CsrWeight& w);
+    const CsrWeight& operator=(const CsrWeight& w);
+    virtual ~CsrWeight() {}
+
+    /** Use arrays that live in memory owned by mapping (a mapped file):
+     off_p holds n+1 offsets, nbr_p and val_p off_p[n] entries each;
+     val_p is NULL for binary weights.  The rows must be sorted. */
+    void AttachMapped(int n, const boost::uint64_t* off_p, const int* nbr_p,
+                      const double* val_p, boost::shared_ptr<void> mapping);
+    bool IsMapped() const { return mapping.get() != NULL; }
+
+    int GetNumNbrs(int obs_idx) const {
+        return (int) (off_ptr[obs_idx+1] - off_ptr[obs_idx]);
+    }
+    const int* GetNbrs(int obs_idx) const {
+        return nbr_ptr ? nbr_ptr + off_ptr[obs_idx] : NULL;
+    }
+    /** NULL for binary weights */
+    const double* GetValues(int obs_idx) const {
+        return val_ptr ? val_ptr + off_ptr[obs_idx] : NULL;
+    }
+    bool IsBinary() const { return val_ptr == NULL; }
+    size_t GetNumEdges() const { return off_ptr[num_obs]; }
+
+    /** weight of nbr_idx in the row of obs_idx, 0 if not a neighbor */
+    double GetWeight(int obs_idx, int nbr_idx, bool row_standardize = false) const;
+
+    /** sum of the weights of the row */
+    double GetRowSum(int obs_idx) const;
+
+    /** spatial lag of observation i, divided by the row sum if
+     row_standardize is set; 0 for an isolate */
+    double SpatialLag(int obs_idx, const double* x,
+                      bool row_standardize = true) const
+    {
+        size_t first = off_ptr[obs_idx], last = off_ptr[obs_idx+1];
+        if (first == last) return 0;
+        const int* nb = nbr_ptr;
+        double lag = 0;
+        if (val_ptr == NULL) {
+            for (size_t j=first; j<last; j++) lag += x[nb[j]];
+            if (row_standardize) lag /= (double) (last - first);
+        } else {
+            const double* w = val_ptr;
+            double sum_w = 0;
+            for (size_t j=first; j<last; j++) {
+                lag += w[j] * x[nb[j]];
+                sum_w += w[j];
+            }
+            if (row_standardize && sum_w != 0) lag /= sum_w;
+        }
+        return lag;
+    }
+
+    /** lag[i] = SpatialLag(i, x, row_standardize) for every observation */
+    void SpatialLag(const double* x, double* lag,
+                    bool row_standardize = true) const;
+
+    /** GAL array with the same neighbors and weights, for code that still
+     needs GalElement */
+    GalElement* ToGal() const;
+
+    /** how Symmetrize() combines W with its transpose */
+    enum SymmetrizeMode {
+        sym_union,        // i and j are neighbors if i~j or j~i
+        sym_intersection  // i and j are neighbors if i~j and j~i
+    };
+
+    /** W' with sorted rows, the weights moving with their neighbors */
+    CsrWeight* Transpose() const;
+
+    /** Number of entries (i,j) of W without an entry (j,i) in W, or with a
+     different weight if compare_values is set; 0 iff W is symmetric.  The
+     rows of W and W' are compared in parallel. */
+    size_t CountAsymmetric(bool compare_values = false) const;
+
+    /** W and W' merged row by row in parallel.  A pair present in both
+     directions keeps its own weights; a pair added by sym_union takes the
+     weight of its reverse. */
+    CsrWeight* Symmetrize(SymmetrizeMode mode) const;
+
+    // GeoDaWeight interface
+    virtual bool SaveDIDWeights(Project* project,
+                                int num_obs,
+                                std::vector<wxInt64>& newids,
+                                std::vector<wxInt64>& stack_ids,
+                                const wxString& ofname);
+
+    virtual bool SaveSpaceTimeWeights(const wxString& ofname,
+                                      WeightsManInterface* wmi,
+                                      TableInterface* table_int);
+
+    /** binary search in the sorted row */
+    virtual bool CheckNeighbor(int obs_idx, int nbr_idx);
+
+    virtual const std::vector<long> GetNeighbors(int obs_idx);
+
+    /** drop undefined observations from all neighbor lists, in place */
+    virtual void Update(const std::vector<bool>& undefs);
+
+    virtual bool HasIsolates();
+
+    virtual void GetNbrStats();
+
+protected:
+    std::vector<boost::uint64_t> offsets; // num_obs + 1
+    std::vector<int> nbrs;
+    std::vector<double> values;
+
+    // the arrays actually read: the vectors above or a mapped file
+    const boost::uint64_t* off_ptr;
+    const int* nbr_ptr;
+    const double* val_ptr;
+    boost::shared_ptr<void> mapping;
+
+    /** point off_ptr, nbr_ptr and val_ptr at the vectors */
+    void SetPointers();
+    /** copy a mapped file into the vectors before changing them */
+    void Detach();
+    void SortRows();
+};
+
+#endif
@@ -23,6 +23,7 @@
 #include <set>
 #include <map>
 #include <utility>
+#include <boost/bind.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <wx/filename.h>
 
@@ -30,7 +31,10 @@
 #include "../Project.h"
 #include "../VarCalc/WeightsManInterface.h"
 #include "../DataViewer/TableInterface.h"
+#include "../GdaThreadPool.h"
+#include "CsrWeight.h"
 #include "GalWeight.h"
+#include "StackedWeights.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -335,125 +339,33 @@ bool GalWeight::SaveDIDWeights(Project* project, int num_obs,
                                std::vector<wxInt64>& stack_ids,
                                const wxString& ofname)
 {
-    using namespace std;
     if (!project || ofname.empty()) return false;
     
     WeightsManInterface* wmi = project->GetWManInt();
     if (!wmi) return false;
     
-    wxString layer_name = GenUtils::GetFileNameNoExt(ofname);
+    if (!gal || num_obs != this->num_obs) return false;
     
-    GalElement* gal = this->gal;
-    if (!gal) return false;
-    
-    int n = newids.size();
-    
-    ofstream out;
-    out.open(GET_ENCODED_FILENAME(ofname));
-    if (!(out.is_open() && out.good())) return false;
-  
-    // if layer_name contains an empty space, the layer name should be
-    // braced with quotes "layer name"
-    if (layer_name.Contains(" ")) {
-        layer_name = "\"" + layer_name + "\"";
-    }
-    
-    wxString id_var_name("STID");
-    out << "0 " << n << " " << layer_name;
-    out << " " << id_var_name << endl;
-   
-    int offset = 0;
-    
-    for (size_t i=0; i<n; ++i) {
-        int orig_id = stack_ids[i];
-        if (i == num_obs) {
-            offset = num_obs;
-            num_obs += num_obs;
-        }
-        
-        out << newids[i];
-        out << " " << gal[orig_id].Size() << endl;
-        
-        for (int cp=gal[orig_id].Size(); --cp >= 0;) {
-			int n_id = gal[orig_id][cp];
-            out << n_id + offset + 1; // n_id starts from 0, so add 1
-            if (cp > 0) out << " ";
-        }
-        out << endl;
-    }
-    return true;
+    StackedWeights st(this);
+    st.SetDID(newids, stack_ids);
+    return st.Write(ofname, GenUtils::GetFileNameNoExt(ofname));
 }
 
 bool GalWeight::SaveSpaceTimeWeights(const wxString& ofname,
                                      WeightsManInterface* wmi,
                                      TableInterface* table_int)
 {
-    using namespace std;
-    
     if (ofname.empty() || !wmi || !table_int)
         return false;
     
-    wxString layer_name = GenUtils::GetFileNameNoExt(ofname);
-    GalElement* gal = this->gal;
     if (!gal) return false;
-
-    vector<wxString> id_vec;
-    int c_id = table_int->FindColId(this->id_field);
-    if (c_id < 0) return false;
-
-    table_int->GetColData(c_id, 1, id_vec);
     
     std::vector<wxString> time_ids;
     table_int->GetTimeStrings(time_ids);
-
-    size_t num_obs = id_vec.size();
-    size_t num_t = time_ids.size();
-    size_t n = num_obs * num_t;
-
-    
-    typedef std::pair<wxString, wxString> STID_KEY;
-    std::map<STID_KEY, int> stid_dict;
-    
-    int id=1;
-    for (size_t i=0; i<num_t; ++i) {
-        for (size_t j=0; j<num_obs; ++j) {
-            STID_KEY k(id_vec[j], time_ids[i]);
-            stid_dict[k] = id++;
-        }
-    }
-
-    ofstream out;
-    out.open(GET_ENCODED_FILENAME(ofname));
-    if (!(out.is_open() && out.good())) return false;
-    
-    // if layer_name contains an empty space, the layer name should be
-    // braced with quotes "layer name"
-    if (layer_name.Contains(" ")) {
-        layer_name = "\"" + layer_name + "\"";
-    }
     
-    wxString id_var_name("STID");
-    out << "0 " << n << " " << layer_name;
-    out << " " << id_var_name << endl;
-
-    for (size_t i=0; i<num_t; ++i) {
-        for (size_t j=0; j<num_obs; ++j) {
-            STID_KEY k(id_vec[j], time_ids[i]);
-            int m_id = stid_dict[k];
-            out << m_id;
-            out << " " << gal[j].Size() << endl;
-            
-            for (int cp=gal[j].Size(); --cp >= 0;) {
-                STID_KEY k(id_vec[gal[j][cp]], time_ids[i]);
-                int n_id = stid_dict[k];
-                out << n_id;
-                if (cp > 0) out << " ";
-            }
-            out << endl;
-        }
-    }
-
-    return true;
+    StackedWeights st(this);
+    st.SetSpaceTime(time_ids.size());
+    return st.Write(ofname, GenUtils::GetFileNameNoExt(ofname));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -558,48 +470,141 @@ bool Gda::SaveSpaceTimeGal(const GalElement* g,
                   const wxString& id_var_name,
                   const std::vector<wxString>& id_vec)
 {
-	using namespace std;
 	if (g == NULL || ofname.empty() ||
         id_var_name.empty() || id_vec.size() == 0) return false;
 	
 	wxFileName wx_fn(ofname);
 	wx_fn.SetExt("gal");
 	wxString final_fon(wx_fn.GetFullPath());
-#ifdef __WIN32__
-	ofstream out(final_fon.wc_str());
-#else
-	ofstream out;
-	out.open(GET_ENCODED_FILENAME(final_fon));
-#endif
-	if (!(out.is_open() && out.good())) return false;
 	
-	size_t num_obs = id_vec.size();
-    size_t num_t = time_ids.size();
-    size_t n = num_obs * num_t;
-   
-    wxString layer_name(_layer_name);
-    // if layer_name contains an empty space, the layer name should be
-    // braced with quotes "layer name"
-    if (layer_name.Contains(" ")) {
-        layer_name = "\"" + layer_name + "\"";
+	CsrWeight w(g, id_vec.size());
+	StackedWeights st(&w);
+	st.SetSpaceTime(id_vec, time_ids);
+	return st.WriteGal(final_fon, _layer_name, id_var_name);
+}
+
+/*
+ Higher order contiguity
+
+ A breadth first search from every observation, in parallel over blocks of
+ observations.  Instead of sets, every job borrows a mark array of num_obs
+ ints from a small pool: a node is visited from source i when its mark is
+ i, so the array never has to be cleared between sources.  Each block
+ writes its rows, sorted, into its own buffer; the buffers are then copied
+ into the CSR arrays one after another.
+ */
+namespace {
+    const int higher_ord_chunk_size = 1024;
+
+    struct HigherOrdBuilder
+    {
+        const GalElement* W;
+        int num_obs;
+        int distance;
+        bool cummulative;
+        // counts[i]: neighbors of i; rows[chunk]: the rows of a chunk
+        std::vector<boost::uint64_t> counts;
+        std::vector<std::vector<int> > rows;
+
+        boost::mutex marks_mutex;
+        std::vector<std::vector<int>*> free_marks;
+
+        std::vector<int>* BorrowMarks();
+        void ReturnMarks(std::vector<int>* marks);
+        void SearchRows(int first, int last);
+        CsrWeight* Run();
+        ~HigherOrdBuilder();
+    };
+
+    std::vector<int>* HigherOrdBuilder::BorrowMarks()
+    {
+        {
+            boost::mutex::scoped_lock lock(marks_mutex);
+            if (!free_marks.empty()) {
+                std::vector<int>* marks = free_marks.back();
+                free_marks.pop_back();
+                return marks;
+            }
+        }
+        return new std::vector<int>(num_obs, -1);
     }
-    
-	out << "0 " << n << " " << layer_name;
-	out << " " << id_var_name << endl;
 
-    for (size_t i=0; i<num_t; ++i) {
-    	for (size_t j=0; j<num_obs; ++j) {
-            out << id_vec[i] << "_t" << time_ids[i];
-    		out << " " << g[i].Size() << endl;
-            
-    		for (int cp=g[i].Size(); --cp >= 0;) {
-    			out << id_vec[g[i][cp]] << "_t" << time_ids[i];
-    			if (cp > 0) out << " ";
-    		}
-    		out << endl;
-    	}
+    void HigherOrdBuilder::ReturnMarks(std::vector<int>* marks)
+    {
+        boost::mutex::scoped_lock lock(marks_mutex);
+        free_marks.push_back(marks);
+    }
+
+    HigherOrdBuilder::~HigherOrdBuilder()
+    {
+        for (size_t i=0; i<free_marks.size(); i++) delete free_marks[i];
+    }
+
+    void HigherOrdBuilder::SearchRows(int first, int last)
+    {
+        std::vector<int>& marks = *BorrowMarks();
+        std::vector<int>& out = rows[first / higher_ord_chunk_size];
+        std::vector<int> frontier, next;
+        for (int i=first; i<=last; i++) {
+            size_t row_start = out.size();
+            marks[i] = i;
+            frontier.assign(1, i);
+            for (int d=1; d<=distance && !frontier.empty(); d++) {
+                next.clear();
+                for (size_t f=0; f<frontier.size(); f++) {
+                    const GalElement& e = W[frontier[f]];
+                    for (long j=0, sz=e.Size(); j<sz; j++) {
+                        int nbr = (int) e[j];
+                        if (marks[nbr] == i) continue;
+                        marks[nbr] = i;
+                        next.push_back(nbr);
+                    }
+                }
+                if (cummulative || d == distance) {
+                    out.insert(out.end(), next.begin(), next.end());
+                }
+                frontier.swap(next);
+            }
+            std::sort(out.begin() + row_start, out.end());
+            counts[i] = out.size() - row_start;
+        }
+        ReturnMarks(&marks);
+    }
+
+    CsrWeight* HigherOrdBuilder::Run()
+    {
+        int num_chunks = (num_obs + higher_ord_chunk_size - 1) /
+            higher_ord_chunk_size;
+        counts.resize(num_obs);
+        rows.resize(num_chunks);
+        GdaThreadPool::GetInstance().ParallelFor(num_obs,
+            boost::bind(&HigherOrdBuilder::SearchRows, this, _1, _2),
+            higher_ord_chunk_size);
+        return CsrWeight::FromRowBlocks(counts, rows, higher_ord_chunk_size);
+    }
+
+    void SetGalRows(GalElement* W, const CsrWeight* w, int first, int last)
+    {
+        for (int i=first; i<=last; i++) {
+            int sz = w->GetNumNbrs(i);
+            const int* nb = w->GetNbrs(i);
+            W[i].nbrLookup.clear();
+            W[i].SetSizeNbrs(sz);
+            // descending, as the set based version used to leave them
+            for (int j=0; j<sz; j++) W[i].SetNbr(j, nb[sz-1-j]);
+        }
     }
-	return true;
+}
+
+CsrWeight* Gda::HigherOrdContiguity(size_t distance, size_t obs,
+                                    const GalElement* W, bool cummulative)
+{
+    HigherOrdBuilder b;
+    b.W = W;
+    b.num_obs = (int) obs;
+    b.distance = (int) distance;
+    b.cummulative = cummulative;
+    return b.Run();
 }
 
 /** Add higher order neighbors up to (and including) distance.
@@ -609,43 +614,10 @@ void Gda::MakeHigherOrdContiguity(size_t distance, size_t obs,
                                   GalElement* W,
                                   bool cummulative)
 {	
-	using namespace std;
 	if (obs < 1 || distance <=1) return;
-	vector<vector<long> > X(obs);
-	for (size_t i=0; i<obs; ++i) {
-		vector<set<long> > n_at_d(distance+1);
-		n_at_d[0].insert(i);
-		for (size_t j=0, sz=W[i].Size(); j<sz; ++j) {
-			n_at_d[1].insert(W[i][j]);
-		}
-		for (size_t d=2; d<=distance; ++d) {
-			for (set<long>::const_iterator it=n_at_d[d-1].begin();
-					 it!=n_at_d[d-1].end(); ++it)
-			{
-				for (size_t j=0, sz=W[*it].Size(); j<sz; ++j) {
-					long nbr = W[*it][j];
-					if (n_at_d[d-1].find(nbr) == n_at_d[d-1].end() &&
-							n_at_d[d-2].find(nbr) == n_at_d[d-2].end()) {
-						n_at_d[d].insert(nbr);
-					}
-				}
-			}
-		}
-		size_t sz_Xi = 0;
-		for (size_t d=(cummulative ? 1 : distance); d<=distance; ++d) {
-			sz_Xi += n_at_d[d].size();
-		}
-		X[i].resize(sz_Xi);
-		size_t cnt=0;
-		for (size_t d=(cummulative ? 1 : distance); d<=distance; ++d) {
-			for (set<long>::const_iterator it=n_at_d[d].begin();
-					 it!=n_at_d[d].end(); ++it) { X[i][cnt++] = *it; }
-		}
-		sort(X[i].begin(), X[i].end(), greater<long>());
-	}
-	for (size_t i=0; i<obs; ++i) {
-		W[i].SetSizeNbrs(X[i].size());
-		for (size_t j=0, sz=X[i].size(); j<sz; ++j) W[i].SetNbr(j, X[i][j]);
-	}
+	CsrWeight* w = HigherOrdContiguity(distance, obs, W, cummulative);
+	GdaThreadPool::GetInstance().ParallelFor(obs,
+		boost::bind(&SetGalRows, W, w, _1, _2), higher_ord_chunk_size);
+	delete w;
 }
 
@@ -24,6 +24,7 @@
 #include <map>
 #include "GeodaWeight.h"
 
+class CsrWeight;
 class Project;
 class WeightsManInterface;
 class TableInterface;
@@ -114,6 +115,13 @@ namespace Gda {
                           const wxString& id_var_name,
                           const std::vector<wxString>& id_vec);
     
+	/** Neighbors up to (and including) order distance of the contiguity
+	 weights W as binary CSR weights, found by a breadth first search from
+	 every observation in parallel.  If cummulative is false only the
+	 neighbors of exactly order distance are kept. */
+	CsrWeight* HigherOrdContiguity(size_t distance, size_t obs,
+	                               const GalElement* W, bool cummulative);
+	/** Replace the neighbors of W by HigherOrdContiguity() */
 	void MakeHigherOrdContiguity(size_t distance, size_t obs, GalElement* W, bool cummulative);
 }
 
@@ -69,7 +69,7 @@ public:
     virtual wxString GetIDName() const { return id_field;}
 
     // Properties
-	enum WeightType { gal_type, gwt_type };
+	enum WeightType { gal_type, gwt_type, csr_type };
 	WeightType weight_type;
 	wxString   wflnm; // filename
     wxString   id_field;
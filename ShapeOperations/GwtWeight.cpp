@@ -25,6 +25,7 @@
 #include "../GenUtils.h"
 #include "../Project.h"
 #include "GwtWeight.h"
+#include "StackedWeights.h"
 
 
 GwtElement::~GwtElement()
@@ -154,129 +155,31 @@ void GwtWeight::GetNbrStats()
 
 bool GwtWeight::SaveDIDWeights(Project* project, int num_obs, std::vector<wxInt64>& newids, std::vector<wxInt64>& stack_ids, const wxString& ofname)
 {
-    using namespace std;
     if (!project || ofname.empty()) return false;
     
     WeightsManInterface* wmi = project->GetWManInt();
     if (!wmi) return false;
     
-    wxString layer_name = GenUtils::GetFileNameNoExt(ofname);
+    if (!gwt || num_obs != this->num_obs) return false;
     
-    if (!gwt) return false;
-    
-    int n = newids.size();
-    
-#ifdef __WIN32__
-	ofstream out(ofname.wc_str());
-#else
-	ofstream out;
-	out.open(GET_ENCODED_FILENAME(ofname));
-#endif
-
-    if (!(out.is_open() && out.good())) return false;
-    
-    // if layer_name contains an empty space, the layer name should be
-    // braced with quotes "layer name"
-    if (layer_name.Contains(" ")) {
-        layer_name = "\"" + layer_name + "\"";
-    }
-    
-    wxString id_var_name("STID");
-    out << "0 " << n << " " << layer_name;
-    out << " " << id_var_name << endl;
-    
-    int offset = 0;
-    
-    for (size_t i=0; i<n; ++i) {
-        int orig_id = stack_ids[i];
-        if (i == num_obs) {
-            offset = num_obs;
-            num_obs += num_obs;
-        }
-        
-        for (long nbr=0; nbr<gwt[orig_id].Size(); ++nbr) {
-            const GwtNeighbor& current = gwt[orig_id].elt(nbr);
-            
-            int n_id = current.nbx + offset + 1; // current.nbx starts from 0, so add 1
-            
-            out << newids[i] << ' ' << n_id << ' ' << setprecision(9) << setw(18) << current.weight << endl;
-        }
-    }
-    return true;
+    StackedWeights st(this);
+    st.SetDID(newids, stack_ids);
+    return st.Write(ofname, GenUtils::GetFileNameNoExt(ofname));
 }
 
 bool GwtWeight::SaveSpaceTimeWeights(const wxString& ofname, WeightsManInterface* wmi, TableInterface* table_int)
 {
-    using namespace std;
-    
     if (ofname.empty() || !wmi || !table_int)
         return false;
     
-    wxString layer_name = GenUtils::GetFileNameNoExt(ofname);
     if (!gwt) return false;
     
-    vector<wxString> id_vec;
-    int c_id = table_int->FindColId(this->id_field);
-    if (c_id < 0) return false;
-    
-    table_int->GetColData(c_id, 1, id_vec);
-    
     std::vector<wxString> time_ids;
     table_int->GetTimeStrings(time_ids);
     
-    size_t num_obs = id_vec.size();
-    size_t num_t = time_ids.size();
-    size_t n = num_obs * num_t;
-
-    // (id, time) : stid
-    typedef std::pair<wxString, wxString> STID_KEY;
-    std::map<STID_KEY, int> stid_dict;
-    
-    int id=1;
-    for (size_t i=0; i<num_t; ++i) {
-        for (size_t j=0; j<num_obs; ++j) {
-            STID_KEY k(id_vec[j], time_ids[i]);
-            stid_dict[k] = id++;
-        }
-    }
-    
-#ifdef __WIN32__
-	ofstream out(ofname.wc_str());
-#else
-	ofstream out;
-	out.open(GET_ENCODED_FILENAME(ofname));
-#endif
-
-    if (!(out.is_open() && out.good())) return false;
-    
-    // if layer_name contains an empty space, the layer name should be
-    // braced with quotes "layer name"
-    if (layer_name.Contains(" ")) {
-        layer_name = "\"" + layer_name + "\"";
-    }
-    
-    wxString id_var_name("STID");
-    out << "0 " << n << " " << layer_name;
-    out << " " << id_var_name << endl;
-    
-    
-    for (size_t i=0; i<num_t; ++i) {
-        for (size_t j=0; j<num_obs; ++j) {
-            STID_KEY k(id_vec[j], time_ids[i]);
-            int m_id = stid_dict[k];
-            
-            for (long nbr=0; nbr<gwt[j].Size(); ++nbr) {
-                const GwtNeighbor& current = gwt[j].elt(nbr);
-                
-                STID_KEY k1(id_vec[current.nbx], time_ids[i]);
-                int n_id = stid_dict[k1];
-                
-                out << m_id << ' ' << n_id << ' ' << setprecision(9) << setw(18) << current.weight << endl;
-            }
-        }
-    }
-    
-    return true;
+    StackedWeights st(this);
+    st.SetSpaceTime(time_ids.size());
+    return st.Write(ofname, GenUtils::GetFileNameNoExt(ofname));
 }
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -25,16 +25,21 @@
 #include <cmath>
 #include <time.h>
 #include <vector>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <wx/wxprec.h>
 #ifndef WX_PRECOMP
 #include <wx/wx.h>
 #endif
+#include <wx/stopwatch.h>
 
 
 
 #include "../logger.h"
 #include "../GenUtils.h"
+#include "../GdaThreadPool.h"
 #include "PolysToContigWeights.h"
 
 using namespace std;
@@ -699,8 +704,288 @@ GalElement* PolysToContigWeights(OGRLayer* layer, bool is_queen,
 }
 */
 
+/*
+ Hashed contiguity builder
+
+ Every vertex (queen) or every edge (rook) of every polygon is a key.  The
+ keys are spread over num_shards shards by their hash: first every block
+ of polygons writes its keys into per-shard lists, then every shard builds
+ its own hash table and emits the polygons that share a bucket.  Blocks
+ and shards are handled in parallel without locks, and the output does
+ not depend on the number of threads.
+ */
+namespace {
+    const int hash_contig_shards = 64;
+    
+    // snap a coordinate to the precision grid so that equal keys hash equal
+    inline double SnapCoord(double v, double precision_threshold)
+    {
+        if (precision_threshold <= 0) return v;
+        return floor(v / precision_threshold + 0.5) * precision_threshold;
+    }
+    
+    inline Shapefile::Point SnapPoint(const Shapefile::Point& p,
+                                      double precision_threshold)
+    {
+        return Shapefile::Point(SnapCoord(p.x, precision_threshold),
+                                SnapCoord(p.y, precision_threshold));
+    }
+    
+    template <class Key>
+    struct HashContigBuilder
+    {
+        typedef std::pair<Key, int> Entry;
+        typedef std::vector<Entry> EntryList;
+        
+        Shapefile::Main* main;
+        bool is_queen;
+        double precision_threshold;
+        int num_obs;
+        int num_blocks;
+        // keys[block][shard]
+        std::vector<std::vector<EntryList> > keys;
+        // pairs[shard]: (i, j) with i < j, may contain duplicates
+        std::vector<std::vector<std::pair<int, int> > > pairs;
+        
+        void AddKey(std::vector<EntryList>& shards, const Key& k, int poly)
+        {
+            size_t h = hash_value(k);
+            shards[h % hash_contig_shards].push_back(Entry(k, poly));
+        }
+        
+        void CollectKeys(int first_block, int last_block);
+        void EmitPairs(int first_shard, int last_shard);
+        GalElement* Run();
+    };
+    
+    inline void MakeKeys(const Shapefile::PolygonContents* ply, int poly,
+                         double precision_threshold,
+                         HashContigBuilder<Shapefile::Point>& b,
+                         std::vector<HashContigBuilder<Shapefile::Point>::EntryList>& shards)
+    {
+        for (size_t i=0; i<ply->points.size(); i++) {
+            b.AddKey(shards, SnapPoint(ply->points[i], precision_threshold),
+                     poly);
+        }
+    }
+    
+    inline void MakeKeys(const Shapefile::PolygonContents* ply, int poly,
+                         double precision_threshold,
+                         HashContigBuilder<Shapefile::Edge>& b,
+                         std::vector<HashContigBuilder<Shapefile::Edge>::EntryList>& shards)
+    {
+        int num_parts = ply->parts.size();
+        int num_points = ply->points.size();
+        for (int part=0; part<num_parts; part++) {
+            int start = ply->parts[part];
+            int end = part+1 < num_parts ? ply->parts[part+1] : num_points;
+            for (int i=start; i+1<end; i++) {
+                Shapefile::Point a = SnapPoint(ply->points[i],
+                                               precision_threshold);
+                Shapefile::Point c = SnapPoint(ply->points[i+1],
+                                               precision_threshold);
+                if (a == c) continue; // repeated vertex
+                b.AddKey(shards, Shapefile::Edge(a, c), poly);
+            }
+        }
+    }
+    
+    template <class Key>
+    void HashContigBuilder<Key>::CollectKeys(int first_block, int last_block)
+    {
+        for (int blk=first_block; blk<=last_block; blk++) {
+            int first = (int) ((long long) num_obs * blk / num_blocks);
+            int last = (int) ((long long) num_obs * (blk+1) / num_blocks);
+            std::vector<EntryList>& shards = keys[blk];
+            shards.resize(hash_contig_shards);
+            for (int i=first; i<last; i++) {
+                Shapefile::PolygonContents* ply =
+                    dynamic_cast<Shapefile::PolygonContents*>(main->records[i].contents_p);
+                if (ply == NULL) continue;
+                MakeKeys(ply, i, precision_threshold, *this, shards);
+            }
+        }
+    }
+    
+    template <class Key>
+    void HashContigBuilder<Key>::EmitPairs(int first_shard, int last_shard)
+    {
+        for (int s=first_shard; s<=last_shard; s++) {
+            size_t n = 0;
+            for (int blk=0; blk<num_blocks; blk++) n += keys[blk][s].size();
+            
+            // bucket heads in the hash table, entries chained through next
+            boost::unordered_map<Key, int> head;
+            head.reserve(n);
+            std::vector<int> next(n, -1);
+            std::vector<int> poly(n);
+            size_t k = 0;
+            for (int blk=0; blk<num_blocks; blk++) {
+                EntryList& list = keys[blk][s];
+                for (size_t e=0; e<list.size(); e++, k++) {
+                    poly[k] = list[e].second;
+                    typename boost::unordered_map<Key, int>::iterator it;
+                    it = head.find(list[e].first);
+                    if (it == head.end()) {
+                        head[list[e].first] = k;
+                    } else {
+                        next[k] = it->second;
+                        it->second = k;
+                    }
+                }
+                EntryList().swap(list);
+            }
+            
+            std::vector<std::pair<int, int> >& out = pairs[s];
+            std::vector<int> bucket;
+            typename boost::unordered_map<Key, int>::iterator it;
+            for (it = head.begin(); it != head.end(); ++it) {
+                bucket.clear();
+                for (int e = it->second; e >= 0; e = next[e]) {
+                    bucket.push_back(poly[e]);
+                }
+                if (bucket.size() < 2) continue;
+                std::sort(bucket.begin(), bucket.end());
+                bucket.erase(std::unique(bucket.begin(), bucket.end()),
+                             bucket.end());
+                for (size_t a=0; a<bucket.size(); a++) {
+                    for (size_t b=a+1; b<bucket.size(); b++) {
+                        out.push_back(std::make_pair(bucket[a], bucket[b]));
+                    }
+                }
+            }
+        }
+    }
+    
+    template <class Key>
+    GalElement* HashContigBuilder<Key>::Run()
+    {
+        num_blocks = hash_contig_shards;
+        keys.resize(num_blocks);
+        pairs.resize(hash_contig_shards);
+        
+        GdaThreadPool& pool = GdaThreadPool::GetInstance();
+        pool.ParallelFor(num_blocks,
+            boost::bind(&HashContigBuilder<Key>::CollectKeys, this, _1, _2), 1);
+        pool.ParallelFor(hash_contig_shards,
+            boost::bind(&HashContigBuilder<Key>::EmitPairs, this, _1, _2), 1);
+        
+        std::vector<std::vector<long> > nbrs(num_obs);
+        for (int s=0; s<hash_contig_shards; s++) {
+            for (size_t p=0; p<pairs[s].size(); p++) {
+                nbrs[pairs[s][p].first].push_back(pairs[s][p].second);
+                nbrs[pairs[s][p].second].push_back(pairs[s][p].first);
+            }
+            std::vector<std::pair<int, int> >().swap(pairs[s]);
+        }
+        
+        GalElement* gl = new GalElement[num_obs];
+        for (int i=0; i<num_obs; i++) {
+            std::vector<long>& nb = nbrs[i];
+            std::sort(nb.begin(), nb.end());
+            nb.erase(std::unique(nb.begin(), nb.end()), nb.end());
+            gl[i].SetSizeNbrs(nb.size());
+            for (size_t j=0; j<nb.size(); j++) gl[i].SetNbr(j, nb[j]);
+            gl[i].SortNbrs();
+        }
+        return gl;
+    }
+}
 
+GalElement* PolysToContigWeightsHashed(Shapefile::Main& main, bool is_queen,
+                                       double precision_threshold)
+{
+    int num_obs = main.records.size();
+    if (num_obs == 0) return NULL;
+    if (is_queen) {
+        HashContigBuilder<Shapefile::Point> b;
+        b.main = &main;
+        b.is_queen = true;
+        b.precision_threshold = precision_threshold;
+        b.num_obs = num_obs;
+        return b.Run();
+    }
+    HashContigBuilder<Shapefile::Edge> b;
+    b.main = &main;
+    b.is_queen = false;
+    b.precision_threshold = precision_threshold;
+    b.num_obs = num_obs;
+    return b.Run();
+}
 
+GalElement* CreateContigWeights(Shapefile::Main& main, bool is_queen,
+                                double precision_threshold)
+{
+    if (GdaConst::gda_use_hash_contiguity) {
+        return PolysToContigWeightsHashed(main, is_queen, precision_threshold);
+    }
+    return PolysToContigWeights(main, is_queen, precision_threshold);
+}
 
+/** n_rows x n_cols unit squares, one polygon record each, in row major
+ order; every interior square has 8 queen and 4 rook neighbors */
+void MakeGridPolygons(int n_rows, int n_cols, Shapefile::Main& main)
+{
+    using namespace Shapefile;
+    main.records.clear();
+    main.records.resize((size_t)n_rows * n_cols);
+    main.header.shape_type = POLYGON;
+    main.header.bbox_x_min = 0;
+    main.header.bbox_y_min = 0;
+    main.header.bbox_x_max = n_cols;
+    main.header.bbox_y_max = n_rows;
+    for (int r=0; r<n_rows; r++) {
+        for (int c=0; c<n_cols; c++) {
+            PolygonContents* ply = new PolygonContents();
+            ply->box[0] = c;
+            ply->box[1] = r;
+            ply->box[2] = c+1;
+            ply->box[3] = r+1;
+            ply->num_parts = 1;
+            ply->num_points = 5;
+            ply->parts.push_back(0);
+            ply->points.push_back(Point(c, r));
+            ply->points.push_back(Point(c, r+1));
+            ply->points.push_back(Point(c+1, r+1));
+            ply->points.push_back(Point(c+1, r));
+            ply->points.push_back(Point(c, r));
+            size_t i = (size_t)r * n_cols + c;
+            main.records[i].header.record_number = i+1;
+            main.records[i].contents_p = ply;
+        }
+    }
+}
 
-
+wxString BenchmarkContigWeights(Shapefile::Main& main, bool is_queen,
+                                double precision_threshold)
+{
+    int num_obs = main.records.size();
+    wxStopWatch sw;
+    GalElement* sweep = PolysToContigWeights(main, is_queen,
+                                             precision_threshold);
+    long sweep_ms = sw.Time();
+    sw.Start();
+    GalElement* hashed = PolysToContigWeightsHashed(main, is_queen,
+                                                    precision_threshold);
+    long hashed_ms = sw.Time();
+    
+    int num_diff = 0;
+    long num_links = 0;
+    for (int i=0; i<num_obs; i++) {
+        std::vector<long> a = sweep[i].GetNbrs();
+        std::vector<long> b = hashed[i].GetNbrs();
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        if (a != b) num_diff++;
+        num_links += b.size();
+    }
+    delete [] sweep;
+    delete [] hashed;
+    
+    wxString report;
+    report << (is_queen ? "queen" : "rook") << ", " << num_obs
+           << " polygons, " << num_links << " links: sweep " << sweep_ms
+           << " ms, hashed " << hashed_ms << " ms, " << num_diff
+           << " observations with different neighbors";
+    return report;
+}
@@ -191,6 +191,30 @@ GalElement* PolysToContigWeights(Shapefile::Main& main,
                                  bool is_queen,
                                  double precision_threshold=0.0);
 
+/** Same weights as PolysToContigWeights() from hashed vertices (queen) or
+ edges (rook), built in parallel.  With precision_threshold > 0 the
+ coordinates are snapped to a grid of that size instead of compared within
+ the threshold, so two points closer than the threshold but on different
+ sides of a grid line are not matched. */
+GalElement* PolysToContigWeightsHashed(Shapefile::Main& main,
+                                       bool is_queen,
+                                       double precision_threshold=0.0);
+
+/** PolysToContigWeightsHashed() if GdaConst::gda_use_hash_contiguity is
+ set, PolysToContigWeights() otherwise */
+GalElement* CreateContigWeights(Shapefile::Main& main,
+                                bool is_queen,
+                                double precision_threshold=0.0);
+
+/** fill main with a n_rows x n_cols grid of unit squares */
+void MakeGridPolygons(int n_rows, int n_cols, Shapefile::Main& main);
+
+/** time both builders on main and count the observations whose neighbors
+ differ */
+wxString BenchmarkContigWeights(Shapefile::Main& main,
+                                bool is_queen,
+                                double precision_threshold=0.0);
+
 /*
 GalElement* PolysToContigWeights(OGRLayer* layer,
                                  bool is_queen,
@@ -0,0 +1,324 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <clocale>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <wx/filename.h>
+#include <wx/log.h>
+
+#include "../GenUtils.h"
+#include "GalWeight.h"
+#include "GwtWeight.h"
+#include "CsrWeight.h"
+#include "StackedWeights.h"
+
+using namespace std;
+
+namespace {
+    const size_t text_buffer_size = 1 << 20;
+
+    /** ofstream behind a plain char buffer, with integers and doubles
+     formatted in place */
+    class TextWriter
+    {
+    public:
+        TextWriter(const wxString& fname)
+        : buf(text_buffer_size), pos(0)
+        {
+#ifdef __WIN32__
+            out.open(fname.wc_str(), ios::out|ios::binary|ios::trunc);
+#else
+            out.open(GET_ENCODED_FILENAME(fname),
+                     ios::out|ios::binary|ios::trunc);
+#endif
+            const char* dp = localeconv()->decimal_point;
+            decimal_point = dp && dp[0] ? dp[0] : '.';
+        }
+
+        bool IsOk() const { return out.is_open() && out.good(); }
+
+        void Put(char c) {
+            if (pos == buf.size()) Flush();
+            buf[pos++] = c;
+        }
+        void Put(const char* s, size_t n) {
+            if (pos + n > buf.size()) Flush();
+            if (n > buf.size()) {
+                out.write(s, n);
+                return;
+            }
+            memcpy(&buf[pos], s, n);
+            pos += n;
+        }
+        void Put(const wxString& s) {
+            wxScopedCharBuffer b = s.ToUTF8();
+            Put(b.data(), b.length());
+        }
+        void Put(const std::string& s) { Put(s.data(), s.size()); }
+        /** "<id>_t<time>" */
+        void PutLabel(const std::string& id, const std::string& tm) {
+            Put(id);
+            Put("_t", 2);
+            Put(tm);
+        }
+        void PutInt(wxInt64 v) {
+            char tmp[24];
+            int len = 0;
+            wxUint64 u = v < 0 ? 0 - (wxUint64) v : v;
+            do {
+                tmp[len++] = '0' + (char) (u % 10);
+                u /= 10;
+            } while (u > 0);
+            if (v < 0) tmp[len++] = '-';
+            std::reverse(tmp, tmp + len);
+            Put(tmp, len);
+        }
+        /** as setprecision(9) << setw(18) of the old writers */
+        void PutWeight(double v) {
+            char tmp[40];
+            int len = snprintf(tmp, sizeof(tmp), "%18.9g", v);
+            if (len < 0 || len >= (int) sizeof(tmp)) return;
+            if (decimal_point != '.') {
+                std::replace(tmp, tmp + len, decimal_point, '.');
+            }
+            Put(tmp, len);
+        }
+
+        /** "0 n layer_name id_var_name" */
+        void PutHeader(size_t n, wxString layer_name,
+                       const wxString& id_var_name)
+        {
+            // if layer_name contains an empty space, the layer name should
+            // be braced with quotes "layer name"
+            if (layer_name.Contains(" ")) {
+                layer_name = "\"" + layer_name + "\"";
+            }
+            Put("0 ", 2);
+            PutInt(n);
+            Put(' ');
+            Put(layer_name);
+            Put(' ');
+            Put(id_var_name);
+            Put('\n');
+        }
+
+        void Flush() {
+            if (pos > 0) out.write(&buf[0], pos);
+            pos = 0;
+        }
+        bool Close() {
+            Flush();
+            out.close();
+            return !out.fail();
+        }
+
+    private:
+        ofstream out;
+        vector<char> buf;
+        size_t pos;
+        char decimal_point;
+    };
+}
+
+StackedWeights::StackedWeights(GeoDaWeight* w)
+: base(0), own_base(false), num_rows(0)
+{
+    int n = w->GetNumObs();
+    if (w->weight_type == GeoDaWeight::csr_type) {
+        base = (CsrWeight*) w;
+    } else if (w->weight_type == GeoDaWeight::gal_type) {
+        base = new CsrWeight(((GalWeight*) w)->gal, n, true);
+        own_base = true;
+    } else {
+        GwtElement* gwt = ((GwtWeight*) w)->gwt;
+        vector<vector<int> > nbrs(n);
+        vector<vector<double> > vals(n);
+        for (int i=0; i<n; i++) {
+            for (long j=0; j<gwt[i].Size(); j++) {
+                nbrs[i].push_back(gwt[i].elt(j).nbx);
+                vals[i].push_back(gwt[i].elt(j).weight);
+            }
+        }
+        base = new CsrWeight(nbrs, vals);
+        own_base = true;
+    }
+    num_base = base->GetNumObs();
+}
+
+StackedWeights::~StackedWeights()
+{
+    if (own_base) delete base;
+}
+
+void StackedWeights::SetSpaceTime(int num_periods)
+{
+    row_ids.clear();
+    stack_ids.clear();
+    id_labels.clear();
+    time_labels.clear();
+    num_rows = num_base * num_periods;
+}
+
+void StackedWeights::SetSpaceTime(const vector<wxString>& ids,
+                                  const vector<wxString>& time_ids)
+{
+    SetSpaceTime(time_ids.size());
+    id_labels.resize(ids.size());
+    for (size_t i=0; i<ids.size(); i++) {
+        id_labels[i] = string(ids[i].ToUTF8().data());
+    }
+    time_labels.resize(time_ids.size());
+    for (size_t t=0; t<time_ids.size(); t++) {
+        time_labels[t] = string(time_ids[t].ToUTF8().data());
+    }
+}
+
+void StackedWeights::SetDID(const vector<wxInt64>& row_ids_,
+                            const vector<wxInt64>& stack_ids_)
+{
+    id_labels.clear();
+    time_labels.clear();
+    row_ids = row_ids_;
+    stack_ids = stack_ids_;
+    num_rows = stack_ids.size();
+}
+
+bool StackedWeights::HasValues() const
+{
+    return !base->IsBinary();
+}
+
+int StackedWeights::GetRowSize(int row) const
+{
+    return base->GetNumNbrs(BaseRow(row));
+}
+
+void StackedWeights::GetRow(int row, vector<int>& nbrs,
+                            vector<double>& values) const
+{
+    int b = BaseRow(row), start = PeriodStart(row);
+    int sz = base->GetNumNbrs(b);
+    const int* nb = base->GetNbrs(b);
+    nbrs.resize(sz);
+    for (int j=0; j<sz; j++) nbrs[j] = nb[j] + start;
+    values.clear();
+    if (!base->IsBinary()) {
+        const double* v = base->GetValues(b);
+        values.assign(v, v + sz);
+    }
+}
+
+bool StackedWeights::Write(const wxString& ofname,
+                           const wxString& layer_name,
+                           const wxString& id_var_name) const
+{
+    wxString ext = wxFileName(ofname).GetExt().Lower();
+    if (ext == "gwb") return WriteBinary(ofname, id_var_name);
+    if (ext == "gwt" || ext == "kwt") {
+        return WriteGwt(ofname, layer_name, id_var_name);
+    }
+    return WriteGal(ofname, layer_name, id_var_name);
+}
+
+bool StackedWeights::WriteGal(const wxString& ofname,
+                              const wxString& layer_name,
+                              const wxString& id_var_name) const
+{
+    TextWriter out(ofname);
+    if (!out.IsOk()) return false;
+    out.PutHeader(num_rows, layer_name, id_var_name);
+    for (int r=0; r<num_rows; r++) {
+        int b = BaseRow(r), start = PeriodStart(r);
+        int sz = base->GetNumNbrs(b);
+        const int* nb = base->GetNbrs(b);
+        if (id_labels.empty()) {
+            out.PutInt(RowId(r));
+        } else {
+            out.PutLabel(id_labels[b], time_labels[r / num_base]);
+        }
+        out.Put(' ');
+        out.PutInt(sz);
+        out.Put('\n');
+        for (int j=0; j<sz; j++) {
+            if (j > 0) out.Put(' ');
+            if (id_labels.empty()) {
+                out.PutInt((wxInt64) nb[j] + start + 1);
+            } else {
+                out.PutLabel(id_labels[nb[j]], time_labels[r / num_base]);
+            }
+        }
+        out.Put('\n');
+    }
+    return out.Close();
+}
+
+bool StackedWeights::WriteGwt(const wxString& ofname,
+                              const wxString& layer_name,
+                              const wxString& id_var_name) const
+{
+    TextWriter out(ofname);
+    if (!out.IsOk()) return false;
+    out.PutHeader(num_rows, layer_name, id_var_name);
+    for (int r=0; r<num_rows; r++) {
+        int b = BaseRow(r), start = PeriodStart(r);
+        int sz = base->GetNumNbrs(b);
+        const int* nb = base->GetNbrs(b);
+        const double* v = base->GetValues(b);
+        wxInt64 id = RowId(r);
+        for (int j=0; j<sz; j++) {
+            if (id_labels.empty()) {
+                out.PutInt(id);
+                out.Put(' ');
+                out.PutInt((wxInt64) nb[j] + start + 1);
+            } else {
+                const string& tm = time_labels[r / num_base];
+                out.PutLabel(id_labels[b], tm);
+                out.Put(' ');
+                out.PutLabel(id_labels[nb[j]], tm);
+            }
+            out.Put(' ');
+            out.PutWeight(v ? v[j] : 1.0);
+            out.Put('\n');
+        }
+    }
+    return out.Close();
+}
+
+bool StackedWeights::WriteBinary(const wxString& ofname,
+                                 const wxString& id_var_name) const
+{
+    // the ids a table of the stack will hold in id_var_name
+    GdaWeightsBinary::IdHasher hasher;
+    for (int r=0; r<num_rows; r++) {
+        if (id_labels.empty()) {
+            hasher.Add(RowId(r));
+        } else {
+            string label = id_labels[BaseRow(r)] + "_t" +
+                time_labels[r / num_base];
+            hasher.Add(label.data(), label.size());
+        }
+    }
+    // every period is a copy of the base weights
+    bool is_symmetric = base->CountAsymmetric() == 0;
+    return GdaWeightsBinary::Write(ofname, *this, id_var_name, hasher.Get(),
+                                   is_symmetric);
+}
@@ -0,0 +1,109 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_STACKED_WEIGHTS_H__
+#define __GEODA_CENTER_STACKED_WEIGHTS_H__
+
+#include <string>
+#include <vector>
+#include <wx/string.h>
+
+#include "../io/weights_binary.h"
+
+class CsrWeight;
+class GeoDaWeight;
+
+/**
+ Space-time and difference-in-differences (DID) weights, generated row by
+ row from the weights of a single period.
+
+ The stack holds one copy of the base weights per period: row r of the
+ stack is a base row, and its neighbors are the base neighbors moved into
+ the period of r, so the stacked rows are the ids 1 .. num_rows in row
+ order.  Rows are produced on demand while a file is written through a
+ buffered writer, so the (n x T) stacked weights are never held in memory
+ and ids are formatted as integers, not through wxString.
+
+ \code
+ StackedWeights st(w);
+ st.SetSpaceTime(num_periods);
+ st.Write(ofname, layer_name);
+ \endcode
+ */
+class StackedWeights : public GdaWeightsBinary::RowSource
+{
+public:
+    /** base is read as CSR; GAL and GWT weights are copied once */
+    explicit StackedWeights(GeoDaWeight* base);
+    virtual ~StackedWeights();
+
+    /** row t*n+j is observation j in period t, with id t*n+j+1 */
+    void SetSpaceTime(int num_periods);
+
+    /** space-time weights with the ids "<id>_t<time>" of the observations
+     ids[j] and the periods time_ids[t] */
+    void SetSpaceTime(const std::vector<wxString>& ids,
+                      const std::vector<wxString>& time_ids);
+
+    /** row i is observation stack_ids[i] with id row_ids[i], in period
+     i/n, as laid out by the DID table of the line chart */
+    void SetDID(const std::vector<wxInt64>& row_ids,
+                const std::vector<wxInt64>& stack_ids);
+
+    /** write by the extension of ofname: .gwb GeoDa binary weights,
+     .gwt or .kwt GWT, otherwise GAL */
+    bool Write(const wxString& ofname, const wxString& layer_name,
+               const wxString& id_var_name = "STID") const;
+    bool WriteGal(const wxString& ofname, const wxString& layer_name,
+                  const wxString& id_var_name) const;
+    bool WriteGwt(const wxString& ofname, const wxString& layer_name,
+                  const wxString& id_var_name) const;
+    bool WriteBinary(const wxString& ofname,
+                     const wxString& id_var_name) const;
+
+    // GdaWeightsBinary::RowSource interface
+    virtual int GetNumRows() const { return num_rows; }
+    virtual bool HasValues() const;
+    virtual int GetRowSize(int row) const;
+    virtual void GetRow(int row, std::vector<int>& nbrs,
+                        std::vector<double>& values) const;
+
+protected:
+    int BaseRow(int row) const {
+        return stack_ids.empty() ? row % num_base : (int) stack_ids[row];
+    }
+    wxInt64 RowId(int row) const {
+        return row_ids.empty() ? (wxInt64) row + 1 : row_ids[row];
+    }
+    // index of the first row of the period of row
+    int PeriodStart(int row) const { return (row / num_base) * num_base; }
+
+    const CsrWeight* base;
+    bool own_base;
+    int num_base;
+    int num_rows;
+    // empty for space-time weights
+    std::vector<wxInt64> row_ids;
+    std::vector<wxInt64> stack_ids;
+    // UTF-8 ids and periods of SetSpaceTime() with string ids
+    std::vector<std::string> id_labels;
+    std::vector<std::string> time_labels;
+};
+
+#endif
@@ -22,8 +22,11 @@
 //   Voronoi Library.  Many thanks to Andrii Sydorchuk for contributing
 //   this high-quality Voronoi Diagram library to Boost.
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <map>
 #include <utility>
+#include <boost/bind.hpp>
 #include <boost/geometry.hpp>
 #include <boost/geometry/geometries/point_xy.hpp>
 #include <boost/geometry/geometries/polygon.hpp>
@@ -32,7 +35,9 @@
 #include <boost/polygon/voronoi_builder.hpp>
 #include <boost/polygon/voronoi_diagram.hpp>
 #include <wx/stopwatch.h>
+#include "CsrWeight.h"
 #include "GalWeight.h"
+#include "../GdaThreadPool.h"
 #include "../GenUtils.h"
 #include "../GenGeomAlgs.h"
 #include "../GdaShape.h"
@@ -718,3 +723,589 @@ GalElement* Gda::VoronoiUtils::NeighborMapToGal(
 	}
 	return gal;
 }
+
+/*
+ Contiguity straight into CSR
+
+ The points are scaled to the same integer grid as in PointsToContiguity
+ and points that fall on the same grid point are merged into one site.
+ The sites are bucketed into a uniform grid of cells, and the cells into
+ tiles_per_axis x tiles_per_axis tiles.  Each tile builds the diagram of
+ its own sites plus the sites of a halo of cells around it and walks the
+ cells of its own sites once, writing the neighbor sites of every cell
+ into its own buffer.  No polygon is clipped, every edge is only tested
+ against the padded bounding box, and no std::set is used.
+
+ The cell of a site in a tile diagram is its cell in the full diagram if
+ the empty circle around every vertex of it holds no site that is missing
+ from the tile, which is looked up in the grid, and every infinite edge of
+ it lies between two neighbors on the convex hull of all sites.  If some
+ cell of a tile fails the test, the missing sites are added to it, or the
+ halo grows towards them, and the tile is built again; a halo that covers
+ all sites gives the full diagram, so the result never depends on the
+ number of tiles.
+ */
+namespace {
+	using Gda::VoronoiUtils::VD;
+	using Gda::VoronoiUtils::VB;
+
+	const int voronoi_obs_chunk_size = 1024;
+	// sites per grid cell, on average
+	const int voronoi_sites_per_cell = 4;
+
+	// a block of grid cells, columns c0..c1 and rows r0..r1
+	struct CellBlock
+	{
+		int c0, r0, c1, r1;
+	};
+
+	struct VoronoiContigBuilder
+	{
+		bool queen;
+		int num_obs;
+		int num_sites;
+		int tiles_per_axis;
+		// integer coordinates of the sites, and the extent of them
+		std::vector<int> sx, sy;
+		double ext_x, ext_y;
+		// padded bounding box of PointsToContiguity
+		double bb_xmin, bb_ymin, bb_xmax, bb_ymax;
+		// site of each observation, observations of each site
+		std::vector<int> obs_site;
+		std::vector<int> site_start, site_obs;
+		// convex hull of all sites, counter-clockwise, and the pairs of
+		// sites next to each other on it, in both orders
+		std::vector<int> hull;
+		std::vector<std::pair<int,int> > hull_nbrs;
+		// grid of cells_per_axis^2 cells, sites sorted by cell
+		int cells_per_axis;
+		double cell_w, cell_h;
+		std::vector<int> cell_start, cell_sites;
+		int init_halo; // in cells
+		// sites of each tile and their neighbor sites
+		std::vector<std::vector<int> > tile_sites, tile_counts, tile_nbrs;
+		std::vector<int> tile_rebuilds;
+		// neighbor sites of each site
+		std::vector<int> site_nbr_start, site_nbrs;
+		// rows of the observations, one buffer per chunk
+		std::vector<boost::uint64_t> counts;
+		std::vector<std::vector<int> > rows;
+
+		int CellCol(double x) const;
+		int CellRow(double y) const;
+		void FindHull();
+		bool IsHullEdge(int s, int t) const;
+		bool FindHullEdgeAcross(double mx, double my, double ux, double uy,
+								std::vector<int>& missing) const;
+		int FindMissing(double cx, double cy, double r, const CellBlock& b,
+						const std::vector<int>& extra,
+						std::vector<int>& missing) const;
+		int MissingSides(const VD::cell_type& cell,
+						 const std::vector<int>& loc_site,
+						 const CellBlock& b, const std::vector<int>& extra,
+						 std::vector<int>& missing) const;
+		void BuildTile(int t);
+		void BuildTiles(int first, int last);
+		void ExpandRows(int first, int last);
+		CsrWeight* Run(const std::vector<double>& x,
+					   const std::vector<double>& y);
+	};
+
+	int VoronoiContigBuilder::CellCol(double x) const
+	{
+		if (x < 0) return 0;
+		return std::min(cells_per_axis-1, (int) (x / cell_w));
+	}
+
+	int VoronoiContigBuilder::CellRow(double y) const
+	{
+		if (y < 0) return 0;
+		return std::min(cells_per_axis-1, (int) (y / cell_h));
+	}
+
+	bool VoronoiContigBuilder::IsHullEdge(int s, int t) const
+	{
+		return std::binary_search(hull_nbrs.begin(), hull_nbrs.end(),
+								  std::make_pair(s, t));
+	}
+
+	// sites are sorted by x, then y: Andrew's monotone chain, keeping the
+	// collinear sites on the hull since their cells are unbounded too
+	void VoronoiContigBuilder::FindHull()
+	{
+		hull.clear();
+		hull_nbrs.clear();
+		std::vector<int> h;
+		for (int pass=0; pass<2 && num_sites>1; pass++) {
+			h.clear();
+			for (int k=0; k<num_sites; k++) {
+				int s = pass == 0 ? k : num_sites-1-k;
+				while (h.size() >= 2) {
+					int o = h[h.size()-2], a = h[h.size()-1];
+					double cross =
+						((double) sx[a]-sx[o])*((double) sy[s]-sy[o]) -
+						((double) sy[a]-sy[o])*((double) sx[s]-sx[o]);
+					if (cross >= 0) break;
+					h.pop_back();
+				}
+				h.push_back(s);
+			}
+			for (size_t k=1; k<h.size(); k++) {
+				hull_nbrs.push_back(std::make_pair(h[k-1], h[k]));
+				hull_nbrs.push_back(std::make_pair(h[k], h[k-1]));
+			}
+			// the last site of a chain is the first of the next one
+			hull.insert(hull.end(), h.begin(), h.end()-1);
+		}
+		std::sort(hull_nbrs.begin(), hull_nbrs.end());
+		hull_nbrs.erase(std::unique(hull_nbrs.begin(), hull_nbrs.end()),
+						hull_nbrs.end());
+	}
+
+	// A site that is on the hull of a tile but not on the hull of all sites
+	// lies below a hull edge whose ends are missing from the tile: the ends
+	// of the hull edge that the ray from (mx,my) in direction (ux,uy)
+	// crosses are added to missing.
+	bool VoronoiContigBuilder::FindHullEdgeAcross(double mx, double my,
+												  double ux, double uy,
+												  std::vector<int>& missing)
+		const
+	{
+		size_t n = hull.size();
+		for (size_t k=0; k<n; k++) {
+			int a = hull[k], b = hull[(k+1) % n];
+			double ex = sx[b]-sx[a], ey = sy[b]-sy[a];
+			double den = ux*ey - uy*ex;
+			if (den == 0) continue;
+			double ax = sx[a]-mx, ay = sy[a]-my;
+			double t = (ax*ey - ay*ex) / den; // along the ray
+			double e = (ax*uy - ay*ux) / den; // along the hull edge
+			if (t >= 0 && e >= 0 && e <= 1) {
+				missing.push_back(a);
+				missing.push_back(b);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Adds the sites within r of (cx,cy) that are missing from a tile
+	// diagram of the sites in block b and extra to missing, and returns the
+	// sides of b (bit 0 left, 1 right, 2 bottom, 3 top) they are beyond.
+	// The cells are visited column by column, over the rows the circle
+	// spans in that column.
+	int VoronoiContigBuilder::FindMissing(double cx, double cy, double r,
+										  const CellBlock& b,
+										  const std::vector<int>& extra,
+										  std::vector<int>& missing) const
+	{
+		int sides = 0;
+		int col0 = CellCol(cx - r), col1 = CellCol(cx + r);
+		if (cx + r < 0 || cx - r > ext_x) return sides;
+		for (int c=col0; c<=col1; c++) {
+			double x0 = c*cell_w, x1 = (c+1)*cell_w;
+			double dx = cx < x0 ? x0-cx : (cx > x1 ? cx-x1 : 0);
+			if (dx > r) continue;
+			// (r-dx)*(r+dx) keeps its precision for circles far away
+			double dy = sqrt((r-dx)*(r+dx));
+			if (cy + dy < 0 || cy - dy > ext_y) continue;
+			int row0 = CellRow(cy - dy), row1 = CellRow(cy + dy);
+			for (int w=row0; w<=row1; w++) {
+				if (c >= b.c0 && c <= b.c1 && w >= b.r0 && w <= b.r1) {
+					w = b.r1; // skip the rows of the block
+					continue;
+				}
+				int cell = w*cells_per_axis + c;
+				for (int k=cell_start[cell]; k<cell_start[cell+1]; k++) {
+					int s = cell_sites[k];
+					double ddx = sx[s]-cx, ddy = sy[s]-cy;
+					if (sqrt(ddx*ddx + ddy*ddy) >= r) continue;
+					if (std::binary_search(extra.begin(), extra.end(), s)) {
+						continue;
+					}
+					missing.push_back(s);
+					sides |= (c < b.c0 ? 1 : 0) | (c > b.c1 ? 2 : 0) |
+						(w < b.r0 ? 4 : 0) | (w > b.r1 ? 8 : 0);
+				}
+			}
+		}
+		return sides;
+	}
+
+	// 0 if the cell is exact, otherwise the sides the halo has to grow
+	int VoronoiContigBuilder::MissingSides(const VD::cell_type& cell,
+										   const std::vector<int>& loc_site,
+										   const CellBlock& b,
+										   const std::vector<int>& extra,
+										   std::vector<int>& missing) const
+	{
+		const int all_sides = 15;
+		const VD::edge_type* edge = cell.incident_edge();
+		if (!edge) return all_sides;
+		int s = loc_site[cell.source_index()];
+		double px = sx[s];
+		double py = sy[s];
+		// inside this rectangle every site is in the tile diagram
+		double hx0 = b.c0 > 0 ? b.c0*cell_w : -DBL_MAX;
+		double hx1 = b.c1 < cells_per_axis-1 ? (b.c1+1)*cell_w : DBL_MAX;
+		double hy0 = b.r0 > 0 ? b.r0*cell_h : -DBL_MAX;
+		double hy1 = b.r1 < cells_per_axis-1 ? (b.r1+1)*cell_h : DBL_MAX;
+		int sides = 0;
+		do {
+			const VD::vertex_type* v = edge->vertex0();
+			if (v) {
+				// the empty circle of the vertex, with some room for the
+				// rounding of the vertex
+				double r = sqrt((v->x()-px)*(v->x()-px) +
+								(v->y()-py)*(v->y()-py)) + 2;
+				if (v->x() - r < hx0 || v->x() + r > hx1 ||
+					v->y() - r < hy0 || v->y() + r > hy1) {
+					sides |= FindMissing(v->x(), v->y(), r, b, extra,
+										 missing);
+				}
+			}
+			// an unbounded cell is exact only along the hull of all sites
+			int t = loc_site[edge->twin()->cell()->source_index()];
+			if (edge->is_infinite() && !IsHullEdge(s, t)) {
+				// direction of the edge as in clipInfiniteEdge
+				double mx = (px + sx[t]) * 0.5, my = (py + sy[t]) * 0.5;
+				double ux = py - sy[t], uy = sx[t] - px;
+				if (!edge->vertex0()) {
+					ux = -ux;
+					uy = -uy;
+				}
+				FindHullEdgeAcross(mx, my, ux, uy, missing);
+				sides = all_sides;
+			}
+			edge = edge->next();
+		} while (edge != cell.incident_edge());
+		return sides;
+	}
+
+	void VoronoiContigBuilder::BuildTile(int t)
+	{
+		int cells_per_tile = cells_per_axis / tiles_per_axis;
+		CellBlock core;
+		core.c0 = (t % tiles_per_axis) * cells_per_tile;
+		core.r0 = (t / tiles_per_axis) * cells_per_tile;
+		core.c1 = core.c0 + cells_per_tile - 1;
+		core.r1 = core.r0 + cells_per_tile - 1;
+		std::vector<int>& core_sites = tile_sites[t];
+		for (int w=core.r0; w<=core.r1; w++) {
+			for (int c=core.c0; c<=core.c1; c++) {
+				int cell = w*cells_per_axis + c;
+				core_sites.insert(core_sites.end(),
+								  cell_sites.begin() + cell_start[cell],
+								  cell_sites.begin() + cell_start[cell+1]);
+			}
+		}
+		int n_core = core_sites.size();
+		if (n_core == 0) return;
+
+		std::vector<int> loc_site;
+		std::vector<std::pair<int,int> > loc_pts;
+		std::vector<const VD::cell_type*> cell_of;
+		std::vector<int> nbrs, extra, missing, added;
+		// halo in cells on the left, right, bottom and top.  The sites that
+		// were found missing are added one by one first, which is all that
+		// the long thin circles along the hull need; after a few attempts
+		// the sides towards the missing sites grow.
+		const int max_added_attempts = 3;
+		int halo[4] = { init_halo, init_halo, init_halo, init_halo };
+		for (int attempt=0; ; attempt++) {
+			CellBlock b;
+			b.c0 = std::max(0, core.c0 - halo[0]);
+			b.c1 = std::min(cells_per_axis-1, core.c1 + halo[1]);
+			b.r0 = std::max(0, core.r0 - halo[2]);
+			b.r1 = std::min(cells_per_axis-1, core.r1 + halo[3]);
+			bool covers_all = (b.c0 == 0 && b.r0 == 0 &&
+							   b.c1 == cells_per_axis-1 &&
+							   b.r1 == cells_per_axis-1);
+
+			// the sites of the tile come first, so local index k < n_core
+			// is core_sites[k]
+			loc_site = core_sites;
+			for (int w=b.r0; w<=b.r1; w++) {
+				for (int c=b.c0; c<=b.c1; c++) {
+					if (c >= core.c0 && c <= core.c1 &&
+						w >= core.r0 && w <= core.r1) continue;
+					int cell = w*cells_per_axis + c;
+					loc_site.insert(loc_site.end(),
+									cell_sites.begin() + cell_start[cell],
+									cell_sites.begin() + cell_start[cell+1]);
+				}
+			}
+			// the hull neighbors of the hull sites, so that the hull edges
+			// of the tile are in its diagram, and the missing sites
+			extra.clear();
+			for (size_t k=0; k<loc_site.size() && !covers_all; k++) {
+				std::vector<std::pair<int,int> >::const_iterator it =
+					std::lower_bound(hull_nbrs.begin(), hull_nbrs.end(),
+									 std::make_pair(loc_site[k], -1));
+				for (; it != hull_nbrs.end() && it->first == loc_site[k]; ++it) {
+					extra.push_back(it->second);
+				}
+			}
+			if (!covers_all) {
+				extra.insert(extra.end(), added.begin(), added.end());
+			}
+			size_t n_extra = 0;
+			for (size_t k=0; k<extra.size(); k++) {
+				int c = CellCol(sx[extra[k]]), w = CellRow(sy[extra[k]]);
+				if (c < b.c0 || c > b.c1 || w < b.r0 || w > b.r1) {
+					extra[n_extra++] = extra[k];
+				}
+			}
+			extra.resize(n_extra);
+			std::sort(extra.begin(), extra.end());
+			extra.erase(std::unique(extra.begin(), extra.end()), extra.end());
+			loc_site.insert(loc_site.end(), extra.begin(), extra.end());
+
+			int n_loc = loc_site.size();
+			loc_pts.resize(n_loc);
+			VB vb;
+			for (int k=0; k<n_loc; k++) {
+				loc_pts[k] = std::make_pair(sx[loc_site[k]], sy[loc_site[k]]);
+				vb.insert_point(loc_pts[k].first, loc_pts[k].second);
+			}
+			VD vd;
+			vb.construct(&vd);
+			cell_of.assign(n_loc, (const VD::cell_type*) 0);
+			for (VD::const_cell_iterator it = vd.cells().begin();
+				 it != vd.cells().end(); ++it) {
+				cell_of[it->source_index()] = &(*it);
+			}
+
+			int grow = 0;
+			missing.clear();
+			for (int k=0; k<n_core && !covers_all; k++) {
+				grow |= MissingSides(*cell_of[k], loc_site, b, extra, missing);
+			}
+			if (grow) {
+				added.insert(added.end(), missing.begin(), missing.end());
+				std::sort(added.begin(), added.end());
+				added.erase(std::unique(added.begin(), added.end()),
+							added.end());
+				if (missing.empty() || attempt >= max_added_attempts) {
+					for (int k=0; k<4; k++) {
+						if (grow & (1 << k)) halo[k] = std::max(1, 2*halo[k]);
+					}
+				}
+				continue;
+			}
+			tile_rebuilds[t] = attempt;
+
+			std::vector<int>& cnts = tile_counts[t];
+			std::vector<int>& out = tile_nbrs[t];
+			cnts.resize(n_core);
+			for (int k=0; k<n_core; k++) {
+				const VD::cell_type& cell = *cell_of[k];
+				nbrs.clear();
+				const VD::edge_type* edge = cell.incident_edge();
+				do {
+					if (!edge) break;
+					double x0, y0, x1, y1;
+					if (Gda::VoronoiUtils::clipEdge(*edge, loc_pts,
+								bb_xmin, bb_ymin, bb_xmax, bb_ymax,
+								x0, y0, x1, y1)) {
+						nbrs.push_back(
+							loc_site[edge->twin()->cell()->source_index()]);
+					}
+					if (queen) {
+						// all cells that share a vertex of the cell
+						const VD::vertex_type* vs[2] = { edge->vertex0(),
+														 edge->vertex1() };
+						for (int v=0; v<2; v++) {
+							if (!vs[v] ||
+								Gda::VoronoiUtils::isVertexOutsideBB(*vs[v],
+									bb_xmin, bb_ymin, bb_xmax, bb_ymax)) {
+								continue;
+							}
+							const VD::edge_type* e = vs[v]->incident_edge();
+							do {
+								nbrs.push_back(
+									loc_site[e->cell()->source_index()]);
+								e = e->rot_next();
+							} while (e != vs[v]->incident_edge());
+						}
+					}
+					edge = edge->next();
+				} while (edge != cell.incident_edge());
+				std::sort(nbrs.begin(), nbrs.end());
+				nbrs.erase(std::unique(nbrs.begin(), nbrs.end()), nbrs.end());
+				int self = loc_site[k];
+				size_t before = out.size();
+				for (size_t j=0; j<nbrs.size(); j++) {
+					if (nbrs[j] != self) out.push_back(nbrs[j]);
+				}
+				cnts[k] = out.size() - before;
+			}
+			return;
+		}
+	}
+
+	void VoronoiContigBuilder::BuildTiles(int first, int last)
+	{
+		for (int t=first; t<=last; t++) BuildTile(t);
+	}
+
+	void VoronoiContigBuilder::ExpandRows(int first, int last)
+	{
+		std::vector<int>& out = rows[first / voronoi_obs_chunk_size];
+		for (int i=first; i<=last; i++) {
+			size_t row_start = out.size();
+			int s = obs_site[i];
+			// the other points at the same site are neighbors too
+			for (int k=site_start[s]; k<site_start[s+1]; k++) {
+				if (site_obs[k] != i) out.push_back(site_obs[k]);
+			}
+			for (int j=site_nbr_start[s]; j<site_nbr_start[s+1]; j++) {
+				int n = site_nbrs[j];
+				out.insert(out.end(), site_obs.begin() + site_start[n],
+						   site_obs.begin() + site_start[n+1]);
+			}
+			std::sort(out.begin() + row_start, out.end());
+			counts[i] = out.size() - row_start;
+		}
+	}
+
+	CsrWeight* VoronoiContigBuilder::Run(const std::vector<double>& x,
+										 const std::vector<double>& y)
+	{
+		typedef std::pair<int,int> int_pair;
+		num_obs = x.size();
+		double x_orig_min=0, x_orig_max=0;
+		double y_orig_min=0, y_orig_max=0;
+		SampleStatistics::CalcMinMax(x, x_orig_min, x_orig_max);
+		SampleStatistics::CalcMinMax(y, y_orig_min, y_orig_max);
+		double orig_scale = std::max(x_orig_max-x_orig_min,
+									 y_orig_max-y_orig_min);
+		if (orig_scale == 0) orig_scale = 1;
+		double big_dbl = 1073741824; // 2^30
+		double p = (big_dbl/orig_scale);
+		const double bb_pad = 0.02;
+		bb_xmin = -bb_pad*big_dbl;
+		bb_xmax = (x_orig_max-x_orig_min)*p + bb_pad*big_dbl;
+		bb_ymin = -bb_pad*big_dbl;
+		bb_ymax = (y_orig_max-y_orig_min)*p + bb_pad*big_dbl;
+
+		// merge the points on the same integer grid point into one site
+		std::vector<std::pair<int_pair, int> > keyed(num_obs);
+		for (int i=0; i<num_obs; i++) {
+			keyed[i].first.first = (int) ((x[i]-x_orig_min)*p);
+			keyed[i].first.second = (int) ((y[i]-y_orig_min)*p);
+			keyed[i].second = i;
+		}
+		std::sort(keyed.begin(), keyed.end());
+		obs_site.resize(num_obs);
+		site_obs.resize(num_obs);
+		site_start.clear();
+		sx.clear();
+		sy.clear();
+		ext_x = 0;
+		ext_y = 0;
+		for (int i=0; i<num_obs; i++) {
+			if (i == 0 || keyed[i].first != keyed[i-1].first) {
+				site_start.push_back(i);
+				sx.push_back(keyed[i].first.first);
+				sy.push_back(keyed[i].first.second);
+				ext_x = std::max(ext_x, (double) keyed[i].first.first);
+				ext_y = std::max(ext_y, (double) keyed[i].first.second);
+			}
+			obs_site[keyed[i].second] = site_start.size()-1;
+			site_obs[i] = keyed[i].second;
+		}
+		site_start.push_back(num_obs);
+		std::vector<std::pair<int_pair, int> >().swap(keyed);
+		num_sites = sx.size();
+
+		if (tiles_per_axis < 1) tiles_per_axis = 1;
+		int num_tiles = tiles_per_axis * tiles_per_axis;
+		if (num_tiles > 1) FindHull();
+
+		// the tiles are blocks of the same number of cells
+		int cells_per_tile = (int) ceil(sqrt((double) num_sites /
+			(voronoi_sites_per_cell * num_tiles)));
+		cells_per_axis = cells_per_tile * tiles_per_axis;
+		cell_w = (ext_x + 1) / cells_per_axis;
+		cell_h = (ext_y + 1) / cells_per_axis;
+		init_halo = std::max(1, cells_per_tile / 8);
+		int num_cells = cells_per_axis * cells_per_axis;
+		cell_start.assign(num_cells+1, 0);
+		std::vector<int> site_cell(num_sites);
+		for (int s=0; s<num_sites; s++) {
+			site_cell[s] = CellRow(sy[s])*cells_per_axis + CellCol(sx[s]);
+			cell_start[site_cell[s]+1] += 1;
+		}
+		for (int c=0; c<num_cells; c++) cell_start[c+1] += cell_start[c];
+		cell_sites.resize(num_sites);
+		std::vector<int> pos(cell_start.begin(), cell_start.end()-1);
+		for (int s=0; s<num_sites; s++) cell_sites[pos[site_cell[s]]++] = s;
+		std::vector<int>().swap(site_cell);
+		std::vector<int>().swap(pos);
+
+		wxStopWatch sw_vd;
+		tile_sites.resize(num_tiles);
+		tile_counts.resize(num_tiles);
+		tile_nbrs.resize(num_tiles);
+		tile_rebuilds.assign(num_tiles, 0);
+		GdaThreadPool::GetInstance().ParallelFor(num_tiles,
+			boost::bind(&VoronoiContigBuilder::BuildTiles, this, _1, _2), 1);
+		int rebuilds = 0;
+		for (int t=0; t<num_tiles; t++) rebuilds += tile_rebuilds[t];
+		LOG_MSG(wxString::Format("Voronoi contiguity of %d sites in %d tiles "
+								 "(%d halo rebuilds) took %ld ms", num_sites,
+								 num_tiles, rebuilds, sw_vd.Time()));
+
+		// stitch the tiles into one neighbor list per site
+		site_nbr_start.assign(num_sites+1, 0);
+		for (int t=0; t<num_tiles; t++) {
+			for (size_t k=0; k<tile_sites[t].size(); k++) {
+				site_nbr_start[tile_sites[t][k]+1] = tile_counts[t][k];
+			}
+		}
+		for (int s=0; s<num_sites; s++) {
+			site_nbr_start[s+1] += site_nbr_start[s];
+		}
+		site_nbrs.resize(site_nbr_start[num_sites]);
+		for (int t=0; t<num_tiles; t++) {
+			std::vector<int>::const_iterator src = tile_nbrs[t].begin();
+			for (size_t k=0; k<tile_sites[t].size(); k++) {
+				int s = tile_sites[t][k];
+				int sz = site_nbr_start[s+1] - site_nbr_start[s];
+				std::copy(src, src + sz, site_nbrs.begin() + site_nbr_start[s]);
+				src += sz;
+			}
+			std::vector<int>().swap(tile_nbrs[t]);
+		}
+
+		int num_chunks = (num_obs + voronoi_obs_chunk_size - 1) /
+			voronoi_obs_chunk_size;
+		counts.resize(num_obs);
+		rows.resize(num_chunks);
+		GdaThreadPool::GetInstance().ParallelFor(num_obs,
+			boost::bind(&VoronoiContigBuilder::ExpandRows, this, _1, _2),
+			voronoi_obs_chunk_size);
+		return CsrWeight::FromRowBlocks(counts, rows, voronoi_obs_chunk_size);
+	}
+}
+
+CsrWeight* Gda::VoronoiUtils::PointsToContiguityCsr(
+											const std::vector<double>& x,
+											const std::vector<double>& y,
+											bool queen, int tiles_per_axis)
+{
+	if (x.size() == 0 || x.size() != y.size()) return 0;
+	VoronoiContigBuilder b;
+	b.queen = queen;
+	b.tiles_per_axis = tiles_per_axis;
+	return b.Run(x, y);
+}
+
+int Gda::VoronoiUtils::SuggestTilesPerAxis(int num_obs)
+{
+	if (num_obs < 1000000) return 1;
+	if (GdaThreadPool::GetInstance().GetNumWorkers() < 2) return 1;
+	// about half a million points per tile
+	return (int) ceil(sqrt(num_obs / 500000.0));
+}
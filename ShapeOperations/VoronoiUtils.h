@@ -24,6 +24,7 @@
 #include <set>
 #include <vector>
 
+class CsrWeight;
 class GdaPolygon;
 class GdaShape;
 class GalElement;
@@ -44,6 +45,18 @@ namespace Gda {
 								bool queen, // if false, then rook only
 								std::vector<std::set<int> >& nbr_map);
 		GalElement* NeighborMapToGal(std::vector<std::set<int> >& nbr_map);
+		/** Same neighbors as PointsToContiguity, as binary CSR weights.  The
+		 cells are walked once without clipping them.  With tiles_per_axis
+		 > 1 the points are split into a grid of tiles whose diagrams are
+		 built in parallel, each with a halo of the points around it that
+		 is grown until the cells of the tile are exact.  Returns NULL if
+		 there are no points. */
+		CsrWeight* PointsToContiguityCsr(const std::vector<double>& x,
+										 const std::vector<double>& y,
+										 bool queen, int tiles_per_axis = 1);
+		/** 1 below a million points or without worker threads, otherwise
+		 about half a million points per tile */
+		int SuggestTilesPerAxis(int num_obs);
 	}
 }
 
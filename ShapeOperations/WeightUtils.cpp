@@ -21,25 +21,35 @@
 #include <climits>
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <sstream>
 #include <vector>
 #include <map>
-#include <boost/unordered_map.hpp>
+#include <boost/bind.hpp>
 #include <wx/msgdlg.h>
+#include <wx/log.h>
 #include "GalWeight.h"
+#include "CsrWeight.h"
 #include "GwtWeight.h"
 #include "GeodaWeight.h"
 #include "../DataViewer/TableInterface.h"
 #include "../GdaConst.h"
+#include "../GdaThreadPool.h"
 #include "../GenUtils.h"
 #include "../VarCalc/WeightsMetaInfo.h"
 #include "WeightsManager.h"
 #include "WeightUtils.h"
+#include "../io/weights_binary.h"
+#include "../io/weights_interface.h"
+#include "../io/weights_reader.h"
 
 wxString WeightUtils::ReadIdField(const wxString& fname)
 {
 	using namespace std;
 	wxString ext = GenUtils::GetFileExt(fname).Lower();
+    if (ext == "gwb") {
+        return GdaWeightsBinary::ReadIdField(fname);
+    }
     if (ext != "gal" && ext != "gwt" && ext != "kwt") {
         return "";
     }
@@ -106,519 +116,57 @@ wxString WeightUtils::ReadIdField(const wxString& fname)
 	return key_field;
 }
 
+/** Read a .gal, .gwt or .kwt file as CSR weights, with the problems of the
+ file reported to the user */
+CsrWeight* WeightUtils::ReadAsCsr(const wxString& fname,
+                                  TableInterface* table_int)
+{
+    wxString ext = GenUtils::GetFileExt(fname).Lower();
+    try {
+        if (ext == "gal") {
+            return GdaWeightsReader::ReadGal(fname, table_int);
+        } else if (ext == "gwt" || ext == "kwt") {
+            return GdaWeightsReader::ReadGwt(fname, table_int, ext == "kwt");
+        }
+    } catch (WeightsReadException& e) {
+        wxMessageDialog dlg(NULL, e.msg, _("Error"), wxOK | wxICON_ERROR);
+        dlg.ShowModal();
+    }
+    return 0;
+}
+
 GalElement* WeightUtils::ReadGal(const wxString& fname,
 								 TableInterface* table_int)
 {
-	using namespace std;
-#ifdef __WIN32__
-	ifstream file(fname.wc_str());
-#else
-	ifstream file;
-	file.open(GET_ENCODED_FILENAME(fname), ios::in);  // a text file
-#endif
-	
-	if (!(file.is_open() && file.good())) {
-		return 0;
-	}
-	
-	// First determine if header line is correct
-	// Can be either: int int string string  (type n_obs filename field)
-	// or : int (n_obs)
-	
-	int line_cnt = 0;
-	bool use_rec_order = false;
-	string str;
-	getline(file, str);
-	line_cnt++;
-	stringstream ss (str, stringstream::in | stringstream::out);
-	
-	wxInt64 num1 = 0;
-	wxInt64 num2 = 0;
-	wxInt64 num_obs = 0;
-	string dbf_name, t_key_field;
-  
-    string line;
-    std::getline(ss, line);
-    wxString header(line);
-    
-    // detect if header contains string with empty space, which should be quoted
-    if (header.Contains("\"")) {
-        int start_quote = header.find("\"");
-        int end_quote = header.find("\"", start_quote + 1);
-        dbf_name = header.SubString(start_quote + 1, end_quote - 1);
-        t_key_field = header.SubString(end_quote + 1 + 1 /*1 for blank space */,
-                                       header.length()-1);
-        wxString nums = header.SubString(0, start_quote-1);
-        int break_pos = nums.find(" ");
-        wxString num1_str = nums.SubString(0, break_pos-1);
-        wxString num2_str = nums.SubString(break_pos+1, nums.length()-1);
-        num1_str.ToLongLong(&num1);
-        num2_str.ToLongLong(&num2);
-        
-    } else {
-        
-        ss.clear();
-        ss.seekg(0, ios::beg); // reset to beginning
-        ss >> num1 >> num2 >> dbf_name >> t_key_field;
+    CsrWeight* w = 0;
+    try {
+        w = GdaWeightsReader::ReadGal(fname, table_int);
+    } catch (WeightsReadException& e) {
+        wxMessageDialog dlg(NULL, e.msg, _("Error"), wxOK | wxICON_ERROR);
+        dlg.ShowModal();
     }
-    
-    
-	wxString key_field(t_key_field);
-	if (num2 == 0) {
-		use_rec_order = true;
-		num_obs = num1;
-	} else {
-		num_obs = num2;
-		if (key_field.IsEmpty() || key_field == "ogc_fid") {
-			use_rec_order = true;
-		}
-	}
-	
-	if (table_int != NULL && num_obs != table_int->GetNumberRows()) {
-		wxString msg = "The number of observations specified in chosen ";
-		msg << "weights file is " << num_obs << ", but the number in the ";
-		msg << "current Table is " << table_int->GetNumberRows();
-		msg << ", which is incompatible.";
-		wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-		dlg.ShowModal();
-		return 0;
-	}
-	
-	// Note: we want to be able to support blank lines.  If an observation
-	// has no neighbors, then we'd like to be able to not include the
-	// observation, or, if it is recorded, then the following line can
-	// either be empty or blank.
-    // note: we use wxString as key (convert int to string) for the case of any
-    // string type numbers (e.g. the FIPS)
-	map<wxString, int> id_map;
-    
-	if (use_rec_order) {
-		// we need to traverse through every second line of the file and
-		// record the max and min values.  So long as the max and min
-		// values are such that num_obs = (max - min) + 1, we will assume
-		// record order is valid.
-		wxInt64 min_val = LLONG_MAX;
-		wxInt64 max_val = LLONG_MIN;
-		while (!file.eof()) {
-			wxInt64 obs=0, num_neigh=0;
-			// get next non-blank line
-			str = "";
-			while (str.empty() && !file.eof()) {
-				getline(file, str);
-				line_cnt++;
-			}
-			if (file.eof()) continue;
-			{
-				stringstream ss (str, stringstream::in | stringstream::out);
-				ss >> obs >> num_neigh;
-				if (obs < min_val) {
-					min_val = obs;
-				} else if (obs > max_val) {
-					max_val = obs;
-				}
-			}
-			if (num_neigh > 0) { // ignore the list of neighbors
-				// get next non-blank line
-				str = "";
-				while (str.empty() && !file.eof()) {
-					getline(file, str);
-					line_cnt++;
-				}
-				if (file.eof()) continue;
-			}
-		}
-		if (max_val - min_val != num_obs - 1) {
-			wxString msg = "Record order specified, but found minimum";
-			msg << " and maximum observation values of " << min_val;
-			msg << " and " << max_val << " which is incompatible with";
-			msg << " number of observations specified in first line of";
-			msg << " weights file: " << num_obs << ".";
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-        for (int i=0; i<num_obs; i++) {
-            wxString iid;
-            iid << i+min_val;
-            id_map[ iid ] = i;
-        }
-        
-	} else if ( table_int != NULL) {
-		int col=0, tm=0;
-        
-		table_int->DbColNmToColAndTm(key_field, col, tm);
-		if (col == wxNOT_FOUND) {
-            wxString msg = _("Specified key value field \"%s\" on first line of weights file not found in currently loaded Table.");
-            msg = wxString::Format(msg, key_field);
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-		if (table_int->GetColType(col) != GdaConst::long64_type &&
-            table_int->GetColType(col) != GdaConst::string_type ) {
-            wxString msg = _("Specified key value field \"%s\" on first line of weights file is not an integer type in the currently loaded Table.");
-            msg = wxString::Format(msg, key_field);
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-		// get mapping from key_field to record ids (which always start
-		// from 0 internally, but are displayed to the user from 1)
-        if (table_int->GetColType(col) == GdaConst::long64_type) {
-    		vector<wxInt64> vec;
-    		table_int->GetColData(col, 0, vec);
-    		for (int i=0; i<num_obs; i++) {
-                wxString str_id;
-                str_id << vec[i];
-                id_map[ str_id ] = i;
-            }
-        }
-        if (table_int->GetColType(col) == GdaConst::string_type) {
-    		vector<wxString> vec;
-    		table_int->GetColData(col, 0, vec);
-    		for (int i=0; i<num_obs; i++) {
-                id_map[ vec[i] ] = i;
-            }
-        }
-		if (id_map.size() != num_obs) {
-            wxString msg = _("Specified key value field \"%s\" in weights file contains duplicate values in the currently loaded Table.");
-            msg = wxString::Format(msg, key_field);
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-	}
-	
-	GalElement* gal = new GalElement[num_obs];
-	file.clear();
-	file.seekg(0, ios::beg); // reset to beginning
-	line_cnt = 0;
-	getline(file, str); // skip header line
-	line_cnt++;
-	map<wxString, int>::iterator it;
-	while (!file.eof()) {
-		int gal_obs;
-        std::string obs;
-        wxInt64 num_neigh;
-		// get next non-blank line
-		str = "";
-		while (str.empty() && !file.eof()) {
-			getline(file, str);
-			line_cnt++;
-		}
-		if (file.eof()) continue;
-		{
-			stringstream ss (str, stringstream::in | stringstream::out);
-			ss >> obs >> num_neigh;
-			it = id_map.find(wxString(obs));
-			if (it == id_map.end()) {
-				wxString msg = "On line ";
-				msg << line_cnt << " of weights file, observation id " << obs;
-				if (use_rec_order) {
-					msg << " encountered which is out of allowed observation ";
-					msg << "range of 1 through " << num_obs << ".";
-				} else {
-					msg << " encountered which does not exist in field \"";
-					msg << key_field << "\" of the Table.";
-				}
-				wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-				dlg.ShowModal();
-				delete [] gal;
-				return 0;
-			}
-			gal_obs = (*it).second; // value
-			gal[gal_obs].SetSizeNbrs(num_neigh);
-		}
-		if (num_neigh > 0) { // skip next if no neighbors
-			// get next non-blank line
-			str = "";
-			while (str.empty() && !file.eof()) {
-				getline(file, str);
-				line_cnt++;
-			}
-			if (file.eof()) continue;
-			{
-				stringstream ss (str, stringstream::in | stringstream::out);
-				for (int j=0; j<num_neigh; j++) {
-					string neigh;
-					ss >> neigh;
-					it = id_map.find(wxString(neigh));
-					if (it == id_map.end()) {
-						wxString msg = "On line ";
-						msg << line_cnt << " of weights file, observation id ";
-						msg << neigh;
-						if (use_rec_order) {
-							msg << " encountered which is out of allowed ";
-							msg << "observation ";
-							msg << "range of 1 through " << num_obs << ".";
-						} else {
-							msg << " encountered which does not exist ";
-							msg << "in field \"" << key_field;
-							msg << "\" of the Table.";
-						}
-						wxMessageDialog dlg(NULL, msg, _("Error"),
-											wxOK|wxICON_ERROR);
-						dlg.ShowModal();
-						delete [] gal;
-						return 0;
-					}
-					long n_id = (*it).second; // value of id_map[neigh];
-					gal[gal_obs].SetNbr(j, n_id);
-				}
-			}
-		}
-	}	
-	
-	file.clear();
-	if (file.is_open()) file.close();
-	
-	return gal;
+    if (w == 0) return 0;
+    GalElement* gal = w->ToGal();
+    delete w;
+    return gal;
 }
 
-
-
 GalElement* WeightUtils::ReadGwtAsGal(const wxString& fname,
 									  TableInterface* table_int)
 {
-	using namespace std;
-#ifdef __WIN32__
-	ifstream file(fname.wc_str());
-#else
-	ifstream file;
-	file.open(GET_ENCODED_FILENAME(fname), ios::in);  // a text file
-#endif
- 
-	if (!(file.is_open() && file.good())) {
-		return 0;
-	}
-	
-	// First determine if header line is correct
-	// Can be either: int int string string  (type n_obs filename field)
-	// or : int (n_obs)
-	
-	bool use_rec_order = false;
-	string str;
-	getline(file, str);
-	cout << str << endl;
-	stringstream ss(str, stringstream::in | stringstream::out);
-	
-	wxInt64 num1 = 0;
-	wxInt64 num2 = 0;
-	wxInt64 num_obs = 0;	
-	string dbf_name, t_key_field;
-    
-    string line;
-    std::getline(ss, line);
-    wxString header(line);
-    
-    // detect if header contains string with empty space, which should be quoted
-    if (header.Contains("\"")) {
-        int start_quote = header.find("\"");
-        int end_quote = header.find("\"", start_quote + 1);
-        dbf_name = header.SubString(start_quote + 1, end_quote - 1);
-        t_key_field = header.SubString(end_quote + 1 + 1 /*1 for blank space */,
-                                       header.length()-1);
-        wxString nums = header.SubString(0, start_quote-1);
-        int break_pos = nums.find(" ");
-        wxString num1_str = nums.SubString(0, break_pos-1);
-        wxString num2_str = nums.SubString(break_pos+1, nums.length()-1);
-        num1_str.ToLongLong(&num1);
-        num2_str.ToLongLong(&num2);
-        
-    } else {
-        
-        ss.clear();
-        ss.seekg(0, ios::beg); // reset to beginning
-        ss >> num1 >> num2 >> dbf_name >> t_key_field;
+    // a KWT file keeps the kernel weight of each observation with itself
+    bool keep_self = GenUtils::GetFileExt(fname).Lower() == "kwt";
+    CsrWeight* w = 0;
+    try {
+        w = GdaWeightsReader::ReadGwt(fname, table_int, keep_self);
+    } catch (WeightsReadException& e) {
+        wxMessageDialog dlg(NULL, e.msg, _("Error"), wxOK | wxICON_ERROR);
+        dlg.ShowModal();
     }
-    
-	wxString key_field(t_key_field);
-	if (num2 == 0) {
-		use_rec_order = true;
-		num_obs = num1;
-	} else {
-		num_obs = num2;
-		if (key_field.IsEmpty() || key_field == "ogc_fid") {
-			use_rec_order = true;
-		}
-	}
-	
-	if (table_int != NULL && num_obs != table_int->GetNumberRows()) {
-        wxString msg = _("The number of observations specified in chosen weights file is %d, but the number in the current Table is %d, which is incompatible.");
-        msg = wxString::Format(msg, num_obs, table_int->GetNumberRows());
-		wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-		dlg.ShowModal();
-		return 0;
-	}
-	
-	file.clear();
-	file.seekg(0, ios::beg); // reset to beginning
-	getline(file, str); // skip header line
-	map<wxString, int> id_map;
-	if (use_rec_order) {
-		// we need to traverse through every line of the file and
-		// record the max and min values.  So long as the max and min
-		// values are such that num_obs = (max - min) + 1, we will assume
-		// record order is valid.
-		wxInt64 min_val = LLONG_MAX;
-		wxInt64 max_val = LLONG_MIN;
-		while (!file.eof()) {
-			wxInt64 obs1=0, obs2=0;
-			getline(file, str);
-			if (!str.empty()) {
-				stringstream ss (str, stringstream::in | stringstream::out);
-				ss >> obs1 >> obs2;
-				if (obs1 < min_val) {
-					min_val = obs1;
-				} else if (obs1 > max_val) {
-					max_val = obs1;
-				}
-				if (obs2 < min_val) {
-					min_val = obs2;
-				} else if (obs2 > max_val) {
-					max_val = obs2;
-				}
-			}
-		}
-		if (max_val - min_val != num_obs - 1) {
-			wxString msg = _("Record order specified, but found minimum and maximum observation values of %d and %d which is incompatible with number of observations specified in first line of weights file:  %d .");
-            msg = wxString::Format(msg, min_val, max_val, num_obs);
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-		for (int i=0; i<num_obs; i++) {
-                    wxString iid;
-                    iid << i+min_val;
-                    id_map[ iid ] = i;
-                }
-        
-	} else if (table_int != NULL) {
-		int col, tm;
-		table_int->DbColNmToColAndTm(key_field, col, tm);
-		if (col == wxNOT_FOUND) {
-			wxString msg = _("Specified key value field \"%s\" on first line of weights file not found in currently loaded Table.");
-            msg = wxString::Format(msg, key_field);
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-		if (table_int->GetColType(col) != GdaConst::long64_type &&
-            table_int->GetColType(col) != GdaConst::string_type) {
-			wxString msg = _("Specified key value field \"%s\" on first line of weights file is not an integer type in the currently loaded Table.");
-            msg = wxString::Format(msg, key_field);
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-		// get mapping from key_field to record ids (which always start
-		// from 0 internally, but are displayed to the user from 1)
-        if (table_int->GetColType(col) == GdaConst::long64_type) {
-    		vector<wxInt64> vec;
-    		table_int->GetColData(col, 0, vec);
-    		for (int i=0; i<num_obs; i++) {
-                wxString str_id;
-                str_id << vec[i];
-                id_map[ str_id ] = i;
-            }
-        }
-        if (table_int->GetColType(col) == GdaConst::string_type) {
-    		vector<wxString> vec;
-    		table_int->GetColData(col, 0, vec);
-    		for (int i=0; i<num_obs; i++) {
-                id_map[ vec[i] ] = i;
-            }
-        }
-
-		if (id_map.size() != num_obs) {
-			wxString msg = _("Specified key value field \"%s\" in weights file contains duplicate values in the currently loaded Table.");
-            msg = wxString::Format(msg, key_field);
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-	}
-	file.clear();
-	file.seekg(0, ios::beg); // reset to beginning
-	getline(file, str); // skip header line
-	// we need to traverse through every line of the file and
-	// record the number of neighbors for each observation.
-	map<wxString, set<wxString> >::iterator it;
-	map<wxString, set<wxString> > nbr_histogram;
-	while (!file.eof()) {
-		string obs1, obs2;
-		getline(file, str);
-		if (!str.empty()) {
-			stringstream ss (str, stringstream::in | stringstream::out);
-            ss >> obs1 >> obs2;
-			it = nbr_histogram.find(wxString(obs1));
-			if (it == nbr_histogram.end()) {
-                set<wxString> s;
-				nbr_histogram[obs1] = s;
-			}
-            if (obs2 != obs1)
-                nbr_histogram[obs1].insert(obs2);
-		}
-	}
-	
-	vector<size_t> gal_cnt(num_obs, 0);
-	GalElement* gal = new GalElement[num_obs];
-	file.clear();
-	file.seekg(0, ios::beg); // reset to beginning
-	getline(file, str); // skip header line
-	map<wxString, int>::iterator it1;
-	map<wxString, int>::iterator it2;
-	int line_num=1;
-	while (!file.eof()) {
-		int gwt_obs1, gwt_obs2;
-		//wxInt64 obs1, obs2;
-        string obs1, obs2;
-        double wVal;
-		getline(file, str);
-		if (!str.empty()) {
-			stringstream ss(str, stringstream::in | stringstream::out);
-			ss >> obs1 >> obs2 >> wVal;
-			it1 = id_map.find(obs1);
-			it2 = id_map.find(obs2);
-			if (it1 == id_map.end() || it2 == id_map.end()) {
-				string obs;
-				if (it1 == id_map.end())
-                    obs = obs1;
-				if (it2 == id_map.end())
-                    obs = obs2;
-                
-                wxString msg;
-				if (use_rec_order) {
-                    msg = _("On line %d of weights file, observation id %d encountered which is out of allowed observation range of 1 through %d.");
-                    msg = wxString::Format(msg, line_num+1, obs, num_obs);
-				} else {
-                    msg = _("On line %d of weights file, observation id %d encountered which does not exist in field \"%s\" of the Table.");
-                    msg = wxString::Format(msg, line_num+1, obs, key_field);
-				}
-                
-				wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-				dlg.ShowModal();
-				delete [] gal;
-				return 0;
-			}
-			
-			gwt_obs1 = (*it1).second; // value
-			gwt_obs2 = (*it2).second; // value
-			if (gal[gwt_obs1].Size() == 0) {
-				gal[gwt_obs1].SetSizeNbrs(nbr_histogram[obs1].size());
-			}
-            if (fname.EndsWith("kwt") ||
-                (fname.EndsWith("gwt") && obs2 != obs1) ) {
-                gal[gwt_obs1].SetNbr(gal_cnt[gwt_obs1]++, gwt_obs2, wVal);
-            }
-		}
-		line_num++;
-	}	
-	
-	file.clear();
-	if (file.is_open()) file.close();
-	
-	return gal;
+    if (w == 0) return 0;
+    GalElement* gal = w->ToGal();
+    delete w;
+    return gal;
 }
 
 /** This function should not be used unless an actual GWT object is needed
@@ -626,222 +174,29 @@ GalElement* WeightUtils::ReadGwtAsGal(const wxString& fname,
 GwtElement* WeightUtils::ReadGwt(const wxString& fname,
 								 TableInterface* table_int)
 {
-	using namespace std;
-#ifdef __WIN32__
-	ifstream file(fname.wc_str());
-#else
-	ifstream file;
-	file.open(GET_ENCODED_FILENAME(fname), ios::in);  // a text file
-#endif
-
-	if (!(file.is_open() && file.good())) {
-		return 0;
-	}
-	
-	// First determine if header line is correct
-	// Can be either: int int string string  (type n_obs filename field)
-	// or : int (n_obs)
-	
-	bool use_rec_order = false;
-	string str;
-	getline(file, str);
-	cout << str << endl;
-	stringstream ss(str, stringstream::in | stringstream::out);
-	
-	wxInt64 num1 = 0;
-	wxInt64 num2 = 0;
-	wxInt64 num_obs = 0;	
-	string dbf_name, t_key_field;
-    
-    string line;
-    std::getline(ss, line);
-    wxString header(line);
-    
-    // detect if header contains string with empty space, which should be quoted
-    if (header.Contains("\"")) {
-        int start_quote = header.find("\"");
-        int end_quote = header.find("\"", start_quote + 1);
-        dbf_name = header.SubString(start_quote + 1, end_quote - 1);
-        t_key_field = header.SubString(end_quote + 1 + 1 /*1 for blank space */,
-                                       header.length()-1);
-        wxString nums = header.SubString(0, start_quote-1);
-        int break_pos = nums.find(" ");
-        wxString num1_str = nums.SubString(0, break_pos-1);
-        wxString num2_str = nums.SubString(break_pos+1, nums.length()-1);
-        num1_str.ToLongLong(&num1);
-        num2_str.ToLongLong(&num2);
-        
-    } else {
-        
-        ss.clear();
-        ss.seekg(0, ios::beg); // reset to beginning
-        ss >> num1 >> num2 >> dbf_name >> t_key_field;
+    bool keep_self = GenUtils::GetFileExt(fname).Lower() == "kwt";
+    CsrWeight* w = 0;
+    try {
+        w = GdaWeightsReader::ReadGwt(fname, table_int, keep_self);
+    } catch (WeightsReadException& e) {
+        wxMessageDialog dlg(NULL, e.msg, _("Error"), wxOK | wxICON_ERROR);
+        dlg.ShowModal();
     }
-    
-	wxString key_field(t_key_field);
-	if (num2 == 0) {
-		use_rec_order = true;
-		num_obs = num1;
-	} else {
-		num_obs = num2;
-		if (key_field.IsEmpty()) {
-			use_rec_order = true;
-		}
-	}
-	
-	if (num_obs != table_int->GetNumberRows()) {
-		wxString msg = "The number of observations specified in chosen ";
-		msg << "weights file is " << num_obs << ", but the number in the ";
-		msg << "current Table is " << table_int->GetNumberRows();
-		msg << ", which is incompatible.";
-		wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-		dlg.ShowModal();
-		return 0;
-	}
-	
-	file.clear();
-	file.seekg(0, ios::beg); // reset to beginning
-	getline(file, str); // skip header line
-	map<wxInt64, int> id_map;
-	if (use_rec_order) {
-		// we need to traverse through every line of the file and
-		// record the max and min values.  So long as the max and min
-		// values are such that num_obs = (max - min) + 1, we will assume
-		// record order is valid.
-		wxInt64 min_val = LLONG_MAX;
-		wxInt64 max_val = LLONG_MIN;
-		while (!file.eof()) {
-			wxInt64 obs1=0, obs2=0;
-			getline(file, str);
-			if (!str.empty()) {
-				stringstream ss (str, stringstream::in | stringstream::out);
-				ss >> obs1 >> obs2;
-				if (obs1 < min_val) {
-					min_val = obs1;
-				} else if (obs1 > max_val) {
-					max_val = obs1;
-				}
-				if (obs2 < min_val) {
-					min_val = obs2;
-				} else if (obs2 > max_val) {
-					max_val = obs2;
-				}
-			}
-		}
-		if (max_val - min_val != num_obs - 1) {
-			wxString msg = "Record order specified, but found minimum ";
-			msg << " and maximum observation values of " << min_val;
-			msg << " and " << max_val << " which is incompatible with ";
-			msg << " number of observations specified in first line of ";
-			msg << " weights file: " << num_obs << ".";
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-		for (int i=0; i<num_obs; i++) id_map[i+min_val] = i;
-	} else {
-		int col, tm;
-		table_int->DbColNmToColAndTm(key_field, col, tm);
-		if (col == wxNOT_FOUND) {
-            wxString msg = _("Specified key value field \"%s\" on first line of weights file not found in currently loaded Table.");
-            msg = wxString::Format(msg, key_field);
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-		if (table_int->GetColType(col) != GdaConst::long64_type &&
-            table_int->GetColType(col) != GdaConst::string_type) {
-            wxString msg = _("Specified key value field \"%s\" on first line of weights file is not an integer type in the currently loaded Table.");
-            msg = wxString::Format(msg, key_field);
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-		// get mapping from key_field to record ids (which always start
-		// from 0 internally, but are displayed to the user from 1)
-		vector<wxInt64> vec;
-		table_int->GetColData(col, 0, vec);
-		for (int i=0; i<num_obs; i++) id_map[vec[i]] = i;
-		if (id_map.size() != num_obs) {
-            wxString msg = _("Specified key value field \"%s\" in weights file contains duplicate values in the currently loaded Table.");
-            msg = wxString::Format(msg, key_field);
-			wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-			dlg.ShowModal();
-			return 0;
-		}
-	}
-	file.clear();
-	file.seekg(0, ios::beg); // reset to beginning
-	getline(file, str); // skip header line
-	// we need to traverse through every line of the file and
-	// record the number of neighbors for each observation.
-	map<wxInt64, int>::iterator it;
-	map<wxInt64, int> nbr_histogram;
-	while (!file.eof()) {
-		wxInt64 obs1=0;
-		getline(file, str);
-		if (!str.empty()) {
-			stringstream ss (str, stringstream::in | stringstream::out);
-			ss >> obs1;
-			
-			it = nbr_histogram.find(obs1);
-			if (it == nbr_histogram.end()) {
-				nbr_histogram[obs1] = 1;
-			} else {
-				nbr_histogram[obs1] = (*it).second + 1;
-			}
-		}
-	}
-	
-	GwtElement* gwt = new GwtElement[num_obs];
-	file.clear();
-	file.seekg(0, ios::beg); // reset to beginning
-	getline(file, str); // skip header line
-	map<wxInt64, int>::iterator it1;
-	map<wxInt64, int>::iterator it2;
-	int line_num = 1;
-	while (!file.eof()) {
-		int gwt_obs1, gwt_obs2;
-		wxInt64 obs1, obs2;
-        double w_val;
-		getline(file, str);
-		if (!str.empty()) {
-			stringstream ss(str, stringstream::in | stringstream::out);
-			ss >> obs1 >> obs2 >> w_val;
-			it1 = id_map.find(obs1);
-			it2 = id_map.find(obs2);
-			if (it1 == id_map.end() || it2 == id_map.end()) {
-				int obs;
-				if (it1 == id_map.end()) obs = obs1;
-				if (it2 == id_map.end()) obs = obs2;
-				wxString msg = "On line ";
-				msg << line_num+1 << " of weights file, observation id " << obs;
-				if (use_rec_order) {
-					msg << " encountered which out allowed observation ";
-					msg << "range of 1 through " << num_obs << ".";
-				} else {
-					msg << " encountered which does not exist in field \"";
-					msg << key_field << "\" of the Table.";
-				}
-				wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
-				dlg.ShowModal();
-				delete [] gwt;
-				return 0;
-			}
-			gwt_obs1 = (*it1).second; // value
-			gwt_obs2 = (*it2).second; // value
-            
-			if (gwt[gwt_obs1].empty())
-                gwt[gwt_obs1].alloc(nbr_histogram[obs1]);
-            
-			gwt[gwt_obs1].Push(GwtNeighbor(gwt_obs2, w_val));
-		}
-		line_num++;
-	}	
-	
-	if (file.is_open()) file.close();
-	
-	return gwt;
+    if (w == 0) return 0;
+    int num_obs = w->GetNumObs();
+    GwtElement* gwt = new GwtElement[num_obs];
+    for (int i=0; i<num_obs; i++) {
+        int sz = w->GetNumNbrs(i);
+        if (sz == 0) continue;
+        const int* nb = w->GetNbrs(i);
+        const double* v = w->GetValues(i);
+        gwt[i].alloc(sz);
+        for (int j=0; j<sz; j++) {
+            gwt[i].Push(GwtNeighbor(nb[j], v ? v[j] : 1.0));
+        }
+    }
+    delete w;
+    return gwt;
 }
 
 GalElement* WeightUtils::Gwt2Gal(GwtElement* Gwt, long obs) 
@@ -858,6 +213,95 @@ GalElement* WeightUtils::Gwt2Gal(GwtElement* Gwt, long obs)
 	return Gal;
 }
 
+CsrWeight* WeightUtils::ReadBinary(const wxString& fname,
+                                   TableInterface* table_int)
+{
+    wxString msg;
+    try {
+        return GdaWeightsBinary::Read(fname, table_int);
+    } catch (WeightsMismatchObsException& e) {
+        msg = _("The number of observations specified in chosen weights file is incompatible with current Table.");
+    } catch (WeightsIdNotFoundException& e) {
+        msg = _("Specified id field (%s) not found in currently loaded Table.");
+        msg = wxString::Format(msg, e.id);
+    } catch (WeightsIdsChangedException& e) {
+        msg = _("The values of the id field in the currently loaded Table do not match the ids the weights file was created with.");
+    } catch (WeightsNotValidException& e) {
+        msg = _("Weights file/format is not valid.");
+    }
+    wxMessageDialog dlg(NULL, msg, _("Error"), wxOK | wxICON_ERROR);
+    dlg.ShowModal();
+    return 0;
+}
+
+bool WeightUtils::ConvertToBinary(const wxString& in_fname,
+                                  const wxString& out_fname,
+                                  TableInterface* table_int)
+{
+    if (table_int == NULL) return false;
+    wxString ext = GenUtils::GetFileExt(in_fname).Lower();
+    wxString id_field;
+    CsrWeight* w = 0;
+    
+    try {
+        if (ext == "gal" || ext == "gwt" || ext == "kwt") {
+            id_field = ReadIdField(in_fname);
+            w = ReadAsCsr(in_fname, table_int);
+        } else if (ext == "swm") {
+            id_field = ReadIdFieldFromSwm(in_fname);
+            w = ReadSwm(in_fname, table_int);
+        }
+        if (w == 0) return false;
+        
+        bool is_symmetric = w->CountAsymmetric() == 0;
+        boost::uint64_t fp = GdaWeightsBinary::IdFingerprint(table_int,
+                                                             id_field);
+        bool success = GdaWeightsBinary::Write(out_fname, *w, id_field, fp,
+                                               is_symmetric);
+        delete w;
+        return success;
+        
+    } catch (std::exception& e) {
+        wxLogMessage("WeightUtils::ConvertToBinary(): %s", e.what());
+        if (w) delete w;
+        return false;
+    }
+}
+
+namespace {
+    /** register a .gwb file with the manager on its mapped CSR weights;
+     the GAL copy is only built if a consumer asks for it */
+    void LoadBinaryInMan(WeightsManInterface* w_man_int,
+                         const wxString& filepath, TableInterface* table_int,
+                         const wxString& id_field,
+                         WeightsMetaInfo::WeightTypeEnum type)
+    {
+        CsrWeight* w = WeightUtils::ReadBinary(filepath, table_int);
+        if (w == NULL) return;
+        w->GetNbrStats();
+        
+        WeightsMetaInfo wmi;
+        wmi.num_obs = w->GetNumObs();
+        wmi.id_var = id_field;
+        if (w->symmetry_checked) wmi.SetSymmetric(w->is_symmetric);
+        wmi.SetMinNumNbrs(w->GetMinNumNbrs());
+        wmi.SetMaxNumNbrs(w->GetMaxNumNbrs());
+        wmi.SetMeanNumNbrs(w->GetMeanNumNbrs());
+        wmi.SetMedianNumNbrs(w->GetMedianNumNbrs());
+        wmi.SetSparsity(w->GetSparsity());
+        wmi.SetDensity(w->GetDensity());
+        wmi.SetWeightsType(type);
+        wmi.filename = filepath;
+        
+        boost::uuids::uuid uid = w_man_int->RequestWeights(wmi);
+        if (uid.is_nil() ||
+            !((WeightsNewManager*) w_man_int)->AssociateCsr(uid, w)) {
+            delete w;
+            return;
+        }
+        w_man_int->MakeDefault(uid);
+    }
+}
 
 void WeightUtils::LoadGwtInMan(WeightsManInterface* w_man_int,
                                wxString filepath,
@@ -869,6 +313,10 @@ void WeightUtils::LoadGwtInMan(WeightsManInterface* w_man_int,
     
     WeightsMetaInfo wmi;
     
+    if (GenUtils::GetFileExt(filepath).Lower() == "gwb") {
+        LoadBinaryInMan(w_man_int, filepath, table_int, id_field, type);
+        return;
+    }
     GalElement* tempGal = WeightUtils::ReadGwtAsGal(filepath, table_int);
     if (tempGal == NULL) {
         return;
@@ -915,6 +363,10 @@ void WeightUtils::LoadGalInMan(WeightsManInterface* w_man_int,
 
     WeightsMetaInfo wmi;
 
+    if (GenUtils::GetFileExt(filepath).Lower() == "gwb") {
+        LoadBinaryInMan(w_man_int, filepath, table_int, id_field, type);
+        return;
+    }
     GalElement* tempGal = WeightUtils::ReadGal(filepath, table_int);
     if (tempGal == NULL) {
         return;
@@ -951,85 +403,143 @@ void WeightUtils::LoadGalInMan(WeightsManInterface* w_man_int,
     }
 }
 
-GalWeight* WeightUtils::WeightsIntersection(std::vector<GeoDaWeight*> ws)
-{
-    // Get the intersection from an array of weights
-    int num_obs = ws[0]->GetNumObs();
-    wxString id_field = ws[0]->GetIDName();
-    GalElement* gal = new GalElement[num_obs];
-    boost::unordered_map<int, int>::iterator it;
-
-    size_t n_w = ws.size();
-    for (size_t i=0; i<num_obs; ++i) {
-        boost::unordered_map<int, int> nbr_dict;
+/*
+ Weights algebra
 
-        for (size_t j=0; j<n_w; ++j) {
-            GeoDaWeight* w = ws[j];
-            const std::vector<long>& nbr_ids = w->GetNeighbors(i);
-            for (size_t k=0; k<nbr_ids.size(); ++k) {
-                if (nbr_dict.find(nbr_ids[k])==nbr_dict.end()) {
-                    nbr_dict[ nbr_ids[k] ] = 1;
+ Every input is read as sorted CSR rows: a CsrWeight as it is, a GAL by
+ copying it into a CsrWeight once, other weights through GetNeighbors().
+ A row of the result is then folded left over the inputs with the sorted
+ merges of <algorithm>, in two scratch vectors per job, so a chain of
+ operations never builds the intermediate weights.  As for higher order
+ contiguity, every block of rows writes into its own buffer and the
+ buffers are copied into the CSR arrays by CsrWeight::FromRowBlocks().
+ */
+namespace {
+    const int weights_algebra_chunk_size = 1024;
+
+    struct WeightsAlgebraBuilder
+    {
+        std::vector<const CsrWeight*> ws;
+        std::vector<WeightUtils::WeightsOp> ops;
+        int num_obs;
+        std::vector<boost::uint64_t> counts;
+        std::vector<std::vector<int> > rows;
+
+        void MergeRows(int first, int last);
+        CsrWeight* Run();
+    };
+
+    void WeightsAlgebraBuilder::MergeRows(int first, int last)
+    {
+        std::vector<int>& out = rows[first / weights_algebra_chunk_size];
+        std::vector<int> cur, tmp;
+        for (int i=first; i<=last; i++) {
+            const int* nb = ws[0]->GetNbrs(i);
+            cur.assign(nb, nb + ws[0]->GetNumNbrs(i));
+            for (size_t k=0; k<ops.size(); k++) {
+                const int* b_first = ws[k+1]->GetNbrs(i);
+                const int* b_last = b_first + ws[k+1]->GetNumNbrs(i);
+                tmp.clear();
+                if (ops[k] == WeightUtils::weights_intersection) {
+                    std::set_intersection(cur.begin(), cur.end(),
+                                          b_first, b_last,
+                                          std::back_inserter(tmp));
+                } else if (ops[k] == WeightUtils::weights_union) {
+                    std::set_union(cur.begin(), cur.end(), b_first, b_last,
+                                   std::back_inserter(tmp));
                 } else {
-                    nbr_dict[ nbr_ids[k] ] += 1;
+                    std::set_difference(cur.begin(), cur.end(),
+                                        b_first, b_last,
+                                        std::back_inserter(tmp));
                 }
+                cur.swap(tmp);
             }
+            // a row with repeated neighbors may keep repeats through union
+            cur.erase(std::unique(cur.begin(), cur.end()), cur.end());
+            out.insert(out.end(), cur.begin(), cur.end());
+            counts[i] = cur.size();
         }
-        // the intersect observation should be shared by ws.size() weights
-        std::vector<long> nbrs;
-        for (it=nbr_dict.begin(); it !=nbr_dict.end(); ++it) {
-            if (it->second == n_w) {
-                nbrs.push_back(it->first);
-            }
+    }
+
+    CsrWeight* WeightsAlgebraBuilder::Run()
+    {
+        int num_chunks = (num_obs + weights_algebra_chunk_size - 1) /
+            weights_algebra_chunk_size;
+        counts.resize(num_obs);
+        rows.resize(num_chunks);
+        GdaThreadPool::GetInstance().ParallelFor(num_obs,
+            boost::bind(&WeightsAlgebraBuilder::MergeRows, this, _1, _2),
+            weights_algebra_chunk_size);
+        return CsrWeight::FromRowBlocks(counts, rows,
+                                        weights_algebra_chunk_size);
+    }
+
+    /** sorted rows of w: w itself if it is a CsrWeight, otherwise a copy
+     that the caller deletes */
+    const CsrWeight* SortedRows(GeoDaWeight* w)
+    {
+        if (w->weight_type == GeoDaWeight::csr_type) return (CsrWeight*) w;
+        int num_obs = w->GetNumObs();
+        if (w->weight_type == GeoDaWeight::gal_type) {
+            return new CsrWeight(((GalWeight*) w)->gal, num_obs);
         }
-        gal[i].SetSizeNbrs(nbrs.size());
-        for (size_t j=0; j<nbrs.size(); ++j) {
-            gal[i].SetNbr(j, nbrs[j]);
+        std::vector<std::vector<int> > nbr_lists(num_obs);
+        for (int i=0; i<num_obs; i++) {
+            const std::vector<long> nb = w->GetNeighbors(i);
+            nbr_lists[i].assign(nb.begin(), nb.end());
         }
+        return new CsrWeight(nbr_lists, std::vector<std::vector<double> >());
     }
 
-    GalWeight* new_w = new GalWeight();
-    new_w->num_obs = num_obs;
-    new_w->gal = gal;
-    new_w->is_symmetric = false;
-
-    new_w->id_field = id_field;
-    return new_w;
+    GalWeight* ToGalWeight(CsrWeight* csr, const wxString& id_field,
+                           bool is_symmetric)
+    {
+        GalWeight* new_w = new GalWeight();
+        new_w->num_obs = csr->GetNumObs();
+        new_w->gal = csr->ToGal();
+        new_w->is_symmetric = is_symmetric;
+        new_w->id_field = id_field;
+        delete csr;
+        return new_w;
+    }
 }
 
-GalWeight* WeightUtils::WeightsUnion(std::vector<GeoDaWeight*> ws)
+CsrWeight* WeightUtils::WeightsAlgebra(const std::vector<GeoDaWeight*>& ws,
+                                       const std::vector<WeightsOp>& ops)
 {
+    if (ws.empty() || ops.size() + 1 != ws.size()) return NULL;
     int num_obs = ws[0]->GetNumObs();
-    wxString id_field = ws[0]->GetIDName();
-    GalElement* gal = new GalElement[num_obs];
-    boost::unordered_map<int, int>::iterator it;
-
-    for (size_t i=0; i<num_obs; ++i) {
-        boost::unordered_map<int, int> nbr_dict;
-
-        for (size_t j=0; j<ws.size(); ++j) {
-            GeoDaWeight* w = ws[j];
-            const std::vector<long>& nbr_ids = w->GetNeighbors(i);
-            for (size_t k=0; k<nbr_ids.size(); ++k) {
-                nbr_dict[ nbr_ids[k] ] = 1;
-            }
-        }
+    for (size_t j=1; j<ws.size(); j++) {
+        if (ws[j]->GetNumObs() != num_obs) return NULL;
+    }
 
-        std::vector<long> nbrs;
-        for (it=nbr_dict.begin(); it !=nbr_dict.end(); ++it) {
-            nbrs.push_back(it->first);
-        }
-        gal[i].SetSizeNbrs(nbrs.size());
-        for (size_t j=0; j<nbrs.size(); ++j) {
-            gal[i].SetNbr(j, nbrs[j]);
-        }
+    WeightsAlgebraBuilder b;
+    b.num_obs = num_obs;
+    b.ops = ops;
+    for (size_t j=0; j<ws.size(); j++) b.ws.push_back(SortedRows(ws[j]));
+    CsrWeight* result = b.Run();
+    for (size_t j=0; j<ws.size(); j++) {
+        if (b.ws[j] != ws[j]) delete b.ws[j];
     }
+    result->id_field = ws[0]->GetIDName();
+    return result;
+}
 
-    GalWeight* new_w = new GalWeight();
-    new_w->num_obs = num_obs;
-    new_w->gal = gal;
-    new_w->is_symmetric = true;
+GalWeight* WeightUtils::WeightsIntersection(std::vector<GeoDaWeight*> ws)
+{
+    // Get the intersection from an array of weights
+    if (ws.empty()) return NULL;
+    std::vector<WeightsOp> ops(ws.size() - 1, weights_intersection);
+    CsrWeight* csr = WeightsAlgebra(ws, ops);
+    if (csr == NULL) return NULL;
+    return ToGalWeight(csr, ws[0]->GetIDName(), false);
+}
 
-    //new_w->wflnm = filepath;
-    new_w->id_field = id_field;
-    return new_w;
+GalWeight* WeightUtils::WeightsUnion(std::vector<GeoDaWeight*> ws)
+{
+    if (ws.empty()) return NULL;
+    std::vector<WeightsOp> ops(ws.size() - 1, weights_union);
+    CsrWeight* csr = WeightsAlgebra(ws, ops);
+    if (csr == NULL) return NULL;
+    return ToGalWeight(csr, ws[0]->GetIDName(), true);
 }
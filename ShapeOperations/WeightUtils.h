@@ -24,6 +24,7 @@
 
 #include "../VarCalc/WeightsMetaInfo.h"
 
+class CsrWeight;
 class GeoDaWeight;
 class TableInterface;
 class GalWeight;
@@ -35,6 +36,11 @@ class WeightsManInterface;
 namespace WeightUtils {
 	wxString ReadIdField(const wxString& w_fname);
 
+    /** .gal, .gwt or .kwt file as CSR weights, parsed in parallel from the
+     mapped file; problems of the file are reported to the user and NULL
+     is returned */
+    CsrWeight* ReadAsCsr(const wxString& w_fname, TableInterface* table_int);
+
 	GalElement* ReadGal(const wxString& w_fname, TableInterface* table_int);
 	
 	GalElement* ReadGwtAsGal(const wxString& w_fname, TableInterface* table_int);
@@ -43,6 +49,15 @@ namespace WeightUtils {
 
 	GalElement* Gwt2Gal(GwtElement* Gwt, long obs);
 
+    /** GeoDa binary weights (.gwb) as CSR weights on the mapped file,
+     errors reported to the user */
+    CsrWeight* ReadBinary(const wxString& w_fname, TableInterface* table_int);
+
+    /** Write a .gal, .gwt, .kwt or .swm file as GeoDa binary weights
+     (.gwb).  The ids are matched against table_int, which is required. */
+    bool ConvertToBinary(const wxString& in_fname, const wxString& out_fname,
+                         TableInterface* table_int);
+
     void LoadGwtInMan(WeightsManInterface* w_man_int, wxString filepath,
                       TableInterface* table_int, wxString id_field,
                       WeightsMetaInfo::WeightTypeEnum type);
@@ -51,8 +66,23 @@ namespace WeightUtils {
                       TableInterface* table_int, wxString id_field,
                       WeightsMetaInfo::WeightTypeEnum type);
 
+    /** set operation between the result so far and the next weights */
+    enum WeightsOp {
+        weights_intersection, weights_union, weights_difference
+    };
+
+    /** Evaluate (((ws[0] ops[0] ws[1]) ops[1] ws[2]) ...) as binary CSR
+     weights, row by row in parallel by merging sorted neighbor lists, so
+     no intermediate weights are built.  ops.size() must be ws.size()-1
+     and all weights must have the same number of observations; returns
+     NULL otherwise. */
+    CsrWeight* WeightsAlgebra(const std::vector<GeoDaWeight*>& ws,
+                              const std::vector<WeightsOp>& ops);
+
+    /** ws[0] and ws[1] and ..., through WeightsAlgebra() */
     GalWeight* WeightsIntersection(std::vector<GeoDaWeight*> ws);
 
+    /** ws[0] or ws[1] or ..., through WeightsAlgebra() */
     GalWeight* WeightsUnion(std::vector<GeoDaWeight*> ws);
 }
 
@@ -0,0 +1,374 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <wx/filefn.h>
+#include <wx/filename.h>
+#include <wx/log.h>
+
+#include "../DataViewer/DataSource.h"
+#include "../GdaConst.h"
+#include "../GenUtils.h"
+#include "../Project.h"
+#include "../ShpFile.h"
+#include "../io/weights_binary.h"
+#include "CsrWeight.h"
+#include "WeightsCache.h"
+
+using namespace std;
+
+namespace {
+    const boost::uint64_t fnv_offset = 14695981039346656037ULL;
+    const boost::uint64_t fnv_prime = 1099511628211ULL;
+
+    void HashBytes(boost::uint64_t& h, const void* p, size_t n)
+    {
+        const unsigned char* s = (const unsigned char*) p;
+        for (size_t i=0; i<n; i++) {
+            h ^= s[i];
+            h *= fnv_prime;
+        }
+    }
+
+    void HashPoints(boost::uint64_t& h,
+                    const std::vector<Shapefile::Point>& pts)
+    {
+        for (size_t i=0; i<pts.size(); i++) {
+            HashBytes(h, &pts[i].x, sizeof(pts[i].x));
+            HashBytes(h, &pts[i].y, sizeof(pts[i].y));
+        }
+    }
+
+    wxString ToHex(boost::uint64_t h)
+    {
+        return wxString::Format("%08x%08x", (unsigned int) (h >> 32),
+                                (unsigned int) (h & 0xffffffff));
+    }
+
+    // keys are stored one per line in the tab separated index
+    wxString CleanKey(wxString key)
+    {
+        key.Replace("\t", " ");
+        key.Replace("\r", " ");
+        key.Replace("\n", " ");
+        return key;
+    }
+}
+
+WeightsCache::WeightsCache()
+: total_bytes(0), hits(0), misses(0)
+{
+    wxFileName cache_fn(GenUtils::GetCachePath());
+    cache_dir = cache_fn.GetPath() + wxFileName::GetPathSeparator() +
+        "weights_cache";
+    if (!wxDirExists(cache_dir)) {
+        wxFileName::Mkdir(cache_dir, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+    }
+    LoadIndex();
+}
+
+wxString WeightsCache::FileFingerprint(const wxString& fname)
+{
+    wxString s;
+    s << fname;
+    wxFileName fn(fname);
+    if (fn.FileExists()) {
+        s << "|" << fn.GetSize().ToString();
+        s << "|" << fn.GetModificationTime().GetValue().ToString();
+    }
+    return s;
+}
+
+wxString WeightsCache::GeomFingerprint(Project* project)
+{
+    wxString s;
+    IDataSource* ds = project->GetDataSource();
+    if (ds) {
+        wxString conn = ds->GetOGRConnectStr();
+        if (wxFileExists(conn)) {
+            s << FileFingerprint(conn);
+        } else {
+            s << conn;
+        }
+    }
+    s << "|" << project->GetNumRecords();
+    s << "|" << project->main_data.header.shape_type;
+
+    boost::uint64_t h = fnv_offset;
+    const std::vector<Shapefile::MainRecord>& recs =
+        project->main_data.records;
+    for (size_t i=0; i<recs.size(); i++) {
+        Shapefile::RecordContents* rec = recs[i].contents_p;
+        if (rec == NULL) continue;
+        HashBytes(h, &rec->shape_type, sizeof(rec->shape_type));
+        if (Shapefile::PointContents* pt =
+            dynamic_cast<Shapefile::PointContents*>(rec)) {
+            HashBytes(h, &pt->x, sizeof(pt->x));
+            HashBytes(h, &pt->y, sizeof(pt->y));
+        } else if (Shapefile::PolygonContents* ply =
+                   dynamic_cast<Shapefile::PolygonContents*>(rec)) {
+            for (size_t p=0; p<ply->parts.size(); p++) {
+                HashBytes(h, &ply->parts[p], sizeof(ply->parts[p]));
+            }
+            HashPoints(h, ply->points);
+        } else if (Shapefile::PolyLineContents* line =
+                   dynamic_cast<Shapefile::PolyLineContents*>(rec)) {
+            for (size_t p=0; p<line->parts.size(); p++) {
+                HashBytes(h, &line->parts[p], sizeof(line->parts[p]));
+            }
+            HashPoints(h, line->points);
+        }
+    }
+    s << "|" << ToHex(h);
+    return s;
+}
+
+wxString WeightsCache::MetaInfoFingerprint(const WeightsMetaInfo& wmi)
+{
+    wxString s;
+    s << wmi.TypeToStr() << "|" << wmi.id_var;
+    s << "|" << wmi.order << "|" << wmi.inc_lower_orders;
+    s << "|" << wmi.dist_metric << "|" << wmi.dist_units;
+    s << "|" << wmi.dist_values;
+    s << "|" << wmi.dist_var1 << "|" << wmi.dist_tm1;
+    s << "|" << wmi.dist_var2 << "|" << wmi.dist_tm2;
+    for (size_t i=0; i<wmi.dist_multivars.size(); i++) {
+        s << "|" << wmi.dist_multivars[i];
+    }
+    s << "|" << wxString::Format("%.17g", wmi.power);
+    s << "|" << wxString::Format("%.17g", wmi.threshold_val);
+    s << "|" << wmi.num_neighbors;
+    s << "|" << wmi.kernel << "|" << wmi.k;
+    s << "|" << wxString::Format("%.17g", wmi.bandwidth);
+    s << "|" << wmi.is_adaptive_kernel << "|" << wmi.use_kernel_diagnals;
+    return s;
+}
+
+wxString WeightsCache::FileKey(const wxString& fname, const wxString& id_var)
+{
+    wxString key;
+    key << "file|" << FileFingerprint(fname) << "|" << id_var;
+    return CleanKey(key);
+}
+
+wxString WeightsCache::GeomKey(Project* project, const WeightsMetaInfo& wmi,
+                               double precision_threshold)
+{
+    wxString key;
+    key << "geom|" << GeomFingerprint(project);
+    key << "|" << MetaInfoFingerprint(wmi);
+    key << "|" << wxString::Format("%.17g", precision_threshold);
+    if (wmi.weights_type == WeightsMetaInfo::WT_rook ||
+        wmi.weights_type == WeightsMetaInfo::WT_queen) {
+        // the two contiguity builders differ under a precision threshold
+        // and at rook T-junctions
+        key << "|" << (GdaConst::gda_use_hash_contiguity ? "hashed" : "sweep");
+    }
+    return CleanKey(key);
+}
+
+wxString WeightsCache::GetFilePath(const wxString& file_id) const
+{
+    return cache_dir + wxFileName::GetPathSeparator() + file_id + ".gwb";
+}
+
+void WeightsCache::LoadIndex()
+{
+    lru.clear();
+    entries.clear();
+    total_bytes = 0;
+    wxString index_fname = cache_dir + wxFileName::GetPathSeparator() +
+        "index.txt";
+#ifdef __WIN32__
+    ifstream istream(index_fname.wc_str());
+#else
+    ifstream istream(GET_ENCODED_FILENAME(index_fname));
+#endif
+    if (!(istream.is_open() && istream.good())) return;
+
+    string line;
+    while (getline(istream, line)) {
+        // file_id \t bytes \t key
+        size_t t1 = line.find('\t');
+        size_t t2 = t1 == string::npos ? t1 : line.find('\t', t1 + 1);
+        if (t2 == string::npos) continue;
+        CacheEntry e;
+        e.file_id = wxString::FromUTF8(line.substr(0, t1).c_str());
+        e.key = wxString::FromUTF8(line.substr(t2 + 1).c_str());
+        wxString bytes_str = wxString::FromUTF8(line.substr(t1 + 1, t2 - t1 - 1).c_str());
+        unsigned long long bytes = 0;
+        if (!bytes_str.ToULongLong(&bytes)) continue;
+        e.bytes = bytes;
+        if (entries.find(e.key) != entries.end() ||
+            !wxFileExists(GetFilePath(e.file_id))) {
+            continue;
+        }
+        lru.push_back(e);
+        entries[e.key] = --lru.end();
+        total_bytes += e.bytes;
+    }
+}
+
+void WeightsCache::SaveIndex() const
+{
+    wxString index_fname = cache_dir + wxFileName::GetPathSeparator() +
+        "index.txt";
+#ifdef __WIN32__
+    ofstream ostream(index_fname.wc_str(), ios::out|ios::trunc);
+#else
+    ofstream ostream(GET_ENCODED_FILENAME(index_fname), ios::out|ios::trunc);
+#endif
+    if (!(ostream.is_open() && ostream.good())) {
+        wxLogMessage("WeightsCache: can't write %s", index_fname);
+        return;
+    }
+    for (LruList::const_iterator it=lru.begin(); it!=lru.end(); ++it) {
+        ostream << it->file_id.ToUTF8().data() << '\t';
+        ostream << it->bytes << '\t';
+        ostream << it->key.ToUTF8().data() << '\n';
+    }
+}
+
+void WeightsCache::RemoveEntry(LruList::iterator it)
+{
+    // a mapped file stays readable after it is unlinked, except on Windows
+    // where the removal fails until the weights are closed
+    wxString fname = GetFilePath(it->file_id);
+    if (wxFileExists(fname) && !wxRemoveFile(fname)) {
+        wxLogMessage("WeightsCache: can't remove %s", fname);
+    }
+    total_bytes -= it->bytes;
+    entries.erase(it->key);
+    lru.erase(it);
+}
+
+void WeightsCache::Evict(boost::uint64_t max_bytes)
+{
+    while (!lru.empty() && total_bytes > max_bytes) {
+        LruList::iterator it = --lru.end();
+        wxLogMessage("WeightsCache: evict %s", it->file_id);
+        RemoveEntry(it);
+    }
+}
+
+CsrWeight* WeightsCache::Get(const wxString& key, TableInterface* table_int)
+{
+    if (GdaConst::gda_weights_cache_mb <= 0) return NULL;
+    boost::mutex::scoped_lock lock(mutex);
+    std::map<wxString, LruList::iterator>::iterator it = entries.find(key);
+    if (it == entries.end()) {
+        misses++;
+        wxLogMessage("WeightsCache: miss, %s", GetStats());
+        return NULL;
+    }
+    LruList::iterator e = it->second;
+    CsrWeight* w = NULL;
+    try {
+        w = GdaWeightsBinary::Read(GetFilePath(e->file_id), table_int);
+    } catch (std::exception& ex) {
+        wxLogMessage("WeightsCache: drop %s: %s", e->file_id, ex.what());
+        RemoveEntry(e);
+        SaveIndex();
+        misses++;
+        return NULL;
+    }
+    // most recently used to the front
+    lru.splice(lru.begin(), lru, e);
+    SaveIndex();
+    hits++;
+    wxLogMessage("WeightsCache: hit %s, %s", e->file_id, GetStats());
+    return w;
+}
+
+bool WeightsCache::Put(const wxString& key, const CsrWeight& w,
+                       const wxString& id_field, TableInterface* table_int,
+                       bool is_symmetric)
+{
+    if (GdaConst::gda_weights_cache_mb <= 0) return false;
+    boost::mutex::scoped_lock lock(mutex);
+
+    boost::uint64_t id_fp = 0;
+    try {
+        id_fp = GdaWeightsBinary::IdFingerprint(table_int, id_field);
+    } catch (std::exception& ex) {
+        wxLogMessage("WeightsCache::Put(): %s", ex.what());
+        return false;
+    }
+
+    boost::uint64_t h = fnv_offset;
+    wxScopedCharBuffer key_buf = key.ToUTF8();
+    HashBytes(h, key_buf.data(), key_buf.length());
+    wxString file_id = ToHex(h);
+    wxString fname = GetFilePath(file_id);
+
+    // write next to the old file and rename, so weights still mapped from
+    // an older entry with the same key keep their data
+    wxString tmp_fname = fname + ".tmp";
+    if (!GdaWeightsBinary::Write(tmp_fname, w, id_field, id_fp,
+                                 is_symmetric) ||
+        !wxRenameFile(tmp_fname, fname, true)) {
+        wxLogMessage("WeightsCache: can't write %s", fname);
+        wxRemoveFile(tmp_fname);
+        return false;
+    }
+
+    std::map<wxString, LruList::iterator>::iterator it = entries.find(key);
+    if (it != entries.end()) {
+        total_bytes -= it->second->bytes;
+        lru.erase(it->second);
+        entries.erase(it);
+    }
+    CacheEntry e;
+    e.key = key;
+    e.file_id = file_id;
+    e.bytes = wxFileName(fname).GetSize().GetValue();
+    lru.push_front(e);
+    entries[key] = lru.begin();
+    total_bytes += e.bytes;
+
+    Evict((boost::uint64_t) GdaConst::gda_weights_cache_mb * 1024 * 1024);
+    SaveIndex();
+    return true;
+}
+
+void WeightsCache::Remove(const wxString& key)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    std::map<wxString, LruList::iterator>::iterator it = entries.find(key);
+    if (it == entries.end()) return;
+    RemoveEntry(it->second);
+    SaveIndex();
+}
+
+void WeightsCache::Clear()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while (!lru.empty()) RemoveEntry(lru.begin());
+    SaveIndex();
+}
+
+wxString WeightsCache::GetStats() const
+{
+    wxString s;
+    s << hits << " hits, " << misses << " misses, " << lru.size();
+    s << " entries, " << (total_bytes / 1024) << " KB";
+    return s;
+}
@@ -0,0 +1,130 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_WEIGHTS_CACHE_H__
+#define __GEODA_CENTER_WEIGHTS_CACHE_H__
+
+#include <list>
+#include <map>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include <wx/string.h>
+
+#include "../VarCalc/WeightsMetaInfo.h"
+
+class CsrWeight;
+class Project;
+class TableInterface;
+
+/**
+ WeightsCache keeps weights as GeoDa binary weights files (.gwb) in a
+ "weights_cache" directory next to the GdaCache database, so weights that
+ were parsed or built once are mapped back in milliseconds.
+
+ An entry is found by a key string that describes everything the weights
+ were made from: the fingerprint of a weights file (path, size and
+ modification time), or the fingerprint of the geometries of the layer
+ (datasource, size, modification time, number of features and a hash of
+ all coordinates) together with the WeightsMetaInfo used to build them.
+ Any change of the layer or the file changes the key, so stale entries are
+ never found; they are dropped by the LRU eviction once the cache is
+ larger than GdaConst::gda_weights_cache_mb.  A size of 0 turns the cache
+ off.
+
+ \code
+ wxString key = WeightsCache::FileKey(fname, id_var);
+ CsrWeight* w = WeightsCache::GetInstance().Get(key, table_int);
+ if (w == NULL) {
+     // read or build the weights, then
+     WeightsCache::GetInstance().Put(key, csr, id_var, table_int, false);
+ }
+ \endcode
+ */
+class WeightsCache
+{
+public:
+    static WeightsCache& GetInstance() {
+        static WeightsCache instance;
+        return instance;
+    }
+
+    /** key of the weights read from a weights file */
+    static wxString FileKey(const wxString& fname, const wxString& id_var);
+    /** key of the weights built from the geometries of the project; the
+     key of contiguity weights includes the builder chosen by
+     GdaConst::gda_use_hash_contiguity */
+    static wxString GeomKey(Project* project, const WeightsMetaInfo& wmi,
+                            double precision_threshold = 0);
+
+    /** path, size and modification time of a file */
+    static wxString FileFingerprint(const wxString& fname);
+    /** datasource, number of features and a hash of the coordinates */
+    static wxString GeomFingerprint(Project* project);
+    /** all fields of wmi that change the neighbors or the weights */
+    static wxString MetaInfoFingerprint(const WeightsMetaInfo& wmi);
+
+    /** The cached weights of key, mapped from the cache file, or NULL.  If
+     table_int is given, the number of rows and the ids are checked as
+     for any .gwb file and a mismatching entry is dropped. */
+    CsrWeight* Get(const wxString& key, TableInterface* table_int = NULL);
+
+    /** Store w under key, replacing an older entry, and evict the least
+     recently used entries beyond the size cap. */
+    bool Put(const wxString& key, const CsrWeight& w,
+             const wxString& id_field = wxEmptyString,
+             TableInterface* table_int = NULL, bool is_symmetric = false);
+
+    void Remove(const wxString& key);
+    void Clear();
+
+    size_t GetHits() const { return hits; }
+    size_t GetMisses() const { return misses; }
+    size_t GetNumEntries() const { return lru.size(); }
+    boost::uint64_t GetSize() const { return total_bytes; }
+    /** hits, misses, entries and size, for the log */
+    wxString GetStats() const;
+
+protected:
+    WeightsCache();
+
+    struct CacheEntry {
+        wxString key;
+        wxString file_id; // hash of the key, name of the .gwb file
+        boost::uint64_t bytes;
+    };
+    typedef std::list<CacheEntry> LruList;
+
+    wxString GetFilePath(const wxString& file_id) const;
+    void LoadIndex();
+    void SaveIndex() const;
+    // drop entries from the back of lru until the cache fits in max_bytes
+    void Evict(boost::uint64_t max_bytes);
+    void RemoveEntry(LruList::iterator it);
+
+    boost::mutex mutex;
+    wxString cache_dir;
+    // most recently used first; the index file keeps the same order
+    LruList lru;
+    std::map<wxString, LruList::iterator> entries;
+    boost::uint64_t total_bytes;
+    size_t hits;
+    size_t misses;
+};
+
+#endif
@@ -30,8 +30,11 @@
 #include "WeightsManState.h"
 #include "GeodaWeight.h"
 #include "GalWeight.h"
+#include "CsrWeight.h"
 #include "GwtWeight.h"
 #include "WeightUtils.h"
+#include "WeightsCache.h"
+#include "../io/weights_binary.h"
 #include "WeightsManager.h"
 #include "../Project.h"
 #include "../SaveButtonManager.h"
@@ -53,6 +56,10 @@ WeightsNewManager::~WeightsNewManager()
             delete e.gal_weight;
             e.gal_weight = NULL;
         }
+        if (e.csr_weight) {
+            delete e.csr_weight;
+            e.csr_weight = NULL;
+        }
         if (e.geoda_weight) {
             delete e.geoda_weight;
             e.geoda_weight = NULL;
@@ -115,12 +122,74 @@ bool WeightsNewManager::AssociateGal(boost::uuids::uuid w_uuid, GalWeight* gw)
 	if (it->second.gal_weight != 0) {
 		delete it->second.gal_weight; it->second.gal_weight = 0;
 	}
+	if (it->second.csr_weight != 0) {
+		delete it->second.csr_weight; it->second.csr_weight = 0;
+	}
 	it->second.gal_weight = gw;
 	if (w_man_state) w_man_state->notifyObservers();
 	return true;
 }
 
+/**
+ As AssociateGal, for weights opened as CSR, e.g. a mapped .gwb file.  The
+ GAL copy is left to GetGal(), so it is only built if a consumer needs it.
+ WeightsNewManager assumes ownership of CsrWeight!
+ */
+bool WeightsNewManager::AssociateCsr(boost::uuids::uuid w_uuid, CsrWeight* cw)
+{
+	EmType::iterator it = entry_map.find(w_uuid);
+	if (it == entry_map.end()) return false;
+	if (it->second.gal_weight != 0) {
+		delete it->second.gal_weight; it->second.gal_weight = 0;
+	}
+	if (it->second.csr_weight != 0) {
+		delete it->second.csr_weight; it->second.csr_weight = 0;
+	}
+	cw->title = it->second.wpte.title;
+	it->second.csr_weight = cw;
+	if (w_man_state) w_man_state->notifyObservers();
+	return true;
+}
+
 
+bool WeightsNewManager::SaveBinary(boost::uuids::uuid w_uuid,
+								   const wxString& fname)
+{
+	EmType::iterator it = entry_map.find(w_uuid);
+	if (it == entry_map.end()) return false;
+	const WeightsMetaInfo& wmi = it->second.wpte.wmi;
+	wxString ext = wxFileName(wmi.filename).GetExt().Lower();
+	if (it->second.gal_weight == 0 &&
+		(ext == "gal" || ext == "gwt" || ext == "kwt" || ext == "swm")) {
+		// not opened yet: straight from the file, without building a GAL
+		return WeightUtils::ConvertToBinary(wmi.filename, fname, table_int);
+	}
+	if (ext == "gwb") {
+		CsrWeight* cw = GetCsr(w_uuid);
+		if (!cw) return false;
+		try {
+			return GdaWeightsBinary::Write(fname, *cw, wmi.id_var,
+				GdaWeightsBinary::IdFingerprint(table_int, wmi.id_var),
+				cw->symmetry_checked && cw->is_symmetric);
+		} catch (std::exception& ex) {
+			wxLogMessage("WeightsNewManager::SaveBinary(): %s", ex.what());
+		}
+		return false;
+	}
+	GalWeight* gw = GetGal(w_uuid);
+	if (!gw || !gw->gal) return false;
+	
+	CsrWeight w(gw->gal, gw->num_obs, true);
+	try {
+		boost::uint64_t fp = GdaWeightsBinary::IdFingerprint(table_int,
+															 wmi.id_var);
+		return GdaWeightsBinary::Write(fname, w, wmi.id_var, fp,
+									   wmi.sym_type == WeightsMetaInfo::SYM_symmetric);
+	} catch (std::exception& ex) {
+		wxLogMessage("WeightsNewManager::SaveBinary(): %s", ex.what());
+	}
+	return false;
+}
 
 void WeightsNewManager::GetIds(std::vector<boost::uuids::uuid>& ids,
                                bool allow_internal_weights) const
@@ -234,14 +303,17 @@ WeightsNewManager::CheckSym(boost::uuids::uuid w_uuid, ProgressDlg* p_dlg)
 	EmType::iterator it = entry_map.find(w_uuid);
 	if (it == entry_map.end()) return WeightsMetaInfo::SYM_unknown;
 	Entry& e = it->second;
-	GalWeight* w = GetGal(w_uuid);
-	if (w == 0 || w->gal == 0) {
+	CsrWeight* w = GetCsr(w_uuid);
+	if (w == 0) {
 		e.wpte.wmi.sym_type = WeightsMetaInfo::SYM_unknown;
-	} else if (GdaWeightsTools::CheckGalSymmetry(w, p_dlg)) {
-		e.wpte.wmi.sym_type = WeightsMetaInfo::SYM_symmetric;
 	} else {
-		e.wpte.wmi.sym_type = WeightsMetaInfo::SYM_asymmetric;
+		size_t n_asym = w->CountAsymmetric();
+		wxLogMessage("WeightsNewManager::CheckSym(): %d asymmetric pairs",
+					 (int) n_asym);
+		e.wpte.wmi.sym_type = (n_asym == 0 ? WeightsMetaInfo::SYM_symmetric :
+							   WeightsMetaInfo::SYM_asymmetric);
 	}
+	if (p_dlg) p_dlg->ValueUpdate(1);
 	// if (w_man_state) w_man_state->notifyObservers();
 	// should notify SaveButtonManager that meta-data changed.
 	return e.wpte.wmi.sym_type;
@@ -262,20 +334,20 @@ bool WeightsNewManager::Lag(boost::uuids::uuid w_uuid, const GdaFlexValue& data,
 		result = data;
 		return true;
 	}
-	GalWeight* gw = GetGal(w_uuid);
-	if (!gw || !gw->gal || !(gw->num_obs = data.GetObs())) {
+	CsrWeight* cw = GetCsr(w_uuid);
+	if (!cw || cw->GetNumObs() != data.GetObs()) {
 		return false;
 	}
-	GalElement* W = gw->gal;
 	const std::valarray<double>& x = data.GetConstValArrayRef();
 	result.SetSize(data.GetObs(), data.GetTms());
 	std::valarray<double>& y = result.GetValArrayRef();
 	for (size_t t=0, tms=data.GetTms(); t<tms; ++t) {
 		for (size_t i=0, obs=data.GetObs(); i<obs; ++i) {
 			double s = 0;
-			size_t nbrs = W[i].Size();
+			size_t nbrs = cw->GetNumNbrs(i);
+			const int* nb = cw->GetNbrs(i);
 			for (size_t n=0; n<nbrs; ++n) {
-				s += x[W[i][n]*tms+t];
+				s += x[nb[n]*tms+t];
 			}
 			y[i*tms+t] = s / ((double) nbrs);
 		}
@@ -323,6 +395,7 @@ void WeightsNewManager::Remove(boost::uuids::uuid w_uuid)
 	EmType::iterator it = entry_map.find(w_uuid);
 	if (it == entry_map.end()) return;
 	if (it->second.gal_weight) delete it->second.gal_weight;
+	if (it->second.csr_weight) delete it->second.csr_weight;
 	entry_map.erase(it);
 	for (std::list<boost::uuids::uuid>::iterator it=uuid_order.begin();
 		 it != uuid_order.end(); ++it) {
@@ -388,14 +461,44 @@ GalWeight* WeightsNewManager::GetGal(boost::uuids::uuid w_uuid)
 	// Load file for first use
 	wxFileName t_fn(e.wpte.wmi.filename);
 	wxString ext = t_fn.GetExt().Lower();
-	if (ext != "gal" && ext != "gwt" && ext != "kwt") {
+	if (ext != "gal" && ext != "gwt" && ext != "kwt" && ext != "gwb") {
 		return 0;
 	}
 	GalElement* gal=0;
-	if (ext == "gal") {
-		gal = WeightUtils::ReadGal(e.wpte.wmi.filename, table_int);
-	} else { // ext == "gwt"
-		gal = WeightUtils::ReadGwtAsGal(e.wpte.wmi.filename, table_int);
+	if (ext == "gwb") {
+		CsrWeight* cw = GetCsr(w_uuid);
+		if (cw) gal = cw->ToGal();
+	} else {
+		// a text weights file is parsed once, later sessions map the
+		// binary copy from the weights cache
+		WeightsCache& cache = WeightsCache::GetInstance();
+		wxString key = WeightsCache::FileKey(e.wpte.wmi.filename,
+											 e.wpte.wmi.id_var);
+		CsrWeight* cw = cache.Get(key, table_int);
+		if (cw) {
+			gal = cw->ToGal();
+			if (e.csr_weight == 0) {
+				cw->wflnm = e.wpte.wmi.filename;
+				cw->title = e.wpte.title;
+				e.csr_weight = cw;
+			} else {
+				delete cw;
+			}
+		} else {
+			cw = WeightUtils::ReadAsCsr(e.wpte.wmi.filename, table_int);
+			if (cw != 0) {
+				gal = cw->ToGal();
+				cache.Put(key, *cw, e.wpte.wmi.id_var, table_int,
+						  e.wpte.wmi.sym_type == WeightsMetaInfo::SYM_symmetric);
+				if (e.csr_weight == 0) {
+					cw->wflnm = e.wpte.wmi.filename;
+					cw->title = e.wpte.title;
+					e.csr_weight = cw;
+				} else {
+					delete cw;
+				}
+			}
+		}
 	}
 	if (gal != 0) {
 		GalWeight* w = new GalWeight();
@@ -409,6 +512,36 @@ GalWeight* WeightsNewManager::GetGal(boost::uuids::uuid w_uuid)
 	return e.gal_weight;
 }
 
+/** Binary CSR copy of GetGal(), built on first use.  Lag() runs on it
+ instead of walking the GalElement vectors. */
+CsrWeight* WeightsNewManager::GetCsr(boost::uuids::uuid w_uuid)
+{
+	EmType::iterator it = entry_map.find(w_uuid);
+	if (it == entry_map.end()) return 0;
+	Entry& e = it->second;
+	if (e.csr_weight) return e.csr_weight;
+	wxFileName t_fn(e.wpte.wmi.filename);
+	if (t_fn.GetExt().Lower() == "gwb") {
+		// mapped straight from the file, ids checked against the table
+		try {
+			e.csr_weight = GdaWeightsBinary::Read(e.wpte.wmi.filename,
+												  table_int);
+			e.csr_weight->title = e.wpte.title;
+		} catch (std::exception& ex) {
+			wxLogMessage("WeightsNewManager::GetCsr(): %s", ex.what());
+		}
+		return e.csr_weight;
+	}
+	GalWeight* gw = GetGal(w_uuid);
+	if (!gw || !gw->gal) return 0;
+	CsrWeight* w = new CsrWeight(gw->gal, gw->num_obs);
+	w->wflnm = gw->wflnm;
+	w->id_field = gw->id_field;
+	w->title = gw->title;
+	e.csr_weight = w;
+	return e.csr_weight;
+}
+
 GeoDaWeight* WeightsNewManager::GetWeights(boost::uuids::uuid w_uuid)
 {
 	EmType::iterator it = entry_map.find(w_uuid);
@@ -418,7 +551,7 @@ GeoDaWeight* WeightsNewManager::GetWeights(boost::uuids::uuid w_uuid)
     
     wxFileName t_fn(tmpName);
     wxString ext = t_fn.GetExt().Lower();
-    if (ext != "gal" && ext != "gwt" && ext != "kwt") {
+    if (ext != "gal" && ext != "gwt" && ext != "kwt" && ext != "gwb") {
         return 0;
     }
     
@@ -427,7 +560,12 @@ GeoDaWeight* WeightsNewManager::GetWeights(boost::uuids::uuid w_uuid)
 	
 	// Load file for first use
 	
-	if (ext == "gal") {
+	if (ext == "gwb") {
+        // shares the mapped file with the cached CSR
+        CsrWeight* cw = GetCsr(w_uuid);
+        if (cw) e.geoda_weight = new CsrWeight(*cw);
+        
+	} else if (ext == "gal") {
         GalElement* gal = WeightUtils::ReadGal(e.wpte.wmi.filename, table_int);
     	if (gal != 0) {
     		GalWeight* w = new GalWeight();
@@ -606,84 +744,57 @@ bool GdaWeightsTools::CheckWeightSymmetry(GeoDaWeight* w, ProgressDlg* p_dlg)
 	if (!w->symmetry_checked) {
 		if (w->weight_type == GeoDaWeight::gal_type) {
 			w->is_symmetric = CheckGalSymmetry((GalWeight*) w, p_dlg);
-		} else {
+		} else if (w->weight_type == GeoDaWeight::gwt_type) {
 			w->is_symmetric = CheckGwtSymmetry((GwtWeight*) w, p_dlg);
+		} else if (w->weight_type == GeoDaWeight::csr_type) {
+			w->is_symmetric = CheckCsrSymmetry((CsrWeight*) w, p_dlg);
 		}
 		w->symmetry_checked = true;
 	}
 	return w->is_symmetric;
 }
 
+/** W is compared with its transpose over CSR, see
+ CsrWeight::CountAsymmetric() */
 bool GdaWeightsTools::CheckGalSymmetry(GalWeight* w, ProgressDlg* p_dlg)
 {
-    int obs = w->num_obs;
-	int update_ival = (obs > 100 ? obs/100 : 1);
-	
-	GalElement* gal = w->gal;
-	int tenth = std::max(1, obs/10);
-	for (int i=0; i<obs; i++) {
-		if (p_dlg && (i % tenth == 0)) {
-			p_dlg->ValueUpdate(i/ (double) obs);
-		}
-		const GalElement& elm_i = gal[i];
-		// for each neighbor j of i, check that i is a neighbor of j
-		for (int j=0, sz_i=elm_i.Size(); j<sz_i; j++) {
-			bool found = false;
-			const GalElement& elm_j = gal[elm_i[j]];
-			long sz_j = elm_j.Size();
-			int k = 0;
-			while (!found && k < sz_j) {
-				if (elm_j[k++] == i) found = true;
-			}
-			if (!found) {
-				p_dlg->ValueUpdate(1);
-                
-				return false;
-			}
-		}
-	}
-	p_dlg->ValueUpdate(1);
-	return true;
+	CsrWeight csr(w->gal, w->num_obs);
+	bool is_sym = csr.CountAsymmetric() == 0;
+	if (p_dlg) p_dlg->ValueUpdate(1);
+	return is_sym;
 }
 
 bool GdaWeightsTools::CheckGwtSymmetry(GwtWeight* w, ProgressDlg* p_dlg)
 {
 	int obs = w->num_obs;
-	int update_ival = (obs > 100 ? obs/100 : 1);
-	
-	GwtElement* gwt = w->gwt;
-	int tenth = std::max(1, obs/10);
+	std::vector<std::vector<int> > nbr_lists(obs);
 	for (int i=0; i<obs; i++) {
-		if (p_dlg && (i % tenth == 0)) {
-			p_dlg->ValueUpdate(i/ (double) obs);
-		}
-		GwtNeighbor* data_i = gwt[i].dt();
-		long size_i = gwt[i].Size();
-		// for each neighbor j of i, check that i is a neighbor of j
-		for (int j=0; j<size_i; j++) {
-			bool found = false;
-			long size_j = gwt[data_i[j].nbx].Size();
-			GwtNeighbor* data_j = gwt[data_i[j].nbx].dt();
-			int k = 0;
-			while (!found && k < size_j) {
-				if (data_j[k++].nbx == i) found = true;
-			}
-			if (!found) {
-				p_dlg->ValueUpdate(1);
-				return false;
-			}
-		}
+		GwtNeighbor* data_i = w->gwt[i].dt();
+		long size_i = w->gwt[i].Size();
+		nbr_lists[i].resize(size_i);
+		for (long j=0; j<size_i; j++) nbr_lists[i][j] = data_i[j].nbx;
 	}
-	p_dlg->ValueUpdate(1);
-	return true;
+	CsrWeight csr(nbr_lists, std::vector<std::vector<double> >());
+	bool is_sym = csr.CountAsymmetric() == 0;
+	if (p_dlg) p_dlg->ValueUpdate(1);
+	return is_sym;
+}
+
+bool GdaWeightsTools::CheckCsrSymmetry(CsrWeight* w, ProgressDlg* p_dlg)
+{
+	bool is_sym = w->CountAsymmetric() == 0;
+	if (p_dlg) p_dlg->ValueUpdate(1);
+	return is_sym;
 }
 
 void GdaWeightsTools::DumpWeight(GeoDaWeight* w)
 {
 	if (w->weight_type == GeoDaWeight::gal_type) {
 		DumpGal((GalWeight*) w);
-	} else {
+	} else if (w->weight_type == GeoDaWeight::gwt_type) {
 		DumpGwt((GwtWeight*) w);
+	} else if (w->weight_type == GeoDaWeight::csr_type) {
+		DumpCsr((CsrWeight*) w);
 	}
 }
 
@@ -715,3 +826,21 @@ void GdaWeightsTools::DumpGwt(GwtWeight* w)
 	}
 }
 
+void GdaWeightsTools::DumpCsr(CsrWeight* w)
+{
+	int obs = w->num_obs;
+	for (int i=0; i<obs; i++) {
+		const int* nbrs = w->GetNbrs(i);
+		const double* vals = w->GetValues(i);
+		wxString msg("");
+		msg << i << ":";
+		for (int j=0, jend=w->GetNumNbrs(i); j<jend; j++) {
+			if (vals) {
+				msg << " (" << nbrs[j] << ", " << vals[j] << ")";
+			} else {
+				msg << " " << nbrs[j];
+			}
+		}
+	}
+}
+
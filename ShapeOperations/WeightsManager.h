@@ -27,6 +27,7 @@
 #include "../VarCalc/WeightsManInterface.h"
 class GeoDaWeight;
 class GalWeight;
+class CsrWeight;
 class GwtWeight;
 class GalElement;
 class GwtElement;
@@ -45,6 +46,9 @@ public:
 	void Init(const std::list<WeightsPtreeEntry>& entries);
 	std::list<WeightsPtreeEntry> GetPtreeEntries() const;
 	bool AssociateGal(boost::uuids::uuid w_uuid, GalWeight* gw);
+	bool AssociateCsr(boost::uuids::uuid w_uuid, CsrWeight* cw);
+	/** Save the weights as a GeoDa binary weights file (.gwb) */
+	bool SaveBinary(boost::uuids::uuid w_uuid, const wxString& fname);
 	
 	// Implementation of WeightsManInterface
 	virtual void GetIds(std::vector<boost::uuids::uuid>& ids,
@@ -71,6 +75,7 @@ public:
 	virtual void Remove(boost::uuids::uuid w_uuid);
 	virtual wxString RecNumToId(boost::uuids::uuid w_uuid, long rec_num);
 	virtual GalWeight* GetGal(boost::uuids::uuid w_uuid);
+	virtual CsrWeight* GetCsr(boost::uuids::uuid w_uuid);
 	virtual GeoDaWeight* GetWeights(boost::uuids::uuid w_uuid);
 	virtual boost::uuids::uuid GetDefault() const;
 	virtual void MakeDefault(boost::uuids::uuid w_uuid);
@@ -85,10 +90,11 @@ public:
     
 private:
 	struct Entry {
-		Entry() : gal_weight(0), geoda_weight(0) {}
-		Entry(const WeightsPtreeEntry& e) : gal_weight(0), geoda_weight(0), wpte(e) {}
+		Entry() : gal_weight(0), csr_weight(0), geoda_weight(0) {}
+		Entry(const WeightsPtreeEntry& e) : gal_weight(0), csr_weight(0), geoda_weight(0), wpte(e) {}
 		WeightsPtreeEntry wpte;
 		GalWeight* gal_weight;
+		CsrWeight* csr_weight; // binary copy of gal_weight, or a mapped .gwb
         GeoDaWeight* geoda_weight;
 		std::vector<wxString> rec_num_to_id;
 	};
@@ -112,8 +118,10 @@ namespace GdaWeightsTools {
 	
 	bool CheckGalSymmetry(GalWeight* w, ProgressDlg* p_dlg=0);
 	bool CheckGwtSymmetry(GwtWeight* w, ProgressDlg* p_dlg=0);
+	bool CheckCsrSymmetry(CsrWeight* w, ProgressDlg* p_dlg=0);
 	void DumpGal(GalWeight* w);
 	void DumpGwt(GwtWeight* w);
+	void DumpCsr(CsrWeight* w);
 }
 
 #endif
@@ -18,7 +18,9 @@
  */
 #include <math.h>
 #include <wx/wx.h>
+#include <algorithm>
 #include <fstream>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/random.hpp>
 #include <boost/random/uniform_01.hpp>
@@ -30,9 +32,12 @@
 
 #include "PointSetAlgs.h"
 #include "GenGeomAlgs.h"
+#include "GdaConst.h"
+#include "GdaThreadPool.h"
 #include "SpatialIndAlgs.h"
 #include "VarCalc/NumericTests.h"
 #include "ShapeOperations/OGRLayerProxy.h"
+#include "Weights/GridNeighbors.h"
 #include "Explore/MapLayer.hpp"
 #include "Project.h"
 #include "GdaException.h"
@@ -252,6 +257,143 @@ void SpatialIndAlgs::apply_kernel(const GwtWeight* Wp, const wxString& kernel, b
     }
 }
 
+namespace {
+	/** options shared by the rows of one knn_build */
+	struct KnnRowParams {
+		int k; // neighbors to query, the point itself included
+		bool keep_self; // true for kernel weights
+		bool is_inverse;
+		double power;
+		bool adaptive; // divide each row by its largest distance
+		bool is_arc;
+		bool is_mi;
+	};
+	
+	/** Query the neighbors of vals[first..last] and fill their rows of Wp.
+	 row_max[obs] gets the largest distance of the row, which is what the
+	 serial loop used to track for the max knn bandwidth. */
+	void knn_rows_2d(const rtree_pt_2d_t* rtree,
+					 const vector<pt_2d_val>* vals,
+					 const KnnRowParams* p, GwtWeight* Wp,
+					 vector<double>* row_max, int first, int last)
+	{
+		vector<pt_2d_val> q;
+		for (int i=first; i<=last; i++) {
+			const pt_2d_val& v = (*vals)[i];
+			size_t obs = v.second;
+			q.clear();
+			rtree->query(bgi::nearest(v.first, p->k), std::back_inserter(q));
+			GwtElement& e = Wp->gwt[obs];
+			e.alloc(q.size());
+			double local_bandwidth = 0;
+			BOOST_FOREACH(pt_2d_val const& w, q) {
+				if (!p->keep_self && w.second == v.second)
+					continue;
+				GwtNeighbor neigh;
+				neigh.nbx = w.second;
+				double d = bg::distance(v.first, w.first);
+				if (d > local_bandwidth) local_bandwidth = d;
+				if (p->is_inverse) d = pow(d, p->power);
+				neigh.weight =  d;
+				e.Push(neigh);
+			}
+			if (p->adaptive && local_bandwidth > 0 && p->keep_self) {
+				GwtNeighbor* nbrs = e.dt();
+				for (int j=0; j<e.Size(); j++) {
+					nbrs[j].weight = nbrs[j].weight / local_bandwidth;
+				}
+			}
+			(*row_max)[obs] = local_bandwidth;
+		}
+	}
+	
+	void knn_rows_3d(const rtree_pt_3d_t* rtree,
+					 const vector<pt_3d_val>* vals,
+					 const KnnRowParams* p, GwtWeight* Wp,
+					 vector<double>* row_max, int first, int last)
+	{
+		using namespace GenGeomAlgs;
+		vector<pt_3d_val> q;
+		for (int i=first; i<=last; i++) {
+			const pt_3d_val& v = (*vals)[i];
+			size_t obs = v.second;
+			q.clear();
+			rtree->query(bgi::nearest(v.first, p->k), std::back_inserter(q));
+			GwtElement& e = Wp->gwt[obs];
+			e.alloc(q.size());
+			double lon_v, lat_v;
+			double x_v, y_v;
+			if (p->is_arc) {
+				UnitToLongLatDeg(bg::get<0>(v.first), bg::get<1>(v.first),
+								 bg::get<2>(v.first), lon_v, lat_v);
+			} else {
+				x_v = bg::get<0>(v.first);
+				y_v = bg::get<1>(v.first);
+			}
+			double local_bandwidth = 0;
+			BOOST_FOREACH(pt_3d_val const& w, q) {
+				if (!p->keep_self && w.second == v.second)
+					continue;
+				GwtNeighbor neigh;
+				neigh.nbx = w.second;
+				if (p->is_arc) {
+					double lon_w, lat_w;
+					UnitToLongLatDeg(bg::get<0>(w.first), bg::get<1>(w.first),
+									 bg::get<2>(w.first), lon_w, lat_w);
+					if (p->is_mi) {
+						neigh.weight = ComputeArcDistMi(lon_v, lat_v, lon_w, lat_w);
+					} else {
+						neigh.weight = ComputeArcDistKm(lon_v, lat_v, lon_w, lat_w);
+					}
+				} else {
+					neigh.weight = ComputeEucDist(x_v, y_v,
+												  bg::get<0>(w.first),
+												  bg::get<1>(w.first));
+				}
+				if (p->is_inverse) neigh.weight = pow(neigh.weight, p->power);
+				if (neigh.weight > local_bandwidth)
+					local_bandwidth = neigh.weight;
+				e.Push(neigh);
+			}
+			if (p->adaptive && local_bandwidth > 0 && p->keep_self) {
+				GwtNeighbor* nbrs = e.dt();
+				for (int j=0; j<e.Size(); j++) {
+					nbrs[j].weight = nbrs[j].weight / local_bandwidth;
+				}
+			}
+			(*row_max)[obs] = local_bandwidth;
+		}
+	}
+	
+	/** divide all weights by the max knn distance, then apply the kernel */
+	void knn_finish_kernel(GwtWeight* Wp, const vector<double>& row_max,
+						   const wxString& kernel, double bandwidth_,
+						   bool adaptive_bandwidth, bool use_kernel_diagnals)
+	{
+		if (kernel.IsEmpty()) return;
+		double bandwidth = bandwidth_;
+		if (bandwidth_ == 0) {
+			for (size_t i=0; i<row_max.size(); i++) {
+				if (row_max[i] > bandwidth) bandwidth = row_max[i];
+			}
+		}
+		if (!adaptive_bandwidth && bandwidth > 0) {
+			// use max knn distance as bandwidth
+			for (int i=0; i<Wp->num_obs; i++) {
+				GwtElement& e = Wp->gwt[i];
+				GwtNeighbor* nbrs = e.dt();
+				for (int j=0; j<e.Size(); j++) {
+					nbrs[j].weight = nbrs[j].weight / bandwidth;
+				}
+			}
+		}
+		SpatialIndAlgs::apply_kernel(Wp, kernel, use_kernel_diagnals);
+	}
+}
+
+/** The rows are independent: the queries run in parallel on the shared,
+ read-only rtree and every job writes only the GwtElement rows of its own
+ points. */
 GwtWeight* SpatialIndAlgs::knn_build(const rtree_pt_2d_t& rtree, int nn, bool is_inverse, double power, const wxString& kernel, double bandwidth_, bool adaptive_bandwidth_, bool use_kernel_diagnals)
 {
 	GwtWeight* Wp = new GwtWeight;
@@ -260,59 +402,25 @@ GwtWeight* SpatialIndAlgs::knn_build(const rtree_pt_2d_t& rtree, int nn, bool is
 	Wp->symmetry_checked = true;
 	Wp->gwt = new GwtElement[Wp->num_obs];
 	
-	int cnt=0;
-	const int k=nn+1;
-    double bandwidth = bandwidth_;
-    bool adaptive_bandwidth = adaptive_bandwidth_;
-
-	for (rtree_pt_2d_t::const_query_iterator it =
-			 rtree.qbegin(bgi::intersects(rtree.bounds()));
-		 it != rtree.qend() ; ++it)
-	{
-		const pt_2d_val& v = *it;
-		size_t obs = v.second;
-        // each point "v" with index "obs"
-		vector<pt_2d_val> q;
-		rtree.query(bgi::nearest(v.first, k), std::back_inserter(q));
-		GwtElement& e = Wp->gwt[obs];
-		e.alloc(q.size());
-        double local_bandwidth = 0;
-		BOOST_FOREACH(pt_2d_val const& w, q) {
-			if (kernel.IsEmpty() && w.second == v.second)
-                continue;
-			GwtNeighbor neigh;
-			neigh.nbx = w.second;
-            double d = bg::distance(v.first, w.first);
-            if (bandwidth_ ==0 && d > bandwidth) bandwidth = d;
-            if (d > local_bandwidth) local_bandwidth = d;
-            if (is_inverse) d = pow(d, power);
-            neigh.weight =  d;
-			e.Push(neigh);
-			++cnt;
-		}
-        if (adaptive_bandwidth && local_bandwidth > 0 && !kernel.IsEmpty()) {
-            GwtNeighbor* nbrs = e.dt();
-            for (int j=0; j<e.Size(); j++) {
-                nbrs[j].weight = nbrs[j].weight / local_bandwidth;
-            }
-        }
-	}
-
-    if (!adaptive_bandwidth && bandwidth > 0 && !kernel.IsEmpty()) {
-        // use max knn distance as bandwidth
-        for (int i=0; i<Wp->num_obs; i++) {
-            GwtElement& e = Wp->gwt[i];
-            GwtNeighbor* nbrs = e.dt();
-            for (int j=0; j<e.Size(); j++) {
-                nbrs[j].weight = nbrs[j].weight / bandwidth;
-            }
-        }
-    }
-    if (!kernel.IsEmpty()) {
-        
-        apply_kernel(Wp, kernel, use_kernel_diagnals);
-    }
-    
+	vector<pt_2d_val> vals;
+	vals.reserve(rtree.size());
+	rtree.query(bgi::intersects(rtree.bounds()), std::back_inserter(vals));
+	
+	KnnRowParams p;
+	p.k = nn+1;
+	p.keep_self = !kernel.IsEmpty();
+	p.is_inverse = is_inverse;
+	p.power = power;
+	p.adaptive = adaptive_bandwidth_;
+	p.is_arc = false;
+	p.is_mi = false;
+	vector<double> row_max(Wp->num_obs, 0);
+	GdaThreadPool::GetInstance().ParallelFor(vals.size(),
+		boost::bind(&knn_rows_2d, &rtree, &vals, &p, Wp, &row_max, _1, _2),
+		GdaThreadPool::query_chunk_size);
+	
+	knn_finish_kernel(Wp, row_max, kernel, bandwidth_, adaptive_bandwidth_,
+					  use_kernel_diagnals);
 	return Wp;
 }
 
@@ -320,7 +428,6 @@ GwtWeight* SpatialIndAlgs::knn_build(const rtree_pt_3d_t& rtree, int nn,
 					 bool is_arc, bool is_mi,  bool is_inverse, double power, const wxString& kernel, double bandwidth_, bool adaptive_bandwidth_, bool use_kernel_diagnals)
 {
 	wxStopWatch sw;
-	using namespace GenGeomAlgs;
 
 	GwtWeight* Wp = new GwtWeight;
 	Wp->num_obs = rtree.size();
@@ -328,84 +435,29 @@ GwtWeight* SpatialIndAlgs::knn_build(const rtree_pt_3d_t& rtree, int nn,
 	Wp->symmetry_checked = true;
 	Wp->gwt = new GwtElement[Wp->num_obs];
 	
-	int cnt=0;
-	const int k=nn+1;
-    double bandwidth = bandwidth_;
-    bool adaptive_bandwidth = adaptive_bandwidth_;
-    // if not set,  use max knn distance as bandwidth
-    
-	for (rtree_pt_3d_t::const_query_iterator it =
-			 rtree.qbegin(bgi::intersects(rtree.bounds()));
-		 it != rtree.qend() ; ++it)
-	{
-		const pt_3d_val& v = *it;
-		size_t obs = v.second;		
-		vector<pt_3d_val> q;
-		rtree.query(bgi::nearest(v.first, k), std::back_inserter(q));
-		GwtElement& e = Wp->gwt[obs];
-		e.alloc(q.size());
-		double lon_v, lat_v;
-		double x_v, y_v;
-		if (is_arc) {
-			UnitToLongLatDeg(bg::get<0>(v.first), bg::get<1>(v.first),
-							 bg::get<2>(v.first), lon_v, lat_v);
-		} else {
-			x_v = bg::get<0>(v.first);
-			y_v = bg::get<1>(v.first);
-		}
-        double local_bandwidth = 0;
-		BOOST_FOREACH(pt_3d_val const& w, q) {
-			if (kernel.IsEmpty() && w.second == v.second)
-                continue;
-			GwtNeighbor neigh;
-			neigh.nbx = w.second;
-			if (is_arc) {
-				double lon_w, lat_w;
-				UnitToLongLatDeg(bg::get<0>(w.first), bg::get<1>(w.first),
-								 bg::get<2>(w.first), lon_w, lat_w);
-				if (is_mi) {
-					neigh.weight = ComputeArcDistMi(lon_v, lat_v, lon_w, lat_w);
-				} else {
-					neigh.weight = ComputeArcDistKm(lon_v, lat_v, lon_w, lat_w);
-				}
-			} else {
-				//neigh.weight = bg::distance(v.first, w.first);
-				neigh.weight = ComputeEucDist(x_v, y_v,
-											  bg::get<0>(w.first),
-                                              bg::get<1>(w.first));
-			}
-            if (is_inverse) neigh.weight = pow(neigh.weight, power);
-            
-            if (bandwidth_ == 0 && neigh.weight > bandwidth)
-                bandwidth = neigh.weight;
-            if (neigh.weight > local_bandwidth)
-                local_bandwidth = neigh.weight;
-           
-			e.Push(neigh);
-			++cnt;
-		}
-        if (adaptive_bandwidth && local_bandwidth > 0 && !kernel.IsEmpty()) {
-            GwtNeighbor* nbrs = e.dt();
-            for (int j=0; j<e.Size(); j++) {
-                nbrs[j].weight = nbrs[j].weight / local_bandwidth;
-            }
-        }
-	}
-
-    if (!adaptive_bandwidth && bandwidth > 0 && !kernel.IsEmpty()) {
-        // use max knn distance as bandwidth
-        for (int i=0; i<Wp->num_obs; i++) {
-            GwtElement& e = Wp->gwt[i];
-            GwtNeighbor* nbrs = e.dt();
-            for (int j=0; j<e.Size(); j++) {
-                nbrs[j].weight = nbrs[j].weight / bandwidth;
-            }
-        }
-    }
-    if (!kernel.IsEmpty()) {
-        apply_kernel(Wp, kernel, use_kernel_diagnals);
-    }
-    
+	vector<pt_3d_val> vals;
+	vals.reserve(rtree.size());
+	rtree.query(bgi::intersects(rtree.bounds()), std::back_inserter(vals));
+	
+	KnnRowParams p;
+	p.k = nn+1;
+	p.keep_self = !kernel.IsEmpty();
+	p.is_inverse = is_inverse;
+	p.power = power;
+	p.adaptive = adaptive_bandwidth_;
+	p.is_arc = is_arc;
+	p.is_mi = is_mi;
+	// if not set,  use max knn distance as bandwidth
+	vector<double> row_max(Wp->num_obs, 0);
+	GdaThreadPool::GetInstance().ParallelFor(vals.size(),
+		boost::bind(&knn_rows_3d, &rtree, &vals, &p, Wp, &row_max, _1, _2),
+		GdaThreadPool::query_chunk_size);
+	
+	knn_finish_kernel(Wp, row_max, kernel, bandwidth_, adaptive_bandwidth_,
+					  use_kernel_diagnals);
+	
+	int cnt = 0;
+	for (int i=0; i<Wp->num_obs; i++) cnt += Wp->gwt[i].Size();
 	stringstream ss;
 	ss << "Time to create 3D " << (is_arc ? " arc " : "")
 	   << nn << "-NN GwtWeight "
@@ -413,6 +465,76 @@ GwtWeight* SpatialIndAlgs::knn_build(const rtree_pt_3d_t& rtree, int nn,
 	return Wp;
 }
 
+wxString SpatialIndAlgs::knn_scaling_benchmark(const vector<double>& x,
+											   const vector<double>& y,
+											   int nn, bool is_arc,
+											   int max_cores)
+{
+	size_t nobs = x.size();
+	wxStopWatch sw;
+	rtree_pt_2d_t rtree_2d;
+	rtree_pt_3d_t rtree_3d;
+	if (is_arc) {
+		vector<pt_3d> pts;
+		{
+			vector<pt_lonlat> ptll(nobs);
+			for (size_t i=0; i<nobs; ++i) ptll[i] = pt_lonlat(x[i], y[i]);
+			to_3d_centroids(ptll, pts);
+		}
+		fill_pt_rtree(rtree_3d, pts);
+	} else {
+		vector<pt_2d> pts(nobs);
+		for (size_t i=0; i<nobs; ++i) pts[i] = pt_2d(x[i], y[i]);
+		fill_pt_rtree(rtree_2d, pts);
+	}
+	long build_ms = sw.Time();
+	
+	int saved_cores = GdaConst::gda_cpu_cores;
+	bool saved_set_cores = GdaConst::gda_set_cpu_cores;
+	int hw_cores = boost::thread::hardware_concurrency();
+	if (max_cores <= 0) max_cores = hw_cores < 1 ? 1 : hw_cores;
+	
+	wxString report;
+	report << nobs << " points, " << nn << "-NN" << (is_arc ? " arc" : "")
+		   << ", rtree built in " << build_ms << " ms\n";
+	GwtWeight* ref = 0;
+	long ref_ms = 0;
+	for (int cores=1; ; cores = std::min(cores*2, max_cores)) {
+		GdaConst::gda_set_cpu_cores = true;
+		GdaConst::gda_cpu_cores = cores;
+		sw.Start();
+		GwtWeight* Wp = is_arc ? knn_build(rtree_3d, nn, true, false)
+			: knn_build(rtree_2d, nn);
+		long ms = sw.Time();
+		
+		int num_diff = 0;
+		if (ref == 0) {
+			ref = Wp;
+			ref_ms = ms;
+		} else {
+			for (int i=0; i<Wp->num_obs; i++) {
+				GwtElement& a = ref->gwt[i];
+				GwtElement& b = Wp->gwt[i];
+				bool same = a.Size() == b.Size();
+				for (int j=0; same && j<a.Size(); j++) {
+					same = a.dt()[j].nbx == b.dt()[j].nbx &&
+						a.dt()[j].weight == b.dt()[j].weight;
+				}
+				if (!same) num_diff++;
+			}
+			delete Wp;
+		}
+		double speedup = ms > 0 ? (double) ref_ms / ms : 0;
+		report << cores << (cores == 1 ? " thread: " : " threads: ")
+			   << ms << " ms, speedup " << wxString::Format("%.2f", speedup)
+			   << ", " << num_diff << " rows differ from 1 thread\n";
+		if (cores == max_cores) break;
+	}
+	delete ref;
+	GdaConst::gda_cpu_cores = saved_cores;
+	GdaConst::gda_set_cpu_cores = saved_set_cores;
+	return report;
+}
 
 double SpatialIndAlgs::est_thresh_for_num_pairs(const rtree_pt_2d_t& rtree,
 												double num_pairs)
@@ -617,6 +739,85 @@ double SpatialIndAlgs::est_median_distance(const std::vector<double>& x,
 	return v[v.size()/2];
 }
 
+namespace {
+	/** options shared by the rows of one grid thresh_build */
+	struct ThreshRowParams {
+		GwtElement* gwt;
+		double power;
+		double bandwidth; // divide by it for kernel weights, 0 otherwise
+		bool is_arc; // grid distances are unit sphere chords
+		bool is_mi;
+	};
+	
+	void thresh_row(const ThreshRowParams* p, int obs,
+					const Gda::GridNeighbors::NbrList& nbrs)
+	{
+		using namespace GenGeomAlgs;
+		GwtElement& e = p->gwt[obs];
+		e.alloc(nbrs.size());
+		for (size_t j=0; j<nbrs.size(); j++) {
+			GwtNeighbor neigh;
+			neigh.nbx = nbrs[j].first;
+			double d = nbrs[j].second;
+			if (p->is_arc) {
+				double r = UnitDistToRad(d);
+				d = p->is_mi ? EarthRadToMi(r) : EarthRadToKm(r);
+			}
+			if (p->power != 1) d = pow(d, p->power);
+			if (p->bandwidth > 0) d = d / p->bandwidth;
+			neigh.weight = d;
+			e.Push(neigh);
+		}
+	}
+	
+	/** Emit the weights of the grid in parallel.  bandwidth is the
+	 threshold in the units of the weights, used by kernel weights. */
+	GwtWeight* grid_thresh_build(Gda::GridNeighbors& grid, double bandwidth,
+								 double power, bool is_arc, bool is_mi,
+								 const wxString& kernel,
+								 bool use_kernel_diagnals)
+	{
+		wxStopWatch sw;
+		// the exact count is only needed when the cells are crowded
+		if (grid.GetMaxCandidates() > 200) {
+			vector<double> th(1, grid.GetRadius());
+			vector<Gda::NbrCountStats> stats;
+			grid.CountNeighbors(th, stats);
+			if (stats[0].max_nbrs > 200) {
+				wxString msg = _("You can try to proceed but the current threshold distance value might be too large to compute. If it fails, please input a smaller distance band (which might leave some observations neighborless) or use other weights (e.g. KNN).");
+				wxMessageDialog dlg(NULL, msg, "Do you want to continue?", wxYES_NO | wxYES_DEFAULT);
+				if (dlg.ShowModal() != wxID_YES) {
+					throw GdaException(msg.mb_str());
+				}
+			}
+		}
+		
+		GwtWeight* Wp = new GwtWeight;
+		Wp->num_obs = grid.GetNumObs();
+		Wp->is_symmetric = false;
+		Wp->symmetry_checked = true;
+		Wp->gwt = new GwtElement[Wp->num_obs];
+		
+		ThreshRowParams p;
+		p.gwt = Wp->gwt;
+		p.power = power;
+		p.bandwidth = kernel.IsEmpty() ? 0 : bandwidth;
+		p.is_arc = is_arc;
+		p.is_mi = is_mi;
+		grid.VisitNeighbors(boost::bind(&thresh_row, &p, _1, _2));
+		
+		if (!kernel.IsEmpty()) {
+			SpatialIndAlgs::apply_kernel(Wp, kernel, use_kernel_diagnals);
+		}
+		wxLogMessage("thresh_build: %d observations in %ld ms",
+					 Wp->num_obs, sw.Time());
+		return Wp;
+	}
+}
+
+/** Uses the uniform grid of Gda::GridNeighbors instead of an rtree: for
+ arc distances the points are put on the unit sphere and the threshold
+ becomes the chord of the arc. */
 GwtWeight* SpatialIndAlgs::thresh_build(const std::vector<double>& x,
                                         const std::vector<double>& y,
                                         double th, double power,
@@ -626,107 +827,37 @@ GwtWeight* SpatialIndAlgs::thresh_build(const std::vector<double>& x,
 {
 	using namespace GenGeomAlgs;
 	size_t nobs = x.size();
-	GwtWeight* gwt = 0;
 	if (is_arc) {
 		double r_th = is_mi ? EarthMiToRad(th) : EarthKmToRad(th);
 		double u_th = RadToUnitDist(r_th);
-		rtree_pt_3d_t rtree;
-		{
-			vector<pt_3d> pts;
-			{
-				vector<pt_lonlat> ptll(nobs);
-				for (int i=0; i<nobs; ++i) ptll[i] = pt_lonlat(x[i], y[i]);
-				to_3d_centroids(ptll, pts);
-			}
-			fill_pt_rtree(rtree, pts);
-		}
-		gwt = thresh_build(rtree, u_th, power, is_mi, kernel, use_kernel_diagnals);
-	} else {
-		rtree_pt_2d_t rtree;
-		{
-			vector<pt_2d> pts(nobs);
-            for (int i=0; i<nobs; ++i) {
-                pts[i] = pt_2d(x[i], y[i]);
-            }
-			fill_pt_rtree(rtree, pts);
+		vector<double> ux(nobs), uy(nobs), uz(nobs);
+		for (size_t i=0; i<nobs; ++i) {
+			LongLatDegToUnit(x[i], y[i], ux[i], uy[i], uz[i]);
 		}
-		gwt = thresh_build(rtree, th, power, kernel, use_kernel_diagnals);
+		Gda::GridNeighbors grid(ux, uy, uz, u_th);
+		return grid_thresh_build(grid, th, power, true, is_mi, kernel,
+								 use_kernel_diagnals);
 	}
-	return gwt;
+	Gda::GridNeighbors grid(x, y, th);
+	return grid_thresh_build(grid, th, power, false, false, kernel,
+							 use_kernel_diagnals);
 }
 
 GwtWeight* SpatialIndAlgs::thresh_build(const rtree_pt_2d_t& rtree, double th, double power, const wxString& kernel, bool use_kernel_diagnals)
 {
-	wxStopWatch sw;
-    
-	GwtWeight* Wp = new GwtWeight;
-	Wp->num_obs = rtree.size();
-	Wp->is_symmetric = false;
-	Wp->symmetry_checked = true;
-    
-    int num_obs = Wp->num_obs;
-	Wp->gwt = new GwtElement[num_obs];
-	
-	int cnt=0;
-	bool ignore_too_large_compute = false;
-    rtree_pt_2d_t::const_query_iterator it;
+	size_t nobs = rtree.size();
+	vector<double> x(nobs), y(nobs);
+	rtree_pt_2d_t::const_query_iterator it;
 	for (it = rtree.qbegin(bgi::intersects(rtree.bounds()));
 		 it != rtree.qend() ; ++it)
 	{
 		const pt_2d_val& v = *it;
-		double x = v.first.get<0>();
-		double y = v.first.get<1>();
-		box_2d b(pt_2d(x-th, y-th), pt_2d(x+th, y+th));
-		size_t obs = v.second;		
-		vector<pt_2d_val> q;
-		rtree.query(bgi::intersects(b), std::back_inserter(q));
-		size_t lcnt = 0;
-		list<pt_2d_val> l;
-		BOOST_FOREACH(pt_2d_val const& w, q) {
-			if (w.second != v.second &&
-				bg::distance(v.first, w.first) <= th)
-			{
-				l.push_front(w);
-				++lcnt;
-			}
-		}
-        if (lcnt > 200 && ignore_too_large_compute == false) {
-            
-            wxString msg = _("You can try to proceed but the current threshold distance value might be too large to compute. If it fails, please input a smaller distance band (which might leave some observations neighborless) or use other weights (e.g. KNN).");
-			wxMessageDialog dlg(NULL, msg, "Do you want to continue?", wxYES_NO | wxYES_DEFAULT);
-			if (dlg.ShowModal() != wxID_YES) {
-				// clean up memory
-				delete Wp;
-				throw GdaException(msg.mb_str());
-			}
-			else {
-				ignore_too_large_compute = true;
-			}
-            
-        }
-		GwtElement& e = Wp->gwt[obs];
-		e.alloc(lcnt);
-		BOOST_FOREACH(pt_2d_val const& w, l) {
-			GwtNeighbor neigh;
-			neigh.nbx = w.second;
-			double w_val = bg::distance(v.first, w.first);
-            if (power != 1) w_val = pow(w_val, power);
-            if (!kernel.IsEmpty()) w_val = w_val / th;
-            neigh.weight = w_val;
-			e.Push(neigh);
-			++cnt;
-		}
+		x[v.second] = v.first.get<0>();
+		y[v.second] = v.first.get<1>();
 	}
-
-    if (!kernel.IsEmpty()) {
-        apply_kernel(Wp, kernel, use_kernel_diagnals);
-    }
-    
-	stringstream ss;
-	ss << "Time to create " << th << " threshold GwtWeight,"
-	   << endl << "  with " << cnt << " total neighbors in ms : "
-	   << sw.Time();
-	return Wp;
+	Gda::GridNeighbors grid(x, y, th);
+	return grid_thresh_build(grid, th, power, false, false, kernel,
+							 use_kernel_diagnals);
 }
 
 double SpatialIndAlgs::est_avg_num_neigh_thresh(const rtree_pt_3d_t& rtree,
@@ -770,89 +901,29 @@ double SpatialIndAlgs::est_avg_num_neigh_thresh(const rtree_pt_3d_t& rtree,
   respect to the unit shpere of the 3d point rtree */
 GwtWeight* SpatialIndAlgs::thresh_build(const rtree_pt_3d_t& rtree, double th, double power, bool is_mi, const wxString& kernel, bool use_kernel_diagnals)
 {
-	wxStopWatch sw;
 	using namespace GenGeomAlgs;
-	
-	GwtWeight* Wp = new GwtWeight;
-	Wp->num_obs = rtree.size();
-	Wp->is_symmetric = false;
-	Wp->symmetry_checked = true;
-	Wp->gwt = new GwtElement[Wp->num_obs];
-	
-	{
-		stringstream ss;
-		ss << "In thresh_build for unit sphere" << endl;
-		ss << "th : " << th << endl;
-		ss << "Input th (unit sphere secant distance): " << th << endl;
-		double r = UnitDistToRad(th);
-		ss << "Input th (unit sphere rad): " << r << endl;
-		ss << "Input th (earth km): " << EarthRadToKm(r) << endl;
-		ss << "Input th (earth mi): " << EarthRadToMi(r);	
-	}
-	int cnt=0;
+	size_t nobs = rtree.size();
+	vector<double> x(nobs), y(nobs), z(nobs);
 	for (rtree_pt_3d_t::const_query_iterator it =
 			 rtree.qbegin(bgi::intersects(rtree.bounds()));
 		 it != rtree.qend() ; ++it)
 	{
 		const pt_3d_val& v = *it;
-		double vx = v.first.get<0>();
-		double vy = v.first.get<1>();
-		double vz = v.first.get<2>();
-		double lon_v, lat_v;
-		UnitToLongLatDeg(vx, vy, vz, lon_v, lat_v);
-		box_3d b(pt_3d(vx-th, vy-th, vz-th), pt_3d(vx+th, vy+th, vz+th));
-		size_t obs = v.second;
-		vector<pt_3d_val> q;
-		rtree.query(bgi::intersects(b), std::back_inserter(q));
-		size_t lcnt = 0;
-		list<pt_3d_val> l;
-		BOOST_FOREACH(pt_3d_val const& w, q) {
-			if (w.second != v.second &&
-				bg::distance(v.first, w.first) <= th)
-			{
-				l.push_front(w);
-				++lcnt;
-			}
-		}
-		GwtElement& e = Wp->gwt[obs];
-		e.alloc(lcnt);
-		BOOST_FOREACH(pt_3d_val const& w, l) {
-			GwtNeighbor neigh;
-			neigh.nbx = w.second;
-			double wx = w.first.get<0>();
-			double wy = w.first.get<1>();
-			double wz = w.first.get<2>();
-			double lon_w, lat_w;
-			double d;
-			UnitToLongLatDeg(wx, wy, wz, lon_w, lat_w);
-			if (is_mi) {
-				d = ComputeArcDistMi(lon_v, lat_v, lon_w, lat_w);
-			} else {
-				d = ComputeArcDistKm(lon_v, lat_v, lon_w, lat_w);
-			}
-            if (power!=1) d = pow(d, power);
-            if (!kernel.IsEmpty()) d = d / th;
-			neigh.weight = d;
-			e.Push(neigh);
-			++cnt;
-		}
+		x[v.second] = v.first.get<0>();
+		y[v.second] = v.first.get<1>();
+		z[v.second] = v.first.get<2>();
 	}
-
-	stringstream ss;
-	ss << "Time to create arc " << th << " threshold GwtWeight,"
-	   << endl << "  with " << cnt << " total neighbors in ms : "
-	   << sw.Time();
-    
-    if (!kernel.IsEmpty()) {
-        apply_kernel(Wp, kernel, use_kernel_diagnals);
-    }
-    
-	return Wp;
+	double r = UnitDistToRad(th);
+	double bandwidth = is_mi ? EarthRadToMi(r) : EarthRadToKm(r);
+	Gda::GridNeighbors grid(x, y, z, th);
+	return grid_thresh_build(grid, bandwidth, power, true, is_mi, kernel,
+							 use_kernel_diagnals);
 }
 
 double SpatialIndAlgs::find_max_1nn_dist(const std::vector<double>& x,
                                          const std::vector<double>& y,
-                                         bool is_arc, bool is_mi)
+                                         bool is_arc, bool is_mi,
+                                         double* mean_1nn)
 {
 	using namespace GenGeomAlgs;
 	size_t nobs = x.size();
@@ -870,6 +941,8 @@ double SpatialIndAlgs::find_max_1nn_dist(const std::vector<double>& x,
 		}
 		get_pt_rtree_stats(rtree, min_d_1nn, max_d_1nn, mean_d_1nn, median_d_1nn);
 		d = is_mi ? EarthRadToMi(max_d_1nn) : EarthRadToKm(max_d_1nn);
+		mean_d_1nn = (is_mi ? EarthRadToMi(mean_d_1nn) :
+					  EarthRadToKm(mean_d_1nn));
 	} else {
 		rtree_pt_2d_t rtree;
 		{
@@ -880,6 +953,7 @@ double SpatialIndAlgs::find_max_1nn_dist(const std::vector<double>& x,
 		get_pt_rtree_stats(rtree, min_d_1nn, max_d_1nn, mean_d_1nn, median_d_1nn);
 		d = max_d_1nn;
 	}
+	if (mean_1nn) *mean_1nn = mean_d_1nn;
 	return d;
 }
 
@@ -1064,31 +1138,49 @@ bool SpatialIndAlgs::write_gwt(const GwtWeight* W,
     return true;
 }
 
+namespace {
+	/** Give the i-th geometry the value i.  An empty rtree is bulk loaded
+	 with the packing algorithm of the range constructor, which sorts the
+	 values into full, barely overlapping nodes in O(n log n) instead of
+	 splitting nodes on every insert. */
+	template <class Rtree, class Geom>
+	void pack_rtree(Rtree& rtree, const std::vector<Geom>& geoms)
+	{
+		std::vector<std::pair<Geom, unsigned> > vals(geoms.size());
+		for (size_t i=0; i<geoms.size(); ++i) {
+			vals[i] = std::make_pair(geoms[i], (unsigned) i);
+		}
+		if (rtree.empty()) {
+			Rtree packed(vals.begin(), vals.end());
+			rtree.swap(packed);
+		} else {
+			rtree.insert(vals.begin(), vals.end());
+		}
+	}
+}
+
 void SpatialIndAlgs::fill_pt_rtree(rtree_pt_2d_t& rtree,
 								   const std::vector<pt_2d>& pts)
 {
-	size_t obs = pts.size();
-	for (size_t i=0; i<obs; ++i) {
-		rtree.insert(make_pair(pts[i], i));
-	}
+	pack_rtree(rtree, pts);
 }
 
 void SpatialIndAlgs::fill_pt_rtree(rtree_pt_lonlat_t& rtree,
 								   const std::vector<pt_lonlat>& pts)
 {
-	size_t obs = pts.size();
-	for (size_t i=0; i<obs; ++i) {
-		rtree.insert(make_pair(pts[i], i));
-	}
+	pack_rtree(rtree, pts);
 }
 
 void SpatialIndAlgs::fill_pt_rtree(rtree_pt_3d_t& rtree,
 								   const std::vector<pt_3d>& pts)
 {
-	size_t obs = pts.size();
-	for (size_t i=0; i<obs; ++i) {
-		rtree.insert(make_pair(pts[i], i));
-	}
+	pack_rtree(rtree, pts);
+}
+
+void SpatialIndAlgs::fill_box_rtree(rtree_box_2d_t& rtree,
+									const std::vector<box_2d>& boxes)
+{
+	pack_rtree(rtree, boxes);
 }
 
 std::ostream& SpatialIndAlgs::operator<< (std::ostream &out,
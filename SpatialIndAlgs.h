@@ -72,6 +72,13 @@ GwtWeight* knn_build(const rtree_pt_3d_t& rtree, int nn=6,
                      double bandwidth = 0,
                      bool adaptive_bandwidth = false,
                      bool use_kernel_diagnals = false);
+/** Time the nn-NN weights query of the points x, y with 1, 2, 4, ... up to
+ max_cores worker threads (0: all cores) and report the speedup of each
+ run over one thread and whether its neighbors match the one thread run.
+ The rtree is built once, before the timed runs. */
+wxString knn_scaling_benchmark(const std::vector<double>& x,
+                               const std::vector<double>& y,
+                               int nn, bool is_arc, int max_cores = 0);
 double est_thresh_for_num_pairs(const rtree_pt_2d_t& rtree, double num_pairs);
 double est_thresh_for_avg_num_neigh(const rtree_pt_2d_t& rtree, double avg_n);
 double est_avg_num_neigh_thresh(const rtree_pt_2d_t& rtree, double th,
@@ -111,10 +118,11 @@ GwtWeight* thresh_build(const rtree_pt_3d_t& rtree, double th, double power,
 /** Find the nearest neighbor for all points and return the maximum
  distance of all of these nearest neighbor pairs.  This is the minimum
  threshold distance such that all points have at least one neighbor.
- is_mi only relevant when is_arc is true.*/
+ is_mi only relevant when is_arc is true.  mean_1nn, if given, gets the
+ mean nearest neighbor distance in the same units.*/
 double find_max_1nn_dist(const std::vector<double>& x,
 						const std::vector<double>& y,
-						bool is_arc, bool is_mi);
+						bool is_arc, bool is_mi, double* mean_1nn = 0);
 void get_pt_rtree_stats(const rtree_pt_2d_t& rtree,
 						double& min_d_1nn, double& max_d_1nn,
 						double& mean_d_1nn, double& median_d_1nn);
@@ -132,6 +140,10 @@ void fill_pt_rtree(rtree_pt_lonlat_t& rtree,
 				   const std::vector<pt_lonlat>& pts);
 void fill_pt_rtree(rtree_pt_3d_t& rtree,
 				   const std::vector<pt_3d>& pts);
+/** the value of boxes[i] is i; an empty rtree is bulk loaded, as are the
+ point rtrees of fill_pt_rtree */
+void fill_box_rtree(rtree_box_2d_t& rtree,
+					const std::vector<box_2d>& boxes);
 struct LonLatPt {
 	LonLatPt() : lon(0), lat(0) {}
 	LonLatPt(double lon_, double lat_) : lon(lon_), lat(lat_) {}
@@ -28,6 +28,7 @@
 #include "WeightsMetaInfo.h"
 #include "GdaFlexValue.h"
 class GalWeight;
+class CsrWeight;
 class GeoDaWeight;
 class ProgressDlg;
 
@@ -63,6 +64,7 @@ public:
 	virtual void Remove(boost::uuids::uuid w_uuid) = 0;
 	virtual wxString RecNumToId(boost::uuids::uuid w_uuid, long rec_num) = 0;
 	virtual GalWeight* GetGal(boost::uuids::uuid w_uuid) = 0;
+	virtual CsrWeight* GetCsr(boost::uuids::uuid w_uuid) = 0;
     virtual GeoDaWeight* GetWeights(boost::uuids::uuid w_uuid) = 0;
 	virtual boost::uuids::uuid GetDefault() const = 0;
 	virtual void MakeDefault(boost::uuids::uuid w_uuid) = 0;
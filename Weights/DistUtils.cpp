@@ -7,6 +7,8 @@
 
 #include <cfloat>
 #include <cmath>
+#include <boost/bind.hpp>
+#include "../GdaThreadPool.h"
 #include "DistUtils.h"
 
 #ifndef M_PI
@@ -20,15 +22,17 @@ DistUtils::DistUtils(const std::vector<std::vector<double> >& input_data,
                      int distance_metric)
 {
     eps = 0.0;
-    ANN_DIST_TYPE = distance_metric;
+    dist_type = distance_metric;
     
     n_cols = input_data.size();
+    n_rows = 0;
     if (n_cols > 0) {
         n_rows = input_data[0].size();
     }
     row_mask.resize(n_rows, false);
-    n_valid_rows = 0;
+    n_valid_rows = n_rows;
     if (mask.empty() == false) {
+        n_valid_rows = 0;
         bool skip = false;
         for (size_t i=0; i<n_rows; i++) {
             skip = false;
@@ -44,6 +48,8 @@ DistUtils::DistUtils(const std::vector<std::vector<double> >& input_data,
     }
 
     data = new double*[n_valid_rows];
+    ann_idx_to_row.resize(n_valid_rows);
+    row_to_ann_idx.resize(n_rows, 0);
     for (size_t i=0, cnt=0; i<n_rows; ++i) {
         if (row_mask[i] == true) continue;
         data[cnt] = new double[n_cols];
@@ -57,6 +63,7 @@ DistUtils::DistUtils(const std::vector<std::vector<double> >& input_data,
 
     // create a kdtree
     kdTree = new ANNkd_tree(data, n_valid_rows, n_cols /*dim*/);
+    kdTree->setDistType(dist_type);
 }
 
 DistUtils::~DistUtils()
@@ -65,28 +72,38 @@ DistUtils::~DistUtils()
     delete[] data;
     
     if (kdTree) delete kdTree;
-
-    // reset this global variable, so it won't impact using ANN in other code
-    ANN_DIST_TYPE = ANNuse_euclidean_dist;
 }
 
-double DistUtils::GetMinThreshold()
+void DistUtils::Min1NNRows(int first, int last, std::vector<double>* nn_dist)
 {
-    double max_1nn_dist = 0;
-    
     int k = 2; // the first one is alway the query point itself
     ANNidxArray nnIdx = new ANNidx[k];
     ANNdistArray dists = new ANNdist[k];
-    for (size_t i=0; i<n_valid_rows; i++) { // find nn for every valid row
+    for (int i=first; i<=last; i++) {
         kdTree->annkSearch(data[i], k, nnIdx, dists);
-        if (dists[1] > max_1nn_dist) {
-            max_1nn_dist = dists[1];
-        }
+        (*nn_dist)[i] = dists[1];
     }
     delete[] nnIdx;
     delete[] dists;
+}
 
-    return ANN_ROOT(max_1nn_dist);
+double DistUtils::GetMinThreshold()
+{
+    if (n_valid_rows < 2) return 0;
+    
+    // find nn for every valid row
+    std::vector<double> nn_dist(n_valid_rows, 0);
+    GdaThreadPool::GetInstance().ParallelFor(n_valid_rows,
+        boost::bind(&DistUtils::Min1NNRows, this, _1, _2, &nn_dist),
+        GdaThreadPool::query_chunk_size);
+    
+    double max_1nn_dist = 0;
+    for (size_t i=0; i<n_valid_rows; i++) {
+        if (nn_dist[i] > max_1nn_dist) {
+            max_1nn_dist = nn_dist[i];
+        }
+    }
+    return ANN_ROOT(max_1nn_dist, dist_type);
 }
 
 /*
@@ -124,132 +141,159 @@ double DistUtils::GetMaxThreshold()
     delete[] nnIdx;
     delete[] dists;
 
-    return ANN_ROOT(dist_cand);
+    return ANN_ROOT(dist_cand, dist_type);
 }
 
-Gda::Weights DistUtils::CreateDistBandWeights(double band, bool is_inverse,
-                                                int power)
+void DistUtils::BandRows(int first, int last, double band, bool is_inverse,
+                         int power, bool is_kernel, Gda::Weights* weights)
 {
-    Gda::Weights weights;
-    
-    double radius = ANN_POW(band);
+    double radius = ANN_POW(band, dist_type);
     double w;
-    
-    for (size_t i=0; i<n_rows; i++) {
-        std::vector<std::pair<int, double> > nbrs;
-        if (row_mask[i] == false) {
-            int ann_idx = row_to_ann_idx[i];
-            int k = kdTree->annkFRSearch(data[ann_idx], radius, 0, NULL, NULL);
-            ANNidxArray nnIdx = new ANNidx[k];
-            ANNdistArray dists = new ANNdist[k];
-            kdTree->annkFRSearch(data[ann_idx], radius, k, nnIdx, dists);
-            for (size_t j=0; j<k; j++) {
-                // iter each neighbor
-                int nbr_id = ann_idx_to_row[ nnIdx[j] ];
-                if (nbr_id != i) {
-                    w = ANN_ROOT(dists[j]);
-                    if (is_inverse) {
-                        w = pow(w, power);
-                    }
-                    nbrs.push_back(std::make_pair(nbr_id,w));
-                }
-            }
+    // the buffers only grow, so a row needs a second search only when it
+    // has more neighbors than any row before it in this job
+    int cap = 64;
+    ANNidxArray nnIdx = new ANNidx[cap];
+    ANNdistArray dists = new ANNdist[cap];
+    for (int i=first; i<=last; i++) {
+        if (row_mask[i]) continue;
+        int ann_idx = row_to_ann_idx[i];
+        int k = kdTree->annkFRSearch(data[ann_idx], radius, cap, nnIdx, dists);
+        if (k > cap) {
             delete[] nnIdx;
             delete[] dists;
+            cap = k;
+            nnIdx = new ANNidx[cap];
+            dists = new ANNdist[cap];
+            kdTree->annkFRSearch(data[ann_idx], radius, cap, nnIdx, dists);
+        }
+        std::vector<std::pair<int, double> >& nbrs = (*weights)[i];
+        nbrs.reserve(k);
+        for (int j=0; j<k; j++) {
+            // iter each neighbor
+            int nbr_id = ann_idx_to_row[ nnIdx[j] ];
+            if (is_kernel) {
+                w = ANN_ROOT(dists[j], dist_type) / band;
+                nbrs.push_back(std::make_pair(nbr_id,w));
+            } else if (nbr_id != i) {
+                w = ANN_ROOT(dists[j], dist_type);
+                if (is_inverse) {
+                    w = pow(w, power);
+                }
+                nbrs.push_back(std::make_pair(nbr_id,w));
+            }
         }
-        weights.push_back(nbrs);
     }
-    
+    delete[] nnIdx;
+    delete[] dists;
+}
+
+Gda::Weights DistUtils::CreateDistBandWeights(double band, bool is_inverse,
+                                                int power)
+{
+    Gda::Weights weights(n_rows);
+    GdaThreadPool::GetInstance().ParallelFor(n_rows,
+        boost::bind(&DistUtils::BandRows, this, _1, _2, band, is_inverse,
+                    power, false, &weights),
+        GdaThreadPool::query_chunk_size);
     return weights;
 }
 
-Gda::Weights DistUtils::CreateKNNWeights(int k, bool is_inverse, int power)
+void DistUtils::KNNRows(int first, int last, int k, bool is_inverse,
+                        int power, Gda::Weights* weights)
 {
-    Gda::Weights weights;
-    
     double w;
     ANNidxArray nnIdx = new ANNidx[k+1];
     ANNdistArray dists = new ANNdist[k+1];
-    for (size_t i=0; i<n_rows; i++) {
-        std::vector<std::pair<int, double> > nbrs;
-        if (row_mask[i] == false) {
-            int ann_idx = row_to_ann_idx[i];
-            // k+1, because data[i] will be always returned
-            kdTree->annkSearch(data[ann_idx], k+1, nnIdx, dists);
-            for (size_t j=0; j<k+1; j++) {
-                // iter each neighbor
-                int nbr_id = ann_idx_to_row[ nnIdx[j] ];
-                if (nbr_id != i && nbrs.size() < k) {
-                    w = ANN_ROOT(dists[j]);
-                    if (is_inverse) {
-                        w = pow(w, power);
-                    }
-                    nbrs.push_back(std::make_pair(nbr_id,w));
+    for (int i=first; i<=last; i++) {
+        if (row_mask[i]) continue;
+        std::vector<std::pair<int, double> >& nbrs = (*weights)[i];
+        nbrs.reserve(k);
+        int ann_idx = row_to_ann_idx[i];
+        // k+1, because data[i] will be always returned
+        kdTree->annkSearch(data[ann_idx], k+1, nnIdx, dists);
+        for (size_t j=0; j<k+1; j++) {
+            // iter each neighbor
+            int nbr_id = ann_idx_to_row[ nnIdx[j] ];
+            if (nbr_id != i && nbrs.size() < k) {
+                w = ANN_ROOT(dists[j], dist_type);
+                if (is_inverse) {
+                    w = pow(w, power);
                 }
+                nbrs.push_back(std::make_pair(nbr_id,w));
             }
         }
-        weights.push_back(nbrs);
     }
     delete[] nnIdx;
     delete[] dists;
-    
+}
+
+Gda::Weights DistUtils::CreateKNNWeights(int k, bool is_inverse, int power)
+{
+    // every row is written by exactly one job, in place
+    Gda::Weights weights(n_rows);
+    GdaThreadPool::GetInstance().ParallelFor(n_rows,
+        boost::bind(&DistUtils::KNNRows, this, _1, _2, k, is_inverse, power,
+                    &weights),
+        GdaThreadPool::query_chunk_size);
     return weights;
 }
 
-Gda::Weights DistUtils::CreateAdaptiveKernelWeights(int kernel_type, int k,
-                                                    bool is_adaptive_bandwidth,
-                                                    bool apply_kernel_to_diag)
+void DistUtils::KernelKNNRows(int first, int last, int k,
+                              bool is_adaptive_bandwidth,
+                              Gda::Weights* weights,
+                              std::vector<double>* max_dist)
 {
-    Gda::Weights weights;
     double w;
-    double max_knn_bandwidth = 0;
     ANNidxArray nnIdx = new ANNidx[k+1];
     ANNdistArray dists = new ANNdist[k+1];
-    
-    if (is_adaptive_bandwidth) {
-        for (size_t i=0; i<n_rows; i++) {
-            std::vector<std::pair<int, double> > nbrs;
-            if (row_mask[i] == false) {
-                int ann_idx = row_to_ann_idx[i];
-                // k+1, because data[i] will be always returned
-                kdTree->annkSearch(data[ann_idx], k+1, nnIdx, dists);
-                double local_band = 0;
-                for (size_t j=0; j<k+1; j++) {
-                    // iter each neighbor, include itself
-                    if (dists[j] > local_band) {
-                        local_band = dists[j];
-                    }
-                }
-                local_band = ANN_ROOT(local_band);
-                for (size_t j=0; j<k+1; j++) {
-                    // iter each neighbor
-                    w = ANN_ROOT(dists[j]);
-                    w = local_band > 0 ? w / local_band : 0;
-                    int nbr_id = ann_idx_to_row[ nnIdx[j] ];
-                    nbrs.push_back(std::make_pair(nbr_id, w));
-                }
+    for (int i=first; i<=last; i++) {
+        if (row_mask[i]) continue;
+        std::vector<std::pair<int, double> >& nbrs = (*weights)[i];
+        nbrs.reserve(k+1);
+        int ann_idx = row_to_ann_idx[i];
+        // k+1, because data[i] will be always returned
+        kdTree->annkSearch(data[ann_idx], k+1, nnIdx, dists);
+        double local_band = 0;
+        for (size_t j=0; j<k+1; j++) {
+            // iter each neighbor, include itself
+            if (dists[j] > local_band) {
+                local_band = dists[j];
+            }
+        }
+        local_band = ANN_ROOT(local_band, dist_type);
+        for (size_t j=0; j<k+1; j++) {
+            // iter each neighbor
+            w = ANN_ROOT(dists[j], dist_type);
+            if (is_adaptive_bandwidth) {
+                w = local_band > 0 ? w / local_band : 0;
             }
-            weights.push_back(nbrs);
+            int nbr_id = ann_idx_to_row[ nnIdx[j] ];
+            nbrs.push_back(std::make_pair(nbr_id, w));
         }
-    } else {
+        (*max_dist)[i] = local_band;
+    }
+    delete[] nnIdx;
+    delete[] dists;
+}
+
+Gda::Weights DistUtils::CreateAdaptiveKernelWeights(int kernel_type, int k,
+                                                    bool is_adaptive_bandwidth,
+                                                    bool apply_kernel_to_diag)
+{
+    Gda::Weights weights(n_rows);
+    std::vector<double> max_dist(n_rows, 0);
+    GdaThreadPool::GetInstance().ParallelFor(n_rows,
+        boost::bind(&DistUtils::KernelKNNRows, this, _1, _2, k,
+                    is_adaptive_bandwidth, &weights, &max_dist),
+        GdaThreadPool::query_chunk_size);
+    
+    if (!is_adaptive_bandwidth) {
         // use max knn distance as bandwidth
+        double max_knn_bandwidth = 0;
         for (size_t i=0; i<n_rows; i++) {
-            std::vector<std::pair<int, double> > nbrs;
-            if (row_mask[i] == false) {
-                int ann_idx = row_to_ann_idx[i];
-                // k+1, because data[i] will be always returned
-                kdTree->annkSearch(data[ann_idx], k+1, nnIdx, dists);
-                for (size_t j=0; j<k+1; j++) {
-                    // iter each neighbor
-                    w = ANN_ROOT(dists[j]);
-                    int nbr_id = ann_idx_to_row[ nnIdx[j] ];
-                    nbrs.push_back(std::make_pair(nbr_id, w));
-                    if (w > max_knn_bandwidth) {
-                        max_knn_bandwidth = w;
-                    }
-                }
+            if (max_dist[i] > max_knn_bandwidth) {
+                max_knn_bandwidth = max_dist[i];
             }
-            weights.push_back(nbrs);
         }
         for (size_t i=0; i<n_rows; i++) {
             for (size_t j=0; j<weights[i].size(); j++) {
@@ -258,9 +302,6 @@ Gda::Weights DistUtils::CreateAdaptiveKernelWeights(int kernel_type, int k,
         }
     }
     
-    delete[] nnIdx;
-    delete[] dists;
-    
     ApplyKernel(weights, kernel_type, apply_kernel_to_diag);
     
     return weights;
@@ -269,31 +310,11 @@ Gda::Weights DistUtils::CreateAdaptiveKernelWeights(int kernel_type, int k,
 Gda::Weights DistUtils::CreateAdaptiveKernelWeights(int kernel_type, double band,
                                            bool apply_kernel_to_diag)
 {
-    Gda::Weights weights;
-    double radius = ANN_POW(band);
-    double w;
-    
-    for (size_t i=0; i<n_rows; i++) {
-        std::vector<std::pair<int, double> > nbrs;
-        if (row_mask[i] == false) {
-            int ann_idx = row_to_ann_idx[i];
-            int k = kdTree->annkFRSearch(data[ann_idx], radius, 0, NULL, NULL);
-            ANNidxArray nnIdx = new ANNidx[k];
-            ANNdistArray dists = new ANNdist[k];
-            kdTree->annkFRSearch(data[ann_idx], radius, k, nnIdx, dists);
-
-            for (size_t j=0; j<k; j++) {
-                // iter each neighbor
-                int nbr_id = ann_idx_to_row[ nnIdx[j] ];
-                w = ANN_ROOT(dists[j]) / band;
-                nbrs.push_back(std::make_pair(nbr_id,w));
-            }
-
-            delete[] nnIdx;
-            delete[] dists;
-        }
-        weights.push_back(nbrs);
-    }
+    Gda::Weights weights(n_rows);
+    GdaThreadPool::GetInstance().ParallelFor(n_rows,
+        boost::bind(&DistUtils::BandRows, this, _1, _2, band, false, 1, true,
+                    &weights),
+        GdaThreadPool::query_chunk_size);
     ApplyKernel(weights, kernel_type, apply_kernel_to_diag);
     return weights;
 }
@@ -24,12 +24,26 @@ namespace Gda {
         ANNkd_tree* kdTree;
         double** data;
         double eps;
+        int dist_type;
         unsigned long n_cols;
         unsigned long n_rows;
         unsigned long n_valid_rows;
         std::vector<bool> row_mask;
-        std::map<unsigned long, unsigned long> ann_idx_to_row;
-        std::map<unsigned long, unsigned long> row_to_ann_idx;
+        std::vector<unsigned long> ann_idx_to_row;
+        std::vector<unsigned long> row_to_ann_idx;
+
+        // Bodies of the parallel query loops: each fills the rows
+        // first..last of its output.  The kd-tree is only read, and the
+        // search state of ANN is local to the thread.
+        void Min1NNRows(int first, int last, std::vector<double>* nn_dist);
+        void KNNRows(int first, int last, int k, bool is_inverse, int power,
+                     Gda::Weights* weights);
+        void KernelKNNRows(int first, int last, int k,
+                           bool is_adaptive_bandwidth, Gda::Weights* weights,
+                           std::vector<double>* max_dist);
+        // is_kernel: keep the point itself and divide by band
+        void BandRows(int first, int last, double band, bool is_inverse,
+                      int power, bool is_kernel, Gda::Weights* weights);
     public:
         DistUtils(const std::vector<std::vector<double> >& input_data,
                   const std::vector<std::vector<bool> >& mask,
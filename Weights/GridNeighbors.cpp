@@ -0,0 +1,296 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <boost/bind.hpp>
+
+#include "../GdaThreadPool.h"
+#include "GridNeighbors.h"
+
+using namespace Gda;
+
+namespace {
+    // 21 bits per axis, so three cell indices pack into one key
+    const int cell_bits = 21;
+    const boost::uint64_t max_cell = (1 << cell_bits) - 1;
+    // points per chunk of the parallel loops; a chunk may start or end
+    // inside a cell, so a few crowded cells are still split between
+    // threads
+    const int point_chunk_size = 1024;
+
+    boost::uint64_t cell_index(double v, double lower, double cell_size)
+    {
+        double c = std::floor((v - lower) / cell_size);
+        // also catches NaN
+        if (!(c > 0)) return 0;
+        if (c > (double) max_cell) return max_cell;
+        return (boost::uint64_t) c;
+    }
+
+    boost::uint64_t cell_key(boost::uint64_t cx, boost::uint64_t cy,
+                             boost::uint64_t cz)
+    {
+        return (cx << (2*cell_bits)) | (cy << cell_bits) | cz;
+    }
+
+    bool nbr_less(const std::pair<int, double>& a,
+                  const std::pair<int, double>& b)
+    {
+        return a.first < b.first;
+    }
+}
+
+NbrCountStats::NbrCountStats()
+: min_nbrs(0), max_nbrs(0), mean_nbrs(0), num_isolates(0)
+{
+}
+
+GridNeighbors::GridNeighbors(const std::vector<double>& x,
+                             const std::vector<double>& y,
+                             double radius_)
+{
+    std::vector<const std::vector<double>*> axes;
+    axes.push_back(&x);
+    axes.push_back(&y);
+    Init(axes, radius_);
+}
+
+GridNeighbors::GridNeighbors(const std::vector<double>& x,
+                             const std::vector<double>& y,
+                             const std::vector<double>& z,
+                             double radius_)
+{
+    std::vector<const std::vector<double>*> axes;
+    axes.push_back(&x);
+    axes.push_back(&y);
+    axes.push_back(&z);
+    Init(axes, radius_);
+}
+
+void GridNeighbors::Init(const std::vector<const std::vector<double>*>& axes,
+                         double radius_)
+{
+    dim = axes.size();
+    num_obs = axes[0]->size();
+    radius = radius_ > 0 ? radius_ : 0;
+    radius_sq = radius * radius;
+
+    double max_extent = 0;
+    for (int a=0; a<3; a++) lower[a] = 0;
+    for (int a=0; a<dim; a++) {
+        const std::vector<double>& v = *axes[a];
+        if (num_obs == 0) break;
+        double lo = v[0], hi = v[0];
+        for (int i=1; i<num_obs; i++) {
+            if (v[i] < lo) lo = v[i];
+            if (v[i] > hi) hi = v[i];
+        }
+        lower[a] = lo;
+        if (hi - lo > max_extent) max_extent = hi - lo;
+    }
+    // cells narrower than the radius would miss neighbors; very small
+    // radii are limited by the bits of the key instead
+    cell_size = std::max(radius, max_extent / (double) max_cell);
+    if (cell_size <= 0) cell_size = 1;
+
+    std::vector<std::pair<boost::uint64_t, int> > keyed(num_obs);
+    for (int i=0; i<num_obs; i++) {
+        boost::uint64_t c[3] = {0, 0, 0};
+        for (int a=0; a<dim; a++) {
+            c[a] = cell_index((*axes[a])[i], lower[a], cell_size);
+        }
+        keyed[i] = std::make_pair(cell_key(c[0], c[1], c[2]), i);
+    }
+    std::sort(keyed.begin(), keyed.end());
+
+    coords.resize(num_obs * dim);
+    ids.resize(num_obs);
+    cell_keys.clear();
+    cell_start.clear();
+    for (int i=0; i<num_obs; i++) {
+        int obs = keyed[i].second;
+        ids[i] = obs;
+        for (int a=0; a<dim; a++) coords[i*dim + a] = (*axes[a])[obs];
+        if (i == 0 || keyed[i].first != keyed[i-1].first) {
+            cell_keys.push_back(keyed[i].first);
+            cell_start.push_back(i);
+        }
+    }
+    cell_start.push_back(num_obs);
+}
+
+void GridNeighbors::GetCellRanges(int c,
+                                  std::vector<std::pair<int, int> >& ranges)
+    const
+{
+    ranges.clear();
+    boost::uint64_t key = cell_keys[c];
+    boost::int64_t cx = (boost::int64_t) (key >> (2*cell_bits));
+    boost::int64_t cy = (boost::int64_t) ((key >> cell_bits) & max_cell);
+    boost::int64_t cz = (boost::int64_t) (key & max_cell);
+    int dz_max = dim == 3 ? 1 : 0;
+    for (int dx=-1; dx<=1; dx++) {
+        if (cx+dx < 0 || cx+dx > (boost::int64_t) max_cell) continue;
+        for (int dy=-1; dy<=1; dy++) {
+            if (cy+dy < 0 || cy+dy > (boost::int64_t) max_cell) continue;
+            for (int dz=-dz_max; dz<=dz_max; dz++) {
+                if (cz+dz < 0 || cz+dz > (boost::int64_t) max_cell) continue;
+                boost::uint64_t k = cell_key(cx+dx, cy+dy, cz+dz);
+                std::vector<boost::uint64_t>::const_iterator it =
+                    std::lower_bound(cell_keys.begin(), cell_keys.end(), k);
+                if (it == cell_keys.end() || *it != k) continue;
+                int n = it - cell_keys.begin();
+                ranges.push_back(std::make_pair(cell_start[n],
+                                                cell_start[n+1]));
+            }
+        }
+    }
+}
+
+double GridNeighbors::SqDist(int i, int j) const
+{
+    const double* p = &coords[i*dim];
+    const double* q = &coords[j*dim];
+    double d = 0;
+    for (int a=0; a<dim; a++) d += (p[a] - q[a]) * (p[a] - q[a]);
+    return d;
+}
+
+int GridNeighbors::GetMaxCandidates() const
+{
+    int max_cand = 0;
+    std::vector<std::pair<int, int> > ranges;
+    for (size_t c=0; c<cell_keys.size(); c++) {
+        GetCellRanges(c, ranges);
+        int cand = -1; // the point itself
+        for (size_t r=0; r<ranges.size(); r++) {
+            cand += ranges[r].second - ranges[r].first;
+        }
+        if (cand > max_cand) max_cand = cand;
+    }
+    return max_cand;
+}
+
+int GridNeighbors::GetCell(int i) const
+{
+    // cells are never empty, so the last cell starting at or before i
+    return std::upper_bound(cell_start.begin(), cell_start.end(), i) -
+        cell_start.begin() - 1;
+}
+
+void GridNeighbors::VisitPoints(int first, int last, const RowFunc* row_func)
+{
+    std::vector<std::pair<int, int> > ranges;
+    NbrList nbrs;
+    int c = GetCell(first);
+    GetCellRanges(c, ranges);
+    for (int i=first; i<=last; i++) {
+        if (i == cell_start[c+1]) GetCellRanges(++c, ranges);
+        nbrs.clear();
+        for (size_t r=0; r<ranges.size(); r++) {
+            for (int j=ranges[r].first; j<ranges[r].second; j++) {
+                if (j == i) continue;
+                double d = SqDist(i, j);
+                if (d <= radius_sq) {
+                    nbrs.push_back(std::make_pair(ids[j], std::sqrt(d)));
+                }
+            }
+        }
+        std::sort(nbrs.begin(), nbrs.end(), nbr_less);
+        (*row_func)(ids[i], nbrs);
+    }
+}
+
+void GridNeighbors::VisitNeighbors(const RowFunc& row_func)
+{
+    GdaThreadPool::GetInstance().ParallelFor(num_obs,
+        boost::bind(&GridNeighbors::VisitPoints, this, _1, _2, &row_func),
+        point_chunk_size);
+}
+
+void GridNeighbors::CountPoints(int first, int last,
+                                const std::vector<double>* thresholds,
+                                std::vector<CountPartial>* partials)
+{
+    const std::vector<double>& th = *thresholds;
+    size_t n_th = th.size();
+    CountPartial& part = (*partials)[first / point_chunk_size];
+    part.sum.assign(n_th, 0);
+    part.mins.assign(n_th, num_obs);
+    part.maxs.assign(n_th, 0);
+    part.isolates.assign(n_th, 0);
+
+    std::vector<std::pair<int, int> > ranges;
+    // hist[t]: neighbors closer than th[t] but not closer than th[t-1]
+    std::vector<int> hist(n_th + 1);
+    int c = GetCell(first);
+    GetCellRanges(c, ranges);
+    for (int i=first; i<=last; i++) {
+        if (i == cell_start[c+1]) GetCellRanges(++c, ranges);
+        std::fill(hist.begin(), hist.end(), 0);
+        for (size_t r=0; r<ranges.size(); r++) {
+            for (int j=ranges[r].first; j<ranges[r].second; j++) {
+                if (j == i) continue;
+                double d = SqDist(i, j);
+                if (d > radius_sq) continue;
+                d = std::sqrt(d);
+                hist[std::lower_bound(th.begin(), th.end(), d) -
+                     th.begin()] += 1;
+            }
+        }
+        int cnt = 0;
+        for (size_t t=0; t<n_th; t++) {
+            cnt += hist[t];
+            part.sum[t] += cnt;
+            if (cnt < part.mins[t]) part.mins[t] = cnt;
+            if (cnt > part.maxs[t]) part.maxs[t] = cnt;
+            if (cnt == 0) part.isolates[t] += 1;
+        }
+    }
+}
+
+void GridNeighbors::CountNeighbors(const std::vector<double>& thresholds,
+                                   std::vector<NbrCountStats>& stats)
+{
+    size_t n_th = thresholds.size();
+    stats.assign(n_th, NbrCountStats());
+    if (num_obs == 0 || n_th == 0) return;
+
+    int num_chunks = (num_obs + point_chunk_size - 1) / point_chunk_size;
+    std::vector<CountPartial> partials(num_chunks);
+    GdaThreadPool::GetInstance().ParallelFor(num_obs,
+        boost::bind(&GridNeighbors::CountPoints, this, _1, _2, &thresholds,
+                    &partials),
+        point_chunk_size);
+
+    // merge in chunk order, so the sums don't depend on the threads
+    for (size_t t=0; t<n_th; t++) {
+        double sum = 0;
+        NbrCountStats& s = stats[t];
+        s.min_nbrs = num_obs;
+        for (int p=0; p<num_chunks; p++) {
+            sum += partials[p].sum[t];
+            s.min_nbrs = std::min(s.min_nbrs, partials[p].mins[t]);
+            s.max_nbrs = std::max(s.max_nbrs, partials[p].maxs[t]);
+            s.num_isolates += partials[p].isolates[t];
+        }
+        s.mean_nbrs = sum / num_obs;
+    }
+}
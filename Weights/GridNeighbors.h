@@ -0,0 +1,126 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_GRID_NEIGHBORS_H__
+#define __GEODA_CENTER_GRID_NEIGHBORS_H__
+
+#include <utility>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+
+namespace Gda {
+    /** Neighbor counts of all observations for one threshold distance */
+    struct NbrCountStats {
+        NbrCountStats();
+        int min_nbrs;
+        int max_nbrs;
+        double mean_nbrs;
+        int num_isolates;
+    };
+
+    /**
+     Fixed-radius neighbor search on a uniform grid of 2d or 3d points.
+
+     The points are hashed into cells at least as wide as the radius, so
+     the neighbors of a point are all in its own cell and the cells next to
+     it.  The occupied cells are kept sorted by key and the points are
+     stored in cell order; every query runs in parallel over blocks of
+     points in that order on GdaThreadPool, so the work is split by points
+     even when a coarse grid has few cells, and looks up the neighboring
+     cells once per cell of a block.
+     */
+    class GridNeighbors
+    {
+    public:
+        /** (neighbor id, distance) pairs of one observation, sorted by id */
+        typedef std::vector<std::pair<int, double> > NbrList;
+
+        /** row_func(obs, nbrs) is called once for every observation, from
+         the worker threads, so it must only write to the row of obs. */
+        typedef boost::function<void (int, const NbrList&)> RowFunc;
+
+        GridNeighbors(const std::vector<double>& x,
+                      const std::vector<double>& y,
+                      double radius);
+
+        GridNeighbors(const std::vector<double>& x,
+                      const std::vector<double>& y,
+                      const std::vector<double>& z,
+                      double radius);
+
+        int GetNumObs() const { return num_obs; }
+        double GetRadius() const { return radius; }
+
+        /** Emit the other observations within the radius of every
+         observation.  The buffer handed to row_func is reused. */
+        void VisitNeighbors(const RowFunc& row_func);
+
+        /** Exact neighbor counts for every threshold in one pass.  The
+         thresholds must be sorted ascending; a threshold larger than the
+         radius only counts the neighbors within the radius. */
+        void CountNeighbors(const std::vector<double>& thresholds,
+                            std::vector<NbrCountStats>& stats);
+
+        /** Upper bound of the number of neighbors of any observation: the
+         points in its own and the neighboring cells */
+        int GetMaxCandidates() const;
+
+    protected:
+        struct CountPartial {
+            std::vector<double> sum;
+            std::vector<int> mins;
+            std::vector<int> maxs;
+            std::vector<int> isolates;
+        };
+
+        void Init(const std::vector<const std::vector<double>*>& axes,
+                  double radius);
+        // positions [first, last) of the cells next to cell c, itself
+        // included
+        void GetCellRanges(int c, std::vector<std::pair<int, int> >& ranges)
+            const;
+        double SqDist(int i, int j) const;
+        // cell of the point at position i
+        int GetCell(int i) const;
+
+        // bodies of the parallel loops over the points at positions
+        // first..last
+        void VisitPoints(int first, int last, const RowFunc* row_func);
+        void CountPoints(int first, int last,
+                         const std::vector<double>* thresholds,
+                         std::vector<CountPartial>* partials);
+
+        int dim;
+        int num_obs;
+        double radius;
+        double radius_sq;
+        double cell_size;
+        double lower[3];
+        // coordinates and original ids of the points, in cell order
+        std::vector<double> coords;
+        std::vector<int> ids;
+        // occupied cells: sorted keys and the first point of each cell,
+        // cell_start[num_cells] == num_obs
+        std::vector<boost::uint64_t> cell_keys;
+        std::vector<int> cell_start;
+    };
+}
+
+#endif
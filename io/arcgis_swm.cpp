@@ -1,14 +1,22 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <string>
 
+#include <boost/bind.hpp>
 #include <boost/unordered_map.hpp>
 #include <wx/wx.h>
 
+#include "../GdaThreadPool.h"
 #include "../GenUtils.h"
 #include "../Project.h"
 #include "../DataViewer/TableInterface.h"
+#include "../ShapeOperations/CsrWeight.h"
+#include "weights_binary.h"
 #include "weights_interface.h"
+#include "weights_reader.h"
 #include "arcgis_swm.h"
 
 using namespace std;
@@ -61,30 +69,89 @@ wxString ReadIdFieldFromSwm(const wxString& fname)
 
 
 
-GalElement* ReadSwmAsGal(const wxString& fname, TableInterface* table_int)
+namespace {
+    // observations per chunk of the parallel decode
+    const int swm_chunk_size = 1024;
+
+    /** neighbor ids of one origin, followed by its weights */
+    struct SwmRecord {
+        const char* ids;
+        uint32_t num_nbrs;
+    };
+
+    /*
+     The records of a .swm file have variable length, so one serial pass
+     hops from record to record reading only the origin and the number of
+     neighbors, and the neighbor ids and weights are then decoded from the
+     mapped file in parallel, straight into the CSR arrays.
+     */
+    struct SwmReader
+    {
+        bool fixed;
+        const boost::unordered_map<wxInt64, int>* id_map;
+        std::vector<SwmRecord> records; // by row
+        std::vector<boost::uint64_t> offsets;
+        std::vector<int> nbrs;
+        std::vector<double> values;
+        std::vector<wxInt64> bad_keys; // per chunk, -1 if none
+
+        void DecodeRows(int first, int last);
+    };
+
+    void SwmReader::DecodeRows(int first, int last)
+    {
+        for (int i=first; i<=last; i++) {
+            const SwmRecord& rec = records[i];
+            if (rec.num_nbrs == 0) continue;
+            size_t pos = offsets[i];
+            for (uint32_t j=0; j<rec.num_nbrs; j++) {
+                uint32_t id;
+                memcpy(&id, rec.ids + 4 * (size_t) j, 4);
+                boost::unordered_map<wxInt64, int>::const_iterator it =
+                    id_map->find(id);
+                if (it == id_map->end()) {
+                    bad_keys[first / swm_chunk_size] = id;
+                    return;
+                }
+                nbrs[pos + j] = it->second;
+            }
+            const char* w = rec.ids + 4 * (size_t) rec.num_nbrs;
+            if (fixed) {
+                double v;
+                memcpy(&v, w, sizeof(double));
+                std::fill(values.begin() + pos,
+                          values.begin() + pos + rec.num_nbrs, v);
+            } else {
+                memcpy(&values[pos], w, sizeof(double) * rec.num_nbrs);
+            }
+            GdaWeightsReader::SortRow(&nbrs[pos], &values[pos],
+                                      rec.num_nbrs);
+        }
+    }
+}
+
+CsrWeight* ReadSwm(const wxString& fname, TableInterface* table_int)
 {
-#ifdef __WIN32__
-    ifstream istream;
-    istream.open(fname.wc_str(), ios::binary|ios::in);
-#else
-    ifstream istream;
-    istream.open(GET_ENCODED_FILENAME(fname), ios::binary|ios::in);  // a text file
-#endif
-    
-    if (!(istream.is_open() && istream.good())) {
+    boost::shared_ptr<GdaMappedFile> region = GdaWeightsReader::MapFile(fname);
+    if (!region) {
         return 0;
     }
+    const char* p = region->GetAddress();
+    const char* end = p + region->GetSize();
+
     // first line
     // ID_VAR_NAME;ESRI_SRS\n
-    string line;
-    getline(istream, line, '\n');
+    const char* eol = (const char*) memchr(p, '\n', end - p);
+    if (eol == NULL) {
+        throw WeightsNotValidException();
+    }
+    string line(p, eol);
+    p = eol + 1;
     string id_name = line.substr(0, line.find(';'));
     
-    int swmType = 0; // old
     bool fixed = false;
     
     if (id_name.find("VERSION")==0) {
-        swmType = 1;
         // new format: VERSION@10.1;UNIQUEID@FIELD_ID;
         id_name = line.substr(line.find(';')+1, line.size()-1);
         id_name = id_name.substr(0, id_name.find(';'));
@@ -100,16 +167,21 @@ GalElement* ReadSwmAsGal(const wxString& fname, TableInterface* table_int)
         }
     }
     
-    // NO_OBS length=4
+    // NO_OBS length=4, ROW_STD length = 4
+    if (end - p < 8) {
+        throw WeightsNotValidException();
+    }
     uint32_t no_obs = 0;
-    istream.read((char*)&no_obs, 4); // reads 4 bytes into
+    memcpy(&no_obs, p, 4);
+    p += 8;
+    if (no_obs > INT_MAX) {
+        throw WeightsNotValidException();
+    }
    
-    int num_obs_tbl = table_int->GetNumberRows();
-    if (table_int != NULL && no_obs != num_obs_tbl) {
+    if (table_int != NULL && no_obs != table_int->GetNumberRows()) {
         throw WeightsMismatchObsException(no_obs);
     }
-    std::vector<wxInt64> uids;
-    boost::unordered_map<int, uint32_t> id_map;
+    boost::unordered_map<wxInt64, int> id_map;
     
     if (id_name != "Unknown" && table_int != NULL) {
         int col, tm;
@@ -117,101 +189,82 @@ GalElement* ReadSwmAsGal(const wxString& fname, TableInterface* table_int)
         if (col == wxNOT_FOUND) {
             throw WeightsIdNotFoundException(id_name.c_str());
         }
+        std::vector<wxInt64> uids;
         table_int->GetColData(col, 0, uids);
+        id_map.rehash(uids.size());
         for (int i=0; i<uids.size(); i++) {
             id_map[uids[i]] = i;
         }
     } else {
+        id_map.rehash(no_obs);
         for (int i=0; i<no_obs; i++) {
             id_map[i] = i;
         }
     }
     
-    // ROW_STD length = 4
-    uint32_t row_std = 0;
-    istream.read((char*)&row_std, 4);
-    
-    
-    vector<vector<int> > nbr_ids(no_obs);
-    vector<vector<double> > nbr_ws(no_obs);
-    
-
-    for (int i=0; i<no_obs; i++) {
-        // origin length = 4
-        uint32_t origin = 0;
-        istream.read((char*)&origin, 4);
-        int o_idx = id_map[origin];
-        
-        if ( id_map.find(o_idx) == id_map.end() ) {
-            throw WeightsIntegerKeyNotFoundException(o_idx);
+    SwmReader r;
+    r.fixed = fixed;
+    r.id_map = &id_map;
+    SwmRecord no_rec = { 0, 0 };
+    r.records.assign(no_obs, no_rec);
+    for (uint32_t i=0; i<no_obs; i++) {
+        // origin length = 4, no_nghs length = 4
+        if (end - p < 8) {
+            throw WeightsNotValidException();
+        }
+        uint32_t origin = 0, no_nghs = 0;
+        memcpy(&origin, p, 4);
+        memcpy(&no_nghs, p + 4, 4);
+        p += 8;
+        boost::unordered_map<wxInt64, int>::iterator it = id_map.find(origin);
+        if (it == id_map.end()) {
+            throw WeightsIntegerKeyNotFoundException(origin);
         }
-        
-        // no_nghs length = 4
-        uint32_t no_nghs = 0;
-        istream.read((char*)&no_nghs, 4);
-        
+        SwmRecord& rec = r.records[it->second];
+        rec.ids = p;
+        rec.num_nbrs = no_nghs;
         if (no_nghs > 0) {
-            if (fixed) {
-                uint32_t* n_ids = new uint32_t[no_nghs];
-                istream.read ((char*)n_ids, sizeof (uint32_t) * no_nghs);
-                
-                double _w = 0;
-                istream.read((char*)&_w, sizeof(double));
-                
-                double sum_w;
-                istream.read((char*)&sum_w, sizeof(double)); // 8
-                
-                nbr_ids[o_idx].resize(no_nghs);
-                nbr_ws[o_idx].resize(no_nghs);
-                for (int j=0; j<no_nghs; j++) {
-                    if ( id_map.find(n_ids[j]) == id_map.end() ) {
-                        throw WeightsIntegerKeyNotFoundException(o_idx);
-                    }
-                    nbr_ids[o_idx][j] = id_map[ n_ids[j] ];
-                    nbr_ws[o_idx][j] = _w;
-                }
-                delete[] n_ids;
-                
-            } else {
-                uint32_t* n_ids = new uint32_t[no_nghs];
-                istream.read ((char*)n_ids, sizeof (uint32_t) * no_nghs);
-                
-                double* n_w = new double[no_nghs];
-                istream.read ((char*)n_w, sizeof (double) * no_nghs);
-                
-                double sum_w;
-                istream.read((char*)&sum_w, 8);
-                
-                nbr_ids[o_idx].resize(no_nghs);
-                nbr_ws[o_idx].resize(no_nghs);
-                for (int j=0; j<no_nghs; j++) {
-                    if ( id_map.find(n_ids[j]) == id_map.end() ) {
-                        throw WeightsIntegerKeyNotFoundException(o_idx);
-                    }
-                    nbr_ids[ o_idx ][j] = id_map[ n_ids[j] ];
-                    nbr_ws[ o_idx ][j] = n_w[j];
-                }
-                
-                delete[] n_w;
-                delete[] n_ids;
+            // ids, then one weight or a weight per neighbor, then the sum
+            if ((size_t) no_nghs > (size_t) (end - p) / (fixed ? 4 : 12)) {
+                throw WeightsNotValidException();
+            }
+            size_t n_bytes = 4 * (size_t) no_nghs + sizeof(double) +
+                (fixed ? sizeof(double) : sizeof(double) * no_nghs);
+            if (n_bytes > (size_t) (end - p)) {
+                throw WeightsNotValidException();
             }
+            p += n_bytes;
         }
     }
-    
-    GalElement* gal = new GalElement[no_obs];
-    for (int i=0; i<no_obs; i++) {
-        int no_nghs = nbr_ids[i].size();
-        gal[i].SetSizeNbrs(no_nghs);
-        vector<int>& n_ids = nbr_ids[i];
-        vector<double>& n_w = nbr_ws[i];
-        for (int j=0; j<no_nghs; j++) {
-            int nid = n_ids[j];
-            gal[ i ].SetNbr(j, nid, n_w[j]);
+
+    r.offsets.assign(no_obs + 1, 0);
+    for (uint32_t i=0; i<no_obs; i++) {
+        r.offsets[i+1] = r.offsets[i] + r.records[i].num_nbrs;
+    }
+    r.nbrs.resize(r.offsets[no_obs]);
+    r.values.resize(r.offsets[no_obs]);
+    r.bad_keys.assign((no_obs + swm_chunk_size - 1) / swm_chunk_size, -1);
+    GdaThreadPool::GetInstance().ParallelFor(no_obs,
+        boost::bind(&SwmReader::DecodeRows, &r, _1, _2), swm_chunk_size);
+    for (size_t c=0; c<r.bad_keys.size(); c++) {
+        if (r.bad_keys[c] >= 0) {
+            throw WeightsIntegerKeyNotFoundException((int) r.bad_keys[c]);
         }
     }
-    
-    
-    istream.close();
-    
+
+    CsrWeight* w = new CsrWeight(r.offsets, r.nbrs, r.values);
+    w->wflnm = fname;
+    w->id_field = id_name;
+    return w;
+}
+
+GalElement* ReadSwmAsGal(const wxString& fname, TableInterface* table_int)
+{
+    CsrWeight* w = ReadSwm(fname, table_int);
+    if (w == 0) {
+        return 0;
+    }
+    GalElement* gal = w->ToGal();
+    delete w;
     return gal;
 }
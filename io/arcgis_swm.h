@@ -27,8 +27,14 @@
 using namespace std;
 
 
+class CsrWeight;
+
 wxString ReadIdFieldFromSwm(const wxString& fname);
 
+/** weights of an ArcGIS .swm file, decoded in parallel from the mapped
+ file; NULL if it can't be opened */
+CsrWeight* ReadSwm(const wxString& fname, TableInterface* table_int);
+
 GalElement* ReadSwmAsGal(const wxString& fname, TableInterface* table_int);
 
 #endif
@@ -1,11 +1,18 @@
 #include <vector>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 
+#include <boost/bind.hpp>
+
+#include "../GdaThreadPool.h"
 #include "../GenUtils.h"
 #include "../DataViewer/TableInterface.h"
+#include "../ShapeOperations/CsrWeight.h"
 #include "MatfileReader.h"
+#include "weights_binary.h"
 #include "weights_interface.h"
+#include "weights_reader.h"
 #include "matlab_mat.h"
 
 using namespace std;
@@ -15,110 +22,168 @@ wxString ReadIdFieldFromMat(const wxString& fname)
     return "ogc_fid";
 }
 
-GalElement* ReadMatAsGal(const wxString& fname, TableInterface* table_int)
+namespace {
+    // rows per chunk of the parallel scans
+    const int mat_chunk_size = 64;
+
+    /*
+     Nonzero entries of a dense num_obs x num_obs matrix, as weights: the
+     entries of every row are counted in parallel, then written in
+     parallel at the offsets of the rows.  As before, data[i*n + j] is
+     taken as row i, which is the same for the symmetric matrices of
+     contiguity weights.
+     */
+    template <typename T>
+    struct MatRows
+    {
+        const T* data;
+        int num_obs;
+        std::vector<boost::uint64_t> offsets;
+        std::vector<int> nbrs;
+        std::vector<double> values;
+
+        void CountRows(int first, int last)
+        {
+            for (int i=first; i<=last; i++) {
+                const T* row = data + (size_t) i * num_obs;
+                boost::uint64_t cnt = 0;
+                for (int j=0; j<num_obs; j++) {
+                    if (row[j] != 0) cnt++;
+                }
+                offsets[i+1] = cnt;
+            }
+        }
+
+        void FillRows(int first, int last)
+        {
+            for (int i=first; i<=last; i++) {
+                const T* row = data + (size_t) i * num_obs;
+                boost::uint64_t pos = offsets[i];
+                for (int j=0; j<num_obs; j++) {
+                    if (row[j] != 0) {
+                        nbrs[pos] = j;
+                        values[pos] = (double) row[j];
+                        pos++;
+                    }
+                }
+            }
+        }
+
+        CsrWeight* Run()
+        {
+            GdaThreadPool& pool = GdaThreadPool::GetInstance();
+            offsets.assign(num_obs + 1, 0);
+            pool.ParallelFor(num_obs,
+                             boost::bind(&MatRows::CountRows, this, _1, _2),
+                             mat_chunk_size);
+            for (int i=0; i<num_obs; i++) offsets[i+1] += offsets[i];
+            nbrs.resize(offsets[num_obs]);
+            values.resize(offsets[num_obs]);
+            pool.ParallelFor(num_obs,
+                             boost::bind(&MatRows::FillRows, this, _1, _2),
+                             mat_chunk_size);
+            return new CsrWeight(offsets, nbrs, values);
+        }
+    };
+
+    /** NULL if the element holds fewer than num_obs^2 values */
+    template <typename T>
+    CsrWeight* DenseToCsr(DataElement* real, int num_obs)
+    {
+        vector<T>& v = ((FlatDataElement<T>*) real)->data();
+        if (v.size() < (size_t) num_obs * num_obs) {
+            return NULL;
+        }
+        MatRows<T> m;
+        m.data = v.empty() ? NULL : &v[0];
+        m.num_obs = num_obs;
+        return m.Run();
+    }
+}
+
+CsrWeight* ReadMat(const wxString& fname, TableInterface* table_int)
 {
-#ifdef __WIN32__
-    ifstream istream;
-    istream.open(fname.wc_str(), ios::binary|ios::in);
-#else
-    ifstream istream;
-    istream.open(GET_ENCODED_FILENAME(fname), ios::binary|ios::in);  // a text file
-#endif
-    
-    if (!(istream.is_open() && istream.good())) {
+    boost::shared_ptr<GdaMappedFile> region = GdaWeightsReader::MapFile(fname);
+    if (!region) {
         return 0;
     }
-    MatfileReader mmr(istream);
-    mmr.parseHeader();
-    // cout << mmr->descriptiveText() << endl;
-    // cout << mmr->subsysDataOffset() << endl;
-    // cout << mmr->version() << endl;
-    // cout << mmr->endianIndicator() << endl;
-    mmr.gotoData();
-    mmr.parseDataElement();
-    vector<DataElement*> des = mmr.dataElements();
-    // cout << des[0]->dataType() << endl;
-    DataElement* de = des[0];
-    CompressedDataElement* cde;
-    if (des[0]->dataType() == miCOMPRESSED) {
-        cde = dynamic_cast<CompressedDataElement*>(des[0]);
+    // the elements are parsed from the mapped file, which is only read
+    char* base = (char*) region->GetAddress();
+    size_t size = region->GetSize();
+    
+    // 128 bytes header, then the tag of the first data element
+    if (size < 136) {
+        throw WeightsNotValidException();
+    }
+    bool endian_swap = !(base[126] == 'I' && base[127] == 'M');
+    uint32_t n_bytes = 0;
+    memcpy(&n_bytes, base + 132, 4);
+    if ((size_t) n_bytes > size - 136) {
+        throw WeightsNotValidException();
+    }
+    DataElement* top = parse(base + 128, endian_swap);
+    DataElement* de = top;
+    if (top->dataType() == miCOMPRESSED) {
+        CompressedDataElement* cde = dynamic_cast<CompressedDataElement*>(top);
         assert(cde);
-        // fstream fo("compressed.dat", ios_base::out | ios_base::binary);
-        // assert(fo);
-        // fo.write(cde->decompressedData(), cde->decompressedSize());
         de = cde->reparse();
     }
+    if (de->dataType() != miMATRIX) {
+        if (de != top) delete de;
+        delete top;
+        throw WeightsNotValidException();
+    }
     
     // get row & col #
     MatrixDataElement* mde = (MatrixDataElement*)de;
     DimensionsArray* da = mde->dimensionsArray();
     vector<int32_t>& dim = da->dimensions();
-    if (dim.size() != 2) {
-        throw WeightsNotValidException();
+    int n_rows = dim.size() == 2 ? dim[0] : -1;
+    int n_cols = dim.size() == 2 ? dim[1] : -1;
+    int num_obs = table_int ? table_int->GetNumberRows() : n_rows;
+    
+    CsrWeight* w = NULL;
+    if (n_rows >= 0 && n_rows == n_cols && n_rows == num_obs) {
+        // get weights matrix
+        NumericArray<double>* sde = (NumericArray<double>*)mde;
+        DataElement* real = sde->real();
+        switch (real->dataType()) {
+            case miDOUBLE: w = DenseToCsr<double>(real, num_obs); break;
+            case miSINGLE: w = DenseToCsr<float>(real, num_obs); break;
+            case miINT8: w = DenseToCsr<int8_t>(real, num_obs); break;
+            case miUINT8: w = DenseToCsr<uint8_t>(real, num_obs); break;
+            case miINT16: w = DenseToCsr<int16_t>(real, num_obs); break;
+            case miUINT16: w = DenseToCsr<uint16_t>(real, num_obs); break;
+            case miINT32: w = DenseToCsr<int32_t>(real, num_obs); break;
+            case miUINT32: w = DenseToCsr<uint32_t>(real, num_obs); break;
+            case miINT64: w = DenseToCsr<int64_t>(real, num_obs); break;
+            case miUINT64: w = DenseToCsr<uint64_t>(real, num_obs); break;
+            default: break;
+        }
     }
-    int n_rows = dim[0];
-    int n_cols = dim[1];
-    if (n_rows != n_cols) {
+    if (de != top) delete de;
+    delete top;
+    
+    if (n_rows < 0 || n_rows != n_cols) {
         throw WeightsNotValidException();
     }
-  
-    int num_obs = table_int->GetNumberRows();
     if (n_rows != num_obs) {
         throw WeightsMismatchObsException(n_rows);
     }
-   
-    // prepare output
-    GalElement* gal = new GalElement[num_obs];
-
-    // get weights matrix
-    vector<double> data(num_obs * num_obs);
-    NumericArray<double>* sde = (NumericArray<double>*)mde;
-    DataElement* real = sde->real();
-    EDataType dt = real->dataType();
-    if (dt == miSINGLE) {
-        // float
-        FlatDataElement<float>* flatdata = ( FlatDataElement<float>*)real;
-        vector<float>& _data = flatdata->data();
-        for (int i=0; i< data.size(); i++) {
-            data[i] = _data[i];
-        }
-    } else if (dt == miDOUBLE) {
-        // double
-        FlatDataElement<double>* flatdata = ( FlatDataElement<double>*)real;
-        vector<double>& _data = flatdata->data();
-        for (int i=0; i< data.size(); i++) {
-            data[i] = _data[i];
-        }
-    } else {
-        // INT8 UINT8 INT16 UINT16 INT32 UINT32
-        FlatDataElement<uint8_t>* flatdata = ( FlatDataElement<uint8_t>*)real;
-        vector<uint8_t>& _data = flatdata->data();
-        for (int i=0; i< data.size(); i++) {
-            data[i] = _data[i];
-        }
+    if (w == NULL) {
+        throw WeightsNotValidException();
     }
-    
-    for (int i=0; i<num_obs; i++) {
-        // row
-        int row = i * num_obs;
-        int no_nbrs = 0;
-        for (int j=0; j<num_obs; j++) {
-            // col
-            float w = data[j + row];
-            if ( w != 0) {
-                no_nbrs += 1;
-            }
-        }
-        gal[i].SetSizeNbrs(no_nbrs);
-        int nbr_idx = 0;
-        for (int j=0; j<num_obs; j++) {
-            float w = data[j + row];
-            if ( w != 0) {
-                gal[i].SetNbr(nbr_idx++, j, w);
-            }
-        }
+    w->wflnm = fname;
+    return w;
+}
+
+GalElement* ReadMatAsGal(const wxString& fname, TableInterface* table_int)
+{
+    CsrWeight* w = ReadMat(fname, table_int);
+    if (w == 0) {
+        return 0;
     }
-    
+    GalElement* gal = w->ToGal();
+    delete w;
     return gal;
 }
-
@@ -7,8 +7,14 @@
 
 using namespace std;
 
+class CsrWeight;
+
 wxString ReadIdFieldFromMat(const wxString& fname);
 
+/** weights of the dense matrix of a MATLAB .mat file: the nonzero
+ entries of every row, found in parallel; NULL if it can't be opened */
+CsrWeight* ReadMat(const wxString& fname, TableInterface* table_int);
+
 GalElement* ReadMatAsGal(const wxString& fname, TableInterface* table_int);
 
 #endif /* _MATFILEREADER_H_ */
@@ -0,0 +1,404 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __WIN32__
+#include <windows.h>
+#else
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#endif
+#include <boost/shared_ptr.hpp>
+#include <boost/static_assert.hpp>
+#include <wx/log.h>
+
+#include "../GenUtils.h"
+#include "../DataViewer/TableInterface.h"
+#include "../ShapeOperations/CsrWeight.h"
+#include "weights_interface.h"
+#include "weights_binary.h"
+
+using namespace std;
+
+namespace {
+    const char wbin_magic[8] = {'G','D','A','W','G','T','B','\0'};
+    const boost::uint32_t wbin_version = 1;
+    const boost::uint32_t wbin_symmetric = 1;
+    const boost::uint32_t wbin_has_values = 2;
+
+    struct WeightsBinaryHeader {
+        char magic[8];
+        boost::uint32_t version;
+        boost::uint32_t flags;
+        boost::uint64_t num_obs;
+        boost::uint64_t num_edges;
+        boost::uint64_t id_fingerprint;
+        char id_field[88];
+    };
+    BOOST_STATIC_ASSERT(sizeof(WeightsBinaryHeader) == 128);
+
+    size_t PadTo8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+    bool ReadHeader(const wxString& fname, WeightsBinaryHeader& hdr)
+    {
+#ifdef __WIN32__
+        ifstream istream(fname.wc_str(), ios::binary|ios::in);
+#else
+        ifstream istream(GET_ENCODED_FILENAME(fname), ios::binary|ios::in);
+#endif
+        if (!(istream.is_open() && istream.good())) return false;
+        istream.read((char*)&hdr, sizeof(hdr));
+        if (!istream) return false;
+        return memcmp(hdr.magic, wbin_magic, 8) == 0 &&
+            hdr.version == wbin_version;
+    }
+}
+
+bool GdaWeightsBinary::IsRecordOrder(const wxString& id_field)
+{
+    return id_field.IsEmpty() || id_field == "ogc_fid" ||
+        id_field == "Unknown";
+}
+
+boost::uint64_t GdaWeightsBinary::IdFingerprint(TableInterface* table_int,
+                                                const wxString& id_field)
+{
+    if (table_int == NULL || IsRecordOrder(id_field)) return 0;
+
+    int col = 0, tm = 0;
+    table_int->DbColNmToColAndTm(id_field, col, tm);
+    if (col == wxNOT_FOUND) {
+        throw WeightsIdNotFoundException(id_field);
+    }
+    vector<wxString> ids;
+    if (table_int->GetColType(col) == GdaConst::long64_type) {
+        vector<wxInt64> vec;
+        table_int->GetColData(col, 0, vec);
+        ids.resize(vec.size());
+        for (size_t i=0; i<vec.size(); i++) ids[i] << vec[i];
+    } else if (table_int->GetColType(col) == GdaConst::string_type) {
+        table_int->GetColData(col, 0, ids);
+    } else {
+        throw WeightsNotValidException();
+    }
+
+    IdHasher hasher;
+    for (size_t i=0; i<ids.size(); i++) hasher.Add(ids[i]);
+    return hasher.Get();
+}
+
+// FNV-1a over the UTF-8 ids, each followed by a zero byte
+void GdaWeightsBinary::IdHasher::Add(const char* s, size_t len)
+{
+    for (size_t j=0; j<=len; j++) {
+        h ^= (unsigned char) (j < len ? s[j] : 0);
+        h *= 1099511628211ULL;
+    }
+}
+
+void GdaWeightsBinary::IdHasher::Add(const wxString& id)
+{
+    wxScopedCharBuffer buf = id.ToUTF8();
+    Add(buf.data(), buf.length());
+}
+
+void GdaWeightsBinary::IdHasher::Add(wxInt64 id)
+{
+    // the decimal digits, as wxString << wxInt64 gives them
+    char buf[24];
+    int len = 0;
+    boost::uint64_t v = id < 0 ? 0 - (boost::uint64_t) id : id;
+    do {
+        buf[len++] = '0' + (char) (v % 10);
+        v /= 10;
+    } while (v > 0);
+    if (id < 0) buf[len++] = '-';
+    std::reverse(buf, buf + len);
+    Add(buf, len);
+}
+
+namespace {
+    bool FillHeader(WeightsBinaryHeader& hdr, boost::uint64_t num_obs,
+                    boost::uint64_t num_edges, bool has_values,
+                    const wxString& id_field, boost::uint64_t id_fingerprint,
+                    bool is_symmetric)
+    {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, wbin_magic, 8);
+        hdr.version = wbin_version;
+        hdr.flags = (is_symmetric ? wbin_symmetric : 0) |
+            (has_values ? wbin_has_values : 0);
+        hdr.num_obs = num_obs;
+        hdr.num_edges = num_edges;
+        hdr.id_fingerprint = id_fingerprint;
+
+        wxScopedCharBuffer id_buf = id_field.ToUTF8();
+        if (id_buf.length() >= sizeof(hdr.id_field)) {
+            wxLogMessage("GdaWeightsBinary::Write(): id field name too long");
+            return false;
+        }
+        memcpy(hdr.id_field, id_buf.data(), id_buf.length());
+        return true;
+    }
+
+    void WritePadding(ostream& ostream, boost::uint64_t num_edges)
+    {
+        size_t pad = PadTo8(sizeof(int) * num_edges) - sizeof(int) * num_edges;
+        const char zeros[8] = {0,0,0,0,0,0,0,0};
+        ostream.write(zeros, pad);
+    }
+}
+
+bool GdaWeightsBinary::Write(const wxString& fname, const CsrWeight& w,
+                             const wxString& id_field,
+                             boost::uint64_t id_fingerprint,
+                             bool is_symmetric)
+{
+    WeightsBinaryHeader hdr;
+    if (!FillHeader(hdr, w.GetNumObs(), w.GetNumEdges(), !w.IsBinary(),
+                    id_field, id_fingerprint, is_symmetric)) {
+        return false;
+    }
+
+#ifdef __WIN32__
+    ofstream ostream(fname.wc_str(), ios::binary|ios::out|ios::trunc);
+#else
+    ofstream ostream(GET_ENCODED_FILENAME(fname),
+                     ios::binary|ios::out|ios::trunc);
+#endif
+    if (!(ostream.is_open() && ostream.good())) return false;
+
+    int n = w.GetNumObs();
+    ostream.write((const char*)&hdr, sizeof(hdr));
+    boost::uint64_t off = 0;
+    ostream.write((const char*)&off, sizeof(off));
+    for (int i=0; i<n; i++) {
+        off += w.GetNumNbrs(i);
+        ostream.write((const char*)&off, sizeof(off));
+    }
+    for (int i=0; i<n; i++) {
+        int nn = w.GetNumNbrs(i);
+        if (nn > 0) ostream.write((const char*)w.GetNbrs(i), sizeof(int)*nn);
+    }
+    WritePadding(ostream, off);
+    if (!w.IsBinary()) {
+        for (int i=0; i<n; i++) {
+            int nn = w.GetNumNbrs(i);
+            if (nn > 0) {
+                ostream.write((const char*)w.GetValues(i), sizeof(double)*nn);
+            }
+        }
+    }
+    ostream.close();
+    return !ostream.fail();
+}
+
+bool GdaWeightsBinary::Write(const wxString& fname, const RowSource& rows,
+                             const wxString& id_field,
+                             boost::uint64_t id_fingerprint,
+                             bool is_symmetric)
+{
+    int n = rows.GetNumRows();
+    boost::uint64_t num_edges = 0;
+    for (int i=0; i<n; i++) num_edges += rows.GetRowSize(i);
+
+    WeightsBinaryHeader hdr;
+    if (!FillHeader(hdr, n, num_edges, rows.HasValues(), id_field,
+                    id_fingerprint, is_symmetric)) {
+        return false;
+    }
+
+#ifdef __WIN32__
+    ofstream ostream(fname.wc_str(), ios::binary|ios::out|ios::trunc);
+#else
+    ofstream ostream(GET_ENCODED_FILENAME(fname),
+                     ios::binary|ios::out|ios::trunc);
+#endif
+    if (!(ostream.is_open() && ostream.good())) return false;
+
+    ostream.write((const char*)&hdr, sizeof(hdr));
+    boost::uint64_t off = 0;
+    ostream.write((const char*)&off, sizeof(off));
+    for (int i=0; i<n; i++) {
+        off += rows.GetRowSize(i);
+        ostream.write((const char*)&off, sizeof(off));
+    }
+    vector<int> nbrs;
+    vector<double> values;
+    for (int i=0; i<n; i++) {
+        rows.GetRow(i, nbrs, values);
+        if (!nbrs.empty()) {
+            ostream.write((const char*)&nbrs[0], sizeof(int)*nbrs.size());
+        }
+    }
+    WritePadding(ostream, num_edges);
+    if (rows.HasValues()) {
+        for (int i=0; i<n; i++) {
+            rows.GetRow(i, nbrs, values);
+            if (!values.empty()) {
+                ostream.write((const char*)&values[0],
+                              sizeof(double)*values.size());
+            }
+        }
+    }
+    ostream.close();
+    return !ostream.fail();
+}
+
+#ifdef __WIN32__
+GdaMappedFile::GdaMappedFile(const wxString& fname)
+: address(0), size(0), file(INVALID_HANDLE_VALUE), mapping(0)
+{
+    file = CreateFileW(fname.wc_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size) ||
+        file_size.QuadPart <= 0 ||
+        (boost::uint64_t) file_size.QuadPart > (size_t) -1) {
+        Close();
+        throw std::runtime_error("can't open the file");
+    }
+    size = (size_t) file_size.QuadPart;
+    mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) address = (const char*) MapViewOfFile(mapping, FILE_MAP_READ,
+                                                        0, 0, 0);
+    if (address == NULL) {
+        Close();
+        throw std::runtime_error("can't map the file");
+    }
+}
+
+GdaMappedFile::~GdaMappedFile()
+{
+    Close();
+}
+
+void GdaMappedFile::Close()
+{
+    if (address) UnmapViewOfFile(address);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    address = 0;
+    mapping = 0;
+    file = INVALID_HANDLE_VALUE;
+}
+#else
+GdaMappedFile::GdaMappedFile(const wxString& fname)
+: address(0), size(0), region(0)
+{
+    namespace bip = boost::interprocess;
+    try {
+        bip::file_mapping fm(GET_ENCODED_FILENAME(fname), bip::read_only);
+        // the region keeps the mapping alive after fm is closed
+        region = new bip::mapped_region(fm, bip::read_only);
+    } catch (bip::interprocess_exception& e) {
+        throw std::runtime_error(e.what());
+    }
+    address = (const char*) region->get_address();
+    size = region->get_size();
+}
+
+GdaMappedFile::~GdaMappedFile()
+{
+    delete region;
+}
+#endif
+
+CsrWeight* GdaWeightsBinary::Read(const wxString& fname,
+                                  TableInterface* table_int)
+{
+    boost::shared_ptr<GdaMappedFile> region;
+    try {
+        region.reset(new GdaMappedFile(fname));
+    } catch (std::exception& e) {
+        wxLogMessage("GdaWeightsBinary::Read(): %s", e.what());
+        throw WeightsNotValidException();
+    }
+
+    const char* base = region->GetAddress();
+    size_t size = region->GetSize();
+    if (size < sizeof(WeightsBinaryHeader)) throw WeightsNotValidException();
+    WeightsBinaryHeader hdr;
+    memcpy(&hdr, base, sizeof(hdr));
+    hdr.id_field[sizeof(hdr.id_field)-1] = 0;
+    if (memcmp(hdr.magic, wbin_magic, 8) != 0 || hdr.version != wbin_version) {
+        throw WeightsNotValidException();
+    }
+
+    boost::uint64_t n = hdr.num_obs, e = hdr.num_edges;
+    bool has_values = (hdr.flags & wbin_has_values) != 0;
+    size_t off_pos = sizeof(hdr);
+    size_t nbr_pos = off_pos + sizeof(boost::uint64_t) * (n + 1);
+    size_t val_pos = nbr_pos + PadTo8(sizeof(int) * e);
+    size_t end_pos = val_pos + (has_values ? sizeof(double) * e : 0);
+    if (n > (boost::uint64_t) INT_MAX || e > size || size < end_pos) {
+        throw WeightsNotValidException();
+    }
+
+    if (table_int != NULL) {
+        if (n != (boost::uint64_t) table_int->GetNumberRows()) {
+            throw WeightsMismatchObsException((int) n);
+        }
+        wxString id_field = wxString::FromUTF8(hdr.id_field);
+        if (IdFingerprint(table_int, id_field) != hdr.id_fingerprint) {
+            throw WeightsIdsChangedException();
+        }
+    }
+
+    // one pass over the arrays so a damaged file can't send the lags out
+    // of bounds
+    const boost::uint64_t* off_p = (const boost::uint64_t*) (base + off_pos);
+    const int* nbr_p = (const int*) (base + nbr_pos);
+    if (off_p[0] != 0 || off_p[n] != e) throw WeightsNotValidException();
+    for (boost::uint64_t i=0; i<n; i++) {
+        if (off_p[i+1] < off_p[i]) throw WeightsNotValidException();
+        for (boost::uint64_t j=off_p[i]; j<off_p[i+1]; j++) {
+            if (nbr_p[j] < 0 || (boost::uint64_t) nbr_p[j] >= n ||
+                (j > off_p[i] && nbr_p[j] < nbr_p[j-1])) {
+                throw WeightsNotValidException();
+            }
+        }
+    }
+
+    CsrWeight* w = new CsrWeight();
+    w->AttachMapped((int) n, off_p, nbr_p,
+                    has_values ? (const double*) (base + val_pos) : NULL,
+                    region);
+    w->wflnm = fname;
+    w->id_field = wxString::FromUTF8(hdr.id_field);
+    w->is_symmetric = (hdr.flags & wbin_symmetric) != 0;
+    // an unset flag may mean asymmetric or never checked
+    w->symmetry_checked = w->is_symmetric;
+    return w;
+}
+
+wxString GdaWeightsBinary::ReadIdField(const wxString& fname)
+{
+    WeightsBinaryHeader hdr;
+    if (!ReadHeader(fname, hdr)) return wxEmptyString;
+    hdr.id_field[sizeof(hdr.id_field)-1] = 0;
+    return wxString::FromUTF8(hdr.id_field);
+}
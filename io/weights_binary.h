@@ -0,0 +1,137 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_WEIGHTS_BINARY_H__
+#define __GEODA_CENTER_WEIGHTS_BINARY_H__
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <wx/string.h>
+
+class CsrWeight;
+class TableInterface;
+namespace boost { namespace interprocess { class mapped_region; } }
+
+/**
+ A whole file mapped read-only.  boost.interprocess only takes narrow file
+ names, so on Windows the file is opened by its wide-char name with the
+ Win32 API instead, and non-ASCII paths work as for the streams.  Throws
+ std::runtime_error if the file can't be opened or is empty.
+ */
+class GdaMappedFile
+{
+public:
+    explicit GdaMappedFile(const wxString& fname);
+    ~GdaMappedFile();
+
+    const char* GetAddress() const { return address; }
+    size_t GetSize() const { return size; }
+
+private:
+    GdaMappedFile(const GdaMappedFile&);
+    GdaMappedFile& operator=(const GdaMappedFile&);
+
+    const char* address;
+    size_t size;
+#ifdef __WIN32__
+    void Close();
+
+    void* file;    // HANDLE
+    void* mapping; // HANDLE
+#else
+    boost::interprocess::mapped_region* region;
+#endif
+};
+
+/**
+ GeoDa binary weights file (.gwb): the CSR arrays of a CsrWeight written
+ as they are in memory, so a file can be memory-mapped and used without
+ parsing.
+
+     offset  size     content
+     0       8        magic "GDAWGTB\0"
+     8       4        version (1), also tells the byte order
+     12      4        flags: 1 symmetric (unset if not checked), 2 has
+                      weight values
+     16      8        number of observations n
+     24      8        number of neighbor entries e
+     32      8        fingerprint of the id field values, 0 if record order
+     40      88       id field name, UTF-8, zero padded
+     128     8(n+1)   row offsets
+     ...     4e       neighbor indices, sorted in each row, padded to 8
+     ...     8e       weight values, only if flag 2 is set
+
+ The fingerprint lets a reader check that the id field of the table
+ still holds the ids the file was written with.
+ */
+namespace GdaWeightsBinary {
+    /** the id field names that mean record order */
+    bool IsRecordOrder(const wxString& id_field);
+
+    /** FNV-1a hash of the values of id_field in table_int, 0 for record
+     order; throws WeightsIdNotFoundException if the field is missing */
+    boost::uint64_t IdFingerprint(TableInterface* table_int,
+                                  const wxString& id_field);
+
+    /** IdFingerprint() of ids that are not in a table yet, fed one id at
+     a time in row order */
+    class IdHasher
+    {
+    public:
+        IdHasher() : h(14695981039346656037ULL) {}
+        void Add(const char* utf8, size_t len);
+        void Add(const wxString& id);
+        void Add(wxInt64 id);
+        boost::uint64_t Get() const { return h == 0 ? 1 : h; }
+    private:
+        boost::uint64_t h;
+    };
+
+    bool Write(const wxString& fname, const CsrWeight& w,
+               const wxString& id_field, boost::uint64_t id_fingerprint,
+               bool is_symmetric);
+
+    /** Rows of weights that are generated rather than held in memory */
+    class RowSource
+    {
+    public:
+        virtual ~RowSource() {}
+        virtual int GetNumRows() const = 0;
+        virtual bool HasValues() const = 0;
+        virtual int GetRowSize(int row) const = 0;
+        /** the neighbors of row, sorted, and their weights if HasValues() */
+        virtual void GetRow(int row, std::vector<int>& nbrs,
+                            std::vector<double>& values) const = 0;
+    };
+
+    /** Write the rows of rows as a .gwb file in three sweeps over the
+     rows (offsets, neighbors, weights), one row in memory at a time */
+    bool Write(const wxString& fname, const RowSource& rows,
+               const wxString& id_field, boost::uint64_t id_fingerprint,
+               bool is_symmetric);
+
+    /** Map fname and check it against table_int (may be NULL): throws
+     WeightsNotValidException, WeightsMismatchObsException,
+     WeightsIdNotFoundException or WeightsIdsChangedException */
+    CsrWeight* Read(const wxString& fname, TableInterface* table_int);
+
+    wxString ReadIdField(const wxString& fname);
+}
+
+#endif
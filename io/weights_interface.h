@@ -64,8 +64,26 @@ class WeightsIdNotFoundException: public std::exception {
         return "weights exception: id not found";
     }
 public:
-    WeightsIdNotFoundException(const char* _id) { id = _id; }
-    const char* id;
+    WeightsIdNotFoundException(const wxString& _id) : id(_id) {}
+    virtual ~WeightsIdNotFoundException() throw() {}
+    wxString id;
+};
+
+class WeightsIdsChangedException: public std::exception {
+    virtual const char* what() const throw() {
+        return "weights exception: ids do not match the table";
+    }
+};
+
+/** a weights file that can't be read, with the message for the user */
+class WeightsReadException: public std::exception {
+    virtual const char* what() const throw() {
+        return "weights exception: weights file can not be read";
+    }
+public:
+    WeightsReadException(const wxString& _msg) : msg(_msg) {}
+    virtual ~WeightsReadException() throw() {}
+    wxString msg;
 };
 
 
@@ -78,10 +96,16 @@ class WeightsInterface
 };
 
 
+class CsrWeight;
+
 wxString ReadIdFieldFromSwm(const wxString& fname);
 
+CsrWeight* ReadSwm(const wxString& fname, TableInterface* table_int);
+
 GalElement* ReadSwmAsGal(const wxString& fname, TableInterface* table_int);
 
+CsrWeight* ReadMat(const wxString& fname, TableInterface* table_int);
+
 GalElement* ReadMatAsGal(const wxString& fname, TableInterface* table_int);
 
 #endif
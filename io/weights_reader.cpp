@@ -0,0 +1,927 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#include <locale>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <wx/intl.h>
+#include <wx/log.h>
+
+#include "../GdaConst.h"
+#include "../GdaThreadPool.h"
+#include "../GenUtils.h"
+#include "../DataViewer/TableInterface.h"
+#include "../ShapeOperations/CsrWeight.h"
+#include "weights_binary.h"
+#include "weights_interface.h"
+#include "weights_reader.h"
+
+using namespace GdaWeightsReader;
+
+namespace {
+    // bytes of text per parallel chunk
+    const size_t text_chunk_bytes = 1 << 22;
+    // rows per chunk when the records are already known
+    const int row_chunk_size = 1024;
+
+    const double pow10_table[23] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+    bool NbrLess(const std::pair<int, double>& a,
+                 const std::pair<int, double>& b)
+    {
+        return a.first < b.first;
+    }
+
+    /** splitmix64 finalizer, spreads consecutive ids over the table */
+    size_t HashKey(boost::uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return (size_t) x;
+    }
+
+    /** FNV-1a of the bytes [first, last) */
+    boost::uint64_t HashString(const char* first, const char* last)
+    {
+        boost::uint64_t h = 14695981039346656037ULL;
+        for (; first < last; first++) {
+            h ^= (unsigned char) *first;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    const char* LineEnd(const char* p, const char* last)
+    {
+        const char* e = (const char*) memchr(p, '\n', last - p);
+        return e ? e : last;
+    }
+
+    /** next token of the line [p, eol) in [first, last), p moves past it */
+    bool NextToken(const char*& p, const char* eol,
+                   const char*& first, const char*& last)
+    {
+        while (p < eol && IsSpace(*p)) p++;
+        if (p == eol) return false;
+        first = p;
+        while (p < eol && !IsSpace(*p)) p++;
+        last = p;
+        return true;
+    }
+
+    /** pieces of about text_chunk_bytes of [first, last), each starting
+     at a line start; piece c is [bounds[c], bounds[c+1]) */
+    void SplitLines(const char* first, const char* last,
+                    std::vector<const char*>& bounds)
+    {
+        bounds.clear();
+        bounds.push_back(first);
+        size_t size = last - first;
+        for (size_t pos=text_chunk_bytes; pos<size; pos+=text_chunk_bytes) {
+            const char* p = first + pos;
+            if (p <= bounds.back()) continue;
+            p = LineEnd(p, last);
+            if (p < last) p++;
+            if (p > bounds.back() && p < last) bounds.push_back(p);
+        }
+        bounds.push_back(last);
+    }
+
+    /** strtod() on a copy of the token with the decimal point of the C
+     locale, for the numbers the fast path of ParseDouble() can't round */
+    double SlowParseDouble(const char* first, const char* last, bool& ok)
+    {
+        char buf[128];
+        size_t len = last - first;
+        ok = false;
+        if (len == 0) return 0;
+        if (len >= sizeof(buf)) {
+            std::istringstream ss(std::string(first, last));
+            ss.imbue(std::locale::classic());
+            double v = 0;
+            char c;
+            ok = (ss >> v) && !(ss >> c);
+            return v;
+        }
+        char point = localeconv()->decimal_point[0];
+        for (size_t i=0; i<len; i++) {
+            buf[i] = first[i] == '.' ? point : first[i];
+        }
+        buf[len] = 0;
+        char* e = 0;
+        double v = strtod(buf, &e);
+        ok = e == buf + len;
+        return v;
+    }
+
+    /** first bad record of a chunk */
+    struct ReadError {
+        ReadError() : pos(0), bad_id(false) {}
+        const char* pos;   // NULL if the chunk is fine
+        bool bad_id;       // else the line is malformed
+        std::string id;
+        void Set(const char* p, const char* id_first, const char* id_last) {
+            pos = p;
+            bad_id = id_first != 0;
+            if (bad_id) id.assign(id_first, id_last);
+        }
+    };
+
+    const ReadError* FirstError(const std::vector<ReadError>& errors)
+    {
+        const ReadError* first = 0;
+        for (size_t i=0; i<errors.size(); i++) {
+            if (errors[i].pos && (!first || errors[i].pos < first->pos)) {
+                first = &errors[i];
+            }
+        }
+        return first;
+    }
+
+    void ThrowReadError(const ReadError& err, const char* base,
+                        const TextHeader& hdr)
+    {
+        int line = 1 + (int) std::count(base, err.pos, '\n');
+        wxString msg;
+        if (!err.bad_id) {
+            msg = _("Line %d of the weights file is not valid.");
+            msg = wxString::Format(msg, line);
+        } else if (hdr.use_rec_order) {
+            msg = _("On line %d of weights file, observation id %s encountered which is out of allowed observation range of 1 through %d.");
+            msg = wxString::Format(msg, line, wxString(err.id),
+                                   (int) hdr.num_obs);
+        } else {
+            msg = _("On line %d of weights file, observation id %s encountered which does not exist in field \"%s\" of the Table.");
+            msg = wxString::Format(msg, line, wxString(err.id),
+                                   hdr.key_field);
+        }
+        throw WeightsReadException(msg);
+    }
+
+    /** the mapped file split into its header line and the body */
+    struct MappedText {
+        boost::shared_ptr<GdaMappedFile> region;
+        const char* base;
+        const char* body;
+        const char* end;
+        TextHeader hdr;
+
+        bool Open(const wxString& fname, TableInterface* table_int);
+    };
+
+    bool MappedText::Open(const wxString& fname, TableInterface* table_int)
+    {
+        region = MapFile(fname);
+        if (!region) return false;
+        base = region->GetAddress();
+        end = base + region->GetSize();
+        body = LineEnd(base, end);
+        ParseTextHeader(std::string(base, body), hdr);
+        if (body < end) body++;
+
+        if (hdr.num_obs < 0 || hdr.num_obs > INT_MAX) {
+            throw WeightsReadException(_("Weights file/format is not valid."));
+        }
+        if (table_int != NULL && hdr.num_obs != table_int->GetNumberRows()) {
+            wxString msg = _("The number of observations specified in chosen weights file is %d, but the number in the current Table is %d, which is incompatible.");
+            msg = wxString::Format(msg, (int) hdr.num_obs,
+                                   table_int->GetNumberRows());
+            throw WeightsReadException(msg);
+        }
+        return true;
+    }
+
+    /** record order requires the ids to be exactly min..min+n-1 */
+    void CheckRecordOrder(boost::int64_t min_id, boost::int64_t max_id,
+                          boost::int64_t num_obs)
+    {
+        if (max_id - min_id == num_obs - 1) return;
+        wxString msg = _("Record order specified, but found minimum and maximum observation values of %d and %d which is incompatible with number of observations specified in first line of weights file:  %d .");
+        msg = wxString::Format(msg, (int) min_id, (int) max_id,
+                               (int) num_obs);
+        throw WeightsReadException(msg);
+    }
+
+    /*
+     GWT: every line "from to weight" is a record.  Every chunk keeps its
+     records in its own arrays; they are counted per row and scattered
+     into the CSR arrays in chunk order, so the rows keep the order of the
+     file before they are sorted.  A pair repeated in the file keeps the
+     weight of its first line.
+     */
+    struct GwtChunk {
+        std::vector<int> from;
+        std::vector<int> to;
+        std::vector<double> w;
+        boost::int64_t min_id;
+        boost::int64_t max_id;
+    };
+
+    struct GwtReader
+    {
+        MappedText* text;
+        const IdMap* ids;
+        bool keep_self;
+        std::vector<const char*> bounds;
+        std::vector<GwtChunk> chunks;
+        std::vector<ReadError> errors;
+        std::vector<boost::uint64_t> offsets;
+        std::vector<int> nbrs;
+        std::vector<double> values;
+        std::vector<int> row_size; // without the repeated pairs
+
+        void ScanIds(int first, int last);
+        void ParseChunks(int first, int last);
+        void SortRows(int first, int last);
+    };
+
+    void GwtReader::ScanIds(int first, int last)
+    {
+        for (int c=first; c<=last; c++) {
+            GwtChunk& ch = chunks[c];
+            ch.min_id = LLONG_MAX;
+            ch.max_id = LLONG_MIN;
+            const char* p = bounds[c];
+            while (p < bounds[c+1]) {
+                const char* eol = LineEnd(p, bounds[c+1]);
+                const char* t0;
+                const char* t1;
+                for (int k=0; k<2 && NextToken(p, eol, t0, t1); k++) {
+                    boost::int64_t id;
+                    // other tokens are reported by the parse
+                    if (!ParseInt64(t0, t1, id)) continue;
+                    if (id < ch.min_id) ch.min_id = id;
+                    if (id > ch.max_id) ch.max_id = id;
+                }
+                p = eol + 1;
+            }
+        }
+    }
+
+    void GwtReader::ParseChunks(int first, int last)
+    {
+        for (int c=first; c<=last; c++) {
+            GwtChunk& ch = chunks[c];
+            const char* p = bounds[c];
+            while (p < bounds[c+1]) {
+                const char* line = p;
+                const char* eol = LineEnd(p, bounds[c+1]);
+                p = eol + 1;
+                const char* f0; const char* f1;
+                const char* t0; const char* t1;
+                const char* w0; const char* w1;
+                const char* q = line;
+                if (!NextToken(q, eol, f0, f1)) continue; // blank line
+                double w;
+                if (!NextToken(q, eol, t0, t1) || !NextToken(q, eol, w0, w1) ||
+                    !ParseDouble(w0, w1, w)) {
+                    errors[c].Set(line, 0, 0);
+                    return;
+                }
+                int from = ids->Find(f0, f1);
+                if (from < 0) {
+                    errors[c].Set(line, f0, f1);
+                    return;
+                }
+                int to = ids->Find(t0, t1);
+                if (to < 0) {
+                    errors[c].Set(line, t0, t1);
+                    return;
+                }
+                if (from == to && !keep_self) continue;
+                ch.from.push_back(from);
+                ch.to.push_back(to);
+                ch.w.push_back(w);
+            }
+        }
+    }
+
+    void GwtReader::SortRows(int first, int last)
+    {
+        for (int i=first; i<=last; i++) {
+            int n = (int) (offsets[i+1] - offsets[i]);
+            if (n > 1) SortRow(&nbrs[offsets[i]], &values[offsets[i]], n);
+            int* nb = n > 0 ? &nbrs[offsets[i]] : 0;
+            double* v = n > 0 ? &values[offsets[i]] : 0;
+            int k = 0;
+            for (int j=0; j<n; j++) {
+                if (k > 0 && nb[j] == nb[k-1]) continue;
+                nb[k] = nb[j];
+                v[k] = v[j];
+                k++;
+            }
+            row_size[i] = k;
+        }
+    }
+
+    /*
+     GAL: a record is the line "id num_nbrs" followed by the line of
+     neighbor ids if num_nbrs > 0; blank lines are skipped.
+     */
+    struct GalRecord {
+        const char* line;     // header line
+        const char* nbr_line; // NULL without neighbors
+        const char* id_first;
+        const char* id_last;
+        int num_nbrs;
+    };
+
+    struct GalReader
+    {
+        MappedText* text;
+        const IdMap* ids;
+        std::vector<const char*> bounds;
+        std::vector<std::vector<const char*> > lines; // non-blank, per chunk
+        std::vector<GalRecord> records;
+        std::vector<int> row_record;
+        std::vector<ReadError> errors;
+        std::vector<boost::uint64_t> offsets;
+        std::vector<int> nbrs;
+
+        void FindLines(int first, int last);
+        void ParseRows(int first, int last);
+    };
+
+    void GalReader::FindLines(int first, int last)
+    {
+        for (int c=first; c<=last; c++) {
+            const char* p = bounds[c];
+            while (p < bounds[c+1]) {
+                const char* eol = LineEnd(p, bounds[c+1]);
+                const char* q = p;
+                while (q < eol && IsSpace(*q)) q++;
+                if (q < eol) lines[c].push_back(p);
+                p = eol + 1;
+            }
+        }
+    }
+
+    void GalReader::ParseRows(int first, int last)
+    {
+        ReadError& err = errors[first / row_chunk_size];
+        for (int i=first; i<=last; i++) {
+            if (row_record[i] < 0) continue;
+            const GalRecord& rec = records[row_record[i]];
+            if (rec.num_nbrs == 0) continue;
+            const char* p = rec.nbr_line;
+            const char* eol = LineEnd(p, text->end);
+            int* out = &nbrs[offsets[i]];
+            for (int j=0; j<rec.num_nbrs; j++) {
+                const char* t0;
+                const char* t1;
+                if (!NextToken(p, eol, t0, t1)) {
+                    err.Set(rec.nbr_line, 0, 0);
+                    return;
+                }
+                out[j] = ids->Find(t0, t1);
+                if (out[j] < 0) {
+                    err.Set(rec.nbr_line, t0, t1);
+                    return;
+                }
+            }
+            std::sort(out, out + rec.num_nbrs);
+        }
+    }
+}
+
+boost::shared_ptr<GdaMappedFile>
+GdaWeightsReader::MapFile(const wxString& fname)
+{
+    boost::shared_ptr<GdaMappedFile> region;
+    try {
+        region.reset(new GdaMappedFile(fname));
+    } catch (std::exception& e) {
+        wxLogMessage("GdaWeightsReader::MapFile(): %s", e.what());
+        region.reset();
+    }
+    return region;
+}
+
+bool GdaWeightsReader::ParseInt64(const char* first, const char* last,
+                                  boost::int64_t& v)
+{
+    const char* p = first;
+    bool neg = false;
+    if (p < last && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
+    }
+    // 18 digits can't overflow
+    if (p == last || last - p > 18) return false;
+    boost::int64_t r = 0;
+    for (; p < last; p++) {
+        if (!IsDigit(*p)) return false;
+        r = r * 10 + (*p - '0');
+    }
+    v = neg ? -r : r;
+    return true;
+}
+
+bool GdaWeightsReader::ParseDouble(const char* first, const char* last,
+                                   double& v)
+{
+    const char* p = first;
+    bool neg = false;
+    if (p < last && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
+    }
+    // mantissa of up to 19 significant digits and its decimal exponent
+    boost::uint64_t m = 0;
+    int sig = 0, exp10 = 0;
+    bool any = false;
+    for (; p < last && IsDigit(*p); p++) {
+        any = true;
+        if (sig < 19) {
+            m = m * 10 + (*p - '0');
+            if (m) sig++;
+        } else {
+            exp10++;
+            sig++;
+        }
+    }
+    if (p < last && *p == '.') {
+        for (p++; p < last && IsDigit(*p); p++) {
+            any = true;
+            if (sig < 19) {
+                m = m * 10 + (*p - '0');
+                exp10--;
+                if (m) sig++;
+            } else {
+                sig++;
+            }
+        }
+    }
+    if (!any) return false;
+    if (p < last && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool e_neg = false;
+        if (p < last && (*p == '-' || *p == '+')) {
+            e_neg = *p == '-';
+            p++;
+        }
+        if (p == last) return false;
+        int e = 0;
+        for (; p < last && IsDigit(*p); p++) {
+            if (e < 100000) e = e * 10 + (*p - '0');
+        }
+        exp10 += e_neg ? -e : e;
+    }
+    if (p != last) return false;
+    // m and the power of ten are exact doubles, so one rounding step
+    // gives the correctly rounded value
+    if (sig <= 15 && exp10 >= -22 && exp10 <= 22) {
+        double d = (double) m;
+        d = exp10 < 0 ? d / pow10_table[-exp10] : d * pow10_table[exp10];
+        v = neg ? -d : d;
+        return true;
+    }
+    bool ok;
+    v = SlowParseDouble(first, last, ok);
+    return ok;
+}
+
+void GdaWeightsReader::SortRow(int* nbrs, double* values, int n)
+{
+    bool sorted = true;
+    for (int j=1; j<n && sorted; j++) sorted = nbrs[j-1] <= nbrs[j];
+    if (sorted) return;
+    if (values == NULL) {
+        std::sort(nbrs, nbrs + n);
+        return;
+    }
+    std::vector<std::pair<int, double> > row(n);
+    for (int j=0; j<n; j++) row[j] = std::make_pair(nbrs[j], values[j]);
+    // stable, so repeated neighbors keep the order of the file
+    std::stable_sort(row.begin(), row.end(), NbrLess);
+    for (int j=0; j<n; j++) {
+        nbrs[j] = row[j].first;
+        values[j] = row[j].second;
+    }
+}
+
+TextHeader::TextHeader()
+: num_obs(0), use_rec_order(false)
+{
+}
+
+void GdaWeightsReader::ParseTextHeader(const std::string& line,
+                                       TextHeader& hdr)
+{
+    wxInt64 num1 = 0;
+    wxInt64 num2 = 0;
+    wxString header(line);
+    header.Trim(true);
+    wxString key_field;
+
+    // detect if header contains string with empty space, which should be
+    // quoted
+    if (header.Contains("\"")) {
+        int start_quote = header.find("\"");
+        int end_quote = header.find("\"", start_quote + 1);
+        key_field = header.SubString(end_quote + 1 + 1 /* blank space */,
+                                     header.length()-1);
+        wxString nums = header.SubString(0, start_quote-1);
+        int break_pos = nums.find(" ");
+        wxString num1_str = nums.SubString(0, break_pos-1);
+        wxString num2_str = nums.SubString(break_pos+1, nums.length()-1);
+        num1_str.ToLongLong(&num1);
+        num2_str.ToLongLong(&num2);
+    } else {
+        std::istringstream ss(line);
+        ss.imbue(std::locale::classic());
+        std::string dbf_name, t_key_field;
+        ss >> num1 >> num2 >> dbf_name >> t_key_field;
+        key_field = wxString(t_key_field);
+    }
+
+    hdr.key_field = key_field;
+    if (num2 == 0) {
+        hdr.use_rec_order = true;
+        hdr.num_obs = num1;
+    } else {
+        hdr.num_obs = num2;
+        hdr.use_rec_order = key_field.IsEmpty() || key_field == "ogc_fid";
+    }
+}
+
+IdMap::IdMap()
+: mode(no_ids), first_id(0), num_obs(0), mask(0)
+{
+}
+
+void IdMap::SetRecordOrder(boost::int64_t first_id_, int num_obs_)
+{
+    mode = record_order;
+    first_id = first_id_;
+    num_obs = num_obs_;
+}
+
+void IdMap::InitSlots()
+{
+    // at most half full
+    size_t size = 1;
+    while (size < 2 * (size_t) num_obs) size <<= 1;
+    Slot empty = { 0, -1 };
+    slots.assign(size, empty);
+    mask = size - 1;
+}
+
+bool IdMap::Insert(boost::uint64_t key, int row)
+{
+    size_t h = HashKey(key) & mask;
+    while (slots[h].row >= 0) {
+        if (slots[h].key == key) {
+            if (mode == integer_ids) return false;
+            // same hash, the strings decide
+            int r = slots[h].row;
+            size_t len = str_off[r+1] - str_off[r];
+            if (len == str_off[row+1] - str_off[row] &&
+                (len == 0 || memcmp(&str_keys[str_off[r]],
+                                    &str_keys[str_off[row]], len) == 0)) {
+                return false;
+            }
+        }
+        h = (h + 1) & mask;
+    }
+    slots[h].key = key;
+    slots[h].row = row;
+    return true;
+}
+
+void IdMap::SetKeyField(TableInterface* table_int, const wxString& key_field)
+{
+    int col = 0, tm = 0;
+    table_int->DbColNmToColAndTm(key_field, col, tm);
+    if (col == wxNOT_FOUND) {
+        wxString msg = _("Specified key value field \"%s\" on first line of weights file not found in currently loaded Table.");
+        throw WeightsReadException(wxString::Format(msg, key_field));
+    }
+    int col_type = table_int->GetColType(col);
+    if (col_type != GdaConst::long64_type &&
+        col_type != GdaConst::string_type) {
+        wxString msg = _("Specified key value field \"%s\" on first line of weights file is not an integer type in the currently loaded Table.");
+        throw WeightsReadException(wxString::Format(msg, key_field));
+    }
+    num_obs = table_int->GetNumberRows();
+    bool unique = true;
+    if (col_type == GdaConst::long64_type) {
+        std::vector<wxInt64> vec;
+        table_int->GetColData(col, 0, vec);
+        boost::int64_t min_id = 0, max_id = -1;
+        if (num_obs > 0) {
+            min_id = *std::min_element(vec.begin(), vec.end());
+            max_id = *std::max_element(vec.begin(), vec.end());
+        }
+        boost::uint64_t range = (boost::uint64_t) max_id -
+            (boost::uint64_t) min_id;
+        if (num_obs > 0 && range < 4 * (boost::uint64_t) num_obs + 1024) {
+            mode = dense_ids;
+            first_id = min_id;
+            dense.assign(range + 1, -1);
+            for (int i=0; i<num_obs && unique; i++) {
+                int& row = dense[vec[i] - min_id];
+                unique = row < 0;
+                row = i;
+            }
+        } else {
+            mode = integer_ids;
+            InitSlots();
+            for (int i=0; i<num_obs && unique; i++) {
+                unique = Insert((boost::uint64_t) vec[i], i);
+            }
+        }
+    } else {
+        mode = string_ids;
+        std::vector<wxString> vec;
+        table_int->GetColData(col, 0, vec);
+        str_off.assign(1, 0);
+        for (int i=0; i<num_obs; i++) {
+            wxScopedCharBuffer buf = vec[i].ToUTF8();
+            str_keys.insert(str_keys.end(), buf.data(),
+                            buf.data() + buf.length());
+            str_off.push_back(str_keys.size());
+        }
+        InitSlots();
+        for (int i=0; i<num_obs && unique; i++) {
+            const char* s = str_keys.empty() ? 0 : &str_keys[0];
+            unique = Insert(HashString(s + str_off[i], s + str_off[i+1]), i);
+        }
+    }
+    if (!unique) {
+        wxString msg = _("Specified key value field \"%s\" in weights file contains duplicate values in the currently loaded Table.");
+        throw WeightsReadException(wxString::Format(msg, key_field));
+    }
+}
+
+int IdMap::FindString(const char* first, const char* last) const
+{
+    boost::uint64_t key = HashString(first, last);
+    size_t len = last - first;
+    size_t h = HashKey(key) & mask;
+    while (slots[h].row >= 0) {
+        if (slots[h].key == key) {
+            int r = slots[h].row;
+            if (str_off[r+1] - str_off[r] == len &&
+                (len == 0 ||
+                 memcmp(&str_keys[0] + str_off[r], first, len) == 0)) {
+                return r;
+            }
+        }
+        h = (h + 1) & mask;
+    }
+    return -1;
+}
+
+int IdMap::Find(const char* first, const char* last) const
+{
+    if (mode == string_ids) return FindString(first, last);
+    if (mode == no_ids) return -1;
+    boost::int64_t id;
+    if (!ParseInt64(first, last, id)) return -1;
+    if (mode == record_order) {
+        if (id < first_id || id - first_id >= num_obs) return -1;
+        return (int) (id - first_id);
+    }
+    if (mode == dense_ids) {
+        if (id < first_id || id - first_id >= (boost::int64_t) dense.size()) {
+            return -1;
+        }
+        return dense[id - first_id];
+    }
+    boost::uint64_t key = (boost::uint64_t) id;
+    size_t h = HashKey(key) & mask;
+    while (slots[h].row >= 0) {
+        if (slots[h].key == key) return slots[h].row;
+        h = (h + 1) & mask;
+    }
+    return -1;
+}
+
+CsrWeight* GdaWeightsReader::ReadGal(const wxString& fname,
+                                     TableInterface* table_int)
+{
+    MappedText text;
+    if (!text.Open(fname, table_int)) return NULL;
+    int num_obs = (int) text.hdr.num_obs;
+    GdaThreadPool& pool = GdaThreadPool::GetInstance();
+
+    GalReader r;
+    r.text = &text;
+    SplitLines(text.body, text.end, r.bounds);
+    int num_chunks = r.bounds.size() - 1;
+    r.lines.resize(num_chunks);
+    pool.ParallelFor(num_chunks,
+                     boost::bind(&GalReader::FindLines, &r, _1, _2), 1);
+
+    // pair the lines up into records; only the headers are parsed here
+    boost::int64_t min_id = LLONG_MAX, max_id = LLONG_MIN;
+    const char* pending = 0; // header line waiting for its neighbors
+    for (int c=0; c<num_chunks; c++) {
+        for (size_t k=0; k<r.lines[c].size(); k++) {
+            const char* line = r.lines[c][k];
+            if (pending) {
+                r.records.back().nbr_line = line;
+                pending = 0;
+                continue;
+            }
+            GalRecord rec;
+            const char* p = line;
+            const char* eol = LineEnd(p, text.end);
+            const char* n0;
+            const char* n1;
+            NextToken(p, eol, rec.id_first, rec.id_last);
+            boost::int64_t num_nbrs = 0;
+            if (NextToken(p, eol, n0, n1) &&
+                (!ParseInt64(n0, n1, num_nbrs) || num_nbrs < 0 ||
+                 num_nbrs > INT_MAX)) {
+                ReadError err;
+                err.Set(line, 0, 0);
+                ThrowReadError(err, text.base, text.hdr);
+            }
+            rec.line = line;
+            rec.nbr_line = 0;
+            rec.num_nbrs = (int) num_nbrs;
+            r.records.push_back(rec);
+            if (rec.num_nbrs > 0) pending = line;
+
+            boost::int64_t id;
+            if (ParseInt64(rec.id_first, rec.id_last, id)) {
+                if (id < min_id) min_id = id;
+                if (id > max_id) max_id = id;
+            }
+        }
+        std::vector<const char*>().swap(r.lines[c]);
+    }
+    if (pending) {
+        ReadError err;
+        err.Set(pending, 0, 0);
+        ThrowReadError(err, text.base, text.hdr);
+    }
+
+    IdMap ids;
+    if (text.hdr.use_rec_order) {
+        if (min_id > max_id) min_id = max_id = 1; // no records
+        else CheckRecordOrder(min_id, max_id, num_obs);
+        ids.SetRecordOrder(min_id, num_obs);
+    } else if (table_int != NULL) {
+        ids.SetKeyField(table_int, text.hdr.key_field);
+    }
+    r.ids = &ids;
+
+    // a later record of the same observation replaces an earlier one
+    r.row_record.assign(num_obs, -1);
+    for (size_t k=0; k<r.records.size(); k++) {
+        const GalRecord& rec = r.records[k];
+        int row = ids.Find(rec.id_first, rec.id_last);
+        if (row < 0) {
+            ReadError err;
+            err.Set(rec.line, rec.id_first, rec.id_last);
+            ThrowReadError(err, text.base, text.hdr);
+        }
+        r.row_record[row] = (int) k;
+    }
+    r.offsets.assign(num_obs + 1, 0);
+    for (int i=0; i<num_obs; i++) {
+        int k = r.row_record[i];
+        r.offsets[i+1] = r.offsets[i] + (k < 0 ? 0 : r.records[k].num_nbrs);
+    }
+    r.nbrs.resize(r.offsets[num_obs]);
+    r.errors.resize((num_obs + row_chunk_size - 1) / row_chunk_size);
+    pool.ParallelFor(num_obs,
+                     boost::bind(&GalReader::ParseRows, &r, _1, _2),
+                     row_chunk_size);
+    const ReadError* err = FirstError(r.errors);
+    if (err) ThrowReadError(*err, text.base, text.hdr);
+
+    std::vector<double> values;
+    CsrWeight* w = new CsrWeight(r.offsets, r.nbrs, values);
+    w->wflnm = fname;
+    w->id_field = text.hdr.key_field;
+    return w;
+}
+
+CsrWeight* GdaWeightsReader::ReadGwt(const wxString& fname,
+                                     TableInterface* table_int,
+                                     bool keep_self)
+{
+    MappedText text;
+    if (!text.Open(fname, table_int)) return NULL;
+    int num_obs = (int) text.hdr.num_obs;
+    GdaThreadPool& pool = GdaThreadPool::GetInstance();
+
+    GwtReader r;
+    r.text = &text;
+    r.keep_self = keep_self;
+    SplitLines(text.body, text.end, r.bounds);
+    int num_chunks = r.bounds.size() - 1;
+    r.chunks.resize(num_chunks);
+    r.errors.resize(num_chunks);
+
+    IdMap ids;
+    if (text.hdr.use_rec_order) {
+        // the smallest id is row 0, so the ids are scanned first
+        pool.ParallelFor(num_chunks,
+                         boost::bind(&GwtReader::ScanIds, &r, _1, _2), 1);
+        boost::int64_t min_id = LLONG_MAX, max_id = LLONG_MIN;
+        for (int c=0; c<num_chunks; c++) {
+            min_id = std::min(min_id, r.chunks[c].min_id);
+            max_id = std::max(max_id, r.chunks[c].max_id);
+        }
+        if (min_id > max_id) min_id = max_id = 1; // no records
+        else CheckRecordOrder(min_id, max_id, num_obs);
+        ids.SetRecordOrder(min_id, num_obs);
+    } else if (table_int != NULL) {
+        ids.SetKeyField(table_int, text.hdr.key_field);
+    }
+    r.ids = &ids;
+
+    pool.ParallelFor(num_chunks,
+                     boost::bind(&GwtReader::ParseChunks, &r, _1, _2), 1);
+    const ReadError* err = FirstError(r.errors);
+    if (err) ThrowReadError(*err, text.base, text.hdr);
+
+    r.offsets.assign(num_obs + 1, 0);
+    for (int c=0; c<num_chunks; c++) {
+        const std::vector<int>& from = r.chunks[c].from;
+        for (size_t k=0; k<from.size(); k++) r.offsets[from[k] + 1] += 1;
+    }
+    for (int i=0; i<num_obs; i++) r.offsets[i+1] += r.offsets[i];
+    r.nbrs.resize(r.offsets[num_obs]);
+    r.values.resize(r.offsets[num_obs]);
+    std::vector<boost::uint64_t> pos(r.offsets.begin(), r.offsets.end() - 1);
+    for (int c=0; c<num_chunks; c++) {
+        GwtChunk& ch = r.chunks[c];
+        for (size_t k=0; k<ch.from.size(); k++) {
+            boost::uint64_t p = pos[ch.from[k]]++;
+            r.nbrs[p] = ch.to[k];
+            r.values[p] = ch.w[k];
+        }
+        std::vector<int>().swap(ch.from);
+        std::vector<int>().swap(ch.to);
+        std::vector<double>().swap(ch.w);
+    }
+    r.row_size.resize(num_obs);
+    pool.ParallelFor(num_obs,
+                     boost::bind(&GwtReader::SortRows, &r, _1, _2),
+                     row_chunk_size);
+    boost::uint64_t num_pairs = 0;
+    for (int i=0; i<num_obs; i++) num_pairs += r.row_size[i];
+    if (num_pairs < r.offsets[num_obs]) {
+        // close the gaps left by the repeated pairs
+        boost::uint64_t p = 0;
+        for (int i=0; i<num_obs; i++) {
+            boost::uint64_t src = r.offsets[i];
+            r.offsets[i] = p;
+            for (int j=0; j<r.row_size[i]; j++, p++) {
+                r.nbrs[p] = r.nbrs[src + j];
+                r.values[p] = r.values[src + j];
+            }
+        }
+        r.offsets[num_obs] = p;
+        r.nbrs.resize(p);
+        r.values.resize(p);
+    }
+
+    CsrWeight* w = new CsrWeight(r.offsets, r.nbrs, r.values);
+    w->wflnm = fname;
+    w->id_field = text.hdr.key_field;
+    return w;
+}
@@ -0,0 +1,135 @@
+/**
+ * GeoDa TM, Copyright (C) 2011-2015 by Luc Anselin - all rights reserved
+ *
+ * This file is part of GeoDa.
+ *
+ * GeoDa is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GeoDa is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GEODA_CENTER_WEIGHTS_READER_H__
+#define __GEODA_CENTER_WEIGHTS_READER_H__
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <wx/string.h>
+
+class CsrWeight;
+class GdaMappedFile;
+class TableInterface;
+
+/**
+ Readers of the text weights files (.gal, .gwt, .kwt) that go straight
+ from the memory-mapped file to CsrWeight.
+
+ The body of the file is cut into pieces of a few MB that start at line
+ starts, and the pieces are parsed in parallel on GdaThreadPool with the
+ locale independent number parsers below.  The ids of the file are
+ resolved to rows through one hash map of the id field, built before the
+ parse.  A GWT line is a record by itself; a GAL record spans two lines, so
+ the non-blank lines are found in parallel first, paired up in one cheap
+ serial pass over the record headers and the neighbor lines are then
+ parsed in parallel again.
+
+ Errors are thrown as WeightsReadException with the message for the user;
+ NULL is returned only if the file can't be opened.
+ */
+namespace GdaWeightsReader {
+    /** fname mapped read-only, NULL if it can't be opened or is empty */
+    boost::shared_ptr<GdaMappedFile> MapFile(const wxString& fname);
+
+    /** The token [first, last) as an integer or a double.  The whole
+     token must be the number; the decimal point is always '.'. */
+    bool ParseInt64(const char* first, const char* last, boost::int64_t& v);
+    bool ParseDouble(const char* first, const char* last, double& v);
+
+    /** sort a row by neighbor, keeping the values (may be NULL) with
+     their neighbors; repeated neighbors keep their order */
+    void SortRow(int* nbrs, double* values, int n);
+
+    /** first line of a GAL or GWT file: either "n_obs" or
+     "0 n_obs dbf_name key_field", the dbf name possibly quoted */
+    struct TextHeader {
+        TextHeader();
+        boost::int64_t num_obs;
+        wxString key_field;
+        bool use_rec_order;
+    };
+    void ParseTextHeader(const std::string& line, TextHeader& hdr);
+
+    /**
+     Maps the ids of a weights file to rows of the table.
+
+     Integer ids in a range of at most a few times the number of rows are
+     looked up in a plain array; other ids go through an open addressing
+     table of (key, row) slots, so most lookups cost one cache miss.  String
+     ids are keyed by their hash and compared with the id only on a match.
+     */
+    class IdMap
+    {
+    public:
+        IdMap();
+
+        /** ids first_id .. first_id+num_obs-1 are rows 0 .. num_obs-1 */
+        void SetRecordOrder(boost::int64_t first_id, int num_obs);
+
+        /** the values of key_field in table_int; throws
+         WeightsReadException if the field is missing, is neither integer
+         nor string, or holds duplicates */
+        void SetKeyField(TableInterface* table_int, const wxString& key_field);
+
+        /** row of the id token [first, last), -1 if unknown; safe to call
+         from several threads */
+        int Find(const char* first, const char* last) const;
+
+        bool IsRecordOrder() const { return mode == record_order; }
+
+    protected:
+        enum IdMode {
+            no_ids, record_order, dense_ids, integer_ids, string_ids
+        };
+        struct Slot {
+            boost::uint64_t key; // the id, or the hash of a string id
+            int row;             // -1 for an empty slot
+        };
+
+        void InitSlots();
+        // false if the key is in the table already
+        bool Insert(boost::uint64_t key, int row);
+        int FindString(const char* first, const char* last) const;
+
+        IdMode mode;
+        boost::int64_t first_id;
+        int num_obs;
+        // dense_ids: row of id first_id + k, or -1
+        std::vector<int> dense;
+        std::vector<Slot> slots;
+        size_t mask;
+        // string_ids: id of row i is str_keys[str_off[i]..str_off[i+1])
+        std::vector<char> str_keys;
+        std::vector<size_t> str_off;
+    };
+
+    /** binary weights of a GAL file */
+    CsrWeight* ReadGal(const wxString& fname, TableInterface* table_int);
+
+    /** weights of a GWT or KWT file, pairs of an observation with itself
+     are dropped unless keep_self is set, and a repeated pair keeps the
+     weight of its first line */
+    CsrWeight* ReadGwt(const wxString& fname, TableInterface* table_int,
+                       bool keep_self);
+}
+
+#endif
@@ -32,28 +32,36 @@
 
 using namespace std;					// make std:: accessible
 
-int ANN_DIST_TYPE = ANNuse_euclidean_dist;
+ANN_THREAD_LOCAL int ANNdistType = ANNuse_euclidean_dist;
 
-double ANN_POW(double v)
+double ANN_POW(double v, int dist_type)
 {
-    if (ANN_DIST_TYPE == ANNuse_manhattan_dist) {
+    if (dist_type == ANNuse_manhattan_dist) {
         return fabs(v);
-    } else if (ANN_DIST_TYPE == ANNuse_euclidean_dist) {
+    } else if (dist_type == ANNuse_euclidean_dist) {
         return v * v;
     } else {
-        return pow(fabs(v), ANN_DIST_TYPE);
+        return pow(fabs(v), dist_type);
     }
 }
-double ANN_ROOT(double x)
+double ANN_ROOT(double x, int dist_type)
 {
-    if (ANN_DIST_TYPE == ANNuse_manhattan_dist) {
+    if (dist_type == ANNuse_manhattan_dist) {
         return x;
-    } else if (ANN_DIST_TYPE == ANNuse_euclidean_dist) {
+    } else if (dist_type == ANNuse_euclidean_dist) {
         return sqrt(x);
     } else {
-        return pow(fabs(x), 1/ANN_DIST_TYPE);
+        return pow(fabs(x), 1.0/dist_type);
     }
 }
+double ANN_POW(double v)
+{
+    return ANN_POW(v, ANNdistType);
+}
+double ANN_ROOT(double x)
+{
+    return ANN_ROOT(x, ANNdistType);
+}
 double ANN_SUM(double x, double y)
 {
     return x + y;
@@ -219,7 +227,7 @@ void annError(const char* msg, ANNerr level)
 //----------------------------------------------------------------------
 
 int	ANNmaxPtsVisited = 0;	// maximum number of pts visited
-int	ANNptsVisited;			// number of pts visited in search
+ANN_THREAD_LOCAL int	ANNptsVisited;	// number of pts visited in search
 
 //----------------------------------------------------------------------
 //	Global function declarations
@@ -335,12 +335,27 @@ const ANNbool	ANN_ALLOW_SELF_MATCH	= ANNtrue;
 // compile-time by manually uncommenting the code below
 // The following block is added to specify using manhanttan or euclidean
 // distance in ANN in run-time.
+//
+// The metric is a property of each tree (ANNkd_tree::setDistType()).  A
+// search copies it to ANNdistType, which like the rest of the search state
+// is local to the calling thread, so searches on different trees can run
+// concurrently.  ANN_POW() and ANN_ROOT() without a metric use the one of
+// the running search; callers outside of a search pass the metric.
 const int ANNuse_manhattan_dist    = 1;
 const int ANNuse_euclidean_dist    = 2;
-extern int ANN_DIST_TYPE;
+
+#if defined(_MSC_VER)
+#define ANN_THREAD_LOCAL __declspec(thread)
+#else
+#define ANN_THREAD_LOCAL __thread
+#endif
+
+extern ANN_THREAD_LOCAL int ANNdistType;	// metric of the running search
 
 double ANN_POW(double v);
 double ANN_ROOT(double x);
+double ANN_POW(double v, int dist_type);
+double ANN_ROOT(double x, int dist_type);
 double ANN_SUM(double x, double y);
 double ANN_DIFF(double x, double y);
 
@@ -553,6 +568,7 @@ class DLL_API ANNbruteForce: public ANNpointSet {
 	int				dim;				// dimension
 	int				n_pts;				// number of points
 	ANNpointArray	pts;				// point array
+	int				dist_type;			// distance metric
 public:
 	ANNbruteForce(						// constructor from point array
 		ANNpointArray	pa,				// point array
@@ -576,6 +592,12 @@ public:
 		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
 		double			eps=0.0);		// error bound
 
+	void setDistType(int t)				// set the distance metric
+		{ dist_type = t; }
+
+	int theDistType()					// return the distance metric
+		{ return dist_type; }
+
 	int theDim()						// return dimension of space
 		{ return dim; }
 
@@ -726,6 +748,7 @@ protected:
 	ANNkd_ptr		root;				// root of kd-tree
 	ANNpoint		bnd_box_lo;			// bounding box low point
 	ANNpoint		bnd_box_hi;			// bounding box high point
+	int				dist_type;			// distance metric
 
 	void SkeletonTree(					// construct skeleton tree
 		int				n,				// number of points
@@ -774,6 +797,12 @@ public:
 		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
 		double			eps=0.0);		// error bound
 
+	void setDistType(int t)				// set the distance metric
+		{ dist_type = t; }				// (ANNuse_euclidean_dist by default)
+
+	int theDistType()					// return the distance metric
+		{ return dist_type; }
+
 	int theDim()						// return dimension of space
 		{ return dim; }
 
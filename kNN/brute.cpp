@@ -47,6 +47,7 @@ ANNbruteForce::ANNbruteForce(			// constructor from point array
 	int					dd)				// dimension
 {
 	dim = dd;  n_pts = n;  pts = pa;
+	dist_type = ANNuse_euclidean_dist;
 }
 
 ANNbruteForce::~ANNbruteForce() { }		// destructor (empty)
@@ -61,6 +62,7 @@ void ANNbruteForce::annkSearch(			// approx k near neighbor search
 	ANNmin_k mk(k);						// construct a k-limited priority queue
 	int i;
 
+	ANNdistType = dist_type;			// metric of this point set
 	if (k > n_pts) {					// too many near neighbors?
 		annError("Requesting more near neighbors than data points", ANNabort);
 	}
@@ -88,6 +90,8 @@ int ANNbruteForce::annkFRSearch(		// approx fixed-radius kNN search
 	ANNmin_k mk(k);						// construct a k-limited priority queue
 	int i;
 	int pts_in_range = 0;				// number of points in query range
+
+	ANNdistType = dist_type;			// metric of this point set
 										// run every point through queue
 	for (i = 0; i < n_pts; i++) {
 										// compute distance to point
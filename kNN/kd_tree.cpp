@@ -252,6 +252,7 @@ void ANNkd_tree::SkeletonTree(			// construct skeleton tree
 	n_pts = n;
 	bkt_size = bs;
 	pts = pa;							// initialize points array
+	dist_type = ANNuse_euclidean_dist;	// default metric
 
 	root = NULL;						// no associated tree yet
 
@@ -0,0 +1,22 @@
+from __future__ import print_function
+
+import geoda
+
+# Compare the sweep and hashed contiguity weights builders on the sample
+# polygon shapefiles and on a synthetic grid.  Run from this directory
+# after build.sh.
+shapefiles = [
+    '../SampleData/nat.shp',
+    '../SampleData/colmunic_st.shp',
+    '../SampleData/Examples/columbus/shapefile/columbus.shp',
+]
+
+for shp in shapefiles:
+    for is_rook in [False, True]:
+        print(shp)
+        print(geoda.ContigWeightsBenchmark(shp, is_rook))
+
+for n in [100, 1000]:
+    for is_rook in [False, True]:
+        print("grid", n, "x", n)
+        print(geoda.ContigWeightsGridBenchmark(n, n, is_rook))
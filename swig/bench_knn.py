@@ -0,0 +1,20 @@
+from __future__ import print_function
+
+import geoda
+
+# Time the parallel k-nearest-neighbor weights query by thread count on the
+# sample point/polygon shapefiles and on large sets of random points.  Run
+# from this directory after build.sh.
+shapefiles = [
+    '../SampleData/nat.shp',
+    '../SampleData/Examples/columbus/shapefile/columbus.shp',
+]
+
+for shp in shapefiles:
+    for is_arc in [False, True]:
+        print(shp)
+        print(geoda.KNNWeightsBenchmark(shp, 6, is_arc))
+
+for n in [100000, 1000000, 5000000]:
+    print("random", n)
+    print(geoda.KNNWeightsRandomBenchmark(n, 6))
@@ -0,0 +1,52 @@
+from __future__ import print_function
+
+import struct
+
+from geoda import VecDouble
+import geoda
+
+# Compare the threaded, batch CPU kernel and OpenCL paths of the LISA
+# permutation test on the sample data.  Run from this directory after
+# build.sh; the .gal files are read from ../SampleData.
+cases = [
+    ('../SampleData/nat.dbf', '../SampleData/nat.gal', 'HR60'),
+    ('../SampleData/Examples/columbus/shapefile/columbus.dbf',
+     '../SampleData/columbus.gal', 'CRIME'),
+    ('../SampleData/colmunic_st.dbf', '../SampleData/colmunic_st.gal',
+     'MALARI98'),
+]
+
+
+def read_dbf_column(path, col):
+    """values of the numeric column col of a dBase file, 0 for blanks"""
+    with open(path, 'rb') as f:
+        num_recs, header_len, rec_len = struct.unpack('<xxxxIHH20x',
+                                                      f.read(32))
+        offset, col_offset, col_len = 1, None, 0
+        while True:
+            desc = f.read(32)
+            if desc[:1] == b'\r':
+                break
+            name = desc[:11].split(b'\0')[0].decode('ascii')
+            length = struct.unpack('<B', desc[16:17])[0]
+            if name.upper() == col.upper():
+                col_offset, col_len = offset, length
+            offset += length
+        if col_offset is None:
+            raise KeyError(col)
+        f.seek(header_len)
+        values = []
+        for i in range(num_recs):
+            rec = f.read(rec_len)
+            s = rec[col_offset:col_offset + col_len].strip()
+            values.append(float(s) if s else 0.0)
+        return values
+
+
+for dbf_path, gal_path, col in cases:
+    x = VecDouble(read_dbf_column(dbf_path, col))
+
+    for num_permutation in [999, 9999]:
+        print("=====================")
+        print(gal_path, col)
+        print(geoda.LISABenchmark(gal_path, x, num_permutation, 3))
@@ -5,6 +5,8 @@
 #include <algorithm>
 #include <sstream>
 #include <stdio.h>
+#include <boost/random.hpp>
+#include <boost/random/uniform_01.hpp>
 
 #include <wx/wxprec.h>
 #ifndef WX_PRECOMP
@@ -215,6 +217,28 @@ bool CreateQueenWeights(string in_file, string out_file, int order, bool include
     return CreateContiguityWeights(in_file, out_file, is_rook, order, include_lower_order);
 }
 
+// time the sweep and hashed contiguity builders on a polygon shapefile
+string ContigWeightsBenchmark(string in_file, bool is_rook)
+{
+    Shapefile::Main main_data;
+    Shapefile::Index index_data;
+    if (!OpenShapeFile(in_file, main_data, index_data))
+        return "can't open " + in_file;
+    if (main_data.header.shape_type != Shapefile::POLYGON)
+        return in_file + " is not a polygon shapefile";
+    wxString report = BenchmarkContigWeights(main_data, !is_rook);
+    return string(report.mb_str());
+}
+
+// same on a synthetic n_rows x n_cols grid of squares
+string ContigWeightsGridBenchmark(int n_rows, int n_cols, bool is_rook)
+{
+    Shapefile::Main main_data;
+    MakeGridPolygons(n_rows, n_cols, main_data);
+    wxString report = BenchmarkContigWeights(main_data, !is_rook);
+    return string(report.mb_str());
+}
+
 bool CreateRookWeights(string in_file, string out_file, int order, bool include_lower_order)
 {
     bool is_rook = true;
@@ -314,6 +338,38 @@ bool CreateKNNWeights(std::string in_file, std::string out_file, int k, bool is_
     return flag;
 }
 
+// time the parallel kNN query on the centroids of a shapefile by thread count
+string KNNWeightsBenchmark(string in_file, int k, bool is_arc, int max_cores)
+{
+    Shapefile::Main main_data;
+    Shapefile::Index index_data;
+    if (!OpenShapeFile(in_file, main_data, index_data))
+        return "can't open " + in_file;
+    std::vector<double> XX;
+    std::vector<double> YY;
+    if (!CreateCentroids(main_data, XX, YY))
+        return "can't get the centroids of " + in_file;
+    wxString report = SpatialIndAlgs::knn_scaling_benchmark(XX, YY, k, is_arc,
+                                                            max_cores);
+    return string(report.mb_str());
+}
+
+// same on n_points uniform random points in the unit square
+string KNNWeightsRandomBenchmark(int n_points, int k, int max_cores)
+{
+    boost::mt19937 rng(123456789);
+    boost::uniform_01<boost::mt19937&> uni(rng);
+    std::vector<double> XX(n_points);
+    std::vector<double> YY(n_points);
+    for (int i=0; i<n_points; i++) {
+        XX[i] = uni();
+        YY[i] = uni();
+    }
+    wxString report = SpatialIndAlgs::knn_scaling_benchmark(XX, YY, k, false,
+                                                            max_cores);
+    return string(report.mb_str());
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -395,6 +451,45 @@ bool LISA(std::string in_w_file, std::vector<double> var_1, std::vector<double>
     return true;
 }
 
+// univariate lisa of every variable in vars, sharing the permutations
+bool LISABatch(std::string in_w_file, std::vector<std::vector<double> >& vars, std::vector<std::vector<double> >& localMoran, std::vector<std::vector<double> >& sigLocalMoran, std::vector<std::vector<int> >& sigFlag, std::vector<std::vector<int> >& clusterFlag, int numPermutations)
+{
+    if (vars.empty()) return false;
+    wxString w_path(in_w_file);
+    int num_vars = vars.size();
+    int num_obs = vars[0].size();
+
+    LisaCoordinator* lc = new LisaCoordinator(w_path, num_obs, vars, numPermutations);
+    localMoran.resize(num_vars);
+    sigLocalMoran.resize(num_vars);
+    sigFlag.resize(num_vars);
+    clusterFlag.resize(num_vars);
+    for (int v=0; v<num_vars; v++) {
+        double* lm = lc->local_moran_vecs[v];
+        double* sig = lc->GetLocalSignificanceValues(v);
+        int* cat = lc->GetSigCatIndicators(v);
+        int* clst = lc->GetClusterIndicators(v);
+        localMoran[v].assign(lm, lm + num_obs);
+        sigLocalMoran[v].assign(sig, sig + num_obs);
+        sigFlag[v].assign(cat, cat + num_obs);
+        clusterFlag[v].assign(clst, clst + num_obs);
+    }
+    delete lc;
+    return true;
+}
+
+std::string LISABenchmark(std::string in_w_file, std::vector<double> var_1, int numPermutations, int repeats)
+{
+    wxString w_path(in_w_file);
+    int num_obs = var_1.size();
+    std::vector<double> var_2(num_obs, 0);
+
+    LisaCoordinator* lc = new LisaCoordinator(w_path, num_obs, var_1, var_2, 0, numPermutations);
+    wxString report = lc->BenchmarkPseudoP(repeats);
+    delete lc;
+    return std::string(report.mb_str());
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //
@@ -33,12 +33,24 @@ bool CreateRookWeights(std::string in_file, std::string out_file, int order=1, b
 
 bool CreateQueenWeights(std::string in_file, std::string out_file, int order=1, bool include_lower_order=false);
 
+std::string ContigWeightsBenchmark(std::string in_file, bool is_rook=false);
+
+std::string ContigWeightsGridBenchmark(int n_rows, int n_cols, bool is_rook=false);
+
 bool CreateKNNWeights(std::string in_file, std::string out_file, int k, bool is_arc=false, bool is_mile=true);
 
+std::string KNNWeightsBenchmark(std::string in_file, int k, bool is_arc=false, int max_cores=0);
+
+std::string KNNWeightsRandomBenchmark(int n_points, int k, int max_cores=0);
+
 bool CreateDistanceWeights(std::string in_file, std::string out_file, double threshold, bool is_arc=false, bool is_mile=true);
 
 bool LISA(std::string in_w_file, std::vector<double> var_1, std::vector<double> var_2, std::vector<double>& localMoran, std::vector<double>& sigLocalMoran, std::vector<int>& sigFlag, std::vector<int>& clusterFlag, int lisa_type=0, int numPermutations=599);
 
+std::string LISABenchmark(std::string in_w_file, std::vector<double> var_1, int numPermutations=999, int repeats=3);
+
+bool LISABatch(std::string in_w_file, std::vector<std::vector<double> >& vars, std::vector<std::vector<double> >& localMoran, std::vector<std::vector<double> >& sigLocalMoran, std::vector<std::vector<int> >& sigFlag, std::vector<std::vector<int> >& clusterFlag, int numPermutations=599);
+
 bool LocalGeary(std::string in_w_file, std::vector<std::vector<double> >& data, std::vector<double>& localGeary, std::vector<double>& sigLocalGeary, std::vector<int>& sigFlag, std::vector<int>& clusterFlag, int numPermutations=599);
 
 bool 
@@ -46,11 +46,14 @@ GEODA_SOURCES = [
         '../Explore/CatClassification.cpp',
         '../Explore/LisaCoordinator.cpp',
         '../Explore/LocalGearyCoordinator.cpp',
+        '../Explore/PermutationTable.cpp',
         '../ShapeOperations/AbstractShape.cpp', 
         '../ShapeOperations/BasePoint.cpp', 
         '../ShapeOperations/Box.cpp', 
         '../ShapeOperations/GwtWeight.cpp', 
         '../ShapeOperations/GalWeight.cpp', 
+        '../ShapeOperations/CsrWeight.cpp',
+        '../ShapeOperations/StackedWeights.cpp',
         '../ShapeOperations/GeodaWeight.cpp', 
         '../ShapeOperations/GdaCache.cpp', 
         '../ShapeOperations/OGRDataAdapter.cpp', 
@@ -62,6 +65,8 @@ GEODA_SOURCES = [
         '../ShapeOperations/VoronoiUtils.cpp',
         '../ShapeOperations/WeightsManState.cpp',
         '../ShapeOperations/WeightUtils.cpp',
+        '../io/weights_binary.cpp',
+        '../io/weights_reader.cpp',
         '../VarCalc/NumericTests.cpp',
         '../GenGeomAlgs.cpp', 
         '../GdaConst.cpp', 
@@ -69,10 +74,15 @@ GEODA_SOURCES = [
         '../GdaJson.cpp', 
         '../GdaShape.cpp', 
         '../GenUtils.cpp', 
+        '../GdaThreadPool.cpp',
+        '../Algorithms/cpu_lisa.cpp',
+        '../Algorithms/bit_jc.cpp',
+        '../Algorithms/gpu_lisa.cpp',
         '../GeneralWxUtils.cpp', 
         '../ShpFile.cpp', 
         '../SpatialIndAlgs.cpp', 
         '../VarTools.cpp', 
+        '../Weights/GridNeighbors.cpp',
         '../logger.cpp', 
         '../pca.cpp', 
     ]
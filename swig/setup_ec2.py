@@ -48,6 +48,7 @@ GEODA_SOURCES = [
         '../ShapeOperations/Box.cpp', 
         '../ShapeOperations/GwtWeight.cpp', 
         '../ShapeOperations/GalWeight.cpp', 
+        '../ShapeOperations/StackedWeights.cpp',
         '../ShapeOperations/GeodaWeight.cpp', 
         '../ShapeOperations/GdaCache.cpp', 
         '../ShapeOperations/OGRDataAdapter.cpp', 
@@ -56,6 +57,7 @@ GEODA_SOURCES = [
         '../ShapeOperations/OGRFieldProxy.cpp', 
         '../ShapeOperations/PolysToContigWeights.cpp', 
         '../ShapeOperations/VoronoiUtils.cpp',
+        '../io/weights_reader.cpp',
         '../VarCalc/NumericTests.cpp',
         '../GenGeomAlgs.cpp', 
         '../GdaConst.cpp', 